@@ -18,6 +18,7 @@ function display()
    gl.Clear(gl.COLOR_BUFFER_BIT);
 
    game:draw(p);
+   p:flush();
 
    glut.SwapBuffers();
 end
@@ -17,6 +17,13 @@
 #define LOGW(...) __android_log_print(ANDROID_LOG_WARN,LOG_TAG,__VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR,LOG_TAG,__VA_ARGS__)
 
+// Hard limit for the main Lua state; a script going over it gets a
+// "not enough memory" error instead of taking the process down.
+// Scripts can change it with collectgarbage("limit", kbytes).
+#ifndef LUA_MEMORY_LIMIT
+#define LUA_MEMORY_LIMIT (64*1024*1024)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -13,6 +13,12 @@ extern "C" {
 void jniSetJavaVM(JavaVM* vm);
 JavaVM* jniGetJavaVM();
 JNIEnv* jniGetEnv();
+void jniDetachThread();
+
+// Local reference frames, for native threads that never return to
+// Java and so never free local refs; see also JNILocalFrame below
+int jniPushLocalFrame(int capacity);
+jobject jniPopLocalFrame(jobject result);
 
 int jniSetContext(jobject context);
 jobject jniGetActivity();
@@ -24,10 +30,49 @@ AAssetManager *jniGetAssetManager();
 int jniSetAssetManager(AAssetManager *a);
 
 jclass jniFindClass(const char *name);
+
+// Cached lookups: classes are returned as global refs and IDs are
+// resolved once per class + name + signature
+typedef struct {
+  const char *name;
+  const char *signature;
+  int isStatic;
+  jmethodID id;       // filled in by jniResolveMethods()
+} jniMethod;
+
+jclass jniGetClass(const char *name);
+jmethodID jniGetMethodID(jclass cls, const char *name, const char *sig);
+jmethodID jniGetStaticMethodID(jclass cls, const char *name, const char *sig);
+jfieldID jniGetFieldID(jclass cls, const char *name, const char *sig);
+jfieldID jniGetStaticFieldID(jclass cls, const char *name, const char *sig);
+int jniResolveMethods(jclass cls, jniMethod *methods);
+
+// Typed calls on cached IDs; Java exceptions are logged and cleared
+int jniCallVoidMethod(jobject obj, jmethodID m, ...);
+jint jniCallIntMethod(jobject obj, jmethodID m, ...);
+jboolean jniCallBooleanMethod(jobject obj, jmethodID m, ...);
+jobject jniCallObjectMethod(jobject obj, jmethodID m, ...);
+jint jniCallStaticIntMethod(jclass cls, jmethodID m, ...);
+jobject jniCallStaticObjectMethod(jclass cls, jmethodID m, ...);
 const char* jniGetFilesDir(ANativeActivity *activity);
 
 #ifdef __cplusplus
 }
+
+// Scoped local frame: local refs created in scope are freed at exit,
+// so make global refs of any objects that must outlive it
+class JNILocalFrame {
+public:
+  bool pushed;
+
+  JNILocalFrame(int capacity = 16) {
+    pushed = (jniPushLocalFrame(capacity) == 0);
+  }
+
+  virtual ~JNILocalFrame() {
+    if (pushed) jniPopLocalFrame(NULL);
+  }
+};
 #endif
 
 #endif
@@ -81,6 +81,25 @@ LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s);
 
 LUALIB_API lua_State *(luaL_newstate) (void);
 
+/* statistics of the allocator used by luaL_newstate */
+typedef struct luaL_AllocStats {
+  size_t inuse;            /* bytes allocated by Lua and not yet freed */
+  size_t peak;             /* maximum of inuse */
+  size_t limit;            /* maximum inuse, 0 for no limit */
+  size_t reserved;         /* bytes held in pool pages */
+  unsigned long nalloc;    /* new blocks */
+  unsigned long nrealloc;  /* resized blocks */
+  unsigned long nfree;     /* freed blocks */
+  unsigned long nlarge;    /* new or resized blocks above LUAI_POOLMAX */
+  unsigned long nfailed;   /* allocations refused by the limit */
+} luaL_AllocStats;
+
+LUALIB_API int (luaL_getallocstats) (lua_State *L, luaL_AllocStats *s);
+LUALIB_API int (luaL_setalloclimit) (lua_State *L, size_t limit);
+LUALIB_API size_t (luaL_trimpool) (lua_State *L);
+LUALIB_API void (luaL_pushallocstats) (lua_State *L,
+                                      const luaL_AllocStats *s);
+
 
 LUALIB_API const char *(luaL_gsub) (lua_State *L, const char *s, const char *p,
                                                   const char *r);
@@ -125,16 +144,23 @@ LUALIB_API const char *(luaL_findtable) (lua_State *L, int idx,
 */
 
 
+/*
+** Output goes to `buffer' and is flushed to strings on the stack. Once
+** it overflows `buffer', the whole output moves to a userdata in a
+** single stack slot (lvl 1) that doubles in size as needed.
+*/
 
 typedef struct luaL_Buffer {
   char *p;			/* current position in buffer */
+  char *b;			/* start of buffer: `buffer' or the userdata */
+  size_t size;			/* size of `b' */
   int lvl;  /* number of strings in the stack (level) */
   lua_State *L;
   char buffer[LUAL_BUFFERSIZE];
 } luaL_Buffer;
 
 #define luaL_addchar(B,c) \
-  ((void)((B)->p < ((B)->buffer+LUAL_BUFFERSIZE) || luaL_prepbuffer(B)), \
+  ((void)((B)->p < ((B)->b+(B)->size) || luaL_prepbuffer(B)), \
    (*(B)->p++ = (char)(c)))
 
 /* compatibility only */
@@ -144,6 +170,7 @@ typedef struct luaL_Buffer {
 
 LUALIB_API void (luaL_buffinit) (lua_State *L, luaL_Buffer *B);
 LUALIB_API char *(luaL_prepbuffer) (luaL_Buffer *B);
+LUALIB_API char *(luaL_prepbuffsize) (luaL_Buffer *B, size_t sz);
 LUALIB_API void (luaL_addlstring) (luaL_Buffer *B, const char *s, size_t l);
 LUALIB_API void (luaL_addstring) (luaL_Buffer *B, const char *s);
 LUALIB_API void (luaL_addvalue) (luaL_Buffer *B);
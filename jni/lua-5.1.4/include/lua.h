@@ -191,6 +191,7 @@ LUA_API void  (lua_settable) (lua_State *L, int idx);
 LUA_API void  (lua_setfield) (lua_State *L, int idx, const char *k);
 LUA_API void  (lua_rawset) (lua_State *L, int idx);
 LUA_API void  (lua_rawseti) (lua_State *L, int idx, int n);
+LUA_API void  (lua_rawsetlist) (lua_State *L, int idx, int first, int n);
 LUA_API int   (lua_setmetatable) (lua_State *L, int objindex);
 LUA_API int   (lua_setfenv) (lua_State *L, int idx);
 
@@ -205,6 +206,7 @@ LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
                                         const char *chunkname);
 
 LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data);
+LUA_API void  (lua_clonefunction) (lua_State *L, int idx);
 
 
 /*
@@ -226,8 +228,38 @@ LUA_API int  (lua_status) (lua_State *L);
 #define LUA_GCSTEP		5
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
+#define LUA_GCTHAW		8
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
+LUA_API int (lua_freeze) (lua_State *L, int idx);
+
+/* collector statistics; times are in microseconds */
+typedef struct lua_GCStats {
+  size_t cycles;	/* completed collection cycles */
+  size_t pauses;	/* incremental steps and full collections */
+  double pausetime;	/* total time spent in pauses */
+  double lastpause;
+  double maxpause;
+  double atomic;	/* last atomic (non incremental) mark phase */
+  double maxatomic;
+  size_t marked;	/* bytes traversed by the last mark phase */
+  size_t frozen;	/* frozen objects */
+  size_t remembered;	/* frozen objects still traversed every cycle */
+} lua_GCStats;
+
+LUA_API void (lua_getgcstats) (lua_State *L, lua_GCStats *s);
+
+
+/*
+** bulk array stores: element types of `lua_rawsetarray'
+*/
+#define LUA_ANUMBER	0	/* lua_Number[] */
+#define LUA_AFLOAT	1	/* float[] */
+#define LUA_AINT	2	/* int[] */
+#define LUA_ASTRING	3	/* const char *[]; NULL stores nil */
+
+LUA_API void  (lua_rawsetarray) (lua_State *L, int idx, int first, int type,
+                                 const void *v, int n);
 
 
 /*
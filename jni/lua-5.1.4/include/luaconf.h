@@ -397,6 +397,35 @@
 #endif
 
 
+/*
+@@ LUA_USE_JUMPTABLE makes luaV_execute dispatch opcodes through a table
+@* of label addresses (computed goto) instead of a switch statement.
+** It needs the "labels as values" extension of GCC and Clang. Define
+** LUA_NO_JUMPTABLE to build the switch anyway.
+*/
+#if defined(__GNUC__) && !defined(LUA_NO_JUMPTABLE)
+#define LUA_USE_JUMPTABLE
+#endif
+
+
+/*
+@@ luai_gcclock sets t to the current time in microseconds (a double),
+@* for the collector pause statistics (lua_getgcstats).
+** CHANGE it if your system has no monotonic clock; the ANSI fallback
+** measures processor time with a coarse resolution.
+*/
+#if defined(LUA_CORE)
+#include <time.h>
+#if defined(__linux__) || defined(LUA_USE_POSIX)
+#define luai_gcclock(t)	{ struct timespec ts_; \
+	clock_gettime(CLOCK_MONOTONIC, &ts_); \
+	(t) = (double)ts_.tv_sec*1e6 + (double)ts_.tv_nsec/1e3; }
+#else
+#define luai_gcclock(t)	((t) = (double)clock()*1e6/CLOCKS_PER_SEC)
+#endif
+#endif
+
+
 /*
 @@ LUAI_BITSINT defines the number of bits in an int.
 ** CHANGE here if Lua cannot automatically detect the number of bits of
@@ -500,7 +529,9 @@
 /*
 @@ LUAL_BUFFERSIZE is the buffer size used by the lauxlib buffer system.
 */
+#ifndef LUAL_BUFFERSIZE
 #define LUAL_BUFFERSIZE		BUFSIZ
+#endif
 
 /* }================================================================== */
 
@@ -610,6 +641,23 @@ union luai_Cast { double l_d; long l_l; };
 #define LUAI_USER_ALIGNMENT_T	union { double u; void *s; long l; }
 
 
+/*
+@@ LUAI_POOLMAX is the largest block size (in bytes) that the allocator
+@* of luaL_newstate serves from its per-state size class pools; larger
+@* blocks go to realloc. Define it as 0 to use realloc for all blocks
+@* (memory accounting and limits still apply).
+** CHANGE it if your scripts churn bigger objects.
+*/
+#ifndef LUAI_POOLMAX
+#define LUAI_POOLMAX	256
+#endif
+
+/*
+@@ LUAI_POOLPAGE is the size of the pages the pools are carved from.
+*/
+#define LUAI_POOLPAGE	4096
+
+
 /*
 @@ LUAI_THROW/LUAI_TRY define how Lua does exception handling.
 ** CHANGE them if you prefer to use longjmp/setjmp even with C++
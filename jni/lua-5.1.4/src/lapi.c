@@ -694,6 +694,86 @@ LUA_API void lua_rawseti (lua_State *L, int idx, int n) {
 }
 
 
+/*
+** t[first .. first+n-1] = the n values on top of the stack, which are
+** popped (the API form of OP_SETLIST)
+*/
+LUA_API void lua_rawsetlist (lua_State *L, int idx, int first, int n) {
+  StkId o;
+  Table *t;
+  TValue *slot;
+  StkId v;
+  int barrier = 0;
+  lua_lock(L);
+  api_checknelems(L, n);
+  o = index2adr(L, idx);
+  api_check(L, ttistable(o));
+  api_check(L, first >= 1 && n >= 0 && n - 1 <= MAX_INT - first);
+  t = hvalue(o);
+  slot = luaH_setarray(L, t, first, n);
+  for (v = L->top - n; v < L->top; v++, slot++) {
+    setobj2t(L, slot, v);
+    barrier |= iscollectable(v) && needbarrier(obj2gco(t), gcvalue(v));
+  }
+  if (barrier) luaC_barrierback(L, t);
+  L->top -= n;
+  lua_unlock(L);
+}
+
+
+/*
+** t[first .. first+n-1] = v[0 .. n-1], converting from the C element
+** `type' (LUA_ANUMBER etc.) without going through the stack
+*/
+LUA_API void lua_rawsetarray (lua_State *L, int idx, int first, int type,
+                              const void *v, int n) {
+  StkId o;
+  Table *t;
+  TValue *slot;
+  int i;
+  lua_lock(L);
+  if (type == LUA_ASTRING)
+    luaC_checkGC(L);  /* before `o' is taken: finalizers may move the stack */
+  o = index2adr(L, idx);
+  api_check(L, ttistable(o));
+  api_check(L, first >= 1 && n >= 0 && n - 1 <= MAX_INT - first);
+  t = hvalue(o);
+  slot = luaH_setarray(L, t, first, n);
+  switch (type) {
+    case LUA_ANUMBER: {
+      const lua_Number *p = cast(const lua_Number *, v);
+      for (i = 0; i < n; i++) setnvalue(slot + i, p[i]);
+      break;
+    }
+    case LUA_AFLOAT: {
+      const float *p = cast(const float *, v);
+      for (i = 0; i < n; i++) setnvalue(slot + i, cast_num(p[i]));
+      break;
+    }
+    case LUA_AINT: {
+      const int *p = cast(const int *, v);
+      for (i = 0; i < n; i++) setnvalue(slot + i, cast_num(p[i]));
+      break;
+    }
+    case LUA_ASTRING: {
+      const char *const *p = cast(const char *const *, v);
+      /* new strings are white: never store them into a black `t' */
+      if (n > 0 && isblack(obj2gco(t)))
+        luaC_barrierback(L, t);
+      for (i = 0; i < n; i++) {
+        if (p[i] == NULL)
+          setnilvalue(slot + i);
+        else
+          setsvalue(L, slot + i, luaS_new(L, p[i]));
+      }
+      break;
+    }
+    default: api_check(L, 0);
+  }
+  lua_unlock(L);
+}
+
+
 LUA_API int lua_setmetatable (lua_State *L, int objindex) {
   TValue *obj;
   Table *mt;
@@ -887,6 +967,30 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data) {
 }
 
 
+/*
+** push a new closure of the Lua function at `idx', sharing its prototype,
+** with the current globals as environment and fresh nil upvalues (as
+** `lua_load' would return it, without parsing)
+*/
+LUA_API void lua_clonefunction (lua_State *L, int idx) {
+  StkId o;
+  Closure *cl, *ncl;
+  int i;
+  lua_lock(L);
+  luaC_checkGC(L);
+  o = index2adr(L, idx);
+  api_check(L, isLfunction(o));
+  cl = clvalue(o);
+  ncl = luaF_newLclosure(L, cl->l.nupvalues, hvalue(gt(L)));
+  ncl->l.p = cl->l.p;
+  for (i = 0; i < ncl->l.nupvalues; i++)
+    ncl->l.upvals[i] = luaF_newupval(L);
+  setclvalue(L, L->top, ncl);
+  api_incr_top(L);
+  lua_unlock(L);
+}
+
+
 LUA_API int  lua_status (lua_State *L) {
   return L->status;
 }
@@ -948,6 +1052,10 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       g->gcstepmul = data;
       break;
     }
+    case LUA_GCTHAW: {
+      luaC_thaw(L);
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
@@ -955,6 +1063,26 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
 }
 
 
+LUA_API int lua_freeze (lua_State *L, int idx) {
+  StkId o;
+  int res = 0;
+  lua_lock(L);
+  o = index2adr(L, idx);
+  api_checkvalidindex(L, o);
+  if (iscollectable(o))
+    res = luaC_freeze(L, gcvalue(o));
+  lua_unlock(L);
+  return res;
+}
+
+
+LUA_API void lua_getgcstats (lua_State *L, lua_GCStats *s) {
+  lua_lock(L);
+  *s = G(L)->gcstats;
+  lua_unlock(L);
+}
+
+
 
 /*
 ** miscellaneous functions
@@ -1077,9 +1205,15 @@ LUA_API const char *lua_setupvalue (lua_State *L, int funcindex, int n) {
   api_checknelems(L, 1);
   name = aux_upvalue(fi, n, &val);
   if (name) {
+    Closure *f = clvalue(fi);
     L->top--;
     setobj(L, val, L->top);
-    luaC_barrier(L, clvalue(fi), L->top);
+    if (f->c.isC) {
+      luaC_barrier(L, f, L->top);
+    }
+    else {  /* value lives in the upvalue, which may be shared or frozen */
+      luaC_barrier(L, f->l.upvals[n-1], L->top);
+    }
   }
   lua_unlock(L);
   return name;
@@ -389,10 +389,9 @@ LUALIB_API const char *luaL_findtable (lua_State *L, int idx,
 */
 
 
-#define bufflen(B)	((B)->p - (B)->buffer)
-#define bufffree(B)	((size_t)(LUAL_BUFFERSIZE - bufflen(B)))
-
-#define LIMIT	(LUA_MINSTACK/2)
+#define bufflen(B)	((B)->p - (B)->b)
+#define bufffree(B)	((size_t)((B)->size - bufflen(B)))
+#define buffonheap(B)	((B)->b != (B)->buffer)
 
 
 static int emptybuffer (luaL_Buffer *B) {
@@ -407,35 +406,68 @@ static int emptybuffer (luaL_Buffer *B) {
 }
 
 
-static void adjuststack (luaL_Buffer *B) {
-  if (B->lvl > 1) {
-    lua_State *L = B->L;
-    int toget = 1;  /* number of levels to concat */
-    size_t toplen = lua_strlen(L, -1);
-    do {
-      size_t l = lua_strlen(L, -(toget+1));
-      if (B->lvl - toget + 1 >= LIMIT || toplen > l) {
-        toplen += l;
-        toget++;
-      }
-      else break;
-    } while (toget < B->lvl);
-    lua_concat(L, toget);
-    B->lvl = B->lvl - toget + 1;
+/*
+** Make room for `sz' more bytes on the heap buffer, moving the output
+** there first if needed. `above' values are on the stack over the
+** buffer's own slots.
+*/
+static void growbuffer (luaL_Buffer *B, size_t sz, int above) {
+  lua_State *L = B->L;
+  size_t len = bufflen(B);
+  size_t newsize;
+  char *newb;
+  int i;
+  if (!buffonheap(B)) {  /* add lengths of strings on the stack */
+    for (i = 1; i <= B->lvl; i++)
+      len += lua_strlen(L, -(above+i));
   }
+  if (sz > ~(size_t)0 - len)
+    luaL_error(L, "string length overflow");
+  newsize = (B->size*2 > len+sz) ? B->size*2 : len+sz;
+  newb = (char *)lua_newuserdata(L, newsize);
+  if (buffonheap(B)) {  /* copy and replace old heap buffer */
+    memcpy(newb, B->b, len);
+    lua_replace(L, -(above+2));
+  }
+  else {  /* copy stack strings and `buffer', leave userdata in one slot */
+    char *q = newb;
+    for (i = B->lvl; i >= 1; i--) {
+      size_t l;
+      const char *s = lua_tolstring(L, -(above+i+1), &l);
+      memcpy(q, s, l);
+      q += l;
+    }
+    memcpy(q, B->buffer, bufflen(B));
+    if (B->lvl == 0)
+      lua_insert(L, -(above+1));
+    else {
+      lua_replace(L, -(above+B->lvl+1));
+      for (i = 1; i < B->lvl; i++)
+        lua_remove(L, -(above+1));
+    }
+    B->lvl = 1;
+  }
+  B->b = newb;
+  B->p = newb + len;
+  B->size = newsize;
+}
+
+
+LUALIB_API char *luaL_prepbuffsize (luaL_Buffer *B, size_t sz) {
+  if (bufffree(B) < sz)
+    growbuffer(B, sz, 0);
+  return B->p;
 }
 
 
 LUALIB_API char *luaL_prepbuffer (luaL_Buffer *B) {
-  if (emptybuffer(B))
-    adjuststack(B);
-  return B->buffer;
+  return luaL_prepbuffsize(B, LUAL_BUFFERSIZE);
 }
 
 
 LUALIB_API void luaL_addlstring (luaL_Buffer *B, const char *s, size_t l) {
-  while (l--)
-    luaL_addchar(B, *s++);
+  memcpy(luaL_prepbuffsize(B, l), s, l);
+  luaL_addsize(B, l);
 }
 
 
@@ -445,9 +477,15 @@ LUALIB_API void luaL_addstring (luaL_Buffer *B, const char *s) {
 
 
 LUALIB_API void luaL_pushresult (luaL_Buffer *B) {
-  emptybuffer(B);
-  lua_concat(B->L, B->lvl);
-  B->lvl = 1;
+  if (buffonheap(B)) {
+    lua_pushlstring(B->L, B->b, bufflen(B));
+    lua_replace(B->L, -2);  /* replace heap buffer */
+  }
+  else {
+    emptybuffer(B);
+    lua_concat(B->L, B->lvl);
+    B->lvl = 1;
+  }
 }
 
 
@@ -460,18 +498,22 @@ LUALIB_API void luaL_addvalue (luaL_Buffer *B) {
     B->p += vl;
     lua_pop(L, 1);  /* remove from stack */
   }
+  else if (B->lvl == 0 && bufflen(B) == 0) {
+    B->lvl++;  /* sole value so far: keep it on the stack as is */
+  }
   else {
-    if (emptybuffer(B))
-      lua_insert(L, -2);  /* put buffer before new value */
-    B->lvl++;  /* add new value into B stack */
-    adjuststack(B);
+    growbuffer(B, vl, 1);
+    memcpy(B->p, s, vl);
+    B->p += vl;
+    lua_pop(L, 1);
   }
 }
 
 
 LUALIB_API void luaL_buffinit (lua_State *L, luaL_Buffer *B) {
   B->L = L;
-  B->p = B->buffer;
+  B->p = B->b = B->buffer;
+  B->size = LUAL_BUFFERSIZE;
   B->lvl = 0;
 }
 
@@ -624,18 +666,305 @@ LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Allocator
+** Every state created by luaL_newstate gets its own allocator state,
+** which counts live bytes and can enforce a hard limit: growing a
+** block beyond the limit fails, so Lua raises a memory error in that
+** state only. Small blocks (tables, closures, short strings, upvalues)
+** are served from per-state free lists, one per 8 byte size class,
+** carved from LUAI_POOLPAGE pages. A state is only used by one thread
+** at a time, so no locking is needed. Pages are kept until the state
+** is closed or luaL_trimpool finds them unused; freeing the first block
+** (the global state, freed last by lua_close) releases the whole pool.
+** =======================================================
+*/
+
+#define POOL_ALIGN	8
+#if LUAI_POOLMAX > 0
+#define POOL_NCLASS	((LUAI_POOLMAX + POOL_ALIGN - 1) / POOL_ALIGN)
+#define POOL_SMALL(s)	((s) <= LUAI_POOLMAX)
+#else
+#define POOL_NCLASS	1
+#define POOL_SMALL(s)	0
+#endif
+#define POOL_CLASS(s)	(((s) - 1) / POOL_ALIGN)
+#define POOL_SIZE(c)	(((c) + 1) * POOL_ALIGN)
+#define POOL_NBLOCK(c)	((LUAI_POOLPAGE - sizeof(PoolPage)) / POOL_SIZE(c))
+
+/* large blocks Lua shrank to pool sizes when no pool block was free */
+#define POOL_NSTRAY	8
+
+typedef struct PoolBlock {
+  struct PoolBlock *next;
+} PoolBlock;
+
+typedef union PoolPage {
+  struct {
+    union PoolPage *next;
+    int c;  /* size class of its blocks */
+  } h;
+  LUAI_USER_ALIGNMENT_T dummy;  /* keep blocks aligned */
+} PoolPage;
+
+typedef struct Pool {
+  PoolBlock *freelist[POOL_NCLASS];
+  PoolPage *pages;
+  void *first;  /* global state block */
+  void *stray[POOL_NSTRAY];
+  int nstray;
+  luaL_AllocStats stats;
+} Pool;
+
+
+static void pool_destroy (Pool *p) {
+  PoolPage *page = p->pages;
+  while (page) {
+    PoolPage *next = page->h.next;
+    free(page);
+    page = next;
+  }
+  while (p->nstray > 0)
+    free(p->stray[--p->nstray]);
+  free(p);
+}
+
+
+static void *pool_get (Pool *p, size_t size) {
+  int c;
+  PoolBlock *b;
+  if (!POOL_SMALL(size)) {
+    p->stats.nlarge++;
+    return malloc(size);
+  }
+  c = POOL_CLASS(size);
+  b = p->freelist[c];
+  if (b == NULL) {  /* carve a new page into blocks of this class */
+    size_t bsize = POOL_SIZE(c);
+    char *block, *end;
+    PoolPage *page = (PoolPage *)malloc(LUAI_POOLPAGE);
+    if (page == NULL) return NULL;
+    page->h.next = p->pages;
+    page->h.c = c;
+    p->pages = page;
+    p->stats.reserved += LUAI_POOLPAGE;
+    block = (char *)(page + 1);
+    end = (char *)page + LUAI_POOLPAGE - bsize;
+    for (; block <= end; block += bsize) {
+      ((PoolBlock *)block)->next = b;
+      b = (PoolBlock *)block;
+    }
+  }
+  p->freelist[c] = b->next;
+  return b;
+}
+
+
+static void pool_put (Pool *p, void *ptr, size_t size) {
+  if (POOL_SMALL(size)) {
+    int c = POOL_CLASS(size);
+    int i;
+    for (i = 0; i < p->nstray; i++) {  /* not from a page: give it back */
+      if (p->stray[i] == ptr) {
+        p->stray[i] = p->stray[--p->nstray];
+        free(ptr);
+        return;
+      }
+    }
+    ((PoolBlock *)ptr)->next = p->freelist[c];
+    p->freelist[c] = (PoolBlock *)ptr;
+  }
+  else
+    free(ptr);
+}
+
+
 static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
-  (void)ud;
-  (void)osize;
+  Pool *p = (Pool *)ud;
+  void *nptr;
   if (nsize == 0) {
-    free(ptr);
+    if (ptr == NULL) return NULL;
+    p->stats.nfree++;
+    p->stats.inuse -= osize;
+    pool_put(p, ptr, osize);
+    if (ptr == p->first)  /* lua_close: everything else is freed */
+      pool_destroy(p);
     return NULL;
   }
-  else
-    return realloc(ptr, nsize);
+  if (ptr == NULL) osize = 0;
+  if (nsize > osize && p->stats.limit > 0 &&
+      p->stats.inuse + (nsize - osize) > p->stats.limit) {
+    p->stats.nfailed++;
+    return NULL;  /* over the limit: Lua raises a memory error */
+  }
+  if (ptr == NULL) {  /* new block */
+    nptr = pool_get(p, nsize);
+    if (nptr == NULL) {
+      if (p->first == NULL) pool_destroy(p);  /* lua_newstate failed */
+      return NULL;
+    }
+    if (p->first == NULL) p->first = nptr;
+    p->stats.nalloc++;
+  }
+  else if (POOL_SMALL(osize) && POOL_SMALL(nsize) &&
+           POOL_CLASS(osize) == POOL_CLASS(nsize)) {
+    nptr = ptr;  /* same size class */
+    p->stats.nrealloc++;
+  }
+  else if (!POOL_SMALL(osize) && !POOL_SMALL(nsize)) {
+    nptr = realloc(ptr, nsize);
+    if (nptr == NULL) return NULL;
+    p->stats.nrealloc++;
+    p->stats.nlarge++;
+  }
+  else {  /* move between pool and malloc or between size classes */
+    nptr = pool_get(p, nsize);
+    if (nptr == NULL) {
+      /* shrinking should not fail: keep the (bigger) block. A malloc'ed
+         one is remembered so that freeing it does not leave it on a
+         free list, where lua_close would never release it */
+      if (nsize > osize) return NULL;
+      if (!POOL_SMALL(osize)) {
+        if (p->nstray == POOL_NSTRAY) return NULL;
+        p->stray[p->nstray++] = ptr;
+      }
+      nptr = ptr;
+    }
+    else {
+      memcpy(nptr, ptr, (osize < nsize) ? osize : nsize);
+      pool_put(p, ptr, osize);
+    }
+    p->stats.nrealloc++;
+  }
+  p->stats.inuse += nsize - osize;
+  if (p->stats.inuse > p->stats.peak) p->stats.peak = p->stats.inuse;
+  return nptr;
+}
+
+
+static int pool_cmppage (const void *a, const void *b) {
+  const char *pa = *(const char *const *)a, *pb = *(const char *const *)b;
+  return (pa < pb) ? -1 : (pa > pb);
 }
 
 
+/* index in sorted pages of the page holding block b */
+static size_t pool_findpage (PoolPage **pages, size_t n, const void *b) {
+  size_t lo = 0, hi = n;
+  while (hi - lo > 1) {
+    size_t mid = (lo + hi) / 2;
+    if ((const char *)pages[mid] <= (const char *)b) lo = mid;
+    else hi = mid;
+  }
+  return lo;
+}
+
+
+/*
+** Free the pages whose blocks are all on the free lists. Costs a sort
+** of the pages and a search per free block, so call it on memory
+** pressure (after a full collection), not routinely.
+*/
+static size_t pool_trim (Pool *p) {
+  PoolPage **pages, *page;
+  size_t *nfree;
+  size_t n = 0, i, freed = 0;
+  int c;
+  for (page = p->pages; page; page = page->h.next) n++;
+  if (n == 0) return 0;
+  pages = (PoolPage **)malloc(n * (sizeof(PoolPage *) + sizeof(size_t)));
+  if (pages == NULL) return 0;
+  nfree = (size_t *)(pages + n);
+  for (i = 0, page = p->pages; page; page = page->h.next, i++) {
+    pages[i] = page;
+    nfree[i] = 0;
+  }
+  qsort(pages, n, sizeof(PoolPage *), pool_cmppage);
+  for (c = 0; c < POOL_NCLASS; c++) {
+    PoolBlock *b;
+    for (b = p->freelist[c]; b; b = b->next)
+      nfree[pool_findpage(pages, n, b)]++;
+  }
+  for (i = 0; i < n; i++)  /* nfree[i] now flags an unused page */
+    nfree[i] = (nfree[i] == POOL_NBLOCK(pages[i]->h.c));
+  for (c = 0; c < POOL_NCLASS; c++) {  /* unlink blocks of unused pages */
+    PoolBlock **b = &p->freelist[c];
+    while (*b) {
+      if (nfree[pool_findpage(pages, n, *b)])
+        *b = (*b)->next;
+      else
+        b = &(*b)->next;
+    }
+  }
+  {
+    PoolPage **pp = &p->pages;
+    while (*pp) {
+      page = *pp;
+      if (nfree[pool_findpage(pages, n, page)]) {
+        *pp = page->h.next;
+        free(page);
+        freed += LUAI_POOLPAGE;
+      }
+      else
+        pp = &page->h.next;
+    }
+  }
+  free(pages);
+  p->stats.reserved -= freed;
+  return freed;
+}
+
+
+LUALIB_API int luaL_getallocstats (lua_State *L, luaL_AllocStats *s) {
+  void *ud;
+  if (lua_getallocf(L, &ud) != l_alloc) return 0;
+  *s = ((Pool *)ud)->stats;
+  return 1;
+}
+
+
+LUALIB_API int luaL_setalloclimit (lua_State *L, size_t limit) {
+  void *ud;
+  if (lua_getallocf(L, &ud) != l_alloc) return 0;
+  ((Pool *)ud)->stats.limit = limit;
+  return 1;
+}
+
+
+LUALIB_API size_t luaL_trimpool (lua_State *L) {
+  void *ud;
+  if (lua_getallocf(L, &ud) != l_alloc) return 0;
+  return pool_trim((Pool *)ud);
+}
+
+
+LUALIB_API void luaL_pushallocstats (lua_State *L,
+                                     const luaL_AllocStats *s) {
+  lua_createtable(L, 0, 9);
+  lua_pushnumber(L, (lua_Number)s->inuse);
+  lua_setfield(L, -2, "inuse");
+  lua_pushnumber(L, (lua_Number)s->peak);
+  lua_setfield(L, -2, "peak");
+  lua_pushnumber(L, (lua_Number)s->limit);
+  lua_setfield(L, -2, "limit");
+  lua_pushnumber(L, (lua_Number)s->reserved);
+  lua_setfield(L, -2, "reserved");
+  lua_pushnumber(L, (lua_Number)s->nalloc);
+  lua_setfield(L, -2, "nalloc");
+  lua_pushnumber(L, (lua_Number)s->nrealloc);
+  lua_setfield(L, -2, "nrealloc");
+  lua_pushnumber(L, (lua_Number)s->nfree);
+  lua_setfield(L, -2, "nfree");
+  lua_pushnumber(L, (lua_Number)s->nlarge);
+  lua_setfield(L, -2, "nlarge");
+  lua_pushnumber(L, (lua_Number)s->nfailed);
+  lua_setfield(L, -2, "nfailed");
+}
+
+/* }====================================================== */
+
+
 static int panic (lua_State *L) {
   (void)L;  /* to avoid warnings */
   fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n",
@@ -645,7 +974,8 @@ static int panic (lua_State *L) {
 
 
 LUALIB_API lua_State *luaL_newstate (void) {
-  lua_State *L = lua_newstate(l_alloc, NULL);
+  Pool *p = (Pool *)calloc(1, sizeof(Pool));
+  lua_State *L = (p == NULL) ? NULL : lua_newstate(l_alloc, p);
   if (L) lua_atpanic(L, &panic);
   return L;
 }
@@ -203,14 +203,67 @@ static int luaB_gcinfo (lua_State *L) {
 }
 
 
+/* options of collectgarbage not handled by lua_gc alone */
+#define GCSTATS		(-1)
+#define GCLIMIT		(-2)
+#define GCFREEZE	(-3)
+#define GCTRIM		(-4)
+
+#define setnumfield(L,k,v)	(lua_pushnumber(L, (v)), lua_setfield(L, -2, k))
+
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
-    "count", "step", "setpause", "setstepmul", NULL};
+    "count", "step", "setpause", "setstepmul", "stats", "limit",
+    "freeze", "thaw", "trim", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
-    LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL};
+    LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
+    GCSTATS, GCLIMIT, GCFREEZE, LUA_GCTHAW, GCTRIM};
   int o = luaL_checkoption(L, 1, "collect", opts);
-  int ex = luaL_optint(L, 2, 0);
-  int res = lua_gc(L, optsnum[o], ex);
+  int ex;
+  int res;
+  switch (optsnum[o]) {
+    case GCSTATS: {  /* allocator (bytes) and collector (ms) statistics */
+      luaL_AllocStats s;
+      lua_GCStats gc;
+      if (luaL_getallocstats(L, &s)) luaL_pushallocstats(L, &s);
+      else lua_newtable(L);
+      lua_getgcstats(L, &gc);
+      setnumfield(L, "cycles", (lua_Number)gc.cycles);
+      setnumfield(L, "pauses", (lua_Number)gc.pauses);
+      setnumfield(L, "pausetime", gc.pausetime / 1000);
+      setnumfield(L, "lastpause", gc.lastpause / 1000);
+      setnumfield(L, "maxpause", gc.maxpause / 1000);
+      setnumfield(L, "atomic", gc.atomic / 1000);
+      setnumfield(L, "maxatomic", gc.maxatomic / 1000);
+      setnumfield(L, "marked", (lua_Number)gc.marked);
+      setnumfield(L, "frozen", (lua_Number)gc.frozen);
+      setnumfield(L, "remembered", (lua_Number)gc.remembered);
+      return 1;
+    }
+    case GCLIMIT: {  /* set limit in Kbytes (0 = none), return old one */
+      luaL_AllocStats s;
+      if (!luaL_getallocstats(L, &s)) return 0;
+      if (!lua_isnoneornil(L, 2)) {
+        lua_Number kb = luaL_checknumber(L, 2);
+        luaL_argcheck(L, kb >= 0, 2, "negative limit");
+        luaL_setalloclimit(L, (size_t)(kb * 1024));
+      }
+      lua_pushnumber(L, (lua_Number)s.limit / 1024);
+      return 1;
+    }
+    case GCFREEZE: {  /* freeze everything reachable from a value */
+      luaL_checkany(L, 2);
+      lua_pushinteger(L, lua_freeze(L, 2));
+      return 1;
+    }
+    case GCTRIM: {  /* collect, then free unused pool pages (Kbytes) */
+      lua_gc(L, LUA_GCCOLLECT, 0);
+      lua_pushnumber(L, (lua_Number)luaL_trimpool(L) / 1024);
+      return 1;
+    }
+  }
+  ex = luaL_optint(L, 2, 0);
+  res = lua_gc(L, optsnum[o], ex);
   switch (optsnum[o]) {
     case LUA_GCCOUNT: {
       int b = lua_gc(L, LUA_GCCOUNTB, 0);
@@ -23,6 +23,15 @@ typedef struct {
  int status;
 } DumpState;
 
+/*
+** type of string lengths in dumped chunks; a host luac producing
+** chunks for a target with a smaller size_t (e.g. a 64-bit build
+** for 32-bit ARM) is compiled with -DLUAC_DUMP_SIZE_T=<that type>
+*/
+#ifndef LUAC_DUMP_SIZE_T
+#define LUAC_DUMP_SIZE_T	size_t
+#endif
+
 #define DumpMem(b,n,size,D)	DumpBlock(b,(n)*(size),D)
 #define DumpVar(x,D)	 	DumpMem(&x,1,sizeof(x),D)
 
@@ -62,12 +71,12 @@ static void DumpString(const TString* s, DumpState* D)
 {
  if (s==NULL || getstr(s)==NULL)
  {
-  size_t size=0;
+  LUAC_DUMP_SIZE_T size=0;
   DumpVar(size,D);
  }
  else
  {
-  size_t size=s->tsv.len+1;		/* include trailing '\0' */
+  LUAC_DUMP_SIZE_T size=(LUAC_DUMP_SIZE_T)(s->tsv.len+1); /* include trailing '\0' */
   DumpVar(size,D);
   DumpBlock(getstr(s),size,D);
  }
@@ -144,6 +153,7 @@ static void DumpHeader(DumpState* D)
 {
  char h[LUAC_HEADERSIZE];
  luaU_header(h);
+ h[8]=(char)sizeof(LUAC_DUMP_SIZE_T);		/* size_t, see luaU_header */
  DumpBlock(h,LUAC_HEADERSIZE,D);
 }
 
@@ -121,6 +121,7 @@ Proto *luaF_newproto (lua_State *L) {
   f->sizep = 0;
   f->code = NULL;
   f->sizecode = 0;
+  f->icache = NULL;
   f->sizelineinfo = 0;
   f->sizeupvalues = 0;
   f->nups = 0;
@@ -138,8 +139,21 @@ Proto *luaF_newproto (lua_State *L) {
 }
 
 
+/*
+** Give `f' its inline caches once its code is final
+*/
+void luaF_initcache (lua_State *L, Proto *f) {
+  int i;
+  f->icache = luaM_newvector(L, f->sizecode, ICache);
+  for (i = 0; i < f->sizecode; i++)
+    f->icache[i].slot = f->icache[i].islot = 0;
+}
+
+
 void luaF_freeproto (lua_State *L, Proto *f) {
   luaM_freearray(L, f->code, f->sizecode, Instruction);
+  if (f->icache)
+    luaM_freearray(L, f->icache, f->sizecode, ICache);
   luaM_freearray(L, f->p, f->sizep, Proto *);
   luaM_freearray(L, f->k, f->sizek, TValue);
   luaM_freearray(L, f->lineinfo, f->sizelineinfo, int);
@@ -413,7 +413,8 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count) {
       sweepwholelist(L, &gco2th(curr)->openupval);
     if ((curr->gch.marked ^ WHITEBITS) & deadmask) {  /* not dead? */
       lua_assert(!isdead(g, curr) || testbit(curr->gch.marked, FIXEDBIT));
-      makewhite(g, curr);  /* make it white (for next cycle) */
+      if (!isfrozen(curr))
+        makewhite(g, curr);  /* make it white (for next cycle) */
       p = &curr->gch.next;
     }
     else {  /* must erase `curr' */
@@ -485,8 +486,9 @@ void luaC_freeall (lua_State *L) {
   int i;
   g->currentwhite = WHITEBITS | bitmask(SFIXEDBIT);  /* mask to collect all elements */
   sweepwholelist(L, &g->rootgc);
-  for (i = 0; i < g->strt.size; i++)  /* free all string lists */
-    sweepwholelist(L, &g->strt.hash[i]);
+  sweepwholelist(L, &g->frozengc);
+  for (i = 0; i < luaS_nchains(&g->strt); i++)  /* free all string lists */
+    sweepwholelist(L, luaS_chainat(&g->strt, i));
 }
 
 
@@ -503,6 +505,7 @@ static void markroot (lua_State *L) {
   g->gray = NULL;
   g->grayagain = NULL;
   g->weak = NULL;
+  g->gcmarked = 0;
   markobject(g, g->mainthread);
   /* make global table be traversed before main stack */
   markvalue(g, gt(g->mainthread));
@@ -522,28 +525,333 @@ static void remarkupvals (global_State *g) {
 }
 
 
+/*
+** Frozen objects (luaC_freeze)
+** A frozen string, table, function, prototype or closed upvalue is
+** never collected nor recolored, and all but strings live in list
+** `frozengc', out of reach of the sweep. While everything a frozen
+** object refers to is frozen too, it stays black and is never
+** traversed. Otherwise (it refers to userdata, threads, open upvalues
+** or weak tables, or a barrier caught a store into it) it stays gray
+** in list `remembered', which the atomic phase traverses once per
+** cycle. So only the remembered part of a frozen structure costs mark
+** work, whatever its size. Interned strings stay in the string table,
+** which the string sweep still visits.
+** Freezing stops at function environments and at the values of
+** `__index' and `__newindex' fields: those lead to globals and class
+** hierarchies shared with the rest of the program, so the closure or
+** metatable is remembered instead of freezing through it. A remembered
+** object whose references are all frozen again (the stores that caught
+** it were overwritten) turns black and leaves the list.
+*/
+
+static GCObject **gclistof (GCObject *o) {
+  switch (o->gch.tt) {
+    case LUA_TTABLE: return &gco2h(o)->gclist;
+    case LUA_TFUNCTION: return &gco2cl(o)->c.gclist;
+    case LUA_TPROTO: return &gco2p(o)->gclist;
+    case LUA_TUPVAL: return &gco2uv(o)->gclist;
+    default: lua_assert(0); return NULL;
+  }
+}
+
+
+static void remember (global_State *g, GCObject *o) {
+  lua_assert(isfrozen(o) && isblack(o));
+  black2gray(o);  /* no more barriers; traversed by `markremembered' */
+  *gclistof(o) = g->remembered;
+  g->remembered = o;
+  g->gcstats.remembered++;
+}
+
+
+#define isfrozenvalue(v)	(!iscollectable(v) || isfrozen(gcvalue(v)))
+
+#define markfrozen(g,v,clean) \
+  { markvalue(g, v); if (!isfrozenvalue(v)) clean = 0; }
+
+
+static void markremembered (global_State *g) {
+  GCObject **p = &g->remembered;
+  GCObject *o;
+  while ((o = *p) != NULL) {
+    int clean = 1;  /* refers to frozen objects only? */
+    int i;
+    lua_assert(isfrozen(o) && isgray(o));
+    switch (o->gch.tt) {
+      case LUA_TTABLE: {  /* weak modes do not apply to frozen tables */
+        Table *h = gco2h(o);
+        if (h->metatable) {
+          markobject(g, h->metatable);
+          if (!isfrozen(obj2gco(h->metatable))) clean = 0;
+        }
+        i = h->sizearray;
+        while (i--)
+          markfrozen(g, &h->array[i], clean);
+        i = sizenode(h);
+        while (i--) {
+          Node *n = gnode(h, i);
+          if (ttisnil(gval(n)))
+            removeentry(n);
+          else {
+            markfrozen(g, gkey(n), clean);
+            markfrozen(g, gval(n), clean);
+          }
+        }
+        break;
+      }
+      case LUA_TFUNCTION: {
+        Closure *cl = gco2cl(o);
+        traverseclosure(g, cl);
+        if (!isfrozen(obj2gco(cl->c.env))) clean = 0;
+        if (cl->c.isC) {
+          for (i=0; i<cl->c.nupvalues; i++)
+            if (!isfrozenvalue(&cl->c.upvalue[i])) clean = 0;
+        }
+        else {
+          for (i=0; i<cl->l.nupvalues; i++)
+            if (!isfrozen(obj2gco(cl->l.upvals[i]))) clean = 0;
+        }
+        break;
+      }
+      case LUA_TPROTO: {
+        Proto *f = gco2p(o);
+        traverseproto(g, f);
+        for (i=0; i<f->sizek; i++)
+          if (!isfrozenvalue(&f->k[i])) clean = 0;
+        break;
+      }
+      case LUA_TUPVAL: markfrozen(g, gco2uv(o)->v, clean); break;
+      default: lua_assert(0);
+    }
+    if (clean) {  /* barriers catch its next unfrozen store */
+      *p = *gclistof(o);
+      gray2black(o);
+      g->gcstats.remembered--;
+    }
+    else
+      p = gclistof(o);
+  }
+}
+
+
+static int isweak (global_State *g, Table *h) {
+  const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
+  return (mode && ttisstring(mode) &&
+          (strchr(svalue(mode), 'k') || strchr(svalue(mode), 'v')));
+}
+
+
+/* freeze `o' if it can be frozen; return 0 if it stays collectable */
+static int freezeobject (global_State *g, GCObject *o) {
+  if (isfrozen(o)) return 1;
+  lua_assert(iswhite(o));
+  switch (o->gch.tt) {
+    case LUA_TSTRING: {
+      white2gray(o);  /* strings are never black */
+      break;
+    }
+    case LUA_TTABLE:
+    case LUA_TFUNCTION:
+    case LUA_TPROTO:
+    case LUA_TUPVAL: {
+      if ((o->gch.tt == LUA_TTABLE && isweak(g, gco2h(o))) ||
+          (o->gch.tt == LUA_TUPVAL && gco2uv(o)->v != &gco2uv(o)->u.value))
+        return 0;  /* weak tables and open upvalues are marked as usual */
+      white2gray(o);
+      *gclistof(o) = g->gray;
+      g->gray = o;
+      break;
+    }
+    case LUA_TUSERDATA: {  /* marked as usual, but its metatable may freeze */
+      Table *mt = gco2u(o)->metatable;
+      if (mt) freezeobject(g, obj2gco(mt));
+      return 0;
+    }
+    default: return 0;  /* threads */
+  }
+  l_setbit(o->gch.marked, FROZENBIT);
+  g->gcstats.frozen++;
+  return 1;
+}
+
+
+#define freezevalue(g,v,clean) \
+  { if (iscollectable(v) && !freezeobject(g, gcvalue(v))) clean = 0; }
+
+
+/* a metatable field whose value is not frozen through (see above) */
+#define isstopkey(g,k) \
+  (ttisstring(k) && (rawtsvalue(k) == (g)->tmname[TM_INDEX] || \
+                     rawtsvalue(k) == (g)->tmname[TM_NEWINDEX]))
+
+
+/* freeze everything reachable from the objects in list `gray' */
+static void freezegray (global_State *g) {
+  while (g->gray) {
+    GCObject *o = g->gray;
+    int clean = 1;  /* refers to frozen objects only? */
+    int i;
+    g->gray = *gclistof(o);
+    switch (o->gch.tt) {
+      case LUA_TTABLE: {
+        Table *h = gco2h(o);
+        if (h->metatable && !freezeobject(g, obj2gco(h->metatable)))
+          clean = 0;
+        i = h->sizearray;
+        while (i--)
+          freezevalue(g, &h->array[i], clean);
+        i = sizenode(h);
+        while (i--) {
+          Node *n = gnode(h, i);
+          if (!ttisnil(gval(n))) {
+            freezevalue(g, key2tval(n), clean);
+            if (isstopkey(g, key2tval(n))) {
+              if (!isfrozenvalue(gval(n))) clean = 0;
+            }
+            else
+              freezevalue(g, gval(n), clean);
+          }
+        }
+        break;
+      }
+      case LUA_TFUNCTION: {
+        Closure *cl = gco2cl(o);
+        if (!isfrozen(obj2gco(cl->c.env)))
+          clean = 0;
+        if (cl->c.isC) {
+          for (i=0; i<cl->c.nupvalues; i++)
+            freezevalue(g, &cl->c.upvalue[i], clean);
+        }
+        else {
+          freezeobject(g, obj2gco(cl->l.p));
+          for (i=0; i<cl->l.nupvalues; i++) {
+            if (!freezeobject(g, obj2gco(cl->l.upvals[i])))
+              clean = 0;
+          }
+        }
+        break;
+      }
+      case LUA_TUPVAL: {
+        freezevalue(g, gco2uv(o)->v, clean);
+        break;
+      }
+      case LUA_TPROTO: {
+        Proto *f = gco2p(o);
+        if (f->source) freezeobject(g, obj2gco(f->source));
+        for (i=0; i<f->sizek; i++)
+          freezevalue(g, &f->k[i], clean);
+        for (i=0; i<f->sizeupvalues; i++) {
+          if (f->upvalues[i])
+            freezeobject(g, obj2gco(f->upvalues[i]));
+        }
+        for (i=0; i<f->sizep; i++) {
+          if (f->p[i])
+            freezeobject(g, obj2gco(f->p[i]));
+        }
+        for (i=0; i<f->sizelocvars; i++) {
+          if (f->locvars[i].varname)
+            freezeobject(g, obj2gco(f->locvars[i].varname));
+        }
+        break;
+      }
+      default: lua_assert(0);
+    }
+    gray2black(o);
+    if (!clean)
+      remember(g, o);
+  }
+}
+
+
+/*
+** Freeze everything reachable from `o' (see above) and return the
+** number of objects frozen. Done between cycles, when every live
+** object is white and list `gray' is free to use.
+*/
+int luaC_freeze (lua_State *L, GCObject *o) {
+  global_State *g = G(L);
+  size_t frozen = g->gcstats.frozen;
+  GCObject **p = &g->rootgc;
+  GCObject *curr;
+  if (g->gcstate != GCSpause)
+    luaC_fullgc(L);
+  lua_assert(g->gray == NULL);
+  freezeobject(g, o);
+  freezegray(g);
+  /* move them out of the sweep; `rootgc' has only udata after mainthread */
+  while ((curr = *p) != obj2gco(g->mainthread)) {
+    if (isfrozen(curr)) {
+      *p = curr->gch.next;
+      curr->gch.next = g->frozengc;
+      g->frozengc = curr;
+    }
+    else
+      p = &curr->gch.next;
+  }
+  return cast_int(g->gcstats.frozen - frozen);
+}
+
+
+/* make all frozen objects collectable again */
+void luaC_thaw (lua_State *L) {
+  global_State *g = G(L);
+  GCObject *o;
+  int i;
+  if (g->gcstate != GCSpause)
+    luaC_fullgc(L);
+  while ((o = g->frozengc) != NULL) {
+    g->frozengc = o->gch.next;
+    resetbit(o->gch.marked, FROZENBIT);
+    makewhite(g, o);
+    o->gch.next = g->rootgc;
+    g->rootgc = o;
+  }
+  for (i = 0; i < luaS_nchains(&g->strt); i++) {
+    for (o = *luaS_chainat(&g->strt, i); o != NULL; o = o->gch.next) {
+      if (isfrozen(o)) {
+        resetbit(o->gch.marked, FROZENBIT);
+        makewhite(g, o);
+      }
+    }
+  }
+  g->remembered = NULL;
+  g->gcstats.frozen = 0;
+  g->gcstats.remembered = 0;
+}
+
+
 static void atomic (lua_State *L) {
   global_State *g = G(L);
   size_t udsize;  /* total size of userdata to be finalized */
+  double start, end;
+  luai_gcclock(start);
+  /* traverse frozen objects that may refer to unfrozen ones */
+  markremembered(g);
   /* remark occasional upvalues of (maybe) dead threads */
   remarkupvals(g);
   /* traverse objects cautch by write barrier and by 'remarkupvals' */
-  propagateall(g);
+  g->gcmarked += propagateall(g);
   /* remark weak tables */
   g->gray = g->weak;
   g->weak = NULL;
   lua_assert(!iswhite(obj2gco(g->mainthread)));
   markobject(g, L);  /* mark running thread */
   markmt(g);  /* mark basic metatables (again) */
-  propagateall(g);
+  g->gcmarked += propagateall(g);
   /* remark gray again */
   g->gray = g->grayagain;
   g->grayagain = NULL;
-  propagateall(g);
+  g->gcmarked += propagateall(g);
   udsize = luaC_separateudata(L, 0);  /* separate userdata to be finalized */
   marktmu(g);  /* mark `preserved' userdata */
   udsize += propagateall(g);  /* remark, to propagate `preserveness' */
   cleartable(g->weak);  /* remove collected objects from weak tables */
+  g->gcstats.marked = g->gcmarked + udsize;
+  luai_gcclock(end);
+  g->gcstats.atomic = end - start;
+  if (g->gcstats.atomic > g->gcstats.maxatomic)
+    g->gcstats.maxatomic = g->gcstats.atomic;
   /* flip current white */
   g->currentwhite = cast_byte(otherwhite(g));
   g->sweepstrgc = 0;
@@ -562,8 +870,11 @@ static l_mem singlestep (lua_State *L) {
       return 0;
     }
     case GCSpropagate: {
-      if (g->gray)
-        return propagatemark(g);
+      if (g->gray) {
+        l_mem m = propagatemark(g);
+        g->gcmarked += m;
+        return m;
+      }
       else {  /* no more `gray' objects */
         atomic(L);  /* finish mark phase */
         return 0;
@@ -571,21 +882,24 @@ static l_mem singlestep (lua_State *L) {
     }
     case GCSsweepstring: {
       lu_mem old = g->totalbytes;
-      sweepwholelist(L, &g->strt.hash[g->sweepstrgc++]);
-      if (g->sweepstrgc >= g->strt.size)  /* nothing more to sweep? */
+      sweepwholelist(L, luaS_chainat(&g->strt, g->sweepstrgc));
+      g->sweepstrgc++;
+      if (g->sweepstrgc >= luaS_nchains(&g->strt))  /* nothing more to sweep? */
         g->gcstate = GCSsweep;  /* end sweep-string phase */
       lua_assert(old >= g->totalbytes);
       g->estimate -= old - g->totalbytes;
       return GCSWEEPCOST;
     }
     case GCSsweep: {
-      lu_mem old = g->totalbytes;
+      lu_mem old;
+      luaS_rehash(L, 1);  /* string table resize in progress */
+      old = g->totalbytes;
       g->sweepgc = sweeplist(L, g->sweepgc, GCSWEEPMAX);
       if (*g->sweepgc == NULL) {  /* nothing more to sweep? */
-        checkSizes(L);
+        checkSizes(L);  /* may keep the old string array for a while */
         g->gcstate = GCSfinalize;  /* end sweep phase */
       }
-      lua_assert(old >= g->totalbytes);
+      /* unsigned, so this also adds what checkSizes kept allocated */
       g->estimate -= old - g->totalbytes;
       return GCSWEEPMAX*GCSWEEPCOST;
     }
@@ -599,6 +913,7 @@ static l_mem singlestep (lua_State *L) {
       else {
         g->gcstate = GCSpause;  /* end collection */
         g->gcdept = 0;
+        g->gcstats.cycles++;
         return 0;
       }
     }
@@ -607,9 +922,22 @@ static l_mem singlestep (lua_State *L) {
 }
 
 
+static void addpause (global_State *g, double start) {
+  double end;
+  luai_gcclock(end);
+  g->gcstats.pauses++;
+  g->gcstats.lastpause = end - start;
+  g->gcstats.pausetime += g->gcstats.lastpause;
+  if (g->gcstats.lastpause > g->gcstats.maxpause)
+    g->gcstats.maxpause = g->gcstats.lastpause;
+}
+
+
 void luaC_step (lua_State *L) {
   global_State *g = G(L);
   l_mem lim = (GCSTEPSIZE/100) * g->gcstepmul;
+  double start;
+  luai_gcclock(start);
   if (lim == 0)
     lim = (MAX_LUMEM-1)/2;  /* no limit */
   g->gcdept += g->totalbytes - g->GCthreshold;
@@ -630,11 +958,14 @@ void luaC_step (lua_State *L) {
     lua_assert(g->totalbytes >= g->estimate);
     setthreshold(g);
   }
+  addpause(g, start);
 }
 
 
 void luaC_fullgc (lua_State *L) {
   global_State *g = G(L);
+  double start;
+  luai_gcclock(start);
   if (g->gcstate <= GCSpropagate) {
     /* reset sweep marks to sweep all elements (returning them to white) */
     g->sweepstrgc = 0;
@@ -656,11 +987,16 @@ void luaC_fullgc (lua_State *L) {
     singlestep(L);
   }
   setthreshold(g);
+  addpause(g, start);
 }
 
 
 void luaC_barrierf (lua_State *L, GCObject *o, GCObject *v) {
   global_State *g = G(L);
+  if (isfrozen(o)) {  /* will not be traversed by the mark phase */
+    remember(g, o);
+    return;
+  }
   lua_assert(isblack(o) && iswhite(v) && !isdead(g, v) && !isdead(g, o));
   lua_assert(g->gcstate != GCSfinalize && g->gcstate != GCSpause);
   lua_assert(ttype(&o->gch) != LUA_TTABLE);
@@ -675,6 +1011,10 @@ void luaC_barrierf (lua_State *L, GCObject *o, GCObject *v) {
 void luaC_barrierback (lua_State *L, Table *t) {
   global_State *g = G(L);
   GCObject *o = obj2gco(t);
+  if (isfrozen(o)) {  /* will not be traversed by the mark phase */
+    remember(g, o);
+    return;
+  }
   lua_assert(isblack(o) && !isdead(g, o));
   lua_assert(g->gcstate != GCSfinalize && g->gcstate != GCSpause);
   black2gray(o);  /* make table gray (again) */
@@ -48,6 +48,7 @@
 ** bit 4 - for tables: has weak values
 ** bit 5 - object is fixed (should not be collected)
 ** bit 6 - object is "super" fixed (only the main thread)
+** bit 7 - object is frozen (see luaC_freeze)
 */
 
 
@@ -59,12 +60,14 @@
 #define VALUEWEAKBIT	4
 #define FIXEDBIT	5
 #define SFIXEDBIT	6
+#define FROZENBIT	7
 #define WHITEBITS	bit2mask(WHITE0BIT, WHITE1BIT)
 
 
 #define iswhite(x)      test2bits((x)->gch.marked, WHITE0BIT, WHITE1BIT)
 #define isblack(x)      testbit((x)->gch.marked, BLACKBIT)
 #define isgray(x)	(!isblack(x) && !iswhite(x))
+#define isfrozen(x)	testbit((x)->gch.marked, FROZENBIT)
 
 #define otherwhite(g)	(g->currentwhite ^ WHITEBITS)
 #define isdead(g,v)	((v)->gch.marked & otherwhite(g) & WHITEBITS)
@@ -83,18 +86,26 @@
 	luaC_step(L); }
 
 
-#define luaC_barrier(L,p,v) { if (valiswhite(v) && isblack(obj2gco(p)))  \
-	luaC_barrierf(L,obj2gco(p),gcvalue(v)); }
+/*
+** a black frozen object is never traversed again, so storing any
+** unfrozen object into it needs the barrier, not only a white one
+*/
+#define needbarrier(p,o)	(isblack(p) && \
+	(iswhite(o) || (isfrozen(p) && !isfrozen(o))))
+
+#define luaC_barrier(L,p,v) { if (iscollectable(v) && \
+	needbarrier(obj2gco(p),gcvalue(v))) \
+		luaC_barrierf(L,obj2gco(p),gcvalue(v)); }
 
-#define luaC_barriert(L,t,v) { if (valiswhite(v) && isblack(obj2gco(t)))  \
-	luaC_barrierback(L,t); }
+#define luaC_barriert(L,t,v) { if (iscollectable(v) && \
+	needbarrier(obj2gco(t),gcvalue(v))) luaC_barrierback(L,t); }
 
 #define luaC_objbarrier(L,p,o)  \
-	{ if (iswhite(obj2gco(o)) && isblack(obj2gco(p))) \
+	{ if (needbarrier(obj2gco(p),obj2gco(o))) \
 		luaC_barrierf(L,obj2gco(p),obj2gco(o)); }
 
 #define luaC_objbarriert(L,t,o)  \
-   { if (iswhite(obj2gco(o)) && isblack(obj2gco(t))) luaC_barrierback(L,t); }
+   { if (needbarrier(obj2gco(t),obj2gco(o))) luaC_barrierback(L,t); }
 
 LUAI_FUNC size_t luaC_separateudata (lua_State *L, int all);
 LUAI_FUNC void luaC_callGCTM (lua_State *L);
@@ -105,6 +116,8 @@ LUAI_FUNC void luaC_link (lua_State *L, GCObject *o, lu_byte tt);
 LUAI_FUNC void luaC_linkupval (lua_State *L, UpVal *uv);
 LUAI_FUNC void luaC_barrierf (lua_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback (lua_State *L, Table *t);
+LUAI_FUNC int luaC_freeze (lua_State *L, GCObject *o);
+LUAI_FUNC void luaC_thaw (lua_State *L);
 
 
 #endif
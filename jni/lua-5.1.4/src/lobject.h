@@ -225,6 +225,17 @@ typedef union Udata {
 
 
 
+/*
+** Inline cache of an instruction looking up a constant string key
+** (see lvm.c): node indexes where the key was last found in the
+** table and in its __index table
+*/
+typedef struct ICache {
+  unsigned short slot;
+  unsigned short islot;
+} ICache;
+
+
 /*
 ** Function Prototypes
 */
@@ -233,6 +244,7 @@ typedef struct Proto {
   TValue *k;  /* constants used by the function */
   Instruction *code;
   struct Proto **p;  /* functions defined inside the function */
+  ICache *icache;  /* inline caches, one per instruction (or NULL) */
   int *lineinfo;  /* map from opcodes to source lines */
   struct LocVar *locvars;  /* information about local variables */
   TString **upvalues;  /* upvalue names */
@@ -274,6 +286,7 @@ typedef struct LocVar {
 typedef struct UpVal {
   CommonHeader;
   TValue *v;  /* points to stack or to its own value */
+  GCObject *gclist;  /* when frozen and remembered (see lgc.c) */
   union {
     TValue value;  /* the value (when closed) */
     struct {  /* double linked list (when open) */
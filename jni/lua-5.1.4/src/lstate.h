@@ -39,6 +39,9 @@ typedef struct stringtable {
   GCObject **hash;
   lu_int32 nuse;  /* number of elements */
   int size;
+  GCObject **oldhash;  /* chains not yet moved by an incremental resize */
+  int oldsize;
+  int rehashpos;  /* next chain of `oldhash' to move */
 } stringtable;
 
 
@@ -67,6 +70,7 @@ typedef struct CallInfo {
 */
 typedef struct global_State {
   stringtable strt;  /* hash table for strings */
+  unsigned int seed;  /* randomized seed for string hashes */
   lua_Alloc frealloc;  /* function to reallocate memory */
   void *ud;         /* auxiliary data to `frealloc' */
   lu_byte currentwhite;
@@ -78,6 +82,8 @@ typedef struct global_State {
   GCObject *grayagain;  /* list of objects to be traversed atomically */
   GCObject *weak;  /* list of weak tables (to be cleared) */
   GCObject *tmudata;  /* last element of list of userdata to be GC */
+  GCObject *frozengc;  /* list of frozen objects (never swept) */
+  GCObject *remembered;  /* frozen objects traversed by every atomic phase */
   Mbuffer buff;  /* temporary buffer for string concatentation */
   lu_mem GCthreshold;
   lu_mem totalbytes;  /* number of bytes currently allocated */
@@ -85,6 +91,8 @@ typedef struct global_State {
   lu_mem gcdept;  /* how much GC is `behind schedule' */
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC `granularity' */
+  lu_mem gcmarked;  /* bytes traversed in current mark phase */
+  lua_GCStats gcstats;  /* pause metrics (see lua_getgcstats) */
   lua_CFunction panic;  /* to be called in unprotected errors */
   TValue l_registry;
   struct lua_State *mainthread;
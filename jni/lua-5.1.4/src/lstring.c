@@ -19,6 +19,98 @@
 
 
 
+/*
+** MurmurHash3 (x86, 32-bit) over the whole string. The old hash
+** sampled at most 32 characters, so long keys sharing a prefix and
+** suffix (paths, formatted messages) piled up in the same chains.
+*/
+#define rotl32(x,r)	(((x) << (r)) | ((x) >> (32 - (r))))
+
+unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
+  const unsigned char *p = cast(const unsigned char *, str);
+  const lu_int32 c1 = 0xcc9e2d51, c2 = 0x1b873593;
+  lu_int32 h = seed ^ cast(lu_int32, l);
+  lu_int32 k;
+  size_t n;
+  for (n = l >> 2; n > 0; n--, p += 4) {  /* body */
+    memcpy(&k, p, 4);  /* unaligned load */
+    k *= c1; k = rotl32(k, 15); k *= c2;
+    h ^= k; h = rotl32(h, 13); h = h*5 + 0xe6546b64;
+  }
+  k = 0;
+  switch (l & 3) {  /* tail */
+    case 3: k ^= cast(lu_int32, p[2]) << 16;  /* FALLTHROUGH */
+    case 2: k ^= cast(lu_int32, p[1]) << 8;  /* FALLTHROUGH */
+    case 1: k ^= p[0];
+            k *= c1; k = rotl32(k, 15); k *= c2; h ^= k;
+  }
+  h ^= cast(lu_int32, l);  /* finalization mix */
+  h ^= h >> 16; h *= 0x85ebca6b;
+  h ^= h >> 13; h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return cast(unsigned int, h);
+}
+
+
+/*
+** While the table is being resized, chains of the old array that
+** were not moved yet (index >= rehashpos) still hold their strings
+*/
+static GCObject **chainfor (stringtable *tb, unsigned int h) {
+  if (tb->oldhash) {
+    int h0 = lmod(h, tb->oldsize);
+    if (h0 >= tb->rehashpos)
+      return &tb->oldhash[h0];
+  }
+  return &tb->hash[lmod(h, tb->size)];
+}
+
+
+/*
+** Move up to `n' chains of the old array into the new one. The
+** collector sweeps the table by chain index, so nothing moves
+** during the sweep-string phase.
+*/
+static void rehash (lua_State *L, stringtable *tb, int n) {
+  while (tb->oldhash && n-- > 0) {
+    GCObject *p = tb->oldhash[tb->rehashpos];
+    tb->oldhash[tb->rehashpos++] = NULL;
+    while (p) {  /* for each node in the list */
+      GCObject *next = p->gch.next;  /* save next */
+      unsigned int h = gco2ts(p)->hash;
+      int h1 = lmod(h, tb->size);  /* new position */
+      lua_assert(cast_int(h%tb->size) == lmod(h, tb->size));
+      p->gch.next = tb->hash[h1];  /* chain it */
+      tb->hash[h1] = p;
+      p = next;
+    }
+    if (tb->rehashpos >= tb->oldsize) {  /* done? */
+      luaM_freearray(L, tb->oldhash, tb->oldsize, TString *);
+      tb->oldhash = NULL;
+      tb->oldsize = tb->rehashpos = 0;
+    }
+  }
+}
+
+
+void luaS_rehash (lua_State *L, int n) {
+  global_State *g = G(L);
+  lu_mem old = g->totalbytes;
+  if (g->gcstate == GCSsweepstring) return;
+  rehash(L, &g->strt, n);
+  /* the old array is not freed by a sweep; keep the estimate in step */
+  lua_assert(old >= g->totalbytes);
+  g->estimate = (g->estimate > old - g->totalbytes) ?
+                g->estimate - (old - g->totalbytes) : 0;
+}
+
+
+/*
+** Resizing only installs the new array; strings move over a few
+** chains at a time (see `luaS_rehash'), so growing a large table
+** does not stall the thread that created the string crossing the
+** threshold.
+*/
 void luaS_resize (lua_State *L, int newsize) {
   GCObject **newhash;
   stringtable *tb;
@@ -28,20 +120,15 @@ void luaS_resize (lua_State *L, int newsize) {
   newhash = luaM_newvector(L, newsize, GCObject *);
   tb = &G(L)->strt;
   for (i=0; i<newsize; i++) newhash[i] = NULL;
-  /* rehash */
-  for (i=0; i<tb->size; i++) {
-    GCObject *p = tb->hash[i];
-    while (p) {  /* for each node in the list */
-      GCObject *next = p->gch.next;  /* save next */
-      unsigned int h = gco2ts(p)->hash;
-      int h1 = lmod(h, newsize);  /* new position */
-      lua_assert(cast_int(h%newsize) == lmod(h, newsize));
-      p->gch.next = newhash[h1];  /* chain it */
-      newhash[h1] = p;
-      p = next;
-    }
+  rehash(L, tb, MAX_INT);  /* finish previous resize */
+  if (tb->nuse == 0) {  /* nothing to move */
+    luaM_freearray(L, tb->hash, tb->size, TString *);
+  }
+  else {
+    tb->oldhash = tb->hash;
+    tb->oldsize = tb->size;
+    tb->rehashpos = 0;
   }
-  luaM_freearray(L, tb->hash, tb->size, TString *);
   tb->size = newsize;
   tb->hash = newhash;
 }
@@ -51,6 +138,7 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
                                        unsigned int h) {
   TString *ts;
   stringtable *tb;
+  GCObject **list;
   if (l+1 > (MAX_SIZET - sizeof(TString))/sizeof(char))
     luaM_toobig(L);
   ts = cast(TString *, luaM_malloc(L, (l+1)*sizeof(char)+sizeof(TString)));
@@ -62,11 +150,13 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
   memcpy(ts+1, str, l*sizeof(char));
   ((char *)(ts+1))[l] = '\0';  /* ending 0 */
   tb = &G(L)->strt;
-  h = lmod(h, tb->size);
-  ts->tsv.next = tb->hash[h];  /* chain new entry */
-  tb->hash[h] = obj2gco(ts);
+  list = chainfor(tb, h);
+  ts->tsv.next = *list;  /* chain new entry */
+  *list = obj2gco(ts);
   tb->nuse++;
-  if (tb->nuse > cast(lu_int32, tb->size) && tb->size <= MAX_INT/2)
+  if (tb->oldhash)
+    luaS_rehash(L, 2);  /* keep ahead of the next resize */
+  else if (tb->nuse > cast(lu_int32, tb->size) && tb->size <= MAX_INT/2)
     luaS_resize(L, tb->size*2);  /* too crowded */
   return ts;
 }
@@ -74,16 +164,13 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
 
 TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
   GCObject *o;
-  unsigned int h = cast(unsigned int, l);  /* seed */
-  size_t step = (l>>5)+1;  /* if string is too long, don't hash all its chars */
-  size_t l1;
-  for (l1=l; l1>=step; l1-=step)  /* compute hash */
-    h = h ^ ((h<<5)+(h>>2)+cast(unsigned char, str[l1-1]));
-  for (o = G(L)->strt.hash[lmod(h, G(L)->strt.size)];
+  unsigned int h = luaS_hash(str, l, G(L)->seed);
+  for (o = *chainfor(&G(L)->strt, h);
        o != NULL;
        o = o->gch.next) {
     TString *ts = rawgco2ts(o);
-    if (ts->tsv.len == l && (memcmp(str, getstr(ts), l) == 0)) {
+    if (ts->tsv.hash == h && ts->tsv.len == l &&
+        (memcmp(str, getstr(ts), l) == 0)) {
       /* string may be dead */
       if (isdead(G(L), o)) changewhite(o);
       return ts;
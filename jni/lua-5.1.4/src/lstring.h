@@ -23,7 +23,19 @@
 
 #define luaS_fix(s)	l_setbit((s)->tsv.marked, FIXEDBIT)
 
+/*
+** chains of the string table, including those of a resize in progress
+** (see luaS_resize); the collector sweeps them by index
+*/
+#define luaS_nchains(tb)	((tb)->size + \
+	((tb)->oldhash ? (tb)->oldsize - (tb)->rehashpos : 0))
+#define luaS_chainat(tb,i)	((i) < (tb)->size ? &(tb)->hash[i] : \
+	&(tb)->oldhash[(tb)->rehashpos + (i) - (tb)->size])
+
+LUAI_FUNC unsigned int luaS_hash (const char *str, size_t l,
+                                  unsigned int seed);
 LUAI_FUNC void luaS_resize (lua_State *L, int newsize);
+LUAI_FUNC void luaS_rehash (lua_State *L, int n);
 LUAI_FUNC Udata *luaS_newudata (lua_State *L, size_t s, Table *e);
 LUAI_FUNC TString *luaS_newlstr (lua_State *L, const char *str, size_t l);
 
@@ -330,6 +330,20 @@ void luaH_resizearray (lua_State *L, Table *t, int nasize) {
 }
 
 
+/*
+** Slots for keys [first, first+n) in the array part, growing it if
+** needed (keys already in the hash part move over with the resize).
+** Used for bulk stores from C; the caller handles the barrier.
+*/
+TValue *luaH_setarray (lua_State *L, Table *t, int first, int n) {
+  int last = first + n - 1;
+  lua_assert(first >= 1 && n >= 0 && last <= MAXASIZE);
+  if (last > t->sizearray)
+    luaH_resizearray(L, t, last);
+  return &t->array[first - 1];
+}
+
+
 static void rehash (lua_State *L, Table *t, const TValue *ek) {
   int nasize, na;
   int nums[MAXBITS+1];  /* nums[i] = number of keys between 2^(i-1) and 2^i */
@@ -463,6 +477,23 @@ const TValue *luaH_getstr (Table *t, TString *key) {
 }
 
 
+/*
+** search function for strings that also gives the index of the node
+** holding the key (used by the inline caches in lvm.c)
+*/
+const TValue *luaH_getstrslot (Table *t, TString *key, int *slot) {
+  Node *n = hashstr(t, key);
+  do {  /* check whether `key' is somewhere in the chain */
+    if (ttisstring(gkey(n)) && rawtsvalue(gkey(n)) == key) {
+      *slot = cast_int(n - t->node);
+      return gval(n);  /* that's it */
+    }
+    else n = gnext(n);
+  } while (n);
+  return luaO_nilobject;
+}
+
+
 /*
 ** main search function
 */
@@ -141,6 +141,31 @@ static void addfield (lua_State *L, luaL_Buffer *b, int i) {
 }
 
 
+/*
+** Upper bound of the length of a concatenation of t[i..last] (exact
+** for strings, LUAI_MAXNUMBER2STR for numbers), or 0 if some element
+** is neither (tconcat then raises the error when it gets there)
+*/
+static size_t concatlen (lua_State *L, int i, int last, size_t lsep) {
+  size_t len;
+  if (lsep > 0 && (size_t)(last - i) > ~(size_t)0 / lsep) return 0;
+  len = lsep * (size_t)(last - i);
+  for (; i <= last; i++) {
+    size_t l;
+    lua_rawgeti(L, 1, i);
+    switch (lua_type(L, -1)) {
+      case LUA_TSTRING: l = lua_strlen(L, -1); break;
+      case LUA_TNUMBER: l = LUAI_MAXNUMBER2STR; break;
+      default: lua_pop(L, 1); return 0;
+    }
+    lua_pop(L, 1);
+    if (l > ~(size_t)0 - len) return 0;
+    len += l;
+  }
+  return len;
+}
+
+
 static int tconcat (lua_State *L) {
   luaL_Buffer b;
   size_t lsep;
@@ -150,6 +175,8 @@ static int tconcat (lua_State *L) {
   i = luaL_optint(L, 3, 1);
   last = luaL_opt(L, luaL_checkint, 4, luaL_getn(L, 1));
   luaL_buffinit(L, &b);
+  if (i < last)  /* allocate the result once when it will not fit */
+    luaL_prepbuffsize(&b, concatlen(L, i, last, lsep));
   for (; i < last; i++) {
     addfield(L, &b, i);
     luaL_addlstring(&b, sep, lsep);
@@ -35,6 +35,8 @@ static AAssetManager* assetManager;
 #define ASSETPATH "?.lua;lua/?.lua;lua/?/init.lua"
 
 #define BUFFERSIZE 1024
+#define ASSET_LIST_CHUNK 32
+#define BYTECODE_HEADERSIZE 12  // LUAC_HEADERSIZE in lundump.h
 typedef struct LoadA {
   int extraline;
   AAsset *asset;
@@ -57,21 +59,77 @@ const char *getA(lua_State *L, void *ud, size_t *size) {
   return (*size > 0) ? la->buff : NULL;
 }
 
+// Header of precompiled chunks loadable by this build, as made by
+// luaU_header (tools/luac-assets.sh writes it for the device ABIs)
+static void bytecodeheader(char *h) {
+  int x = 1;
+  memcpy(h, LUA_SIGNATURE, sizeof(LUA_SIGNATURE) - 1);
+  h += sizeof(LUA_SIGNATURE) - 1;
+  *h++ = 0x51;  // version
+  *h++ = 0;     // format
+  *h++ = *(char *)&x;  // endianness
+  *h++ = (char)sizeof(int);
+  *h++ = (char)sizeof(size_t);
+  *h++ = (char)sizeof(LUAI_UINT32);  // Instruction
+  *h++ = (char)sizeof(lua_Number);
+  *h++ = (char)(((lua_Number)0.5) == 0);
+}
+
+// Check the header of a precompiled chunk, so that bytecode built for
+// another target fails with a clear message rather than "bad header"
+static int checkbytecode(lua_State *L, const char *filename,
+			 const char *buff, size_t len) {
+  char h[BYTECODE_HEADERSIZE];
+  bytecodeheader(h);
+  if ((len >= BYTECODE_HEADERSIZE) &&
+      (memcmp(h, buff, BYTECODE_HEADERSIZE) == 0)) {
+    return 1;
+  }
+  if ((len < BYTECODE_HEADERSIZE) || (buff[4] != h[4])) {
+    lua_pushfstring(L, "asset %s: not Lua 5.1 bytecode", filename);
+  }
+  else {
+    lua_pushfstring(L, "asset %s: bytecode for another target "
+		    "(%s-endian, int %d, size_t %d, number %d; expected "
+		    "%s-endian, int %d, size_t %d, number %d)", filename,
+		    buff[6] ? "little" : "big", buff[7], buff[8], buff[10],
+		    h[6] ? "little" : "big", h[7], h[8], h[10]);
+  }
+  LOGE("%s", lua_tostring(L, -1));
+  return 0;
+}
+
 LUA_API int luaL_loadasset(lua_State *L, const char *filename) {
   LoadA la;
 
   AAsset *asset = AAssetManager_open(assetManager,
 				     filename,
-				     AASSET_MODE_STREAMING);
+				     AASSET_MODE_BUFFER);
   if (asset == NULL) {
     LOGE("Cannot open asset %s", filename);
     lua_pushfstring(L, "cannot open asset %s", filename);
     return LUA_ERRFILE;
   }
 
-  la.extraline = 0;
-  la.asset = asset;
-  int status = lua_load(L, getA, &la, filename);
+  int status;
+  const char *buff = (const char *)AAsset_getBuffer(asset);
+  if (buff != NULL) {
+    // Whole asset in memory: precompiled chunks (see
+    // tools/luac-assets.sh) are undumped straight from it
+    size_t len = AAsset_getLength(asset);
+    if ((len > 0) && (buff[0] == LUA_SIGNATURE[0]) &&
+	!checkbytecode(L, filename, buff, len)) {
+      status = LUA_ERRSYNTAX;
+    }
+    else {
+      status = luaL_loadbuffer(L, buff, len, filename);
+    }
+  }
+  else {
+    la.extraline = 0;
+    la.asset = asset;
+    status = lua_load(L, getA, &la, filename);
+  }
   AAsset_close(asset);
 
   return status;
@@ -114,13 +172,21 @@ static int lua_asset_list(lua_State *L) {
 
   AAssetDir_rewind(assetDir);
   int nfiles = 0;
+  int npending = 0;
   const char* filename;
+  luaL_checkstack(L, ASSET_LIST_CHUNK + 1, "asset list");
   lua_createtable(L, 0, 0);
+  // Names are only valid until the next call, so they are pushed and
+  // stored in chunks
   while ((filename = AAssetDir_getNextFileName(assetDir)) != NULL) {
-    nfiles++;
     lua_pushstring(L, filename);
-    lua_rawseti(L, -2, nfiles);
+    if (++npending == ASSET_LIST_CHUNK) {
+      lua_rawsetlist(L, -(npending+1), nfiles+1, npending);
+      nfiles += npending;
+      npending = 0;
+    }
   }
+  lua_rawsetlist(L, -(npending+1), nfiles+1, npending);
   AAssetDir_close(assetDir);
 
   return 1;
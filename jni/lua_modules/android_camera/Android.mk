@@ -1,19 +1,28 @@
 LOCAL_PATH := $(call my-dir)
 
+# YUV conversion kernels shared by both camera modules
+# NEON intrinsics are enabled on armeabi-v7a, SSE2 is baseline on x86
+YUV_SRC_FILES := luayuv.cpp yuvconvert.c
+ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
+YUV_ARM_NEON := true
+endif
+
 # native camera module to access Android camera
 include $(CLEAR_VARS)
 LOCAL_MODULE := nativecamera
-LOCAL_SRC_FILES := luanativecamera.cpp
+LOCAL_SRC_FILES := luanativecamera.cpp $(YUV_SRC_FILES)
+LOCAL_ARM_NEON := $(YUV_ARM_NEON)
 LOCAL_C_INCLUDES += $(JNI_PATH)/android/include
 LOCAL_LDFLAGS += -L$(JNI_PATH)/android/lib/$(TARGET_ARCH_ABI)
-LOCAL_LDLIBS := -lcamera_client -lutils -lbinder -llog
+LOCAL_LDLIBS := -lcamera_client -lutils -lbinder -landroid -llog
 LOCAL_SHARED_LIBRARIES := lua-activity
 include $(BUILD_SHARED_LIBRARY)
 
 # JNI camera module to access Android camera
 include $(CLEAR_VARS)
 LOCAL_MODULE := jnicamera
-LOCAL_SRC_FILES := luajnicamera.cpp
+LOCAL_SRC_FILES := luajnicamera.cpp $(YUV_SRC_FILES)
+LOCAL_ARM_NEON := $(YUV_ARM_NEON)
 LOCAL_C_INCLUDES += $(JNI_PATH)/android/include
 LOCAL_LDFLAGS += -L$(JNI_PATH)/android/lib/$(TARGET_ARCH_ABI)
 LOCAL_LDLIBS := -lcamera_client -lutils -lbinder -llog
@@ -0,0 +1,240 @@
+#ifndef framepool_h
+#define framepool_h
+
+/*
+  Fixed pool of reference counted camera frame buffers
+
+  The camera thread fills a free buffer and publishes it as the latest
+  frame. The pool itself holds one reference on the latest frame, and
+  Lua takes more with acquire(). A buffer is only handed back to the
+  camera (recycle callback) once every reference has been released,
+  so a frame is never overwritten while Lua is reading it.
+
+  References held by Lua go with a handle each (newHandle()), which
+  releaseHandle() takes back once: releasing a handle twice, or one
+  that was never given out, cannot drop someone else's reference.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define FRAMEPOOL_MAX_FRAMES 8
+#define FRAMEPOOL_MAX_HANDLES 64
+
+typedef struct FrameBuffer {
+  unsigned char *data;  // frame bytes (pool or camera owned)
+  size_t len;           // valid bytes of current frame
+  size_t size;          // allocated bytes (pool owned buffers)
+  int refs;             // 0 = free
+  int number;           // frame counter at publish time
+  void *handle;         // owner specific handle (e.g. Java byte[])
+} FrameBuffer;
+
+// Called with the pool unlocked when a frame's last reference is dropped
+typedef void (*FrameRecycleFunc)(FrameBuffer *frame, void *userdata);
+
+class FramePool {
+public:
+  FrameBuffer frame[FRAMEPOOL_MAX_FRAMES];
+  int nFrame;
+  int latest;     // index of latest published frame, -1 if none
+  int nDropped;   // frames dropped because no buffer was free
+
+  FrameRecycleFunc recycle;
+  void *userdata;
+  pthread_mutex_t lock;
+
+  // References held through handles: handle id and frame index
+  struct { int id; int index; } handles[FRAMEPOOL_MAX_HANDLES];
+  int nHandle;
+  int lastHandle;
+
+  FramePool(): nFrame(0), latest(-1), nDropped(0),
+	       recycle(NULL), userdata(NULL), nHandle(0), lastHandle(0) {
+    memset(frame, 0, sizeof(frame));
+    pthread_mutex_init(&lock, NULL);
+  }
+
+  virtual ~FramePool() {
+    freeBuffers();
+    pthread_mutex_destroy(&lock);
+  }
+
+  void setRecycle(FrameRecycleFunc f, void *u) {
+    recycle = f;
+    userdata = u;
+  }
+
+  // Allocate n pool owned buffers of size bytes each
+  int allocBuffers(int n, size_t size) {
+    freeBuffers();
+    if (n > FRAMEPOOL_MAX_FRAMES) n = FRAMEPOOL_MAX_FRAMES;
+    pthread_mutex_lock(&lock);
+    for (nFrame = 0; nFrame < n; nFrame++) {
+      FrameBuffer *f = frame + nFrame;
+      f->data = (unsigned char *)malloc(size);
+      if (f->data == NULL) break;
+      f->size = size;
+    }
+    pthread_mutex_unlock(&lock);
+    return nFrame;
+  }
+
+  // Register an externally owned buffer (e.g. Java callback buffer)
+  FrameBuffer* addBuffer(void *handle, size_t size) {
+    pthread_mutex_lock(&lock);
+    FrameBuffer *f = NULL;
+    if (nFrame < FRAMEPOOL_MAX_FRAMES) {
+      f = frame + nFrame++;
+      f->handle = handle;
+      f->size = size;
+    }
+    pthread_mutex_unlock(&lock);
+    return f;
+  }
+
+  void freeBuffers() {
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < nFrame; i++) {
+      if (frame[i].data && frame[i].handle == NULL) free(frame[i].data);
+    }
+    memset(frame, 0, sizeof(frame));
+    nFrame = 0;
+    latest = -1;
+    nHandle = 0;
+    pthread_mutex_unlock(&lock);
+  }
+
+  // True if no buffer is being filled or held by a reader, apart from
+  // the pool's own reference on the latest frame
+  bool idle() {
+    bool ok = true;
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < nFrame; i++) {
+      if (frame[i].refs > ((i == latest) ? 1 : 0)) ok = false;
+    }
+    pthread_mutex_unlock(&lock);
+    return ok;
+  }
+
+  // Free buffer for the camera to fill, or NULL (frame gets dropped)
+  FrameBuffer* getFree() {
+    FrameBuffer *f = NULL;
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < nFrame; i++) {
+      if (frame[i].refs == 0) {
+	f = frame + i;
+	// Reserve until published so a second producer cannot take it
+	f->refs = 1;
+	break;
+      }
+    }
+    if (f == NULL) nDropped++;
+    pthread_mutex_unlock(&lock);
+    return f;
+  }
+
+  // Reserve a specific free buffer for filling, NULL if still in use
+  FrameBuffer* reserve(int index) {
+    FrameBuffer *f = NULL;
+    pthread_mutex_lock(&lock);
+    if ((index >= 0) && (index < nFrame) && (frame[index].refs == 0)) {
+      f = frame + index;
+      f->refs = 1;
+    }
+    else {
+      nDropped++;
+    }
+    pthread_mutex_unlock(&lock);
+    return f;
+  }
+
+  // Make a filled buffer the latest frame; pool keeps its reference
+  void publish(FrameBuffer *f, size_t len, int number) {
+    pthread_mutex_lock(&lock);
+    f->len = len;
+    f->number = number;
+    int previous = latest;
+    latest = f - frame;
+    pthread_mutex_unlock(&lock);
+
+    if (previous >= 0) release(frame + previous);
+  }
+
+  // Take a reference on the latest frame, NULL if none yet
+  FrameBuffer* acquire() {
+    FrameBuffer *f = NULL;
+    pthread_mutex_lock(&lock);
+    if (latest >= 0) {
+      f = frame + latest;
+      f->refs++;
+    }
+    pthread_mutex_unlock(&lock);
+    return f;
+  }
+
+  // Drop a reference; recycles buffer to the camera on last release
+  bool release(FrameBuffer *f) {
+    bool last = false;
+    pthread_mutex_lock(&lock);
+    if (f->refs > 0) {
+      f->refs--;
+      last = (f->refs == 0);
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (last && recycle) recycle(f, userdata);
+    return last;
+  }
+
+  // Give a reference already held on f a new handle (> 0), or return 0
+  // if too many are out, the reference staying with the caller
+  int newHandle(FrameBuffer *f) {
+    int id = 0;
+    pthread_mutex_lock(&lock);
+    if (nHandle < FRAMEPOOL_MAX_HANDLES) {
+      if (++lastHandle <= 0) lastHandle = 1;
+      id = lastHandle;
+      handles[nHandle].id = id;
+      handles[nHandle].index = f - frame;
+      nHandle++;
+    }
+    pthread_mutex_unlock(&lock);
+    return id;
+  }
+
+  // Take a reference on the latest frame with a handle, 0 if there is
+  // no frame yet or too many handles are out
+  int acquireHandle(FrameBuffer **pf) {
+    FrameBuffer *f = acquire();
+    int id = f ? newHandle(f) : 0;
+    if (f && !id) release(f);
+    *pf = id ? f : NULL;
+    return id;
+  }
+
+  // Drop the reference of a handle; false if it is not one given out
+  // and not yet released
+  bool releaseHandle(int id) {
+    FrameBuffer *f = NULL;
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < nHandle; i++) {
+      if (handles[i].id == id) {
+	f = frame + handles[i].index;
+	handles[i] = handles[--nHandle];
+	break;
+      }
+    }
+    pthread_mutex_unlock(&lock);
+    if (f) release(f);
+    return f != NULL;
+  }
+
+  FrameBuffer* get(int index) {
+    if ((index < 0) || (index >= nFrame)) return NULL;
+    return frame + index;
+  }
+};
+
+#endif
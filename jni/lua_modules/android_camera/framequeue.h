@@ -0,0 +1,83 @@
+#ifndef framequeue_h
+#define framequeue_h
+
+/*
+  Lock-free handoff of frame buffers from the camera thread
+  (single producer) to the Lua looper thread (single consumer)
+
+  FRAMEQUEUE_FIFO keeps up to depth frames in order and drops new
+  frames when full. FRAMEQUEUE_LATEST keeps only the newest frame and
+  drops the one the consumer has not picked up yet. Dropped frames are
+  returned by push() so the caller can release its reference.
+*/
+
+#include "framepool.h"
+
+#define FRAMEQUEUE_MAX_DEPTH FRAMEPOOL_MAX_FRAMES
+
+enum {
+  FRAMEQUEUE_FIFO = 0,
+  FRAMEQUEUE_LATEST = 1
+};
+
+class FrameQueue {
+public:
+  FrameBuffer *ring[FRAMEQUEUE_MAX_DEPTH];
+  volatile unsigned int head;   // written by consumer only
+  volatile unsigned int tail;   // written by producer only
+  FrameBuffer * volatile slot;  // FRAMEQUEUE_LATEST handoff
+
+  int policy;
+  unsigned int depth;
+  volatile int nDropped;
+
+  FrameQueue(): head(0), tail(0), slot(NULL),
+		policy(FRAMEQUEUE_FIFO), depth(FRAMEQUEUE_MAX_DEPTH),
+		nDropped(0) {
+    memset(ring, 0, sizeof(ring));
+  }
+
+  // Only call while producer and consumer are idle
+  void setPolicy(int p, int d) {
+    policy = p;
+    if ((d < 1) || (d > FRAMEQUEUE_MAX_DEPTH)) d = FRAMEQUEUE_MAX_DEPTH;
+    depth = d;
+  }
+
+  // Producer: returns frame that was dropped (new or replaced), or NULL
+  FrameBuffer* push(FrameBuffer *f) {
+    if (policy == FRAMEQUEUE_LATEST) {
+      FrameBuffer *old = __sync_lock_test_and_set(&slot, f);
+      if (old) __sync_fetch_and_add(&nDropped, 1);
+      return old;
+    }
+
+    unsigned int t = tail;
+    if (t - head >= depth) {
+      __sync_fetch_and_add(&nDropped, 1);
+      return f;
+    }
+    ring[t % FRAMEQUEUE_MAX_DEPTH] = f;
+    // Publish ring entry before advancing tail
+    __sync_synchronize();
+    tail = t + 1;
+    return NULL;
+  }
+
+  // Consumer: next frame or NULL if empty
+  FrameBuffer* pop() {
+    if (policy == FRAMEQUEUE_LATEST) {
+      return __sync_lock_test_and_set(&slot, (FrameBuffer *)NULL);
+    }
+
+    unsigned int h = head;
+    if (h == tail) return NULL;
+    __sync_synchronize();
+    FrameBuffer *f = ring[h % FRAMEQUEUE_MAX_DEPTH];
+    __sync_synchronize();
+    head = h + 1;
+    return f;
+  }
+};
+
+#endif
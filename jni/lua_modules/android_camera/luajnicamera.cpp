@@ -22,6 +22,9 @@ extern "C"
 }
 #endif
 
+#include "luayuv.h"
+#include "framepool.h"
+
 #define MT_NAME "jnicamera"
 
 #ifndef LOG_TAG
@@ -34,6 +37,41 @@ extern "C"
 // Java class of CameraJNI stored at luaopen_():
 static jclass cameraJNIClass;
 
+// CameraJNI methods resolved once at luaopen_():
+enum {
+  CAMERA_GETNUMBEROFCAMERAS,
+  CAMERA_INIT,
+  CAMERA_OPEN,
+  CAMERA_RELEASE,
+  CAMERA_SETCONTEXT,
+  CAMERA_STARTPREVIEW,
+  CAMERA_STOPPREVIEW,
+  CAMERA_SETPREVIEWSIZE,
+  CAMERA_SETPREVIEWTEXTURE,
+  CAMERA_GETPARAMETERS,
+  CAMERA_ADDCALLBACKBUFFER
+};
+
+static jniMethod cameraMethods[] = {
+  {"getNumberOfCameras", "()I", 1, 0},
+  {"<init>", "()V", 0, 0},
+  {"open", "(I)V", 0, 0},
+  {"release", "()V", 0, 0},
+  {"setContext", "(J)V", 0, 0},
+  {"startPreview", "()V", 0, 0},
+  {"stopPreview", "()V", 0, 0},
+  {"setPreviewSize", "(II)V", 0, 0},
+  {"setPreviewTexture", "(I)V", 0, 0},
+  {"getParameters", "()Ljava/lang/String;", 0, 0},
+  // Optional, only in newer shims:
+  {"addCallbackBuffer", "([B)V", 0, 0},
+  {NULL, NULL, 0, 0}
+};
+
+#define CAMERA_METHOD(m) (cameraMethods[m].id)
+
+static void recycleFrameBuffer(FrameBuffer *f, void *userdata);
+
 class CameraClass {
 public:
   JNIEnv *env;
@@ -45,27 +83,26 @@ public:
   jbyte *dataBytePtr; // Java byte pointer mapped from last frame
   long dataLen;
 
+  // Java callback buffers (byte[] global refs) recycled through
+  // CameraJNI.addCallbackBuffer() once Lua has released them
+  FramePool pool;
+  bool previewing;
+
   // Static method to get total number of cameras:
   static int getNumberOfCameras() {
-    JNIEnv *env = jniGetEnv();
-    jmethodID methodID =
-      env->GetStaticMethodID(cameraJNIClass, "getNumberOfCameras", "()I");
-    LOGI("getNumberOfCamerasMethod: %p", methodID);
-    return env->CallStaticIntMethod(cameraJNIClass, methodID);
+    return jniCallStaticIntMethod(cameraJNIClass,
+				  CAMERA_METHOD(CAMERA_GETNUMBEROFCAMERAS));
   }
   
   // Constructor:
   CameraClass():id(0), nFrame(0),
-		dataByteArray(0), dataBytePtr(0), dataLen(0) {
+		dataByteArray(0), dataBytePtr(0), dataLen(0),
+		previewing(false) {
     env = jniGetEnv();
 
-    // Get constructor method:
-    jmethodID initMethod =
-      env->GetMethodID(cameraJNIClass, "<init>", "()V");
-    LOGI("initMethod: %p", initMethod);
-
     // Create local Java object:
-    jobject cameraLocal = env->NewObject(cameraJNIClass, initMethod);
+    jobject cameraLocal = env->NewObject(cameraJNIClass,
+					 CAMERA_METHOD(CAMERA_INIT));
     if (!cameraLocal) LOGE("Could not construct CameraJNI Java object");
 
     // Global reference to prevent garbage collection:
@@ -76,6 +113,7 @@ public:
   virtual ~CameraClass() {
     LOGI("CameraClass destructor");
 
+    releaseFrameBuffers();
     if (dataByteArray && dataBytePtr) {
       env->ReleaseByteArrayElements(dataByteArray, dataBytePtr, JNI_ABORT);
     }
@@ -84,39 +122,29 @@ public:
 
   void open(int n) {
     id = n;
-    jmethodID openMethod =
-      env->GetMethodID(cameraJNIClass, "open", "(I)V");
-    env->CallVoidMethod(camera, openMethod, id);
+    env->CallVoidMethod(camera, CAMERA_METHOD(CAMERA_OPEN), id);
   }
   void release() {
-    jmethodID releaseMethod =
-      env->GetMethodID(cameraJNIClass, "release", "()V");
-    env->CallVoidMethod(camera, releaseMethod);
+    env->CallVoidMethod(camera, CAMERA_METHOD(CAMERA_RELEASE));
   }
 
   void startPreview() {
-    jmethodID setContextMethod =
-      env->GetMethodID(cameraJNIClass, "setContext", "(J)V");
-    env->CallVoidMethod(camera, setContextMethod, (long)this);
-
-    jmethodID startPreviewMethod =
-      env->GetMethodID(cameraJNIClass, "startPreview", "()V");
-    env->CallVoidMethod(camera, startPreviewMethod);
+    env->CallVoidMethod(camera, CAMERA_METHOD(CAMERA_SETCONTEXT),
+			(jlong)(long)this);
+    env->CallVoidMethod(camera, CAMERA_METHOD(CAMERA_STARTPREVIEW));
+    previewing = true;
   }
   void stopPreview() {
-    jmethodID stopPreviewMethod =
-      env->GetMethodID(cameraJNIClass, "stopPreview", "()V");
-    env->CallVoidMethod(camera, stopPreviewMethod);
+    env->CallVoidMethod(camera, CAMERA_METHOD(CAMERA_STOPPREVIEW));
+    previewing = false;
   }
   void setPreviewSize(int width, int height) {
-    jmethodID setPreviewSizeMethod =
-      env->GetMethodID(cameraJNIClass, "setPreviewSize", "(II)V");  
-    env->CallVoidMethod(camera, setPreviewSizeMethod, width, height);
+    env->CallVoidMethod(camera, CAMERA_METHOD(CAMERA_SETPREVIEWSIZE),
+			width, height);
   }
   void setPreviewTexture(int texName) {
-    jmethodID setPreviewTextureMethod =
-      env->GetMethodID(cameraJNIClass, "setPreviewTexture", "(I)V");
-    env->CallVoidMethod(camera, setPreviewTextureMethod, texName);
+    env->CallVoidMethod(camera, CAMERA_METHOD(CAMERA_SETPREVIEWTEXTURE),
+			texName);
   }
 
   void setData(JNIEnv *env, const jbyteArray data) {
@@ -133,24 +161,105 @@ public:
     dataBytePtr = env->GetByteArrayElements(dataByteArray, NULL);
   }
 
+  // Allocate n preview sized Java buffers and queue them to the camera.
+  // Requires shim CameraJNI.addCallbackBuffer([B) which switches the
+  // shim to setPreviewCallbackWithBuffer(); returns 0 if not available.
+  int allocFrameBuffers(int n) {
+    if (CAMERA_METHOD(CAMERA_ADDCALLBACKBUFFER) == 0) {
+      LOGW("CameraJNI.addCallbackBuffer not found, copying frames");
+      return 0;
+    }
+    releaseFrameBuffers();
+
+    // NV21 preview frames are 12 bits per pixel
+    int width = callIntMethod("getPreviewSizeWidth");
+    int height = callIntMethod("getPreviewSizeHeight");
+    size_t size = width*height*3/2;
+    if (n > FRAMEPOOL_MAX_FRAMES) n = FRAMEPOOL_MAX_FRAMES;
+
+    pool.setRecycle(recycleFrameBuffer, this);
+    for (int i = 0; i < n; i++) {
+      jbyteArray local = env->NewByteArray(size);
+      if (local == NULL) {
+	env->ExceptionClear();
+	break;
+      }
+      jobject global = env->NewGlobalRef(local);
+      env->DeleteLocalRef(local);
+      pool.addBuffer(global, size);
+      env->CallVoidMethod(camera, CAMERA_METHOD(CAMERA_ADDCALLBACKBUFFER),
+			  global);
+    }
+    LOGI("allocFrameBuffers: %d x %d bytes", pool.nFrame, (int)size);
+    return pool.nFrame;
+  }
+
+  void releaseFrameBuffers() {
+    pool.setRecycle(NULL, NULL);
+    for (int i = 0; i < pool.nFrame; i++) {
+      FrameBuffer *f = pool.frame + i;
+      if (f->data) {
+	env->ReleaseByteArrayElements((jbyteArray)f->handle,
+				      (jbyte *)f->data, JNI_ABORT);
+      }
+      env->DeleteGlobalRef((jobject)f->handle);
+    }
+    pool.freeBuffers();
+  }
+
+  // Last reference dropped: unpin and give buffer back to the camera.
+  // May run on the camera callback thread, so get its own JNIEnv.
+  void recycle(FrameBuffer *f) {
+    JNIEnv *env = jniGetEnv();
+    if (f->data) {
+      env->ReleaseByteArrayElements((jbyteArray)f->handle,
+				    (jbyte *)f->data, JNI_ABORT);
+      f->data = NULL;
+    }
+    env->CallVoidMethod(camera, CAMERA_METHOD(CAMERA_ADDCALLBACKBUFFER),
+			(jobject)f->handle);
+  }
+
+  // Publish frame if data is one of our callback buffers (no copy)
+  bool publishFrame(JNIEnv *env, const jbyteArray data) {
+    for (int i = 0; i < pool.nFrame; i++) {
+      if (!env->IsSameObject(data, (jobject)pool.frame[i].handle))
+	continue;
+      FrameBuffer *f = pool.reserve(i);
+      if (f == NULL) {
+	// Dropped, but the camera handed the array over: give it back
+	// or preview stalls once it runs out of callback buffers
+	env->CallVoidMethod(camera, CAMERA_METHOD(CAMERA_ADDCALLBACKBUFFER),
+			    data);
+	return true;
+      }
+      f->data = (unsigned char *)env->GetByteArrayElements(data, NULL);
+      dataLen = f->size;
+      pool.publish(f, f->size, nFrame);
+      return true;
+    }
+    return false;
+  }
+
   const char* getParameters() {
     // TODO: Doesn't work, truncated characters!
-    jmethodID getParametersMethod =
-      env->GetMethodID(cameraJNIClass, "getParameters", "()Ljava/lang/String;");
-    jstring pString = (jstring) env->CallObjectMethod(camera, getParametersMethod);
+    jstring pString =
+      (jstring) env->CallObjectMethod(camera,
+				      CAMERA_METHOD(CAMERA_GETPARAMETERS));
     const char* s = env->GetStringUTFChars(pString, NULL);
     // Assume that the VM doesn't change this memory before Lua returns:
     env->ReleaseStringUTFChars(pString, s);
     return s;
   }
 
+  // Getters by name (getPreviewSizeWidth etc.) hit the JNI cache
+  // after the first call
   int callIntMethod(const char *name) {
-    jmethodID intMethod =
-      env->GetMethodID(cameraJNIClass, name, "()I");
+    jmethodID intMethod = jniGetMethodID(cameraJNIClass, name, "()I");
     if (intMethod == 0) {
       return -1;
     }
-    return (int)env->CallIntMethod(camera, intMethod);
+    return (int)jniCallIntMethod(camera, intMethod);
   }
 };
 
@@ -162,10 +271,16 @@ Java_shim_CameraJNI_nativePreviewFrameCallback(JNIEnv *env, jclass cls,
   // TODO: Check to make sure accessing C++ class members works robustly:
   CameraClass *p = (CameraClass *)ptr;
   p->nFrame++;
-  p->setData(env, data);
+  if (!p->publishFrame(env, data)) {
+    p->setData(env, data);
+  }
   return;
 }
 
+static void recycleFrameBuffer(FrameBuffer *f, void *userdata) {
+  ((CameraClass *)userdata)->recycle(f);
+}
+
 
 static CameraClass* lua_checkcameraclass(lua_State *L, int narg) {
   void *ud = luaL_checkudata(L, narg, MT_NAME);
@@ -293,60 +408,6 @@ static int lua_camera_tostring(lua_State *L) {
   return 1;
 }
 
-static int lua_camera_yuv420torgba(lua_State *L) {
-  static int *rgba = NULL;
-  static int rgbalen = 0;
-
-  if (!lua_islightuserdata(L, 1)) {
-    return luaL_error(L, "Need yuv420 pointer");
-  }
-  unsigned char* yuv = (unsigned char *)lua_touserdata(L, 1);
-  int len = luaL_checkinteger(L, 2);
-
-  int nfactor = sqrt(len/18);
-  int width = 4*nfactor;
-  int height = 3*nfactor;
-
-  if (rgbalen < width*height) {
-    rgbalen = width*height;
-    rgba = (int *) realloc(rgba, rgbalen*sizeof(int));
-    if (rgba == NULL) {
-      return luaL_error(L, "Could not allocate RGBA memory");
-    }
-  }
-
-  for (int j = 0, yp = 0; j < height; j++) {
-    int uvp = width*height + (j >> 1) * width, u = 0, v = 0;
-    for (int i = 0; i < width; i++, yp++) {
-      int y = (0xff & ((int) yuv[yp])) - 16;
-      if (y < 0) y = 0;
-      if ((i & 1) == 0) {
-	v = (0xff & yuv[uvp++]) - 128;
-	u = (0xff & yuv[uvp++]) - 128;
-      }
-
-      int y1192 = 1192*y;
-      int r = (y1192 + 1634*v);
-      int g = (y1192 - 833*v - 400*u);
-      int b = (y1192 + 2066*u);
-
-      if (r < 0) r = 0;
-      else if (r > 262143) r = 262143;
-      if (g < 0) g = 0;
-      else if (g > 262143) g = 262143;
-      if (b < 0) b = 0;
-      else if (b > 262143) b = 262143;
-
-      rgba[yp] = 0xff000000 | ((b << 6) & 0xff0000) | ((g >> 2) & 0xff00) | ((r >> 10) & 0xff);
-    }
-  }
-
-  lua_pushlightuserdata(L, rgba);
-  lua_pushinteger(L, 4*width*height);
-  lua_pushstring(L, "byte");
-  return 3;
-}
-
 static int lua_camera_getInfo(lua_State *L) {
   CameraClass *cam = lua_checkcameraclass(L, 1);
 
@@ -358,6 +419,16 @@ static int lua_camera_getImage(lua_State *L) {
   
   //  if (!dataBytePtr) return 0;
 
+  // With callback buffers: latest frame without taking a reference,
+  // use acquireFrame()/releaseFrame() to read frames safely
+  FrameBuffer *f = cam->pool.get(cam->pool.latest);
+  if (f && f->data) {
+    lua_pushlightuserdata(L, f->data);
+    lua_pushinteger(L, f->len);
+    lua_pushstring(L, "byte");
+    return 3;
+  }
+
   lua_pushlightuserdata(L, (char *) cam->dataBytePtr);
   lua_pushinteger(L, cam->dataLen);
   lua_pushstring(L, "byte");
@@ -365,6 +436,53 @@ static int lua_camera_getImage(lua_State *L) {
   //  return lua_camera_yuv420torgba(L);
 }
 
+// Returns frame handle, pointer, length and frame number of the latest
+// frame, or nil. The buffer stays valid until releaseFrame(handle),
+// which takes each handle once.
+static int lua_camera_acquireFrame(lua_State *L) {
+  CameraClass *cam = lua_checkcameraclass(L, 1);
+  FrameBuffer *f;
+  int handle = cam->pool.acquireHandle(&f);
+  if (handle == 0) {
+    lua_pushnil(L);
+    return 1;
+  }
+
+  lua_pushinteger(L, handle);
+  lua_pushlightuserdata(L, f->data);
+  lua_pushinteger(L, f->len);
+  lua_pushinteger(L, f->number);
+  return 4;
+}
+
+static int lua_camera_releaseFrame(lua_State *L) {
+  CameraClass *cam = lua_checkcameraclass(L, 1);
+  luaL_argcheck(L, cam->pool.releaseHandle(luaL_checkint(L, 2)), 2,
+		"invalid frame handle");
+  return 0;
+}
+
+// Call after setPreviewSize() and before startPreview(), with every
+// acquired frame released
+static int lua_camera_setFrameBuffers(lua_State *L) {
+  CameraClass *cam = lua_checkcameraclass(L, 1);
+  int n = luaL_checkint(L, 2);
+  luaL_argcheck(L, (n >= 2) && (n <= FRAMEPOOL_MAX_FRAMES), 2,
+		"invalid number of frame buffers");
+  if (cam->previewing)
+    return luaL_error(L, "setFrameBuffers: stop the preview first");
+  if (!cam->pool.idle())
+    return luaL_error(L, "setFrameBuffers: frames are still acquired");
+  lua_pushinteger(L, cam->allocFrameBuffers(n));
+  return 1;
+}
+
+static int lua_camera_getDroppedFrames(lua_State *L) {
+  CameraClass *cam = lua_checkcameraclass(L, 1);
+  lua_pushinteger(L, cam->pool.nDropped);
+  return 1;
+}
+
 static int lua_camera_getFrameNumber(lua_State *L) {
   CameraClass *cam = lua_checkcameraclass(L, 1);
   lua_pushinteger(L, cam->nFrame);
@@ -375,6 +493,7 @@ static const struct luaL_reg camera_functions[] = {
   {"new", lua_camera_new},
   {"getNumberOfCameras", lua_camera_getNumberOfCameras},
   {"yuv420torgba", lua_camera_yuv420torgba},
+  {"yuvconvert", lua_camera_yuvconvert},
   {NULL, NULL}
 };
 
@@ -397,6 +516,10 @@ static const struct luaL_reg camera_methods[] = {
 
   {"getFrameNumber", lua_camera_getFrameNumber},
   {"getImage", lua_camera_getImage},
+  {"acquireFrame", lua_camera_acquireFrame},
+  {"releaseFrame", lua_camera_releaseFrame},
+  {"setFrameBuffers", lua_camera_setFrameBuffers},
+  {"getDroppedFrames", lua_camera_getDroppedFrames},
   {"getInfo", lua_camera_getInfo},
 
   {"__gc", lua_camera_delete},
@@ -411,15 +534,18 @@ extern "C"
 int luaopen_jnicamera (lua_State *L) {
   LOGI("luaopen_jnicamera called");
 
-  JNIEnv *env = jniGetEnv();
-
   // clazz = env->FindClass("android/hardware/Camera");
   // Find encapsulated Java class in src/shim/CameraJNI.java
-  cameraJNIClass = jniFindClass("shim/CameraJNI");
+  cameraJNIClass = jniGetClass("shim/CameraJNI");
   LOGI("cameraJNIClass: %p", cameraJNIClass);
   if (!cameraJNIClass)
     luaL_error(L, "Cannot find class: CameraJNI");
 
+  // Only addCallbackBuffer may be missing (older shim)
+  int nMissing = jniResolveMethods(cameraJNIClass, cameraMethods);
+  if (nMissing > (CAMERA_METHOD(CAMERA_ADDCALLBACKBUFFER) == 0))
+    luaL_error(L, "CameraJNI is missing %d methods", nMissing);
+
   luaL_newmetatable(L, MT_NAME);
   // OO access: mt.__index = mt
   lua_pushvalue(L, -1);
@@ -427,6 +553,7 @@ int luaopen_jnicamera (lua_State *L) {
   luaL_register(L, NULL, camera_methods);
 
   luaL_register(L, "jnicamera", camera_functions);
+  lua_camera_yuvconstants(L);
   return 1;
 }
 
@@ -5,6 +5,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <android/looper.h>
 #include <android/log.h>
 
 #ifdef __cplusplus
@@ -24,7 +28,22 @@ extern "C"
 
 using namespace android;
 
+#include "luayuv.h"
+#include "framepool.h"
+#include "framequeue.h"
+
 #define MT_NAME "nativecamera"
+#define DEFAULT_NUM_FRAME_BUFFERS 3
+
+// How postData() hands frames to the Lua data callback
+enum {
+  DELIVERY_DIRECT = 0,  // call Lua on the camera thread (legacy)
+  DELIVERY_QUEUE = 1,   // queue frames, drop new ones when full
+  DELIVERY_LATEST = 2   // keep only the newest undelivered frame
+};
+static const char *const deliveryModes[] = {
+  "direct", "queue", "latest", NULL
+};
 
 #ifndef LOG_TAG
 #define LOG_TAG "lua"
@@ -33,10 +52,13 @@ using namespace android;
 #define LOGW(...) __android_log_print(ANDROID_LOG_WARN,LOG_TAG,__VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR,LOG_TAG,__VA_ARGS__)
 
+static int frameLooperCallback(int fd, int events, void *data);
+
+// Returns 1 if the callback ran and returned normally
 static int LuaCallback(lua_State *L, int ref, int nargs) {
   lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
   if (!lua_isfunction(L, -1)) {
-    lua_pop(L, 1);
+    lua_pop(L, nargs+1);
     return 0;
   }
   // Move lua function before pushed arguments
@@ -46,7 +68,7 @@ static int LuaCallback(lua_State *L, int ref, int nargs) {
     lua_pop(L, 1);
     return 0;
   }
-  return 0;
+  return 1;
 }
 
 class CameraClass : public CameraListener {
@@ -61,19 +83,37 @@ public:
   int dataRef;
 
   int nframe;
-  unsigned char *buf;
-  size_t datalen;
-  size_t bufsize;
+  // Preview frames are copied once from IMemory into pool buffers
+  FramePool pool;
+  int nFrameBuffers;
+  bool previewing;
+
+  // Queued delivery: camera thread pushes acquired frames and wakes
+  // the looper of the thread that set the data callback. deliveryLock
+  // keeps stopDelivery() from closing the pipe or draining the queue
+  // while the camera thread is pushing.
+  int delivery;
+  FrameQueue queue;
+  int queueDepth;
+  ALooper *looper;
+  int wakeRead, wakeWrite;
+  volatile int wakePending;
+  pthread_mutex_t deliveryLock;
 
   CameraClass():id(0),
 		notifyL(NULL), notifyRef(0),
 		dataL(NULL), dataRef(0),
-		nframe(0), buf(NULL), bufsize(0) {
+		nframe(0), nFrameBuffers(DEFAULT_NUM_FRAME_BUFFERS),
+		previewing(false),
+		delivery(DELIVERY_DIRECT), queueDepth(0), looper(NULL),
+		wakeRead(-1), wakeWrite(-1), wakePending(0) {
     camera = NULL;
+    pthread_mutex_init(&deliveryLock, NULL);
   }
 
   virtual ~CameraClass() {
     LOGI("CameraClass destructor");
+    stopDelivery();
     if (notifyRef) {
       luaL_unref(notifyL, LUA_REGISTRYINDEX, notifyRef);
     }
@@ -84,6 +124,7 @@ public:
       camera.clear();
       camera = NULL;
     }
+    pthread_mutex_destroy(&deliveryLock);
   }
 
   // Note: Android calls these callbacks from a separate thread!
@@ -109,36 +150,161 @@ public:
 
     nframe++;
 
-    datalen = dataPtr->size();
-    // Cannot just store pointer, since IMemory pointer is invalid
-    // outside of postData() callback:
-    // buf = (unsigned char *)dataPtr->pointer()+dataPtr->offset();
-
-    // Need to copy data buffer if pointer is to be used in another thread
-    if (bufsize < datalen) {
-      bufsize = datalen;
-      buf = (unsigned char *) realloc(buf, bufsize);
+    // IMemory pointer is invalid outside of postData() callback,
+    // so copy once into a free pool buffer that no Lua reader holds.
+    // If every buffer is still acquired by Lua the frame is dropped.
+    size_t datalen = dataPtr->size();
+    if (pool.nFrame == 0) {
+      pool.allocBuffers(nFrameBuffers, datalen);
     }
-    if (buf) {
-      memcpy(buf, (unsigned char *)dataPtr->pointer()+dataPtr->offset(), datalen);
+    FrameBuffer *f = pool.getFree();
+    if (f == NULL) return;
+    if (f->size < datalen) {
+      // Preview size changed: buffer is reserved by us, safe to grow
+      unsigned char *p = (unsigned char *) realloc(f->data, datalen);
+      if (p == NULL) {
+	pool.release(f);
+	return;
+      }
+      f->data = p;
+      f->size = datalen;
     }
+    memcpy(f->data, (unsigned char *)dataPtr->pointer()+dataPtr->offset(),
+	   datalen);
+    pool.publish(f, datalen, nframe);
 
+    if (dataRef && queueFrame()) {
+      return;
+    }
     if (dataRef) {
       int nargs = 2;
-      lua_pushlightuserdata(dataL, buf);
+      lua_pushlightuserdata(dataL, f->data);
       lua_pushinteger(dataL, datalen);
       LuaCallback(dataL, dataRef, nargs);
     }
     return;
   }
+
+  // Camera thread: hand a reference on the latest frame to the looper.
+  // Returns false if frames are delivered directly instead.
+  bool queueFrame() {
+    pthread_mutex_lock(&deliveryLock);
+    if (delivery == DELIVERY_DIRECT) {
+      pthread_mutex_unlock(&deliveryLock);
+      return false;
+    }
+    FrameBuffer *f = pool.acquire();
+    FrameBuffer *dropped = f ? queue.push(f) : NULL;
+    if (f && dropped != f &&
+	__sync_bool_compare_and_swap(&wakePending, 0, 1)) {
+      char c = 'f';
+      if (write(wakeWrite, &c, 1) != 1) wakePending = 0;
+    }
+    pthread_mutex_unlock(&deliveryLock);
+    if (dropped) pool.release(dropped);
+    return true;
+  }
+
+  // Looper thread: deliver queued frames to Lua, which owns each
+  // frame reference and returns it with releaseFrame(handle)
+  void deliverFrames() {
+    char buf[16];
+    while (read(wakeRead, buf, sizeof(buf)) > 0);
+    // Clear before draining so a frame pushed meanwhile wakes us again
+    wakePending = 0;
+    __sync_synchronize();
+
+    FrameBuffer *f;
+    while ((f = queue.pop()) != NULL) {
+      int handle = dataRef ? pool.newHandle(f) : 0;
+      if (handle == 0) {
+	pool.release(f);
+	continue;
+      }
+      int nargs = 4;
+      lua_pushlightuserdata(dataL, f->data);
+      lua_pushinteger(dataL, f->len);
+      lua_pushinteger(dataL, handle);
+      lua_pushinteger(dataL, f->number);
+      // A callback that fails may not have released its frame; if it
+      // did, the handle is gone and this does nothing
+      if (!LuaCallback(dataL, dataRef, nargs)) pool.releaseHandle(handle);
+    }
+  }
+
+  // Must be called on the thread whose looper runs the Lua state
+  // Returns false, with the current delivery left as it was, if this
+  // thread has no looper or the wake pipe cannot be made
+  bool startDelivery(int mode, int depth) {
+    if (mode == DELIVERY_DIRECT) {
+      stopDelivery();
+      return true;
+    }
+
+    ALooper *l = ALooper_forThread();
+    if (l == NULL) {
+      LOGE("startDelivery: no looper on this thread");
+      return false;
+    }
+    int fds[2];
+    if (pipe(fds)) {
+      LOGE("startDelivery: could not create pipe");
+      return false;
+    }
+    stopDelivery();
+    looper = l;
+    queueDepth = depth;
+    wakeRead = fds[0];
+    wakeWrite = fds[1];
+    fcntl(wakeRead, F_SETFL, O_NONBLOCK);
+    fcntl(wakeWrite, F_SETFL, O_NONBLOCK);
+
+    queue.setPolicy((mode == DELIVERY_LATEST) ?
+		    FRAMEQUEUE_LATEST : FRAMEQUEUE_FIFO, fifoDepth());
+    ALooper_acquire(looper);
+    ALooper_addFd(looper, wakeRead, ALOOPER_POLL_CALLBACK,
+		  ALOOPER_EVENT_INPUT, frameLooperCallback, this);
+    pthread_mutex_lock(&deliveryLock);
+    delivery = mode;
+    pthread_mutex_unlock(&deliveryLock);
+    return true;
+  }
+
+  // A FIFO deeper than the pool would only ever hold part of it, so
+  // the requested depth (0 for the default) is capped by the pool size
+  int fifoDepth() {
+    if ((queueDepth < 1) || (queueDepth > nFrameBuffers))
+      return nFrameBuffers;
+    return queueDepth;
+  }
+
+  void stopDelivery() {
+    // After this the camera thread no longer touches the pipe or queue
+    pthread_mutex_lock(&deliveryLock);
+    delivery = DELIVERY_DIRECT;
+    pthread_mutex_unlock(&deliveryLock);
+    if (looper) {
+      ALooper_removeFd(looper, wakeRead);
+      ALooper_release(looper);
+      looper = NULL;
+    }
+    if (wakeRead >= 0) close(wakeRead);
+    if (wakeWrite >= 0) close(wakeWrite);
+    wakeRead = wakeWrite = -1;
+    wakePending = 0;
+
+    FrameBuffer *f;
+    while ((f = queue.pop()) != NULL) {
+      pool.release(f);
+    }
+  }
   virtual void postDataTimestamp(nsecs_t timestamp, int32_t msgType,
 				 const sp<IMemory>& dataPtr) {
     LOGI("postDataTimestamp: %d %d", timestamp, msgType);
     if (dataPtr != NULL) {
       nframe++;
-      datalen = dataPtr->size();
-      buf = (unsigned char *)dataPtr->pointer();
-      LOGI("callback postDataTimestamp: %d %p(%d bytes)", msgType, buf, datalen);
+      LOGI("callback postDataTimestamp: %d %p(%d bytes)", msgType,
+	   dataPtr->pointer(), dataPtr->size());
     }
     camera->releaseRecordingFrame(dataPtr);
   }
@@ -154,6 +320,13 @@ public:
   }
 };
 
+static int frameLooperCallback(int fd, int events, void *data) {
+  CameraClass *cam = (CameraClass *)data;
+  cam->deliverFrames();
+  // Return 1 to allow additional callbacks
+  return 1;
+}
+
 static CameraClass* lua_checkcameraclass(lua_State *L, int narg) {
   void *ud = luaL_checkudata(L, narg, MT_NAME);
   luaL_argcheck(L, *(CameraClass **)ud != NULL, narg, "invalid object");
@@ -233,14 +406,31 @@ static int lua_camera_setNotifyCallback(lua_State *L) {
   return 1;
 }
 
+// setDataCallback(func [, mode [, depth]])
+// mode "direct" calls func(ptr, len) on the camera thread.
+// "queue" and "latest" call func(ptr, len, handle, number) from this
+// thread's looper; func must releaseFrame(handle) when done with it,
+// unless it raises an error, which releases the frame.
+// depth limits the "queue" FIFO and defaults to the number of frame
+// buffers. If delivery cannot be started the previous callback and
+// mode stay in place.
 static int lua_camera_setDataCallback(lua_State *L) {
   CameraClass *cam = lua_checkcameraclass(L, 1);
+  int mode = luaL_checkoption(L, 3, "direct", deliveryModes);
+  int depth = luaL_optint(L, 4, 0);
+
+  if (!lua_isfunction(L, 2))
+    cam->stopDelivery();
+  else if (!cam->startDelivery(mode, depth))
+    return luaL_error(L, "Could not start %s frame delivery",
+		      deliveryModes[mode]);
   if (cam->dataRef) {
     luaL_unref(L, LUA_REGISTRYINDEX, cam->dataRef);
     cam->dataRef = 0;
   }
   if (lua_isfunction(L, 2)) {
     cam->dataL = L;
+    lua_pushvalue(L, 2);
     cam->dataRef = luaL_ref(L, LUA_REGISTRYINDEX);
   }
   lua_pushinteger(L, cam->dataRef);
@@ -297,6 +487,7 @@ static int lua_camera_startPreview(lua_State *L) {
   cam->camera->setListener(cam);
 
   int status = cam->camera->startPreview();
+  cam->previewing = (status == NO_ERROR);
   lua_pushinteger(L, status);
   return 1;
 }
@@ -304,6 +495,7 @@ static int lua_camera_startPreview(lua_State *L) {
 static int lua_camera_stopPreview(lua_State *L) {
   CameraClass *cam = lua_checkcameraclass(L, 1);
   cam->camera->stopPreview();
+  cam->previewing = false;
   return 0;
 }
 
@@ -336,60 +528,6 @@ static int lua_camera_tostring(lua_State *L) {
   return 1;
 }
 
-static int lua_camera_yuv420torgba(lua_State *L) {
-  static int *rgba = NULL;
-  static int rgbalen = 0;
-
-  if (!lua_islightuserdata(L, 1)) {
-    return luaL_error(L, "Need yuv420 pointer");
-  }
-  unsigned char* yuv = (unsigned char *)lua_touserdata(L, 1);
-  int len = luaL_checkinteger(L, 2);
-
-  int nfactor = sqrt(len/18);
-  int width = 4*nfactor;
-  int height = 3*nfactor;
-
-  if (rgbalen < width*height) {
-    rgbalen = width*height;
-    rgba = (int *) realloc(rgba, rgbalen*sizeof(int));
-    if (rgba == NULL) {
-      return luaL_error(L, "Could not allocate RGBA memory");
-    }
-  }
-
-  for (int j = 0, yp = 0; j < height; j++) {
-    int uvp = width*height + (j >> 1) * width, u = 0, v = 0;
-    for (int i = 0; i < width; i++, yp++) {
-      int y = (0xff & ((int) yuv[yp])) - 16;
-      if (y < 0) y = 0;
-      if ((i & 1) == 0) {
-	v = (0xff & yuv[uvp++]) - 128;
-	u = (0xff & yuv[uvp++]) - 128;
-      }
-
-      int y1192 = 1192*y;
-      int r = (y1192 + 1634*v);
-      int g = (y1192 - 833*v - 400*u);
-      int b = (y1192 + 2066*u);
-
-      if (r < 0) r = 0;
-      else if (r > 262143) r = 262143;
-      if (g < 0) g = 0;
-      else if (g > 262143) g = 262143;
-      if (b < 0) b = 0;
-      else if (b > 262143) b = 262143;
-
-      rgba[yp] = 0xff000000 | ((b << 6) & 0xff0000) | ((g >> 2) & 0xff00) | ((r >> 10) & 0xff);
-    }
-  }
-
-  lua_pushlightuserdata(L, rgba);
-  lua_pushinteger(L, 4*width*height);
-  lua_pushstring(L, "byte");
-  return 3;
-}
-
 static int lua_camera_getInfo(lua_State *L) {
   CameraClass *cam = lua_checkcameraclass(L, 1);
   struct CameraInfo cameraInfo;
@@ -406,22 +544,76 @@ static int lua_camera_getInfo(lua_State *L) {
   return 1;
 }
 
+// Latest frame without taking a reference: may be recycled at any time,
+// use acquireFrame()/releaseFrame() to read frames safely
 static int lua_camera_getImage(lua_State *L) {
   CameraClass *cam = lua_checkcameraclass(L, 1);
   lua_pop(L, lua_gettop(L));
 
-  if (!(cam->buf)) {
+  FrameBuffer *f = cam->pool.get(cam->pool.latest);
+  if (f == NULL) {
     lua_pushnil(L);
     return 1;
   }
 
-  lua_pushlightuserdata(L, cam->buf);
-  lua_pushinteger(L, cam->datalen);
+  lua_pushlightuserdata(L, f->data);
+  lua_pushinteger(L, f->len);
   lua_pushstring(L, "byte");
   return 3;
   //  return lua_camera_yuv420torgba(L);
 }
 
+// Returns frame handle, pointer, length and frame number of the latest
+// frame, or nil. The buffer stays valid until releaseFrame(handle),
+// which takes each handle once.
+static int lua_camera_acquireFrame(lua_State *L) {
+  CameraClass *cam = lua_checkcameraclass(L, 1);
+  FrameBuffer *f;
+  int handle = cam->pool.acquireHandle(&f);
+  if (handle == 0) {
+    lua_pushnil(L);
+    return 1;
+  }
+
+  lua_pushinteger(L, handle);
+  lua_pushlightuserdata(L, f->data);
+  lua_pushinteger(L, f->len);
+  lua_pushinteger(L, f->number);
+  return 4;
+}
+
+static int lua_camera_releaseFrame(lua_State *L) {
+  CameraClass *cam = lua_checkcameraclass(L, 1);
+  luaL_argcheck(L, cam->pool.releaseHandle(luaL_checkint(L, 2)), 2,
+		"invalid frame handle");
+  return 0;
+}
+
+// Number of pool buffers, call before startPreview() and with every
+// acquired or queued frame released
+static int lua_camera_setFrameBuffers(lua_State *L) {
+  CameraClass *cam = lua_checkcameraclass(L, 1);
+  int n = luaL_checkint(L, 2);
+  luaL_argcheck(L, (n >= 2) && (n <= FRAMEPOOL_MAX_FRAMES), 2,
+		"invalid number of frame buffers");
+  if (cam->previewing)
+    return luaL_error(L, "setFrameBuffers: stop the preview first");
+  if (!cam->pool.idle())
+    return luaL_error(L, "setFrameBuffers: frames are still acquired");
+  cam->nFrameBuffers = n;
+  cam->pool.freeBuffers();
+  // Nothing is queued with the preview stopped
+  if (cam->delivery != DELIVERY_DIRECT)
+    cam->queue.setPolicy(cam->queue.policy, cam->fifoDepth());
+  return 0;
+}
+
+static int lua_camera_getDroppedFrames(lua_State *L) {
+  CameraClass *cam = lua_checkcameraclass(L, 1);
+  lua_pushinteger(L, cam->pool.nDropped + cam->queue.nDropped);
+  return 1;
+}
+
 static int lua_camera_getFrameNumber(lua_State *L) {
   CameraClass *cam = lua_checkcameraclass(L, 1);
   lua_pushinteger(L, cam->nframe);
@@ -432,6 +624,7 @@ static const struct luaL_reg camera_functions[] = {
   {"new", lua_camera_new},
   {"getNumberOfCameras", lua_camera_getNumberOfCameras},
   {"yuv420torgba", lua_camera_yuv420torgba},
+  {"yuvconvert", lua_camera_yuvconvert},
   {NULL, NULL}
 };
 
@@ -456,6 +649,10 @@ static const struct luaL_reg camera_methods[] = {
 
   {"getFrameNumber", lua_camera_getFrameNumber},
   {"getImage", lua_camera_getImage},
+  {"acquireFrame", lua_camera_acquireFrame},
+  {"releaseFrame", lua_camera_releaseFrame},
+  {"setFrameBuffers", lua_camera_setFrameBuffers},
+  {"getDroppedFrames", lua_camera_getDroppedFrames},
   {"getInfo", lua_camera_getInfo},
   {"__gc", lua_camera_delete},
   {"__tostring", lua_camera_tostring},
@@ -476,6 +673,7 @@ int luaopen_nativecamera (lua_State *L) {
   luaL_register(L, NULL, camera_methods);
 
   luaL_register(L, "nativecamera", camera_functions);
+  lua_camera_yuvconstants(L);
   return 1;
 }
 
@@ -0,0 +1,124 @@
+/*
+  Lua bindings for YUV conversion kernels in yuvconvert.c
+*/
+
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+  #include "lua.h"
+  #include "lauxlib.h"
+#ifdef __cplusplus
+}
+#endif
+
+#include "yuvconvert.h"
+#include "luayuv.h"
+
+typedef struct luaIntConst {
+  const char *key;
+  int value;
+} luaIntConst;
+
+static luaIntConst luaYuvConst[] = {
+  {"NV21", YUV_NV21},
+  {"NV12", YUV_NV12},
+  {"I420", YUV_I420},
+  {"RGBA8888", RGB_RGBA8888},
+  {"RGB565", RGB_RGB565},
+  { NULL, 0}
+};
+
+// Largest image whose RGBA size and YUV 4:2:0 size (with that stride) fit in an int
+static int yuv_sizeok(int width, int height, int stride) {
+  return (width > 0) && (height > 0) && (stride >= width)
+    && (width <= INT_MAX/4/height) && (stride <= INT_MAX/2/height);
+}
+
+void lua_camera_yuvconstants(lua_State *L) {
+  luaIntConst *c = luaYuvConst;
+  for (; c->key; c++) {
+    lua_pushstring(L, c->key);
+    lua_pushinteger(L, c->value);
+    lua_settable(L, -3);
+  }
+}
+
+// Legacy interface: NV21 preview frame to RGBA in a module-owned buffer
+// Image size is guessed from a 4:3 frame if width/height are not given
+int lua_camera_yuv420torgba(lua_State *L) {
+  static unsigned char *rgba = NULL;
+  static int rgbalen = 0;
+
+  if (!lua_islightuserdata(L, 1)) {
+    return luaL_error(L, "Need yuv420 pointer");
+  }
+  unsigned char* yuv = (unsigned char *)lua_touserdata(L, 1);
+  int len = luaL_checkinteger(L, 2);
+
+  int nfactor = sqrt(len/18);
+  int width = luaL_optint(L, 3, 4*nfactor);
+  int height = luaL_optint(L, 4, 3*nfactor);
+  luaL_argcheck(L, yuv_sizeok(width, height, width), 3, "invalid image size");
+  if (yuv_size(height, width, YUV_NV21) > len) {
+    return luaL_error(L, "yuv420 buffer too small for %dx%d", width, height);
+  }
+
+  if (rgbalen < 4*width*height) {
+    rgbalen = 4*width*height;
+    rgba = (unsigned char *) realloc(rgba, rgbalen);
+    if (rgba == NULL) {
+      rgbalen = 0;
+      return luaL_error(L, "Could not allocate RGBA memory");
+    }
+  }
+
+  if (yuv_convert(yuv, width, height, width, YUV_NV21,
+		  rgba, 4*width, RGB_RGBA8888, 1) != 0) {
+    return luaL_error(L, "yuv420 conversion failed");
+  }
+
+  lua_pushlightuserdata(L, rgba);
+  lua_pushinteger(L, 4*width*height);
+  lua_pushstring(L, "byte");
+  return 3;
+}
+
+// yuvconvert(src, width, height, dst [, stride, srcFormat, dstFormat, nthreads])
+// Converts into caller-owned dst, returns number of bytes written
+int lua_camera_yuvconvert(lua_State *L) {
+  if (!lua_islightuserdata(L, 1)) {
+    return luaL_error(L, "Need yuv source pointer");
+  }
+  const uint8_t *src = (const uint8_t *)lua_touserdata(L, 1);
+  int width = luaL_checkint(L, 2);
+  int height = luaL_checkint(L, 3);
+  if (!lua_islightuserdata(L, 4)) {
+    return luaL_error(L, "Need destination pointer");
+  }
+  uint8_t *dst = (uint8_t *)lua_touserdata(L, 4);
+  int stride = luaL_optint(L, 5, width);
+  int srcFormat = luaL_optint(L, 6, YUV_NV21);
+  int dstFormat = luaL_optint(L, 7, RGB_RGBA8888);
+  int nthreads = luaL_optint(L, 8, 1);
+
+  luaL_argcheck(L, yuv_sizeok(width, height, width), 2, "invalid image size");
+  luaL_argcheck(L, yuv_sizeok(width, height, stride), 5, "invalid stride");
+  luaL_argcheck(L, (srcFormat >= YUV_NV21) && (srcFormat <= YUV_I420), 6,
+		"invalid yuv format");
+  luaL_argcheck(L, (dstFormat == RGB_RGBA8888) || (dstFormat == RGB_RGB565), 7,
+		"invalid rgb format");
+
+  int dstStride = rgb_pixel_size(dstFormat)*width;
+  if (yuv_convert(src, width, height, stride, srcFormat,
+		  dst, dstStride, dstFormat, nthreads) != 0) {
+    return luaL_error(L, "yuv conversion failed");
+  }
+
+  lua_pushinteger(L, dstStride*height);
+  return 1;
+}
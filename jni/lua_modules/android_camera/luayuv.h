@@ -0,0 +1,20 @@
+#ifndef luayuv_h
+#define luayuv_h
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+  #include "lua.h"
+#ifdef __cplusplus
+}
+#endif
+
+// YUV conversion functions shared by jnicamera and nativecamera
+int lua_camera_yuv420torgba(lua_State *L);
+int lua_camera_yuvconvert(lua_State *L);
+
+// Set NV21/NV12/I420/RGBA8888/RGB565 constants in table on top of stack
+void lua_camera_yuvconstants(lua_State *L);
+
+#endif
@@ -0,0 +1,32 @@
+camera = require('nativecamera')
+
+c = camera.new();
+c:connect(0);
+c:startPreview();
+
+-- Wait for a preview frame
+for i = 1,50 do
+   h, ptr, len, number = c:acquireFrame();
+   if h then break end
+   unix.usleep(100000);
+end
+assert(h, "no preview frame");
+print("acquired", h, len, number);
+
+-- Each handle is released once: a second release is refused instead of
+-- dropping the reference the pool keeps on the latest frame
+c:releaseFrame(h);
+ok, err = pcall(c.releaseFrame, c, h);
+print("release twice", ok, err);
+assert(not ok);
+
+-- Two acquires of the same frame get their own handles
+h1 = c:acquireFrame();
+h2 = c:acquireFrame();
+assert(h1 and h2 and h1 ~= h2);
+c:releaseFrame(h1);
+assert(not pcall(c.releaseFrame, c, h1));
+c:releaseFrame(h2);
+
+c:stopPreview();
+print("dropped", c:getDroppedFrames());
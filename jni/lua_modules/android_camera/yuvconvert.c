@@ -0,0 +1,364 @@
+/*
+  YUV 4:2:0 (NV21/NV12/I420) to RGBA8888/RGB565 conversion kernels
+
+  All paths use the 10-bit fixed point BT.601 coefficients of the
+  scalar converter the camera modules had before, so that the NEON,
+  SSE2 and scalar code produce the same pixels as it did:
+    R = (1192*(Y-16) + 1634*V) >> 10
+    G = (1192*(Y-16) -  833*V - 400*U) >> 10
+    B = (1192*(Y-16) + 2066*U) >> 10
+  Sums are taken in 32 bits, and the results fit in 16 bits before
+  saturating to 0..255.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// YUV_NO_SIMD forces the scalar code (for comparison)
+#if defined(YUV_NO_SIMD)
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define YUV_USE_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define YUV_USE_SSE2 1
+#endif
+
+#include "yuvconvert.h"
+
+#define YUV_MAX_THREADS 16
+
+static inline uint8_t clamp8(int x) {
+  return (x < 0) ? 0 : ((x > 255) ? 255 : x);
+}
+
+static inline void yuv_store(uint8_t *dst, int dstFormat, int i,
+			     int y, int u, int v) {
+  y -= 16;
+  if (y < 0) y = 0;
+  y *= 1192;
+  u -= 128;
+  v -= 128;
+  uint8_t r = clamp8((y + 1634*v) >> 10);
+  uint8_t g = clamp8((y - 833*v - 400*u) >> 10);
+  uint8_t b = clamp8((y + 2066*u) >> 10);
+
+  if (dstFormat == RGB_RGB565) {
+    ((uint16_t *)dst)[i] = ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
+  }
+  else {
+    uint8_t *p = dst + 4*i;
+    p[0] = r;
+    p[1] = g;
+    p[2] = b;
+    p[3] = 0xff;
+  }
+}
+
+#if YUV_USE_NEON
+// (1192*y + k*c) >> 10 in 32 bits, for 4 pixels
+static inline int16x4_t neon_channel4(int16x4_t y, int16x4_t c, int16_t k) {
+  return vshrn_n_s32(vmlal_n_s16(vmull_n_s16(y, 1192), c, k), 10);
+}
+
+static inline void neon_store8(uint8_t *dst, int dstFormat, int i,
+			       uint8x8_t y8, uint8x8_t u8, uint8x8_t v8) {
+  int16x8_t y = vreinterpretq_s16_u16(vmovl_u8(y8));
+  y = vmaxq_s16(vsubq_s16(y, vdupq_n_s16(16)), vdupq_n_s16(0));
+  int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u8)),
+			  vdupq_n_s16(128));
+  int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v8)),
+			  vdupq_n_s16(128));
+  int16x4_t yl = vget_low_s16(y), yh = vget_high_s16(y);
+  int16x4_t ul = vget_low_s16(u), uh = vget_high_s16(u);
+  int16x4_t vl = vget_low_s16(v), vh = vget_high_s16(v);
+
+  uint8x8_t r = vqmovun_s16(vcombine_s16(neon_channel4(yl, vl, 1634),
+					 neon_channel4(yh, vh, 1634)));
+  int32x4_t gl = vmlal_n_s16(vmlal_n_s16(vmull_n_s16(yl, 1192), vl, -833),
+			     ul, -400);
+  int32x4_t gh = vmlal_n_s16(vmlal_n_s16(vmull_n_s16(yh, 1192), vh, -833),
+			     uh, -400);
+  uint8x8_t g = vqmovun_s16(vcombine_s16(vshrn_n_s32(gl, 10),
+					 vshrn_n_s32(gh, 10)));
+  uint8x8_t b = vqmovun_s16(vcombine_s16(neon_channel4(yl, ul, 2066),
+					 neon_channel4(yh, uh, 2066)));
+
+  if (dstFormat == RGB_RGB565) {
+    uint16x8_t rgb = vshll_n_u8(r, 8);
+    rgb = vsriq_n_u16(rgb, vshll_n_u8(g, 8), 5);
+    rgb = vsriq_n_u16(rgb, vshll_n_u8(b, 8), 11);
+    vst1q_u16((uint16_t *)dst + i, rgb);
+  }
+  else {
+    uint8x8x4_t px;
+    px.val[0] = r;
+    px.val[1] = g;
+    px.val[2] = b;
+    px.val[3] = vdup_n_u8(0xff);
+    vst4_u8(dst + 4*i, px);
+  }
+}
+
+// Converts 16 pixels per iteration, returns first unconverted column
+static int convert_row_simd(const uint8_t *yrow, const uint8_t *urow,
+			    const uint8_t *vrow, int uvStep,
+			    uint8_t *dst, int dstFormat, int width) {
+  int i = 0;
+  for (; i + 16 <= width; i += 16) {
+    uint8x16_t y = vld1q_u8(yrow + i);
+    uint8x8_t u, v;
+    if (uvStep == 2) {
+      // Interleaved chroma: urow/vrow point into the same VU/UV row
+      uint8x8x2_t uv = vld2_u8((urow < vrow ? urow : vrow) + i);
+      u = (urow < vrow) ? uv.val[0] : uv.val[1];
+      v = (urow < vrow) ? uv.val[1] : uv.val[0];
+    }
+    else {
+      u = vld1_u8(urow + i/2);
+      v = vld1_u8(vrow + i/2);
+    }
+    uint8x8x2_t uz = vzip_u8(u, u);
+    uint8x8x2_t vz = vzip_u8(v, v);
+    neon_store8(dst, dstFormat, i, vget_low_u8(y), uz.val[0], vz.val[0]);
+    neon_store8(dst, dstFormat, i+8, vget_high_u8(y), uz.val[1], vz.val[1]);
+  }
+  return i;
+}
+#elif YUV_USE_SSE2
+// (k.lo*a + k.hi*b) >> 10 in 32 bits for 8 pixels, packed back to 16 bits
+static inline __m128i sse2_channel(__m128i a, __m128i b, __m128i k) {
+  __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(a, b), k);
+  __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(a, b), k);
+  return _mm_packs_epi32(_mm_srai_epi32(lo, 10), _mm_srai_epi32(hi, 10));
+}
+
+// Same for G, which has a third term: (1192*y - 833*v - 400*u) >> 10
+static inline __m128i sse2_green(__m128i y, __m128i v, __m128i u,
+				 __m128i kyv, __m128i ku) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(y, v), kyv),
+			     _mm_madd_epi16(_mm_unpacklo_epi16(u, zero), ku));
+  __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(y, v), kyv),
+			     _mm_madd_epi16(_mm_unpackhi_epi16(u, zero), ku));
+  return _mm_packs_epi32(_mm_srai_epi32(lo, 10), _mm_srai_epi32(hi, 10));
+}
+
+// Converts 16 pixels per iteration, returns first unconverted column
+static int convert_row_simd(const uint8_t *yrow, const uint8_t *urow,
+			    const uint8_t *vrow, int uvStep,
+			    uint8_t *dst, int dstFormat, int width) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i k16 = _mm_set1_epi16(16);
+  const __m128i k128 = _mm_set1_epi16(128);
+  // (Y, chroma) coefficient pairs for _mm_madd_epi16
+  const __m128i kR = _mm_set1_epi32((1634 << 16) | 1192);
+  const __m128i kG = _mm_set1_epi32((int)(((uint32_t)-833 << 16) | 1192));
+  const __m128i kGU = _mm_set1_epi32(0xffff & -400);
+  const __m128i kB = _mm_set1_epi32((2066 << 16) | 1192);
+  const __m128i lowByte = _mm_set1_epi16(0x00ff);
+  const __m128i alpha = _mm_set1_epi8((char)0xff);
+
+  int i = 0;
+  for (; i + 16 <= width; i += 16) {
+    __m128i y8 = _mm_loadu_si128((const __m128i *)(yrow + i));
+    __m128i u, v;
+    if (uvStep == 2) {
+      // Interleaved chroma: urow/vrow point into the same VU/UV row
+      const uint8_t *uvrow = (urow < vrow) ? urow : vrow;
+      __m128i uv = _mm_loadu_si128((const __m128i *)(uvrow + i));
+      __m128i even = _mm_and_si128(uv, lowByte);
+      __m128i odd = _mm_srli_epi16(uv, 8);
+      u = (urow < vrow) ? even : odd;
+      v = (urow < vrow) ? odd : even;
+    }
+    else {
+      u = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(urow + i/2)),
+			    zero);
+      v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(vrow + i/2)),
+			    zero);
+    }
+    u = _mm_sub_epi16(u, k128);
+    v = _mm_sub_epi16(v, k128);
+
+    __m128i rgb8[3];
+    int h;
+    for (h = 0; h < 2; h++) {
+      __m128i y = h ? _mm_unpackhi_epi8(y8, zero) : _mm_unpacklo_epi8(y8, zero);
+      y = _mm_max_epi16(_mm_sub_epi16(y, k16), zero);
+      __m128i uh = h ? _mm_unpackhi_epi16(u, u) : _mm_unpacklo_epi16(u, u);
+      __m128i vh = h ? _mm_unpackhi_epi16(v, v) : _mm_unpacklo_epi16(v, v);
+
+      __m128i r = sse2_channel(y, vh, kR);
+      __m128i g = sse2_green(y, vh, uh, kG, kGU);
+      __m128i b = sse2_channel(y, uh, kB);
+      if (h == 0) {
+	rgb8[0] = r;
+	rgb8[1] = g;
+	rgb8[2] = b;
+      }
+      else {
+	rgb8[0] = _mm_packus_epi16(rgb8[0], r);
+	rgb8[1] = _mm_packus_epi16(rgb8[1], g);
+	rgb8[2] = _mm_packus_epi16(rgb8[2], b);
+      }
+    }
+
+    if (dstFormat == RGB_RGB565) {
+      const __m128i maskR = _mm_set1_epi16(0xf8);
+      const __m128i maskG = _mm_set1_epi16(0xfc);
+      for (h = 0; h < 2; h++) {
+	__m128i r = h ? _mm_unpackhi_epi8(rgb8[0], zero)
+	  : _mm_unpacklo_epi8(rgb8[0], zero);
+	__m128i g = h ? _mm_unpackhi_epi8(rgb8[1], zero)
+	  : _mm_unpacklo_epi8(rgb8[1], zero);
+	__m128i b = h ? _mm_unpackhi_epi8(rgb8[2], zero)
+	  : _mm_unpacklo_epi8(rgb8[2], zero);
+	__m128i px = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(r, maskR), 8),
+				  _mm_or_si128(_mm_slli_epi16(_mm_and_si128(g, maskG), 3),
+					       _mm_srli_epi16(b, 3)));
+	_mm_storeu_si128((__m128i *)((uint16_t *)dst + i + 8*h), px);
+      }
+    }
+    else {
+      __m128i rgLo = _mm_unpacklo_epi8(rgb8[0], rgb8[1]);
+      __m128i rgHi = _mm_unpackhi_epi8(rgb8[0], rgb8[1]);
+      __m128i baLo = _mm_unpacklo_epi8(rgb8[2], alpha);
+      __m128i baHi = _mm_unpackhi_epi8(rgb8[2], alpha);
+      __m128i *p = (__m128i *)(dst + 4*i);
+      _mm_storeu_si128(p, _mm_unpacklo_epi16(rgLo, baLo));
+      _mm_storeu_si128(p+1, _mm_unpackhi_epi16(rgLo, baLo));
+      _mm_storeu_si128(p+2, _mm_unpacklo_epi16(rgHi, baHi));
+      _mm_storeu_si128(p+3, _mm_unpackhi_epi16(rgHi, baHi));
+    }
+  }
+  return i;
+}
+#else
+static int convert_row_simd(const uint8_t *yrow, const uint8_t *urow,
+			    const uint8_t *vrow, int uvStep,
+			    uint8_t *dst, int dstFormat, int width) {
+  (void)yrow; (void)urow; (void)vrow; (void)uvStep;
+  (void)dst; (void)dstFormat; (void)width;
+  return 0;
+}
+#endif
+
+int yuv_size(int height, int stride, int srcFormat) {
+  int chromaRows = (height + 1)/2;
+  if (srcFormat == YUV_I420)
+    return stride*height + 2*((stride + 1)/2)*chromaRows;
+  return stride*height + stride*chromaRows;
+}
+
+int rgb_pixel_size(int dstFormat) {
+  return (dstFormat == RGB_RGB565) ? 2 : 4;
+}
+
+void yuv_convert_rows(const uint8_t *src, int width, int height,
+		      int stride, int srcFormat,
+		      uint8_t *dst, int dstStride, int dstFormat,
+		      int row0, int row1) {
+  const uint8_t *chroma = src + stride*height;
+  int chromaStride = (srcFormat == YUV_I420) ? (stride + 1)/2 : stride;
+  int uvStep = (srcFormat == YUV_I420) ? 1 : 2;
+  int i, j;
+
+  if (row0 < 0) row0 = 0;
+  if (row1 > height) row1 = height;
+
+  for (j = row0; j < row1; j++) {
+    const uint8_t *yrow = src + j*stride;
+    const uint8_t *crow = chroma + (j >> 1)*chromaStride;
+    const uint8_t *urow, *vrow;
+    switch (srcFormat) {
+    case YUV_NV12:
+      urow = crow;
+      vrow = crow + 1;
+      break;
+    case YUV_I420:
+      urow = crow;
+      vrow = crow + chromaStride*((height + 1)/2);
+      break;
+    default: // YUV_NV21
+      vrow = crow;
+      urow = crow + 1;
+    }
+    uint8_t *drow = dst + j*dstStride;
+
+    i = convert_row_simd(yrow, urow, vrow, uvStep,
+			     drow, dstFormat, width);
+    for (; i < width; i++) {
+      int c = (i >> 1)*uvStep;
+      yuv_store(drow, dstFormat, i, yrow[i], urow[c], vrow[c]);
+    }
+  }
+}
+
+typedef struct yuvJob {
+  const uint8_t *src;
+  int width, height, stride, srcFormat;
+  uint8_t *dst;
+  int dstStride, dstFormat;
+  int row0, row1;
+} yuvJob;
+
+static void *yuv_convert_thread(void *arg) {
+  yuvJob *job = (yuvJob *)arg;
+  yuv_convert_rows(job->src, job->width, job->height,
+		   job->stride, job->srcFormat,
+		   job->dst, job->dstStride, job->dstFormat,
+		   job->row0, job->row1);
+  return NULL;
+}
+
+int yuv_convert(const uint8_t *src, int width, int height,
+		int stride, int srcFormat,
+		uint8_t *dst, int dstStride, int dstFormat,
+		int nthreads) {
+  if ((src == NULL) || (dst == NULL) || (width <= 0) || (height <= 0))
+    return -1;
+  if (nthreads > YUV_MAX_THREADS) nthreads = YUV_MAX_THREADS;
+  if (nthreads > height/2) nthreads = height/2;
+  if (nthreads <= 1) {
+    yuv_convert_rows(src, width, height, stride, srcFormat,
+		     dst, dstStride, dstFormat, 0, height);
+    return 0;
+  }
+
+  // Split into bands of even row count so chroma rows are not shared
+  yuvJob job[YUV_MAX_THREADS];
+  pthread_t thread[YUV_MAX_THREADS];
+  int band = ((height/nthreads) + 1) & ~1;
+  int row = 0;
+  int njob = 0;
+  for (; (njob < nthreads) && (row < height); njob++) {
+    yuvJob *p = job + njob;
+    p->src = src;
+    p->width = width;
+    p->height = height;
+    p->stride = stride;
+    p->srcFormat = srcFormat;
+    p->dst = dst;
+    p->dstStride = dstStride;
+    p->dstFormat = dstFormat;
+    p->row0 = row;
+    row += band;
+    p->row1 = (njob == nthreads-1 || row > height) ? height : row;
+  }
+
+  // Calling thread converts the first band itself
+  int started[YUV_MAX_THREADS];
+  int k;
+  for (k = 1; k < njob; k++) {
+    started[k] = (pthread_create(thread+k, NULL,
+				 yuv_convert_thread, job+k) == 0);
+    if (!started[k]) yuv_convert_thread(job+k);
+  }
+  yuv_convert_thread(job);
+  for (k = 1; k < njob; k++) {
+    if (started[k]) pthread_join(thread[k], NULL);
+  }
+  return 0;
+}
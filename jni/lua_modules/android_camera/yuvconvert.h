@@ -0,0 +1,53 @@
+#ifndef yuvconvert_h
+#define yuvconvert_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Source YUV 4:2:0 layouts
+enum {
+  YUV_NV21 = 0,  // Y plane, interleaved VU plane (Android preview default)
+  YUV_NV12 = 1,  // Y plane, interleaved UV plane
+  YUV_I420 = 2   // Y plane, U plane, V plane
+};
+
+// Destination RGB layouts
+enum {
+  RGB_RGBA8888 = 0,  // R,G,B,A bytes (A = 0xff)
+  RGB_RGB565 = 1     // native endian 16-bit
+};
+
+/*
+  Convert rows [row0, row1) of a YUV 4:2:0 image into a caller-owned
+  RGB buffer. stride is the Y row pitch in bytes; chroma planes follow
+  the Y plane as laid out by the camera (NV21/NV12 chroma pitch is
+  stride, I420 chroma pitch is (stride+1)/2). dstStride is the output
+  row pitch in bytes. row0 should be even so chroma rows line up.
+  Uses NEON on ARM and SSE2 on x86 when available, unless built with
+  YUV_NO_SIMD.
+*/
+void yuv_convert_rows(const uint8_t *src, int width, int height,
+		      int stride, int srcFormat,
+		      uint8_t *dst, int dstStride, int dstFormat,
+		      int row0, int row1);
+
+// Whole image conversion, split across nthreads threads (<= 1 is serial)
+int yuv_convert(const uint8_t *src, int width, int height,
+		int stride, int srcFormat,
+		uint8_t *dst, int dstStride, int dstFormat,
+		int nthreads);
+
+// Size in bytes of a YUV 4:2:0 image with the given layout
+int yuv_size(int height, int stride, int srcFormat);
+
+// Bytes per output pixel of an RGB layout
+int rgb_pixel_size(int dstFormat);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -197,6 +197,9 @@ static int lua_egl_new(lua_State *L) {
 static int lua_egl_GetConfigs(lua_State *L) {
   EGLClass *egl = lua_checkeglclass(L, 1);
 
+  // Config tables are built on the stack and stored in one call;
+  // room for them, the result table and the key/value being set
+  luaL_checkstack(L, egl->num_config + 3, "too many configs");
   lua_createtable(L, egl->config_size, 0);
   for (int i = 0; i < egl->num_config; i++) {
     // Config table
@@ -214,10 +217,8 @@ static int lua_egl_GetConfigs(lua_State *L) {
       lua_pushinteger(L, attribValue);
       lua_settable(L, -3);
     }
-
-    // Set index of config table
-    lua_rawseti(L, -2, i+1);
   }
+  lua_rawsetlist(L, -(egl->num_config+1), 1, egl->num_config);
   return 1;
 }
 
@@ -171,82 +171,53 @@ static int lua_inputevent_getRepeatCount(lua_State *L) {
 }
 
 // Motion events
-static int lua_inputevent_getX(lua_State *L) {
+
+#define POINTER_CHUNK 16
+
+// Array of one axis value per pointer, filled in bulk
+static int lua_pushpointeraxis(lua_State *L,
+			       float (*getAxis)(const AInputEvent*, size_t)) {
   const AInputEvent *event = lua_checkinputevent(L, 1);
   int pointerCount = AMotionEvent_getPointerCount(event);
+  float value[POINTER_CHUNK];
   lua_createtable(L, pointerCount, 0);
-  for (int i = 0; i < pointerCount; i++) {
-    //    int pointerId = AMotionEvent_getPointerId(event, i);
-    lua_pushnumber(L, AMotionEvent_getX(event, i));
-    lua_rawseti(L, -2, i+1);
+  for (int base = 0; base < pointerCount; base += POINTER_CHUNK) {
+    int n = pointerCount - base;
+    if (n > POINTER_CHUNK) n = POINTER_CHUNK;
+    for (int i = 0; i < n; i++) {
+      value[i] = getAxis(event, base + i);
+    }
+    lua_rawsetarray(L, -1, base + 1, LUA_AFLOAT, value, n);
   }
   return 1;
 }
 
+static int lua_inputevent_getX(lua_State *L) {
+  return lua_pushpointeraxis(L, AMotionEvent_getX);
+}
+
 static int lua_inputevent_getY(lua_State *L) {
-  const AInputEvent *event = lua_checkinputevent(L, 1);
-  int pointerCount = AMotionEvent_getPointerCount(event);
-  lua_createtable(L, pointerCount, 0);
-  for (int i = 0; i < pointerCount; i++) {
-    lua_pushnumber(L, AMotionEvent_getY(event, i));
-    lua_rawseti(L, -2, i+1);
-  }
-  return 1;
+  return lua_pushpointeraxis(L, AMotionEvent_getY);
 }
 
 static int lua_inputevent_getPressure(lua_State *L) {
-  const AInputEvent *event = lua_checkinputevent(L, 1);
-  int pointerCount = AMotionEvent_getPointerCount(event);
-  lua_createtable(L, pointerCount, 0);
-  for (int i = 0; i < pointerCount; i++) {
-    lua_pushnumber(L, AMotionEvent_getPressure(event, i));
-    lua_rawseti(L, -2, i+1);
-  }
-  return 1;
+  return lua_pushpointeraxis(L, AMotionEvent_getPressure);
 }
 
 static int lua_inputevent_getSize(lua_State *L) {
-  const AInputEvent *event = lua_checkinputevent(L, 1);
-  int pointerCount = AMotionEvent_getPointerCount(event);
-  lua_createtable(L, pointerCount, 0);
-  for (int i = 0; i < pointerCount; i++) {
-    lua_pushnumber(L, AMotionEvent_getSize(event, i));
-    lua_rawseti(L, -2, i+1);
-  }
-  return 1;
+  return lua_pushpointeraxis(L, AMotionEvent_getSize);
 }
 
 static int lua_inputevent_getTouchMajor(lua_State *L) {
-  const AInputEvent *event = lua_checkinputevent(L, 1);
-  int pointerCount = AMotionEvent_getPointerCount(event);
-  lua_createtable(L, pointerCount, 0);
-  for (int i = 0; i < pointerCount; i++) {
-    lua_pushnumber(L, AMotionEvent_getTouchMajor(event, i));
-    lua_rawseti(L, -2, i+1);
-  }
-  return 1;
+  return lua_pushpointeraxis(L, AMotionEvent_getTouchMajor);
 }
 
 static int lua_inputevent_getTouchMinor(lua_State *L) {
-  const AInputEvent *event = lua_checkinputevent(L, 1);
-  int pointerCount = AMotionEvent_getPointerCount(event);
-  lua_createtable(L, pointerCount, 0);
-  for (int i = 0; i < pointerCount; i++) {
-    lua_pushnumber(L, AMotionEvent_getTouchMinor(event, i));
-    lua_rawseti(L, -2, i+1);
-  }
-  return 1;
+  return lua_pushpointeraxis(L, AMotionEvent_getTouchMinor);
 }
 
 static int lua_inputevent_getOrientation(lua_State *L) {
-  const AInputEvent *event = lua_checkinputevent(L, 1);
-  int pointerCount = AMotionEvent_getPointerCount(event);
-  lua_createtable(L, pointerCount, 0);
-  for (int i = 0; i < pointerCount; i++) {
-    lua_pushnumber(L, AMotionEvent_getOrientation(event, i));
-    lua_rawseti(L, -2, i+1);
-  }
-  return 1;
+  return lua_pushpointeraxis(L, AMotionEvent_getOrientation);
 }
 
 static int lua_inputevent_tostring(lua_State *L) {
@@ -130,6 +130,7 @@ static int lua_sensor_new(lua_State *L) {
 static int lua_sensor_getSensorList(lua_State *L) {
   SensorClass *sensor = lua_checksensorclass(L, 1);
 
+  luaL_checkstack(L, sensor->nList + 3, "too many sensors");
   lua_createtable(L, sensor->nList, 0);
   for (int i = 0; i < sensor->nList; i++) {
     const ASensor* a = sensor->list[i];
@@ -150,9 +151,8 @@ static int lua_sensor_getSensorList(lua_State *L) {
     lua_pushliteral(L, "minDelay");
     lua_pushinteger(L, ASensor_getMinDelay(a));
     lua_rawset(L, -3);
-
-    lua_rawseti(L, -2, i+1);
   }
+  lua_rawsetlist(L, -(sensor->nList+1), 1, sensor->nList);
   return 1;
 }
 
@@ -251,6 +251,9 @@ static int lua_sensor_getEvents(lua_State *L) {
     return 2;
   }
 
+  // Event tables are built on the stack and stored in one call;
+  // room for them, the result table and the key/value being set
+  luaL_checkstack(L, numEvent + 3, "too many sensor events");
   lua_createtable(L, numEvent, 0);
   for (int i = 0; i < numEvent; i++) {
     ASensorEvent* event = eventBuffer + i;
@@ -271,51 +274,20 @@ static int lua_sensor_getEvents(lua_State *L) {
     lua_pushliteral(L, "timestamp");
     lua_pushnumber(L, event->timestamp);
     lua_rawset(L, -3);
+    // acceleration, magnetic, vector, light and distance all alias data[]
+    int nValues;
     switch (event->type) {
-    case ASENSOR_TYPE_ACCELEROMETER:
-      lua_pushnumber(L, event->acceleration.x);
-      lua_rawseti(L, -2, 1);
-      lua_pushnumber(L, event->acceleration.y);
-      lua_rawseti(L, -2, 2);
-      lua_pushnumber(L, event->acceleration.z);
-      lua_rawseti(L, -2, 3);
-      break;
-    case ASENSOR_TYPE_MAGNETIC_FIELD:
-      lua_pushnumber(L, event->magnetic.x);
-      lua_rawseti(L, -2, 1);
-      lua_pushnumber(L, event->magnetic.y);
-      lua_rawseti(L, -2, 2);
-      lua_pushnumber(L, event->magnetic.z);
-      lua_rawseti(L, -2, 3);
-      break;
-    case ASENSOR_TYPE_GYROSCOPE:
-      lua_pushnumber(L, event->vector.azimuth);
-      lua_rawseti(L, -2, 1);
-      lua_pushnumber(L, event->vector.pitch);
-      lua_rawseti(L, -2, 2);
-      lua_pushnumber(L, event->vector.roll);
-      lua_rawseti(L, -2, 3);
-      break;
     case ASENSOR_TYPE_LIGHT:
-      lua_pushnumber(L, event->light);
-      lua_rawseti(L, -2, 1);
-      break;
     case ASENSOR_TYPE_PROXIMITY:
-      lua_pushnumber(L, event->distance);
-      lua_rawseti(L, -2, 1);
+      nValues = 1;
       break;
     default:
-      lua_pushnumber(L, event->data[0]);
-      lua_rawseti(L, -2, 1);
-      lua_pushnumber(L, event->data[1]);
-      lua_rawseti(L, -2, 2);
-      lua_pushnumber(L, event->data[2]);
-      lua_rawseti(L, -2, 3);
+      nValues = 3;
     }
-
-    // Set table in events table
-    lua_rawseti(L, -2, i+1);
+    lua_rawsetarray(L, -1, 1, LUA_AFLOAT, event->data, nValues);
   }
+  // Set tables in events table
+  lua_rawsetlist(L, -(numEvent+1), 1, numEvent);
 
   return 1;
 }
@@ -45,18 +45,19 @@ static int lua_toast_create(lua_State *L) {
   // ApplicationContext crashes Android emulator
   //  jobject context = jniGetApplicationContext();
   jobject context = jniGetActivity();
+  JNILocalFrame frame;
 
   jobject toastObject = 
-    env->CallStaticObjectMethod(toastClass,
-				makeTextMethod,
-				context,
-				env->NewStringUTF(text),
-				duration);
+    jniCallStaticObjectMethod(toastClass,
+			      makeTextMethod,
+			      context,
+			      env->NewStringUTF(text),
+			      duration);
   LOGI("toastObject %p", toastObject);
+  if (toastObject == 0) return 0;
 
   jobject *jptr = (jobject *)lua_newuserdata(L, sizeof(jobject));
   *jptr = env->NewGlobalRef(toastObject);
-  env->DeleteLocalRef(toastObject);
 
   luaL_getmetatable(L, MT_NAME);
   lua_setmetatable(L, -2);
@@ -75,8 +76,7 @@ static int lua_toast_delete(lua_State *L) {
 static int lua_toast_show(lua_State *L) {
   jobject obj = lua_checktoast(L, 1);
 
-  JNIEnv *env = jniGetEnv();
-  env->CallVoidMethod(obj, showMethod);
+  jniCallVoidMethod(obj, showMethod);
   return 0;
 }
 
@@ -117,26 +117,17 @@ extern "C"
 int luaopen_toast (lua_State *L) {
   LOGI("luaopen_toast called");
   
-  // Uses Java VM and application context
-  JNIEnv *env = jniGetEnv();
-
-  jclass toastClassLocal = env->FindClass("android/widget/Toast");
-  LOGI("toastClassLocal %p", toastClassLocal);
-  if (toastClassLocal == 0) {
-    LOGE("Could not find Toast class");
-    return 0;
-  }
-  toastClass = (jclass) env->NewGlobalRef(toastClassLocal);
+  toastClass = jniGetClass("android/widget/Toast");
   LOGI("toastClass %p", toastClass);
   if (toastClass == 0) {
-    LOGE("Could not make global ref");
+    LOGE("Could not find Toast class");
     return 0;
   }
 
   makeTextMethod =
-    env->GetStaticMethodID(toastClass,
-			   "makeText",
-			   "(Landroid/content/Context;Ljava/lang/CharSequence;I)Landroid/widget/Toast;");
+    jniGetStaticMethodID(toastClass,
+			 "makeText",
+			 "(Landroid/content/Context;Ljava/lang/CharSequence;I)Landroid/widget/Toast;");
   LOGI("makeTextMethod %p", makeTextMethod);
   if (makeTextMethod == 0) {
     LOGE("Could not get makeText method");
@@ -144,9 +135,9 @@ int luaopen_toast (lua_State *L) {
   }
 
   showMethod =
-    env->GetMethodID(toastClass,
-		     "show",
-		     "()V");
+    jniGetMethodID(toastClass,
+		   "show",
+		   "()V");
   LOGI("showMethod %p", showMethod);
   if (showMethod == 0) {
     LOGE("Could not get show method");
@@ -44,14 +44,14 @@ static jobject lua_checktts(lua_State *L, int narg) {
 static int lua_tts_create(lua_State *L) {
   JNIEnv *env = jniGetEnv();
   jobject appContext = jniGetApplicationContext();
-  
+  JNILocalFrame frame;
+
   jobject ttsObject = env->NewObject(ttsClass, ttsInitMethod,
 				     appContext, NULL);
   LOGI("ttsObject %p", ttsObject);
 
   jobject *jptr = (jobject *)lua_newuserdata(L, sizeof(jobject));
   *jptr = env->NewGlobalRef(ttsObject);
-  env->DeleteLocalRef(ttsObject);
 
   luaL_getmetatable(L, MT_NAME);
   lua_setmetatable(L, -2);
@@ -73,10 +73,11 @@ static int lua_tts_speak(lua_State *L) {
   int mode = luaL_optint(L, 3, tts_QUEUE_ADD);
 
   JNIEnv *env = jniGetEnv();
-  int ret = env->CallIntMethod(obj, speakMethod,
-			       env->NewStringUTF(text),
-			       mode,
-			       NULL);
+  JNILocalFrame frame;
+  int ret = jniCallIntMethod(obj, speakMethod,
+			     env->NewStringUTF(text),
+			     mode,
+			     NULL);
   lua_pushinteger(L, ret);
   return 1;
 }
@@ -86,10 +87,11 @@ static int lua_tts_speakFlush(lua_State *L) {
   const char *text = luaL_checkstring(L, 2);
 
   JNIEnv *env = jniGetEnv();
-  int ret = env->CallIntMethod(obj, speakMethod,
-			       env->NewStringUTF(text),
-			       tts_QUEUE_FLUSH,
-			       NULL);
+  JNILocalFrame frame;
+  int ret = jniCallIntMethod(obj, speakMethod,
+			     env->NewStringUTF(text),
+			     tts_QUEUE_FLUSH,
+			     NULL);
   lua_pushinteger(L, ret);
   return 1;
 }
@@ -120,33 +122,27 @@ int luaopen_tts (lua_State *L) {
   
   // Uses Java VM and application context
   JNIEnv *env = jniGetEnv();
-  jobject appContext = jniGetApplicationContext();
 
-  jclass ttsClassLocal = env->FindClass("android/speech/tts/TextToSpeech");
-  if (ttsClassLocal == 0) {
-    LOGE("Could not find TextToSpeech class");
-    return 0;
-  }
-  ttsClass = (jclass) env->NewGlobalRef(ttsClassLocal);
+  ttsClass = jniGetClass("android/speech/tts/TextToSpeech");
   LOGI("ttsClass %p", ttsClass);
   if (ttsClass == 0) {
-    LOGE("Could not make global ref");
+    LOGE("Could not find TextToSpeech class");
     return 0;
   }
 
   jfieldID fieldID;
-  fieldID = env->GetStaticFieldID(ttsClass, "QUEUE_ADD", "I");
+  fieldID = jniGetStaticFieldID(ttsClass, "QUEUE_ADD", "I");
   LOGI("QUEUE_ADD fid %p", fieldID);
   tts_QUEUE_ADD = env->GetStaticIntField(ttsClass, fieldID);
 
-  fieldID = env->GetStaticFieldID(ttsClass, "QUEUE_FLUSH", "I");
+  fieldID = jniGetStaticFieldID(ttsClass, "QUEUE_FLUSH", "I");
   LOGI("QUEUE_FLUSH fid %p", fieldID);
   tts_QUEUE_FLUSH = env->GetStaticIntField(ttsClass, fieldID);
 
   ttsInitMethod =
-    env->GetMethodID(ttsClass,
-		     "<init>",
-		     "(Landroid/content/Context;Landroid/speech/tts/TextToSpeech$OnInitListener;)V");
+    jniGetMethodID(ttsClass,
+		   "<init>",
+		   "(Landroid/content/Context;Landroid/speech/tts/TextToSpeech$OnInitListener;)V");
   LOGI("ttsInitMethod %p", ttsInitMethod);
   if (ttsInitMethod == 0) {
     LOGE("Could not get TextToSpeech constructor method");
@@ -154,9 +150,9 @@ int luaopen_tts (lua_State *L) {
   }
 
   speakMethod =
-    env->GetMethodID(ttsClass,
-		     "speak",
-		     "(Ljava/lang/String;ILjava/util/HashMap;)I");
+    jniGetMethodID(ttsClass,
+		   "speak",
+		   "(Ljava/lang/String;ILjava/util/HashMap;)I");
   LOGI("speakMethod %p", speakMethod);
   if (speakMethod == 0) {
     LOGE("Could not get speakText method");
@@ -164,9 +160,9 @@ int luaopen_tts (lua_State *L) {
   }
 
   setLanguageMethod =
-    env->GetMethodID(ttsClass,
-		     "setLanguage",
-		     "(Ljava/util/Locale;)I");
+    jniGetMethodID(ttsClass,
+		   "setLanguage",
+		   "(Ljava/util/Locale;)I");
   LOGI("setLanguageMethod %p", setLanguageMethod);
   if (setLanguageMethod == 0) {
     LOGE("Could not get setLanguage method");
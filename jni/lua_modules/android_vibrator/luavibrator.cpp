@@ -40,10 +40,8 @@ static int lua_vibrator_hasvibrator(lua_State *L) {
     LOGE("Invalid vibrator method");
     return 0;
   }
-  JNIEnv *env = jniGetEnv();
-
-  int ret = (int) env->CallBooleanMethod(vibratorObject,
-					 hasVibratorMethod);
+  int ret = (int) jniCallBooleanMethod(vibratorObject,
+				       hasVibratorMethod);
   lua_pushboolean(L, ret);
   return 1;
 }
@@ -53,11 +51,7 @@ static int lua_vibrator_cancel(lua_State *L) {
     LOGE("Invalid vibrator object");
     return 0;
   }
-  JNIEnv *env = jniGetEnv();
-
-  env->CallVoidMethod(vibratorObject, cancelMethod);
-
-  if (env->ExceptionOccurred()) {
+  if (jniCallVoidMethod(vibratorObject, cancelMethod) < 0) {
     LOGE("Could not call cancel method");
     return 0;
   }
@@ -74,8 +68,11 @@ static int lua_vibrator_vibrate(lua_State *L) {
 
   int narg = lua_gettop(L);
   if (narg < 1) return 0;
+  int status;
 
   if (lua_istable(L, 1)) {
+    JNILocalFrame frame;
+
     // Construct JNI long array
     int npattern = lua_objlen(L, 1);
     jlong t[npattern];
@@ -89,15 +86,15 @@ static int lua_vibrator_vibrate(lua_State *L) {
 
     // Get repeat index (-1 for no repeat by default)
     jint repeat = luaL_optint(L, 2, -1);
-    env->CallVoidMethod(vibratorObject, vibratePatternMethod,
-			pattern, repeat);
+    status = jniCallVoidMethod(vibratorObject, vibratePatternMethod,
+			       pattern, repeat);
   }
   else {
     jlong msec = luaL_checkint(L, 1);
-    env->CallVoidMethod(vibratorObject, vibrateOnMethod, msec);
+    status = jniCallVoidMethod(vibratorObject, vibrateOnMethod, msec);
   }
 
-  if (env->ExceptionOccurred()) {
+  if (status < 0) {
     LOGE("Could not call vibrate method");
     return 0;
   }
@@ -123,12 +120,14 @@ int luaopen_vibrator (lua_State *L) {
   // #include <binder/IServiceManager.h>
   // sp<IServiceManager> serviceManager = defaultServiceManager();
   jmethodID methodGetSystemService =
-    env->GetMethodID(env->GetObjectClass(context),
-		     "getSystemService",
-		     "(Ljava/lang/String;)Ljava/lang/Object;"); 
-  jobject jobj = env->CallObjectMethod(context,
-				       methodGetSystemService,
-				       env->NewStringUTF("vibrator"));
+    jniGetMethodID(jniGetClass("android/content/Context"),
+		   "getSystemService",
+		   "(Ljava/lang/String;)Ljava/lang/Object;"); 
+  jstring serviceName = env->NewStringUTF("vibrator");
+  jobject jobj = jniCallObjectMethod(context,
+				     methodGetSystemService,
+				     serviceName);
+  env->DeleteLocalRef(serviceName);
   if (jobj == 0) {
     LOGE("Could not get vibrator object");
     return 0;
@@ -136,20 +135,19 @@ int luaopen_vibrator (lua_State *L) {
   vibratorObject = env->NewGlobalRef(jobj);
   env->DeleteLocalRef(jobj);
 
-  jclass vibratorClass = env->GetObjectClass(vibratorObject);
+  jclass vibratorClass = jniGetClass("android/os/Vibrator");
   LOGI("object %p, class %p", vibratorObject, vibratorClass);
 
-  cancelMethod = env->GetMethodID(vibratorClass,
-				  "cancel", "()V"); 
-  vibrateOnMethod = env->GetMethodID(vibratorClass,
-				     "vibrate", "(J)V"); 
-  vibratePatternMethod = env->GetMethodID(vibratorClass,
-					  "vibrate", "([JI)V"); 
-  hasVibratorMethod = env->GetMethodID(vibratorClass,
-				       "hasVibrator", "()Z"); 
-  if (env->ExceptionOccurred()) {
+  cancelMethod = jniGetMethodID(vibratorClass,
+				"cancel", "()V"); 
+  vibrateOnMethod = jniGetMethodID(vibratorClass,
+				   "vibrate", "(J)V"); 
+  vibratePatternMethod = jniGetMethodID(vibratorClass,
+					"vibrate", "([JI)V"); 
+  hasVibratorMethod = jniGetMethodID(vibratorClass,
+				     "hasVibrator", "()Z"); 
+  if (hasVibratorMethod == 0) {
     // hasVibrator() doesn't exist on <= Android 2.3.4
-    env->ExceptionClear();
     LOGE("Could not get hasVibrator method");
   }
   /*
@@ -0,0 +1,12 @@
+LOCAL_PATH := $(call my-dir)
+
+# carray module with typed numeric arrays and bulk math kernels
+include $(CLEAR_VARS)
+LOCAL_MODULE := carray
+LOCAL_SRC_FILES := luacarray.cpp carraykernels.c
+ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
+LOCAL_ARM_NEON := true
+endif
+LOCAL_LDLIBS := -llog
+LOCAL_SHARED_LIBRARIES := lua-activity
+include $(BUILD_SHARED_LIBRARY)
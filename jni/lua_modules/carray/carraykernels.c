@@ -0,0 +1,408 @@
+/*
+  Bulk kernels over typed numeric arrays (see carraykernels.h)
+  SIMD paths: NEON on ARM, SSE2 on x86, scalar otherwise.
+  All paths produce identical results.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CARRAY_USE_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define CARRAY_USE_SSE2 1
+#endif
+
+#include "carraykernels.h"
+
+#define SUM_BLOCK 256
+
+const int carray_elemsize[CARRAY_NTYPES] = {
+  sizeof(uint8_t), sizeof(int32_t), sizeof(float), sizeof(double)
+};
+
+/* Element access */
+
+double carray_get(const void *p, int type, int i) {
+  switch (type) {
+  case CARRAY_BYTE: return ((const uint8_t *)p)[i];
+  case CARRAY_INT: return ((const int32_t *)p)[i];
+  case CARRAY_FLOAT: return ((const float *)p)[i];
+  default: return ((const double *)p)[i];
+  }
+}
+
+void carray_set(void *p, int type, int i, double v) {
+  switch (type) {
+  case CARRAY_BYTE:
+    ((uint8_t *)p)[i] = (v <= 0) ? 0 : (v >= 255) ? 255 : (uint8_t)v;
+    break;
+  case CARRAY_INT:
+    ((int32_t *)p)[i] = (int32_t)v;
+    break;
+  case CARRAY_FLOAT:
+    ((float *)p)[i] = (float)v;
+    break;
+  default:
+    ((double *)p)[i] = v;
+  }
+}
+
+/* Fill and copy */
+
+void carray_fill(void *dst, int type, int n, double v) {
+  int i;
+  if (n <= 0) return;
+  carray_set(dst, type, 0, v);
+  if (type == CARRAY_BYTE) {
+    memset(dst, ((uint8_t *)dst)[0], n);
+    return;
+  }
+  // Double the filled prefix each step
+  for (i = 1; i < n; i *= 2) {
+    int k = (2*i <= n) ? i : n - i;
+    memcpy((char *)dst + i*carray_elemsize[type], dst,
+	   k*carray_elemsize[type]);
+  }
+}
+
+void carray_copy(void *dst, int dtype, const void *src, int stype, int n) {
+  void *tmp = NULL;
+  int i;
+  if (n <= 0) return;
+  if (dtype == stype) {
+    memmove(dst, src, n*carray_elemsize[dtype]);
+    return;
+  }
+  if (((const char *)src < (char *)dst + n*carray_elemsize[dtype]) &&
+      ((char *)dst < (const char *)src + n*carray_elemsize[stype])) {
+    // Overlapping views of different types: convert from a snapshot
+    tmp = malloc(n*carray_elemsize[stype]);
+    if (tmp == NULL) return;
+    memcpy(tmp, src, n*carray_elemsize[stype]);
+    src = tmp;
+  }
+  if ((dtype == CARRAY_FLOAT) && (stype == CARRAY_DOUBLE)) {
+    for (i = 0; i < n; i++) ((float *)dst)[i] = (float)((const double *)src)[i];
+  }
+  else if ((dtype == CARRAY_DOUBLE) && (stype == CARRAY_FLOAT)) {
+    for (i = 0; i < n; i++) ((double *)dst)[i] = ((const float *)src)[i];
+  }
+  else {
+    for (i = 0; i < n; i++) carray_set(dst, dtype, i, carray_get(src, stype, i));
+  }
+  free(tmp);
+}
+
+/* Arithmetic */
+
+enum { OP_ADD, OP_MUL, OP_FMA };
+
+// Same-type float kernels, return first element left for the scalar loop
+static int float_op_simd(float *d, const float *b, float s, int n, int op) {
+  int i = 0;
+#if CARRAY_USE_NEON
+  float32x4_t vs = vdupq_n_f32(s);
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t vd = vld1q_f32(d + i);
+    float32x4_t vb = b ? vld1q_f32(b + i) : vs;
+    switch (op) {
+    case OP_ADD: vd = vaddq_f32(vd, vb); break;
+    case OP_MUL: vd = vmulq_f32(vd, vb); break;
+    default: vd = vaddq_f32(vd, vmulq_f32(vb, vs));
+    }
+    vst1q_f32(d + i, vd);
+  }
+#elif CARRAY_USE_SSE2
+  __m128 vs = _mm_set1_ps(s);
+  for (; i + 4 <= n; i += 4) {
+    __m128 vd = _mm_loadu_ps(d + i);
+    __m128 vb = b ? _mm_loadu_ps(b + i) : vs;
+    switch (op) {
+    case OP_ADD: vd = _mm_add_ps(vd, vb); break;
+    case OP_MUL: vd = _mm_mul_ps(vd, vb); break;
+    default: vd = _mm_add_ps(vd, _mm_mul_ps(vb, vs));
+    }
+    _mm_storeu_ps(d + i, vd);
+  }
+#endif
+  return i;
+}
+
+static void float_op(float *d, const float *b, float s, int n, int op) {
+  int i = float_op_simd(d, b, s, n, op);
+  for (; i < n; i++) {
+    float x = b ? b[i] : s;
+    switch (op) {
+    case OP_ADD: d[i] = d[i] + x; break;
+    case OP_MUL: d[i] = d[i] * x; break;
+    default: d[i] = d[i] + x*s;
+    }
+  }
+}
+
+static void double_op(double *d, const double *b, double s, int n, int op) {
+  int i;
+  for (i = 0; i < n; i++) {
+    double x = b ? b[i] : s;
+    switch (op) {
+    case OP_ADD: d[i] = d[i] + x; break;
+    case OP_MUL: d[i] = d[i] * x; break;
+    default: d[i] = d[i] + x*s;
+    }
+  }
+}
+
+static void array_op(void *dst, int type, const void *b, int btype,
+		     double s, int n, int op) {
+  int i;
+  if ((type == CARRAY_FLOAT) && (!b || btype == CARRAY_FLOAT)) {
+    float_op((float *)dst, (const float *)b, (float)s, n, op);
+    return;
+  }
+  if ((type == CARRAY_DOUBLE) && (!b || btype == CARRAY_DOUBLE)) {
+    double_op((double *)dst, (const double *)b, s, n, op);
+    return;
+  }
+  for (i = 0; i < n; i++) {
+    double v = carray_get(dst, type, i);
+    double x = b ? carray_get(b, btype, i) : s;
+    switch (op) {
+    case OP_ADD: v += x; break;
+    case OP_MUL: v *= x; break;
+    default: v += x*s;
+    }
+    carray_set(dst, type, i, v);
+  }
+}
+
+void carray_add(void *dst, int type, const void *b, int btype,
+		double s, int n) {
+  array_op(dst, type, b, btype, s, n, OP_ADD);
+}
+
+void carray_mul(void *dst, int type, const void *b, int btype,
+		double s, int n) {
+  array_op(dst, type, b, btype, s, n, OP_MUL);
+}
+
+void carray_fma(void *dst, int type, const void *b, int btype,
+		double s, int n) {
+  array_op(dst, type, b, btype, s, n, OP_FMA);
+}
+
+/* Reductions */
+
+static int first_index(const void *p, int type, int n, double v) {
+  int i;
+  for (i = 0; i < n; i++) {
+    if (carray_get(p, type, i) == v) return i;
+  }
+  return 0;
+}
+
+// Float min/max, returns first element left for the scalar loop
+static int float_minmax_simd(const float *p, int n, float *min, float *max) {
+  int i = 0;
+#if CARRAY_USE_NEON
+  if (n >= 4) {
+    float32x4_t vmin = vld1q_f32(p), vmax = vmin;
+    float32x2_t h;
+    for (i = 4; i + 4 <= n; i += 4) {
+      float32x4_t v = vld1q_f32(p + i);
+      vmin = vminq_f32(vmin, v);
+      vmax = vmaxq_f32(vmax, v);
+    }
+    h = vpmin_f32(vget_low_f32(vmin), vget_high_f32(vmin));
+    *min = vget_lane_f32(vpmin_f32(h, h), 0);
+    h = vpmax_f32(vget_low_f32(vmax), vget_high_f32(vmax));
+    *max = vget_lane_f32(vpmax_f32(h, h), 0);
+  }
+#elif CARRAY_USE_SSE2
+  if (n >= 4) {
+    __m128 vmin = _mm_loadu_ps(p), vmax = vmin;
+    float m[4];
+    int k;
+    for (i = 4; i + 4 <= n; i += 4) {
+      __m128 v = _mm_loadu_ps(p + i);
+      vmin = _mm_min_ps(vmin, v);
+      vmax = _mm_max_ps(vmax, v);
+    }
+    _mm_storeu_ps(m, vmin);
+    *min = m[0];
+    for (k = 1; k < 4; k++) if (m[k] < *min) *min = m[k];
+    _mm_storeu_ps(m, vmax);
+    *max = m[0];
+    for (k = 1; k < 4; k++) if (m[k] > *max) *max = m[k];
+  }
+#endif
+  return i;
+}
+
+int carray_minmax(const void *p, int type, int n,
+		  double *min, int *imin, double *max, int *imax) {
+  double lo = 0, hi = 0;
+  int i = 0;
+  if (n <= 0) return 0;
+  if (type == CARRAY_FLOAT) {
+    float fmin, fmax;
+    i = float_minmax_simd((const float *)p, n, &fmin, &fmax);
+    if (i > 0) {
+      lo = fmin;
+      hi = fmax;
+    }
+  }
+  if (i == 0) {
+    lo = hi = carray_get(p, type, 0);
+    i = 1;
+  }
+  for (; i < n; i++) {
+    double v = carray_get(p, type, i);
+    if (v < lo) lo = v;
+    if (v > hi) hi = v;
+  }
+  *min = lo;
+  *max = hi;
+  *imin = first_index(p, type, n, lo);
+  *imax = first_index(p, type, n, hi);
+  return 1;
+}
+
+static double float_sum(const float *p, int n) {
+  double total = 0;
+  int base;
+  for (base = 0; base < n; base += SUM_BLOCK) {
+    int end = (base + SUM_BLOCK < n) ? base + SUM_BLOCK : n;
+    float part[4] = {0, 0, 0, 0};
+    int i = base, k;
+#if CARRAY_USE_NEON
+    float32x4_t acc = vdupq_n_f32(0);
+    for (; i + 4 <= end; i += 4) acc = vaddq_f32(acc, vld1q_f32(p + i));
+    vst1q_f32(part, acc);
+#elif CARRAY_USE_SSE2
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= end; i += 4) acc = _mm_add_ps(acc, _mm_loadu_ps(p + i));
+    _mm_storeu_ps(part, acc);
+#endif
+    for (; i + 4 <= end; i += 4) {
+      for (k = 0; k < 4; k++) part[k] += p[i+k];
+    }
+    for (k = 0; i < end; i++, k++) part[k] += p[i];
+    total += ((double)part[0] + part[1]) + ((double)part[2] + part[3]);
+  }
+  return total;
+}
+
+double carray_sum(const void *p, int type, int n) {
+  double total = 0;
+  int i;
+  if (type == CARRAY_FLOAT) return float_sum((const float *)p, n);
+  for (i = 0; i < n; i++) total += carray_get(p, type, i);
+  return total;
+}
+
+/* Point transforms */
+
+// Packed 2D float points (stride 2), returns first point left
+static int float_transform2_simd(float *d, const float *s, int npoint,
+				 const float m[16]) {
+  int i = 0;
+#if CARRAY_USE_NEON
+  float32x4_t m0 = vdupq_n_f32(m[0]), m1 = vdupq_n_f32(m[1]);
+  float32x4_t m4 = vdupq_n_f32(m[4]), m5 = vdupq_n_f32(m[5]);
+  float32x4_t m12 = vdupq_n_f32(m[12]), m13 = vdupq_n_f32(m[13]);
+  for (; i + 4 <= npoint; i += 4) {
+    float32x4x2_t p = vld2q_f32(s + 2*i);
+    float32x4x2_t r;
+    r.val[0] = vaddq_f32(vaddq_f32(vmulq_f32(m0, p.val[0]),
+				   vmulq_f32(m4, p.val[1])), m12);
+    r.val[1] = vaddq_f32(vaddq_f32(vmulq_f32(m1, p.val[0]),
+				   vmulq_f32(m5, p.val[1])), m13);
+    vst2q_f32(d + 2*i, r);
+  }
+#elif CARRAY_USE_SSE2
+  // Two points per register: (x0, y0, x1, y1)
+  __m128 ca = _mm_setr_ps(m[0], m[1], m[0], m[1]);
+  __m128 cb = _mm_setr_ps(m[4], m[5], m[4], m[5]);
+  __m128 ct = _mm_setr_ps(m[12], m[13], m[12], m[13]);
+  for (; i + 2 <= npoint; i += 2) {
+    __m128 p = _mm_loadu_ps(s + 2*i);
+    __m128 x = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 0, 0));
+    __m128 y = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 1, 1));
+    _mm_storeu_ps(d + 2*i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(ca, x),
+						 _mm_mul_ps(cb, y)), ct));
+  }
+#endif
+  return i;
+}
+
+#if CARRAY_USE_NEON
+// Packed 3D float points (stride 3), returns first point left
+static int float_transform3_simd(float *d, const float *s, int npoint,
+				 const float m[16]) {
+  int i = 0;
+  float32x4_t c[12];  // x, y, z rows of the four columns
+  int j, k;
+  for (k = 0; k < 4; k++) {
+    for (j = 0; j < 3; j++) c[3*k+j] = vdupq_n_f32(m[4*k+j]);
+  }
+  for (; i + 4 <= npoint; i += 4) {
+    float32x4x3_t p = vld3q_f32(s + 3*i);
+    float32x4x3_t r;
+    for (k = 0; k < 3; k++) {
+      r.val[k] = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_f32(c[k], p.val[0]),
+					       vmulq_f32(c[3+k], p.val[1])),
+				     vmulq_f32(c[6+k], p.val[2])), c[9+k]);
+    }
+    vst3q_f32(d + 3*i, r);
+  }
+  return i;
+}
+#endif
+
+void carray_transform(void *dst, const void *src, int type,
+		      int npoint, int dim, int stride, const double m[16]) {
+  int i = 0, k;
+  if (type == CARRAY_FLOAT) {
+    float fm[16];
+    float *d = (float *)dst;
+    const float *s = (const float *)src;
+    for (k = 0; k < 16; k++) fm[k] = (float)m[k];
+    if ((dim == 2) && (stride == 2)) {
+      i = float_transform2_simd(d, s, npoint, fm);
+    }
+#if CARRAY_USE_NEON
+    else if ((dim == 3) && (stride == 3)) {
+      i = float_transform3_simd(d, s, npoint, fm);
+    }
+#endif
+    for (; i < npoint; i++) {
+      const float *p = s + i*stride;
+      float *r = d + i*stride;
+      float x = p[0], y = p[1], z = (dim == 3) ? p[2] : 0;
+      if (dim == 2) {
+	r[0] = (fm[0]*x + fm[4]*y) + fm[12];
+	r[1] = (fm[1]*x + fm[5]*y) + fm[13];
+      }
+      else {
+	for (k = 0; k < 3; k++) {
+	  r[k] = ((fm[k]*x + fm[4+k]*y) + fm[8+k]*z) + fm[12+k];
+	}
+      }
+    }
+  }
+  else if (type == CARRAY_DOUBLE) {
+    double *d = (double *)dst;
+    const double *s = (const double *)src;
+    for (; i < npoint; i++) {
+      const double *p = s + i*stride;
+      double *r = d + i*stride;
+      double x = p[0], y = p[1], z = (dim == 3) ? p[2] : 0;
+      for (k = 0; k < dim; k++) {
+	r[k] = ((m[k]*x + m[4+k]*y) + m[8+k]*z) + m[12+k];
+      }
+    }
+  }
+}
@@ -0,0 +1,71 @@
+#ifndef carraykernels_h
+#define carraykernels_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Bulk kernels over typed numeric arrays (see luacarray.cpp)
+
+  Arrays are a data pointer, element type and element count. Kernels
+  on two arrays take the smaller count and convert element types as
+  needed; same-type float paths use SIMD (NEON on ARM, SSE2 on x86).
+  Stores to byte elements clamp to 0..255, stores to int truncate.
+  No Android dependencies, so kernels can be checked on the host.
+*/
+
+enum {
+  CARRAY_BYTE,    // uint8_t
+  CARRAY_INT,     // int32_t
+  CARRAY_FLOAT,   // float
+  CARRAY_DOUBLE,  // double
+  CARRAY_NTYPES
+};
+
+extern const int carray_elemsize[CARRAY_NTYPES];
+
+double carray_get(const void *p, int type, int i);
+void carray_set(void *p, int type, int i, double v);
+
+// dst[i] = v
+void carray_fill(void *dst, int type, int n, double v);
+
+// dst[i] = src[i] with conversion; arrays may overlap
+void carray_copy(void *dst, int dtype, const void *src, int stype, int n);
+
+// dst[i] += b[i], or dst[i] += s when b is NULL
+void carray_add(void *dst, int type, const void *b, int btype,
+		double s, int n);
+
+// dst[i] *= b[i], or dst[i] *= s when b is NULL
+void carray_mul(void *dst, int type, const void *b, int btype,
+		double s, int n);
+
+// dst[i] += b[i]*s; b must not be NULL
+void carray_fma(void *dst, int type, const void *b, int btype,
+		double s, int n);
+
+// Minimum and maximum with the index of their first occurrence;
+// returns 0 for an empty array
+int carray_minmax(const void *p, int type, int n,
+		  double *min, int *imin, double *max, int *imax);
+
+// Sum accumulated in double (float arrays in 4 partial float sums
+// flushed every 256 elements, the same on every path)
+double carray_sum(const void *p, int type, int n);
+
+// Affine transform of npoint points of dim (2 or 3) coordinates,
+// stride elements apart, from src to dst (may be the same array).
+// m is a 4x4 column-major matrix as used by GL; 2D points have z = 0.
+// Only float and double arrays.
+void carray_transform(void *dst, const void *src, int type,
+		      int npoint, int dim, int stride, const double m[16]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
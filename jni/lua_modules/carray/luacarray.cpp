@@ -0,0 +1,452 @@
+/*
+  Lua module with typed numeric arrays (byte, int, float, double)
+
+  Arrays are userdata holding their elements inline, indexed from 1
+  like tables (a[i], #a). carray.pointer exports the data to GL and
+  other modules as lightuserdata. Slices are views sharing the data
+  of the array they were taken from, which they keep alive.
+  Bulk methods (fill, copy, add, mul, fma, transform2/3, min, max,
+  sum) run as native kernels over whole arrays, so vertex generation
+  and per-frame physics need no per-element Lua code; use slices to
+  work on a range.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <android/log.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+  #include "lua.h"
+  #include "lauxlib.h"
+#ifdef __cplusplus
+}
+#endif
+
+#include "carraykernels.h"
+#include "luacarray.h"
+
+#define MT_NAME "carray_mt"
+#define CARRAY_ALIGN 16
+#define TABLE_CHUNK 64
+
+#ifndef LOG_TAG
+#define LOG_TAG "lua"
+#endif
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO,LOG_TAG,__VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN,LOG_TAG,__VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR,LOG_TAG,__VA_ARGS__)
+
+typedef struct CArray {
+  char *data;
+  int type;
+  int n;
+} CArray;
+
+static const char *const typeNames[] = {"byte", "int", "float", "double", NULL};
+
+static CArray* lua_checkcarray(lua_State *L, int narg) {
+  return (CArray *)luaL_checkudata(L, narg, MT_NAME);
+}
+
+static CArray* lua_tocarray(lua_State *L, int narg) {
+  CArray *a = (CArray *)lua_touserdata(L, narg);
+  if ((a == NULL) || !lua_getmetatable(L, narg)) return NULL;
+  luaL_getmetatable(L, MT_NAME);
+  int same = lua_rawequal(L, -1, -2);
+  lua_pop(L, 2);
+  return same ? a : NULL;
+}
+
+// New zeroed array with inline data aligned for SIMD loads
+static CArray* lua_pushcarray(lua_State *L, int type, int n) {
+  size_t size = (size_t)n*carray_elemsize[type];
+  CArray *a = (CArray *)lua_newuserdata(L, sizeof(CArray) +
+					CARRAY_ALIGN - 1 + size);
+  uintptr_t p = (uintptr_t)(a + 1);
+  a->data = (char *)((p + CARRAY_ALIGN - 1) & ~(uintptr_t)(CARRAY_ALIGN - 1));
+  a->type = type;
+  a->n = n;
+  memset(a->data, 0, size);
+  luaL_getmetatable(L, MT_NAME);
+  lua_setmetatable(L, -2);
+  return a;
+}
+
+// Store n values of table t (from index 1) at element i of a
+static void lua_fromtable(lua_State *L, int t, CArray *a, int i, int n) {
+  for (int k = 0; k < n; k++) {
+    lua_rawgeti(L, t, k+1);
+    carray_set(a->data, a->type, i+k, lua_tonumber(L, -1));
+    lua_pop(L, 1);
+  }
+}
+
+// Scalar argument or array of the same size as a (count taken as the
+// smaller of the two)
+static const CArray* lua_checkoperand(lua_State *L, int narg, const CArray *a,
+				      double *s, int *n) {
+  *n = a->n;
+  if (lua_type(L, narg) == LUA_TNUMBER) {
+    *s = lua_tonumber(L, narg);
+    return NULL;
+  }
+  const CArray *b = lua_tocarray(L, narg);
+  if (b == NULL) luaL_typerror(L, narg, "number or carray");
+  if (b->n < *n) *n = b->n;
+  return b;
+}
+
+// First element i of a range (1-based, negative from the end) as an
+// offset in [0, n]
+static int lua_checkposition(lua_State *L, int narg, int n, int def) {
+  int i = luaL_optint(L, narg, def);
+  if (i < 0) i += n + 1;
+  luaL_argcheck(L, (i >= 1) && (i <= n + 1), narg, "index out of range");
+  return i - 1;
+}
+
+// Last element j of a range (default n) as an end offset in [0, n]
+static int lua_checkend(lua_State *L, int narg, int n) {
+  int j = luaL_optint(L, narg, n);
+  if (j < 0) j += n + 1;
+  luaL_argcheck(L, (j >= 0) && (j <= n), narg, "index out of range");
+  return j;
+}
+
+// carray.new(type, n | table | carray)
+static int lua_carray_new(lua_State *L) {
+  int type = luaL_checkoption(L, 1, NULL, typeNames);
+  if (lua_istable(L, 2)) {
+    int n = lua_objlen(L, 2);
+    CArray *a = lua_pushcarray(L, type, n);
+    lua_fromtable(L, 2, a, 0, n);
+    return 1;
+  }
+  const CArray *src = lua_tocarray(L, 2);
+  if (src) {
+    CArray *a = lua_pushcarray(L, type, src->n);
+    carray_copy(a->data, type, src->data, src->type, src->n);
+    return 1;
+  }
+  int n = luaL_checkint(L, 2);
+  luaL_argcheck(L, n >= 0, 2, "invalid array size");
+  lua_pushcarray(L, type, n);
+  return 1;
+}
+
+// carray.pointer(a [, i]) -> lightuserdata to element i
+static int lua_carray_pointer(lua_State *L) {
+  CArray *a = lua_checkcarray(L, 1);
+  int i = lua_checkposition(L, 2, a->n, 1);
+  lua_pushlightuserdata(L, a->data + (size_t)i*carray_elemsize[a->type]);
+  return 1;
+}
+
+static int lua_carray_type(lua_State *L) {
+  CArray *a = lua_checkcarray(L, 1);
+  lua_pushstring(L, typeNames[a->type]);
+  return 1;
+}
+
+// Size of the data in bytes, e.g. for glBufferData
+static int lua_carray_bytes(lua_State *L) {
+  CArray *a = lua_checkcarray(L, 1);
+  lua_pushinteger(L, (lua_Integer)a->n*carray_elemsize[a->type]);
+  return 1;
+}
+
+// a:slice(i [, j]) -> view of elements i..j
+static int lua_carray_slice(lua_State *L) {
+  CArray *a = lua_checkcarray(L, 1);
+  int i = lua_checkposition(L, 2, a->n, 1);
+  int j = lua_checkend(L, 3, a->n);
+  if (j < i) j = i;
+  CArray *v = (CArray *)lua_newuserdata(L, sizeof(CArray));
+  v->data = a->data + (size_t)i*carray_elemsize[a->type];
+  v->type = a->type;
+  v->n = j - i;
+  luaL_getmetatable(L, MT_NAME);
+  lua_setmetatable(L, -2);
+  // Keep the viewed array alive
+  lua_createtable(L, 1, 0);
+  lua_pushvalue(L, 1);
+  lua_rawseti(L, -2, 1);
+  lua_setfenv(L, -2);
+  return 1;
+}
+
+// a:totable([i, j]) -> {a[i], ..., a[j]}
+static int lua_carray_totable(lua_State *L) {
+  CArray *a = lua_checkcarray(L, 1);
+  int i = lua_checkposition(L, 2, a->n, 1);
+  int j = lua_checkend(L, 3, a->n);
+  int n = (j > i) ? j - i : 0;
+  lua_createtable(L, n, 0);
+  switch (a->type) {
+  case CARRAY_INT:
+    lua_rawsetarray(L, -1, 1, LUA_AINT, a->data + i*sizeof(int32_t), n);
+    break;
+  case CARRAY_FLOAT:
+    lua_rawsetarray(L, -1, 1, LUA_AFLOAT, a->data + i*sizeof(float), n);
+    break;
+  case CARRAY_DOUBLE:
+    if (sizeof(lua_Number) == sizeof(double)) {
+      lua_rawsetarray(L, -1, 1, LUA_ANUMBER, a->data + i*sizeof(double), n);
+      break;
+    }
+    // FALLTHROUGH
+  default: {
+    lua_Number chunk[TABLE_CHUNK];
+    for (int base = 0; base < n; base += TABLE_CHUNK) {
+      int m = (n - base < TABLE_CHUNK) ? n - base : TABLE_CHUNK;
+      for (int k = 0; k < m; k++) {
+	chunk[k] = carray_get(a->data, a->type, i + base + k);
+      }
+      lua_rawsetarray(L, -1, base + 1, LUA_ANUMBER, chunk, m);
+    }
+  }
+  }
+  return 1;
+}
+
+// a:fill(v)
+static int lua_carray_fill(lua_State *L) {
+  CArray *a = lua_checkcarray(L, 1);
+  carray_fill(a->data, a->type, a->n, luaL_checknumber(L, 2));
+  lua_settop(L, 1);
+  return 1;
+}
+
+// a:copy(src [, i]) stores a table or carray starting at element i
+static int lua_carray_copy(lua_State *L) {
+  CArray *a = lua_checkcarray(L, 1);
+  int i = lua_checkposition(L, 3, a->n, 1);
+  int n;
+  if (lua_istable(L, 2)) {
+    n = lua_objlen(L, 2);
+    luaL_argcheck(L, n <= a->n - i, 2, "source too long");
+    lua_fromtable(L, 2, a, i, n);
+  }
+  else {
+    const CArray *src = lua_tocarray(L, 2);
+    if (src == NULL) luaL_typerror(L, 2, "table or carray");
+    n = src->n;
+    luaL_argcheck(L, n <= a->n - i, 2, "source too long");
+    carray_copy(a->data + (size_t)i*carray_elemsize[a->type], a->type,
+		src->data, src->type, n);
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+// a:add(x), a:mul(x) with x a number or carray
+static int lua_carray_add(lua_State *L) {
+  CArray *a = lua_checkcarray(L, 1);
+  double s = 0;
+  int n;
+  const CArray *b = lua_checkoperand(L, 2, a, &s, &n);
+  carray_add(a->data, a->type, b ? b->data : NULL, b ? b->type : 0, s, n);
+  lua_settop(L, 1);
+  return 1;
+}
+
+static int lua_carray_mul(lua_State *L) {
+  CArray *a = lua_checkcarray(L, 1);
+  double s = 0;
+  int n;
+  const CArray *b = lua_checkoperand(L, 2, a, &s, &n);
+  carray_mul(a->data, a->type, b ? b->data : NULL, b ? b->type : 0, s, n);
+  lua_settop(L, 1);
+  return 1;
+}
+
+// a:fma(b, s): a += b*s, e.g. position:fma(velocity, dt)
+static int lua_carray_fma(lua_State *L) {
+  CArray *a = lua_checkcarray(L, 1);
+  double bs = 0;
+  int n;
+  const CArray *b = lua_checkoperand(L, 2, a, &bs, &n);
+  double s = luaL_checknumber(L, 3);
+  if (b) {
+    carray_fma(a->data, a->type, b->data, b->type, s, n);
+  }
+  else {
+    carray_add(a->data, a->type, NULL, 0, bs*s, n);
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+// Matrix argument: 6 numbers {a, b, c, d, tx, ty} (2D affine) or 16
+// (GL column-major 4x4), from a table or carray
+static void lua_checkmatrix(lua_State *L, int narg, double m[16]) {
+  int n;
+  const CArray *c = lua_tocarray(L, narg);
+  if (c) {
+    n = c->n;
+  }
+  else {
+    luaL_checktype(L, narg, LUA_TTABLE);
+    n = lua_objlen(L, narg);
+  }
+  luaL_argcheck(L, (n == 6) || (n == 16), narg, "matrix needs 6 or 16 numbers");
+  double v[16];
+  for (int k = 0; k < n; k++) {
+    if (c) {
+      v[k] = carray_get(c->data, c->type, k);
+    }
+    else {
+      lua_rawgeti(L, narg, k+1);
+      v[k] = lua_tonumber(L, -1);
+      lua_pop(L, 1);
+    }
+  }
+  if (n == 16) {
+    memcpy(m, v, sizeof(v));
+    return;
+  }
+  memset(m, 0, 16*sizeof(double));
+  m[0] = v[0]; m[1] = v[1];
+  m[4] = v[2]; m[5] = v[3];
+  m[10] = m[15] = 1;
+  m[12] = v[4]; m[13] = v[5];
+}
+
+// a:transform2/3(m [, dst, stride]) transforms (x, y[, z]) points
+// stride elements apart, in place or into dst; returns the result
+static int lua_carray_transform(lua_State *L, int dim) {
+  CArray *a = lua_checkcarray(L, 1);
+  double m[16];
+  lua_checkmatrix(L, 2, m);
+  int dstArg = lua_isnoneornil(L, 3) ? 1 : 3;
+  CArray *dst = lua_checkcarray(L, dstArg);
+  int stride = luaL_optint(L, 4, dim);
+  luaL_argcheck(L, (a->type == CARRAY_FLOAT) || (a->type == CARRAY_DOUBLE),
+		1, "float or double array expected");
+  luaL_argcheck(L, (dst->type == a->type) && (dst->n >= a->n), 3,
+		"destination must match source");
+  luaL_argcheck(L, stride >= dim, 4, "invalid stride");
+  int npoint = (a->n >= dim) ? (a->n - dim)/stride + 1 : 0;
+  carray_transform(dst->data, a->data, a->type, npoint, dim, stride, m);
+  lua_pushvalue(L, dstArg);
+  return 1;
+}
+
+static int lua_carray_transform2(lua_State *L) {
+  return lua_carray_transform(L, 2);
+}
+
+static int lua_carray_transform3(lua_State *L) {
+  return lua_carray_transform(L, 3);
+}
+
+// a:min(), a:max() -> value, index (nil for an empty array)
+static int lua_carray_minmax(lua_State *L, int wantMax) {
+  CArray *a = lua_checkcarray(L, 1);
+  double min, max;
+  int imin, imax;
+  if (!carray_minmax(a->data, a->type, a->n, &min, &imin, &max, &imax)) {
+    return 0;
+  }
+  lua_pushnumber(L, wantMax ? max : min);
+  lua_pushinteger(L, (wantMax ? imax : imin) + 1);
+  return 2;
+}
+
+static int lua_carray_min(lua_State *L) {
+  return lua_carray_minmax(L, 0);
+}
+
+static int lua_carray_max(lua_State *L) {
+  return lua_carray_minmax(L, 1);
+}
+
+static int lua_carray_sum(lua_State *L) {
+  CArray *a = lua_checkcarray(L, 1);
+  lua_pushnumber(L, carray_sum(a->data, a->type, a->n));
+  return 1;
+}
+
+// a[i] for numbers, methods otherwise (upvalue 1)
+static int lua_carray_index(lua_State *L) {
+  CArray *a = (CArray *)lua_touserdata(L, 1);
+  if (lua_type(L, 2) == LUA_TNUMBER) {
+    int i = lua_tointeger(L, 2);
+    if ((i < 1) || (i > a->n)) return 0;
+    lua_pushnumber(L, carray_get(a->data, a->type, i-1));
+    return 1;
+  }
+  lua_pushvalue(L, 2);
+  lua_rawget(L, lua_upvalueindex(1));
+  return 1;
+}
+
+static int lua_carray_newindex(lua_State *L) {
+  CArray *a = (CArray *)lua_touserdata(L, 1);
+  int i = luaL_checkint(L, 2);
+  luaL_argcheck(L, (i >= 1) && (i <= a->n), 2, "index out of range");
+  carray_set(a->data, a->type, i-1, luaL_checknumber(L, 3));
+  return 0;
+}
+
+static int lua_carray_len(lua_State *L) {
+  CArray *a = (CArray *)lua_touserdata(L, 1);
+  lua_pushinteger(L, a->n);
+  return 1;
+}
+
+static int lua_carray_tostring(lua_State *L) {
+  CArray *a = lua_checkcarray(L, 1);
+  lua_pushfstring(L, "carray(%s, %d): %p", typeNames[a->type], a->n, a->data);
+  return 1;
+}
+
+static const struct luaL_reg carray_functions[] = {
+  {"new", lua_carray_new},
+  {"pointer", lua_carray_pointer},
+  {NULL, NULL}
+};
+
+static const struct luaL_reg carray_methods[] = {
+  {"pointer", lua_carray_pointer},
+  {"type", lua_carray_type},
+  {"bytes", lua_carray_bytes},
+  {"slice", lua_carray_slice},
+  {"totable", lua_carray_totable},
+  {"fill", lua_carray_fill},
+  {"copy", lua_carray_copy},
+  {"add", lua_carray_add},
+  {"mul", lua_carray_mul},
+  {"fma", lua_carray_fma},
+  {"transform2", lua_carray_transform2},
+  {"transform3", lua_carray_transform3},
+  {"min", lua_carray_min},
+  {"max", lua_carray_max},
+  {"sum", lua_carray_sum},
+  {NULL, NULL}
+};
+
+#ifdef __cplusplus
+extern "C"
+#endif
+int luaopen_carray (lua_State *L) {
+  luaL_newmetatable(L, MT_NAME);
+  // __index resolves element numbers first, then methods
+  lua_newtable(L);
+  luaL_register(L, NULL, carray_methods);
+  lua_pushcclosure(L, lua_carray_index, 1);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, lua_carray_newindex);
+  lua_setfield(L, -2, "__newindex");
+  lua_pushcfunction(L, lua_carray_len);
+  lua_setfield(L, -2, "__len");
+  lua_pushcfunction(L, lua_carray_tostring);
+  lua_setfield(L, -2, "__tostring");
+  lua_pop(L, 1);
+
+  luaL_register(L, "carray", carray_functions);
+  return 1;
+}
@@ -0,0 +1,21 @@
+#ifndef luacarray_h
+#define luacarray_h
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+  #include "lua.h"
+  #include "lualib.h"
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef __cplusplus
+#undef LUALIB_API
+#define LUALIB_API extern "C"
+#endif
+
+LUALIB_API int (luaopen_carray) (lua_State *L);
+
+#endif
@@ -0,0 +1,9 @@
+LOCAL_PATH := $(call my-dir)
+
+# glbatch module to batch 2D primitives into single GLES draw calls
+include $(CLEAR_VARS)
+LOCAL_MODULE := glbatch
+LOCAL_SRC_FILES := luaglbatch.cpp
+LOCAL_LDLIBS := -llog -lGLESv1_CM
+LOCAL_SHARED_LIBRARIES := lua-activity
+include $(BUILD_SHARED_LIBRARY)
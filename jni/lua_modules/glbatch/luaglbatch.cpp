@@ -0,0 +1,417 @@
+/*
+  Lua module to batch 2D primitives (rects, quads, circles)
+  into one interleaved vertex array and flush them with
+  a single GLES draw call per texture
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <GLES/gl.h>
+#include <android/log.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+  #include "lua.h"
+  #include "lauxlib.h"
+#ifdef __cplusplus
+}
+#endif
+
+#include "luaglbatch.h"
+
+#define MT_NAME "glbatch_mt"
+#define DEFAULT_NUM_VERTEX 4096
+#define DEFAULT_NUM_SEGMENT 16
+#define DEFAULT_CIRCLE_SEGMENTS 32
+#define MAX_CIRCLE_SEGMENTS 360
+// Bound on the vertex arena (320 MB), so that sizes never overflow an int
+#define MAX_NUM_VERTEX (1 << 24)
+
+#ifndef LOG_TAG
+#define LOG_TAG "lua"
+#endif
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO,LOG_TAG,__VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN,LOG_TAG,__VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR,LOG_TAG,__VA_ARGS__)
+
+// Interleaved vertex: position, texture coordinate, color
+typedef struct BatchVertex {
+  GLfloat x, y;
+  GLfloat u, v;
+  GLubyte r, g, b, a;
+} BatchVertex;
+
+// Run of consecutive vertices sharing the same texture
+typedef struct BatchSegment {
+  GLuint texture;
+  GLint first;
+} BatchSegment;
+
+class BatchClass {
+public:
+  // Per-frame vertex arena, grown on demand and reset by flush()
+  BatchVertex *vertex;
+  int nVertex, maxVertex;
+
+  BatchSegment *segment;
+  int nSegment, maxSegment;
+
+  GLubyte color[4];
+  GLuint texture;
+
+  // Cached unit circle for the last segment count used
+  GLfloat *circle;
+  int nCircle;
+
+  int nFlush;  // draw calls issued by last flush
+
+  BatchClass(int n = DEFAULT_NUM_VERTEX):
+    vertex(0), nVertex(0), maxVertex(0),
+    segment(0), nSegment(0), maxSegment(0),
+    texture(0), circle(0), nCircle(0), nFlush(0) {
+    color[0] = color[1] = color[2] = color[3] = 255;
+    reserve(n);
+  }
+
+  virtual ~BatchClass() {
+    if (vertex) free(vertex);
+    if (segment) free(segment);
+    if (circle) free(circle);
+  }
+
+  bool reserve(int n) {
+    if (n <= maxVertex) return true;
+    if (n > MAX_NUM_VERTEX) return false;
+    int newMax = maxVertex ? maxVertex : DEFAULT_NUM_VERTEX;
+    while (newMax < n)
+      newMax = (newMax > MAX_NUM_VERTEX/2) ? MAX_NUM_VERTEX : 2*newMax;
+    BatchVertex *p =
+      (BatchVertex *)realloc(vertex, newMax*sizeof(BatchVertex));
+    if (p == NULL) return false;
+    vertex = p;
+    maxVertex = newMax;
+    return true;
+  }
+
+  // Start a new segment if texture has changed since last vertex
+  bool beginSegment() {
+    if ((nSegment > 0) && (segment[nSegment-1].texture == texture))
+      return true;
+    if (nSegment > 0 && segment[nSegment-1].first == nVertex) {
+      // Empty segment: just retarget it
+      segment[nSegment-1].texture = texture;
+      return true;
+    }
+    if (nSegment >= maxSegment) {
+      int newMax = maxSegment ? 2*maxSegment : DEFAULT_NUM_SEGMENT;
+      BatchSegment *p =
+	(BatchSegment *)realloc(segment, newMax*sizeof(BatchSegment));
+      if (p == NULL) return false;
+      segment = p;
+      maxSegment = newMax;
+    }
+    segment[nSegment].texture = texture;
+    segment[nSegment].first = nVertex;
+    nSegment++;
+    return true;
+  }
+
+  // Reserve room for n more vertices in current segment
+  BatchVertex* alloc(int n) {
+    if (!beginSegment()) return NULL;
+    if (!reserve(nVertex + n)) return NULL;
+    BatchVertex *p = vertex + nVertex;
+    nVertex += n;
+    return p;
+  }
+
+  inline void put(BatchVertex *p, GLfloat x, GLfloat y,
+		  GLfloat u, GLfloat v) {
+    p->x = x;
+    p->y = y;
+    p->u = u;
+    p->v = v;
+    memcpy(&p->r, color, 4);
+  }
+
+  bool rect(GLfloat x1, GLfloat y1, GLfloat x2, GLfloat y2,
+	    GLfloat u1 = 0, GLfloat v1 = 0, GLfloat u2 = 1, GLfloat v2 = 1) {
+    BatchVertex *p = alloc(6);
+    if (p == NULL) return false;
+    put(p++, x1, y1, u1, v1);
+    put(p++, x2, y1, u2, v1);
+    put(p++, x1, y2, u1, v2);
+    put(p++, x1, y2, u1, v2);
+    put(p++, x2, y1, u2, v1);
+    put(p++, x2, y2, u2, v2);
+    return true;
+  }
+
+  // Quad corners given in triangle strip order (as in GL_TRIANGLE_STRIP)
+  bool quad(const GLfloat *xy) {
+    BatchVertex *p = alloc(6);
+    if (p == NULL) return false;
+    put(p++, xy[0], xy[1], 0, 0);
+    put(p++, xy[2], xy[3], 1, 0);
+    put(p++, xy[4], xy[5], 0, 1);
+    put(p++, xy[4], xy[5], 0, 1);
+    put(p++, xy[2], xy[3], 1, 0);
+    put(p++, xy[6], xy[7], 1, 1);
+    return true;
+  }
+
+  bool setCircle(int n) {
+    if (n == nCircle) return true;
+    GLfloat *p = (GLfloat *)realloc(circle, 2*(n+1)*sizeof(GLfloat));
+    if (p == NULL) return false;
+    circle = p;
+    nCircle = n;
+    for (int i = 0; i <= n; i++) {
+      double a = 2*M_PI*i/n;
+      circle[2*i] = cos(a);
+      circle[2*i+1] = sin(a);
+    }
+    return true;
+  }
+
+  // Circle as a triangle list fan so it can share the draw call
+  bool disc(GLfloat x, GLfloat y, GLfloat r, int n) {
+    if (!setCircle(n)) return false;
+    BatchVertex *p = alloc(3*n);
+    if (p == NULL) return false;
+    for (int i = 0; i < n; i++) {
+      const GLfloat *c = circle + 2*i;
+      put(p++, x, y, 0.5f, 0.5f);
+      put(p++, x + r*c[0], y + r*c[1], 0.5f*(1+c[0]), 0.5f*(1+c[1]));
+      put(p++, x + r*c[2], y + r*c[3], 0.5f*(1+c[2]), 0.5f*(1+c[3]));
+    }
+    return true;
+  }
+
+  void clear() {
+    nVertex = 0;
+    nSegment = 0;
+  }
+
+  // Issue one glDrawArrays per texture segment, then reset the arena
+  int flush() {
+    nFlush = 0;
+    if (nVertex == 0) {
+      clear();
+      return 0;
+    }
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(2, GL_FLOAT, sizeof(BatchVertex), &vertex->x);
+    glTexCoordPointer(2, GL_FLOAT, sizeof(BatchVertex), &vertex->u);
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(BatchVertex), &vertex->r);
+
+    GLuint boundTexture = 0;
+    for (int i = 0; i < nSegment; i++) {
+      GLint first = segment[i].first;
+      GLint last = (i+1 < nSegment) ? segment[i+1].first : nVertex;
+      if (last <= first) continue;
+
+      GLuint tex = segment[i].texture;
+      if (tex != boundTexture) {
+	if (tex) {
+	  if (boundTexture == 0) {
+	    glEnable(GL_TEXTURE_2D);
+	    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	  }
+	  glBindTexture(GL_TEXTURE_2D, tex);
+	}
+	else {
+	  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	  glDisable(GL_TEXTURE_2D);
+	}
+	boundTexture = tex;
+      }
+
+      glDrawArrays(GL_TRIANGLES, first, last - first);
+      nFlush++;
+    }
+
+    if (boundTexture) {
+      glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+      glDisable(GL_TEXTURE_2D);
+    }
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+
+    clear();
+    return nFlush;
+  }
+};
+
+static GLubyte lua_tocolorbyte(lua_State *L, int narg, lua_Number def) {
+  lua_Number c = luaL_optnumber(L, narg, def);
+  if (c < 0) c = 0;
+  else if (c > 1) c = 1;
+  return (GLubyte)(255*c + 0.5);
+}
+
+static BatchClass* lua_checkbatchclass(lua_State *L, int narg) {
+  void *ud = luaL_checkudata(L, narg, MT_NAME);
+  luaL_argcheck(L, *(BatchClass **)ud != NULL, narg, "invalid object");
+  return *(BatchClass **)ud;
+}
+
+static int lua_glbatch_new(lua_State *L) {
+  int n = luaL_optint(L, 1, DEFAULT_NUM_VERTEX);
+  luaL_argcheck(L, n > 0, 1, "invalid vertex count");
+  BatchClass **ud =
+    (BatchClass **)lua_newuserdata(L, sizeof(BatchClass *));
+  *ud = new BatchClass(n);
+  luaL_getmetatable(L, MT_NAME);
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+static int lua_glbatch_setColor(lua_State *L) {
+  BatchClass *batch = lua_checkbatchclass(L, 1);
+  batch->color[0] = lua_tocolorbyte(L, 2, 1);
+  batch->color[1] = lua_tocolorbyte(L, 3, 1);
+  batch->color[2] = lua_tocolorbyte(L, 4, 1);
+  batch->color[3] = lua_tocolorbyte(L, 5, 1);
+  return 0;
+}
+
+static int lua_glbatch_setTexture(lua_State *L) {
+  BatchClass *batch = lua_checkbatchclass(L, 1);
+  batch->texture = luaL_optint(L, 2, 0);
+  return 0;
+}
+
+static int lua_glbatch_rect(lua_State *L) {
+  BatchClass *batch = lua_checkbatchclass(L, 1);
+  GLfloat x1 = luaL_checknumber(L, 2);
+  GLfloat y1 = luaL_checknumber(L, 3);
+  GLfloat x2 = luaL_checknumber(L, 4);
+  GLfloat y2 = luaL_checknumber(L, 5);
+  GLfloat u1 = luaL_optnumber(L, 6, 0);
+  GLfloat v1 = luaL_optnumber(L, 7, 0);
+  GLfloat u2 = luaL_optnumber(L, 8, 1);
+  GLfloat v2 = luaL_optnumber(L, 9, 1);
+  if (!batch->rect(x1, y1, x2, y2, u1, v1, u2, v2))
+    return luaL_error(L, "Could not allocate vertex memory");
+  return 0;
+}
+
+// Whole array of rects as flat {x1, y1, x2, y2, ...} table
+static int lua_glbatch_rects(lua_State *L) {
+  BatchClass *batch = lua_checkbatchclass(L, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  int n = lua_objlen(L, 2) / 4;
+  if (n > (MAX_NUM_VERTEX - batch->nVertex)/6 ||
+      !batch->reserve(batch->nVertex + 6*n))
+    return luaL_error(L, "Could not allocate vertex memory");
+
+  for (int i = 0; i < n; i++) {
+    GLfloat r[4];
+    for (int k = 0; k < 4; k++) {
+      lua_rawgeti(L, 2, 4*i+k+1);
+      r[k] = lua_tonumber(L, -1);
+      lua_pop(L, 1);
+    }
+    if (!batch->rect(r[0], r[1], r[2], r[3]))
+      return luaL_error(L, "Could not allocate vertex memory");
+  }
+  lua_pushinteger(L, n);
+  return 1;
+}
+
+static int lua_glbatch_quad(lua_State *L) {
+  BatchClass *batch = lua_checkbatchclass(L, 1);
+  GLfloat xy[8];
+  for (int k = 0; k < 8; k++) {
+    xy[k] = luaL_checknumber(L, k+2);
+  }
+  if (!batch->quad(xy))
+    return luaL_error(L, "Could not allocate vertex memory");
+  return 0;
+}
+
+static int lua_glbatch_circle(lua_State *L) {
+  BatchClass *batch = lua_checkbatchclass(L, 1);
+  GLfloat x = luaL_checknumber(L, 2);
+  GLfloat y = luaL_checknumber(L, 3);
+  GLfloat r = luaL_checknumber(L, 4);
+  int n = luaL_optint(L, 5, DEFAULT_CIRCLE_SEGMENTS);
+  luaL_argcheck(L, (n >= 3) && (n <= MAX_CIRCLE_SEGMENTS), 5,
+		"invalid number of segments");
+  if (!batch->disc(x, y, r, n))
+    return luaL_error(L, "Could not allocate vertex memory");
+  return 0;
+}
+
+static int lua_glbatch_flush(lua_State *L) {
+  BatchClass *batch = lua_checkbatchclass(L, 1);
+  lua_pushinteger(L, batch->flush());
+  return 1;
+}
+
+static int lua_glbatch_clear(lua_State *L) {
+  BatchClass *batch = lua_checkbatchclass(L, 1);
+  batch->clear();
+  return 0;
+}
+
+static int lua_glbatch_getCount(lua_State *L) {
+  BatchClass *batch = lua_checkbatchclass(L, 1);
+  lua_pushinteger(L, batch->nVertex);
+  lua_pushinteger(L, batch->nSegment);
+  return 2;
+}
+
+static int lua_glbatch_delete(lua_State *L) {
+  BatchClass *batch = lua_checkbatchclass(L, 1);
+  delete batch;
+  *(BatchClass **)lua_touserdata(L, 1) = NULL;
+  return 0;
+}
+
+static int lua_glbatch_tostring(lua_State *L) {
+  BatchClass *batch = lua_checkbatchclass(L, 1);
+  lua_pushfstring(L, "GLBatch(%p): %d vertices, %d segments",
+		  batch, batch->nVertex, batch->nSegment);
+  return 1;
+}
+
+static const struct luaL_reg glbatch_functions[] = {
+  {"new", lua_glbatch_new},
+  {NULL, NULL}
+};
+
+static const struct luaL_reg glbatch_methods[] = {
+  {"setColor", lua_glbatch_setColor},
+  {"setTexture", lua_glbatch_setTexture},
+  {"rect", lua_glbatch_rect},
+  {"rects", lua_glbatch_rects},
+  {"quad", lua_glbatch_quad},
+  {"circle", lua_glbatch_circle},
+  {"flush", lua_glbatch_flush},
+  {"clear", lua_glbatch_clear},
+  {"getCount", lua_glbatch_getCount},
+  {"__gc", lua_glbatch_delete},
+  {"__tostring", lua_glbatch_tostring},
+  {NULL, NULL}
+};
+
+#ifdef __cplusplus
+extern "C"
+#endif
+int luaopen_glbatch (lua_State *L) {
+  luaL_newmetatable(L, MT_NAME);
+  // OO access: mt.__index = mt
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  luaL_register(L, NULL, glbatch_methods);
+
+  luaL_register(L, "glbatch", glbatch_functions);
+  return 1;
+}
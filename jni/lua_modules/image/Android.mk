@@ -0,0 +1,12 @@
+LOCAL_PATH := $(call my-dir)
+
+# image module with 8-bit kernels for camera frames
+include $(CLEAR_VARS)
+LOCAL_MODULE := image
+LOCAL_SRC_FILES := luaimage.cpp imagekernels.c
+ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
+LOCAL_ARM_NEON := true
+endif
+LOCAL_LDLIBS := -llog
+LOCAL_SHARED_LIBRARIES := lua-activity
+include $(BUILD_SHARED_LIBRARY)
@@ -0,0 +1,411 @@
+/*
+  8-bit image kernels for camera frames (see imagekernels.h)
+  SIMD paths: NEON on ARM, SSE2 on x86, scalar otherwise.
+  All paths produce identical results.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define IMAGE_USE_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define IMAGE_USE_SSE2 1
+#endif
+
+#include "imagekernels.h"
+
+#define ROTATE_TILE 16
+
+/* Row band parallelism */
+
+typedef void (*image_rows_func)(void *arg, int row0, int row1, int part);
+
+typedef struct imageBand {
+  image_rows_func fn;
+  void *arg;
+  int row0, row1, part;
+} imageBand;
+
+static void *image_band_thread(void *p) {
+  imageBand *band = (imageBand *)p;
+  band->fn(band->arg, band->row0, band->row1, band->part);
+  return NULL;
+}
+
+// Runs fn over [0, nrows) in up to nthreads bands, returns bands used
+static int image_parallel(int nrows, int nthreads,
+			  image_rows_func fn, void *arg) {
+  imageBand band[IMAGE_MAX_THREADS];
+  pthread_t thread[IMAGE_MAX_THREADS];
+  int started[IMAGE_MAX_THREADS];
+  int nband, k, size;
+
+  if (nthreads > IMAGE_MAX_THREADS) nthreads = IMAGE_MAX_THREADS;
+  if (nthreads > nrows) nthreads = nrows;
+  if (nthreads <= 1) {
+    fn(arg, 0, nrows, 0);
+    return 1;
+  }
+
+  size = (nrows + nthreads - 1)/nthreads;
+  for (nband = 0; nband*size < nrows; nband++) {
+    band[nband].fn = fn;
+    band[nband].arg = arg;
+    band[nband].row0 = nband*size;
+    band[nband].row1 = (nband+1)*size < nrows ? (nband+1)*size : nrows;
+    band[nband].part = nband;
+  }
+
+  // Calling thread runs the first band itself
+  for (k = 1; k < nband; k++) {
+    started[k] = (pthread_create(thread+k, NULL,
+				 image_band_thread, band+k) == 0);
+    if (!started[k]) image_band_thread(band+k);
+  }
+  image_band_thread(band);
+  for (k = 1; k < nband; k++) {
+    if (started[k]) pthread_join(thread[k], NULL);
+  }
+  return nband;
+}
+
+/* Copy, crop, rotate */
+
+void image_copy(const uint8_t *src, int width, int height, int stride,
+		uint8_t *dst, int dstStride) {
+  image_crop(src, stride, 0, 0, width, height, dst, dstStride);
+}
+
+void image_crop(const uint8_t *src, int stride,
+		int x, int y, int cw, int ch,
+		uint8_t *dst, int dstStride) {
+  int j;
+  src += y*stride + x;
+  if ((stride == cw) && (dstStride == cw)) {
+    memcpy(dst, src, cw*ch);
+    return;
+  }
+  for (j = 0; j < ch; j++) {
+    memcpy(dst + j*dstStride, src + j*stride, cw);
+  }
+}
+
+void image_rotate90(const uint8_t *src, int width, int height, int stride,
+		    int turns, uint8_t *dst, int dstStride) {
+  int i, j, ti, tj;
+  turns &= 3;
+  if (turns == 0) {
+    image_copy(src, width, height, stride, dst, dstStride);
+    return;
+  }
+  if (turns == 2) {
+    for (j = 0; j < height; j++) {
+      const uint8_t *s = src + j*stride;
+      uint8_t *d = dst + (height-1-j)*dstStride + width-1;
+      for (i = 0; i < width; i++) *d-- = s[i];
+    }
+    return;
+  }
+
+  // Transpose in tiles so both source and destination stay in cache
+  for (tj = 0; tj < height; tj += ROTATE_TILE) {
+    int jend = (tj + ROTATE_TILE < height) ? tj + ROTATE_TILE : height;
+    for (ti = 0; ti < width; ti += ROTATE_TILE) {
+      int iend = (ti + ROTATE_TILE < width) ? ti + ROTATE_TILE : width;
+      for (j = tj; j < jend; j++) {
+	const uint8_t *s = src + j*stride;
+	if (turns == 1) {
+	  // Clockwise: src(i, j) -> dst(height-1-j, i)
+	  for (i = ti; i < iend; i++)
+	    dst[i*dstStride + height-1-j] = s[i];
+	}
+	else {
+	  // Counter-clockwise: src(i, j) -> dst(j, width-1-i)
+	  for (i = ti; i < iend; i++)
+	    dst[(width-1-i)*dstStride + j] = s[i];
+	}
+      }
+    }
+  }
+}
+
+/* Box downscale */
+
+typedef struct boxArgs {
+  const uint8_t *src;
+  int stride, factor;
+  uint8_t *dst;
+  int dstWidth, dstStride;
+} boxArgs;
+
+// 2x2 box filter of one destination row, returns first unfiltered column
+static int box2_row_simd(const uint8_t *a, const uint8_t *b,
+			 uint8_t *d, int dstWidth) {
+  int i = 0;
+#if IMAGE_USE_NEON
+  for (; i + 8 <= dstWidth; i += 8) {
+    uint16x8_t sum = vpaddlq_u8(vld1q_u8(a + 2*i));
+    sum = vpadalq_u8(sum, vld1q_u8(b + 2*i));
+    vst1_u8(d + i, vrshrn_n_u16(sum, 2));
+  }
+#elif IMAGE_USE_SSE2
+  const __m128i lowByte = _mm_set1_epi16(0x00ff);
+  const __m128i two = _mm_set1_epi16(2);
+  for (; i + 16 <= dstWidth; i += 16) {
+    __m128i out[2];
+    int h;
+    for (h = 0; h < 2; h++) {
+      __m128i va = _mm_loadu_si128((const __m128i *)(a + 2*i + 16*h));
+      __m128i vb = _mm_loadu_si128((const __m128i *)(b + 2*i + 16*h));
+      __m128i sum = _mm_add_epi16(_mm_and_si128(va, lowByte),
+				  _mm_srli_epi16(va, 8));
+      sum = _mm_add_epi16(sum, _mm_and_si128(vb, lowByte));
+      sum = _mm_add_epi16(sum, _mm_srli_epi16(vb, 8));
+      out[h] = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+    }
+    _mm_storeu_si128((__m128i *)(d + i), _mm_packus_epi16(out[0], out[1]));
+  }
+#endif
+  return i;
+}
+
+static void box_rows(void *arg, int row0, int row1, int part) {
+  boxArgs *p = (boxArgs *)arg;
+  int f = p->factor;
+  int n = f*f;
+  int i, j, u, v;
+  (void)part;
+  for (j = row0; j < row1; j++) {
+    const uint8_t *s = p->src + j*f*p->stride;
+    uint8_t *d = p->dst + j*p->dstStride;
+    i = 0;
+    if (f == 2) {
+      i = box2_row_simd(s, s + p->stride, d, p->dstWidth);
+    }
+    for (; i < p->dstWidth; i++) {
+      unsigned int sum = 0;
+      for (v = 0; v < f; v++) {
+	const uint8_t *r = s + v*p->stride + i*f;
+	for (u = 0; u < f; u++) sum += r[u];
+      }
+      d[i] = (sum + n/2)/n;
+    }
+  }
+}
+
+void image_downscale_box(const uint8_t *src, int width, int height,
+			 int stride, int factor,
+			 uint8_t *dst, int dstStride, int nthreads) {
+  boxArgs args;
+  if (factor < 1) return;
+  args.src = src;
+  args.stride = stride;
+  args.factor = factor;
+  args.dst = dst;
+  args.dstWidth = width/factor;
+  args.dstStride = dstStride;
+  image_parallel(height/factor, nthreads, box_rows, &args);
+}
+
+/* Bilinear resize (8-bit fractions, pixel centers aligned) */
+
+typedef struct bilinearArgs {
+  const uint8_t *src;
+  int width, height, stride;
+  uint8_t *dst;
+  int dstWidth, dstHeight, dstStride;
+  int *xs;  // left source column per destination column
+  int *fx;  // right column weight 0..256
+} bilinearArgs;
+
+// Source coordinate of destination index in 24.8 fixed point
+static int bilinear_coord(int i, int srcSize, int dstSize) {
+  int c = (int)(((long long)(2*i + 1)*srcSize*128)/dstSize) - 128;
+  return (c < 0) ? 0 : c;
+}
+
+static void bilinear_rows(void *arg, int row0, int row1, int part) {
+  bilinearArgs *p = (bilinearArgs *)arg;
+  int i, j;
+  (void)part;
+  for (j = row0; j < row1; j++) {
+    int cy = bilinear_coord(j, p->height, p->dstHeight);
+    int y0 = cy >> 8;
+    int fy = cy & 0xff;
+    int y1 = (y0 + 1 < p->height) ? y0 + 1 : y0;
+    if (y0 >= p->height) y0 = y1 = p->height - 1;
+    const uint8_t *r0 = p->src + y0*p->stride;
+    const uint8_t *r1 = p->src + y1*p->stride;
+    uint8_t *d = p->dst + j*p->dstStride;
+    for (i = 0; i < p->dstWidth; i++) {
+      int x0 = p->xs[i];
+      int x1 = (x0 + 1 < p->width) ? x0 + 1 : x0;
+      int fx = p->fx[i];
+      int top = r0[x0]*(256 - fx) + r0[x1]*fx;
+      int bottom = r1[x0]*(256 - fx) + r1[x1]*fx;
+      d[i] = (top*(256 - fy) + bottom*fy + 32768) >> 16;
+    }
+  }
+}
+
+void image_resize_bilinear(const uint8_t *src, int width, int height,
+			   int stride,
+			   uint8_t *dst, int dstWidth, int dstHeight,
+			   int dstStride, int nthreads) {
+  bilinearArgs args;
+  int i;
+  if ((dstWidth <= 0) || (dstHeight <= 0)) return;
+  args.xs = (int *)malloc(2*dstWidth*sizeof(int));
+  if (args.xs == NULL) return;
+  args.fx = args.xs + dstWidth;
+  for (i = 0; i < dstWidth; i++) {
+    int cx = bilinear_coord(i, width, dstWidth);
+    args.xs[i] = cx >> 8;
+    args.fx[i] = cx & 0xff;
+    if (args.xs[i] >= width) {
+      args.xs[i] = width - 1;
+      args.fx[i] = 0;
+    }
+  }
+  args.src = src;
+  args.width = width;
+  args.height = height;
+  args.stride = stride;
+  args.dst = dst;
+  args.dstWidth = dstWidth;
+  args.dstHeight = dstHeight;
+  args.dstStride = dstStride;
+  image_parallel(dstHeight, nthreads, bilinear_rows, &args);
+  free(args.xs);
+}
+
+/* Histogram */
+
+typedef struct histogramArgs {
+  const uint8_t *src;
+  int width, stride;
+  uint32_t (*part)[256];
+} histogramArgs;
+
+static void histogram_rows(void *arg, int row0, int row1, int part) {
+  histogramArgs *p = (histogramArgs *)arg;
+  // Four interleaved sub-histograms avoid stalls on repeated values
+  uint32_t h[4][256];
+  int i, j, k;
+  memset(h, 0, sizeof(h));
+  for (j = row0; j < row1; j++) {
+    const uint8_t *s = p->src + j*p->stride;
+    for (i = 0; i + 4 <= p->width; i += 4) {
+      h[0][s[i]]++;
+      h[1][s[i+1]]++;
+      h[2][s[i+2]]++;
+      h[3][s[i+3]]++;
+    }
+    for (; i < p->width; i++) h[0][s[i]]++;
+  }
+  for (k = 0; k < 256; k++) {
+    p->part[part][k] = h[0][k] + h[1][k] + h[2][k] + h[3][k];
+  }
+}
+
+void image_histogram(const uint8_t *src, int width, int height, int stride,
+		     uint32_t hist[256], int nthreads) {
+  uint32_t part[IMAGE_MAX_THREADS][256];
+  histogramArgs args;
+  int n, k, b;
+  args.src = src;
+  args.width = width;
+  args.stride = stride;
+  args.part = part;
+  n = image_parallel(height, nthreads, histogram_rows, &args);
+  memset(hist, 0, 256*sizeof(uint32_t));
+  for (k = 0; k < n; k++) {
+    for (b = 0; b < 256; b++) hist[b] += part[k][b];
+  }
+}
+
+/* Frame differencing */
+
+typedef struct absdiffArgs {
+  const uint8_t *a, *b;
+  int strideA, strideB;
+  int width, threshold;
+  uint8_t *dst;
+  int dstStride;
+  long count[IMAGE_MAX_THREADS];
+} absdiffArgs;
+
+static void absdiff_rows(void *arg, int row0, int row1, int part) {
+  absdiffArgs *p = (absdiffArgs *)arg;
+  long count = 0;
+  int i, j;
+  for (j = row0; j < row1; j++) {
+    const uint8_t *a = p->a + j*p->strideA;
+    const uint8_t *b = p->b + j*p->strideB;
+    uint8_t *d = p->dst ? p->dst + j*p->dstStride : NULL;
+    i = 0;
+#if IMAGE_USE_NEON
+    {
+      uint8x16_t thr = vdupq_n_u8(p->threshold);
+      uint32x4_t acc = vdupq_n_u32(0);
+      for (; i + 16 <= p->width; i += 16) {
+	uint8x16_t diff = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+	if (d) vst1q_u8(d + i, diff);
+	// 0xff where diff > threshold, shift to 1 and accumulate
+	uint8x16_t over = vshrq_n_u8(vcgtq_u8(diff, thr), 7);
+	acc = vpadalq_u16(acc, vpaddlq_u8(over));
+      }
+      count += vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) +
+	vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+    }
+#elif IMAGE_USE_SSE2
+    {
+      const __m128i zero = _mm_setzero_si128();
+      __m128i thr = _mm_set1_epi8((char)p->threshold);
+      for (; i + 16 <= p->width; i += 16) {
+	__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+	__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+	__m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb),
+				    _mm_subs_epu8(vb, va));
+	if (d) _mm_storeu_si128((__m128i *)(d + i), diff);
+	// Nonzero where diff > threshold
+	int same = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(diff, thr),
+						    zero));
+	count += __builtin_popcount(~same & 0xffff);
+      }
+    }
+#endif
+    for (; i < p->width; i++) {
+      int diff = (a[i] > b[i]) ? a[i] - b[i] : b[i] - a[i];
+      if (d) d[i] = diff;
+      if (diff > p->threshold) count++;
+    }
+  }
+  p->count[part] = count;
+}
+
+long image_absdiff(const uint8_t *a, int strideA,
+		   const uint8_t *b, int strideB,
+		   int width, int height, int threshold,
+		   uint8_t *dst, int dstStride, int nthreads) {
+  absdiffArgs args;
+  long count = 0;
+  int n, k;
+  if (threshold < 0) threshold = 0;
+  if (threshold > 255) threshold = 255;
+  args.a = a;
+  args.b = b;
+  args.strideA = strideA;
+  args.strideB = strideB;
+  args.width = width;
+  args.threshold = threshold;
+  args.dst = dst;
+  args.dstStride = dstStride;
+  n = image_parallel(height, nthreads, absdiff_rows, &args);
+  for (k = 0; k < n; k++) count += args.count[k];
+  return count;
+}
@@ -0,0 +1,61 @@
+#ifndef imagekernels_h
+#define imagekernels_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  8-bit single plane image kernels (camera Y plane, grayscale, masks)
+
+  Every image is a pointer, width, height and stride (row pitch in
+  bytes). Kernels have no Android dependencies so they can be built
+  and checked on the host against raw NV21 dumps. Functions taking
+  nthreads split rows across that many threads (<= 1 is serial).
+*/
+
+#define IMAGE_MAX_THREADS 16
+
+// Copy the Y plane of an NV21/NV12/I420 frame (or any plane) to dst
+void image_copy(const uint8_t *src, int width, int height, int stride,
+		uint8_t *dst, int dstStride);
+
+// Copy rectangle (x, y, cw, ch) of src to dst; caller clips the rect
+void image_crop(const uint8_t *src, int stride,
+		int x, int y, int cw, int ch,
+		uint8_t *dst, int dstStride);
+
+// Rotate by 90 degrees clockwise turns times (1..3); dst is height x width
+// for odd turns
+void image_rotate90(const uint8_t *src, int width, int height, int stride,
+		    int turns, uint8_t *dst, int dstStride);
+
+// Box filter downscale by integer factor: dst is width/factor x height/factor
+void image_downscale_box(const uint8_t *src, int width, int height,
+			 int stride, int factor,
+			 uint8_t *dst, int dstStride, int nthreads);
+
+// Bilinear resize to dstWidth x dstHeight
+void image_resize_bilinear(const uint8_t *src, int width, int height,
+			   int stride,
+			   uint8_t *dst, int dstWidth, int dstHeight,
+			   int dstStride, int nthreads);
+
+// 256 bin histogram of pixel values
+void image_histogram(const uint8_t *src, int width, int height, int stride,
+		     uint32_t hist[256], int nthreads);
+
+// Absolute difference of two frames; dst may be NULL.
+// Returns number of pixels whose difference exceeds threshold.
+long image_absdiff(const uint8_t *a, int strideA,
+		   const uint8_t *b, int strideB,
+		   int width, int height, int threshold,
+		   uint8_t *dst, int dstStride, int nthreads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,241 @@
+/*
+  Lua module with image kernels over camera frames and byte buffers
+
+  Sources are lightuserdata pointers (camera getImage/acquireFrame,
+  carray.pointer) or Lua strings (e.g. raw NV21 dumps read from file).
+  The Y plane of NV21/NV12/I420 frames comes first, so a frame pointer
+  can be passed directly as an 8-bit grayscale image.
+  Results are written to a lightuserdata destination if one is given
+  (returning the byte count), otherwise returned as a new string.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <android/log.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+  #include "lua.h"
+  #include "lauxlib.h"
+#ifdef __cplusplus
+}
+#endif
+
+#include "imagekernels.h"
+#include "luaimage.h"
+
+#ifndef LOG_TAG
+#define LOG_TAG "lua"
+#endif
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO,LOG_TAG,__VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN,LOG_TAG,__VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR,LOG_TAG,__VA_ARGS__)
+
+// Source image of at least need bytes
+static const uint8_t* lua_checkimage(lua_State *L, int narg, size_t need) {
+  if (lua_islightuserdata(L, narg)) {
+    return (const uint8_t *)lua_touserdata(L, narg);
+  }
+  if (lua_type(L, narg) == LUA_TSTRING) {
+    size_t len;
+    const char *s = lua_tolstring(L, narg, &len);
+    luaL_argcheck(L, len >= need, narg, "image string too short");
+    return (const uint8_t *)s;
+  }
+  luaL_typerror(L, narg, "image pointer or string");
+  return NULL;
+}
+
+// Kernels index pixels with int, so an image may span at most INT_MAX
+// bytes; width*height is then safe to compute in int
+static void lua_checksize(lua_State *L, int narg, int width, int height) {
+  luaL_argcheck(L, (width > 0) && (height > 0) && (height <= INT_MAX/width),
+		narg, "invalid image size");
+}
+
+// Bytes spanned by rows of stride bytes, each holding width pixels;
+// the last row need not be padded out to the stride
+static size_t lua_checkstride(lua_State *L, int narg, int stride,
+			      int width, int height) {
+  luaL_argcheck(L, (stride >= width) && (height <= INT_MAX/stride),
+		narg, "invalid stride");
+  return (size_t)stride*(height - 1) + width;
+}
+
+// Destination pointer, or scratch userdata pushed on the stack
+static uint8_t* lua_todest(lua_State *L, int narg, size_t size) {
+  if (lua_islightuserdata(L, narg)) {
+    return (uint8_t *)lua_touserdata(L, narg);
+  }
+  luaL_argcheck(L, lua_isnoneornil(L, narg), narg,
+		"destination must be a pointer");
+  return (uint8_t *)lua_newuserdata(L, size > 0 ? size : 1);
+}
+
+static int lua_pushresult(lua_State *L, int narg,
+			  const uint8_t *dst, size_t size) {
+  if (lua_islightuserdata(L, narg)) {
+    lua_pushinteger(L, size);
+  }
+  else {
+    lua_pushlstring(L, (const char *)dst, size);
+  }
+  return 1;
+}
+
+// extractY(src, width, height [, stride, dst])
+static int lua_image_extractY(lua_State *L) {
+  int width = luaL_checkint(L, 2);
+  int height = luaL_checkint(L, 3);
+  lua_checksize(L, 2, width, height);
+  int stride = luaL_optint(L, 4, width);
+  size_t bytes = lua_checkstride(L, 4, stride, width, height);
+  const uint8_t *src = lua_checkimage(L, 1, bytes);
+  uint8_t *dst = lua_todest(L, 5, width*height);
+
+  image_copy(src, width, height, stride, dst, width);
+  return lua_pushresult(L, 5, dst, width*height);
+}
+
+// crop(src, width, height, x, y, cw, ch [, stride, dst])
+static int lua_image_crop(lua_State *L) {
+  int width = luaL_checkint(L, 2);
+  int height = luaL_checkint(L, 3);
+  lua_checksize(L, 2, width, height);
+  int x = luaL_checkint(L, 4);
+  int y = luaL_checkint(L, 5);
+  int cw = luaL_checkint(L, 6);
+  int ch = luaL_checkint(L, 7);
+  luaL_argcheck(L, (x >= 0) && (y >= 0) && (cw > 0) && (ch > 0) &&
+		(cw <= width - x) && (ch <= height - y), 4,
+		"crop rectangle outside image");
+  int stride = luaL_optint(L, 8, width);
+  size_t bytes = lua_checkstride(L, 8, stride, width, height);
+  const uint8_t *src = lua_checkimage(L, 1, bytes);
+  uint8_t *dst = lua_todest(L, 9, cw*ch);
+
+  image_crop(src, stride, x, y, cw, ch, dst, cw);
+  return lua_pushresult(L, 9, dst, cw*ch);
+}
+
+// rotate90(src, width, height [, turns, stride, dst])
+static int lua_image_rotate90(lua_State *L) {
+  int width = luaL_checkint(L, 2);
+  int height = luaL_checkint(L, 3);
+  lua_checksize(L, 2, width, height);
+  int turns = luaL_optint(L, 4, 1) & 3;
+  int stride = luaL_optint(L, 5, width);
+  size_t bytes = lua_checkstride(L, 5, stride, width, height);
+  const uint8_t *src = lua_checkimage(L, 1, bytes);
+  uint8_t *dst = lua_todest(L, 6, width*height);
+
+  image_rotate90(src, width, height, stride, turns,
+		 dst, (turns & 1) ? height : width);
+  return lua_pushresult(L, 6, dst, width*height);
+}
+
+// downscale(src, width, height, factor [, stride, dst, nthreads])
+static int lua_image_downscale(lua_State *L) {
+  int width = luaL_checkint(L, 2);
+  int height = luaL_checkint(L, 3);
+  lua_checksize(L, 2, width, height);
+  int factor = luaL_checkint(L, 4);
+  luaL_argcheck(L, (factor >= 1) && (factor <= width) && (factor <= height),
+		4, "invalid downscale factor");
+  int stride = luaL_optint(L, 5, width);
+  size_t bytes = lua_checkstride(L, 5, stride, width, height);
+  int nthreads = luaL_optint(L, 7, 1);
+  const uint8_t *src = lua_checkimage(L, 1, bytes);
+  int dw = width/factor;
+  int dh = height/factor;
+  uint8_t *dst = lua_todest(L, 6, dw*dh);
+
+  image_downscale_box(src, width, height, stride, factor, dst, dw, nthreads);
+  return lua_pushresult(L, 6, dst, dw*dh);
+}
+
+// resize(src, width, height, dstWidth, dstHeight [, stride, dst, nthreads])
+static int lua_image_resize(lua_State *L) {
+  int width = luaL_checkint(L, 2);
+  int height = luaL_checkint(L, 3);
+  lua_checksize(L, 2, width, height);
+  int dw = luaL_checkint(L, 4);
+  int dh = luaL_checkint(L, 5);
+  lua_checksize(L, 4, dw, dh);
+  int stride = luaL_optint(L, 6, width);
+  size_t bytes = lua_checkstride(L, 6, stride, width, height);
+  int nthreads = luaL_optint(L, 8, 1);
+  const uint8_t *src = lua_checkimage(L, 1, bytes);
+  uint8_t *dst = lua_todest(L, 7, dw*dh);
+
+  image_resize_bilinear(src, width, height, stride, dst, dw, dh, dw, nthreads);
+  return lua_pushresult(L, 7, dst, dw*dh);
+}
+
+// histogram(src, width, height [, stride, nthreads]) -> {count[1..256]}
+static int lua_image_histogram(lua_State *L) {
+  int width = luaL_checkint(L, 2);
+  int height = luaL_checkint(L, 3);
+  lua_checksize(L, 2, width, height);
+  int stride = luaL_optint(L, 4, width);
+  size_t bytes = lua_checkstride(L, 4, stride, width, height);
+  int nthreads = luaL_optint(L, 5, 1);
+  const uint8_t *src = lua_checkimage(L, 1, bytes);
+
+  uint32_t hist[256];
+  image_histogram(src, width, height, stride, hist, nthreads);
+
+  lua_createtable(L, 256, 0);
+  for (int i = 0; i < 256; i++) {
+    lua_pushinteger(L, hist[i]);
+    lua_rawseti(L, -2, i+1);
+  }
+  return 1;
+}
+
+// diff(a, b, width, height [, threshold, stride, dst, nthreads])
+// Returns number of pixels whose difference exceeds threshold;
+// absolute difference image is written to dst if given
+static int lua_image_diff(lua_State *L) {
+  int width = luaL_checkint(L, 3);
+  int height = luaL_checkint(L, 4);
+  lua_checksize(L, 3, width, height);
+  int threshold = luaL_optint(L, 5, 0);
+  int stride = luaL_optint(L, 6, width);
+  size_t bytes = lua_checkstride(L, 6, stride, width, height);
+  int nthreads = luaL_optint(L, 8, 1);
+  const uint8_t *a = lua_checkimage(L, 1, bytes);
+  const uint8_t *b = lua_checkimage(L, 2, bytes);
+  uint8_t *dst = NULL;
+  if (!lua_isnoneornil(L, 7)) {
+    luaL_checktype(L, 7, LUA_TLIGHTUSERDATA);
+    dst = (uint8_t *)lua_touserdata(L, 7);
+  }
+
+  long count = image_absdiff(a, stride, b, stride, width, height,
+			     threshold, dst, width, nthreads);
+  lua_pushinteger(L, count);
+  return 1;
+}
+
+static const struct luaL_reg image_functions[] = {
+  {"extractY", lua_image_extractY},
+  {"crop", lua_image_crop},
+  {"rotate90", lua_image_rotate90},
+  {"downscale", lua_image_downscale},
+  {"resize", lua_image_resize},
+  {"histogram", lua_image_histogram},
+  {"diff", lua_image_diff},
+  {NULL, NULL}
+};
+
+#ifdef __cplusplus
+extern "C"
+#endif
+int luaopen_image (lua_State *L) {
+  luaL_register(L, "image", image_functions);
+  return 1;
+}
@@ -8,6 +8,8 @@ LOCAL_SRC_FILES := \
 	threading.c \
 	tools.c \
 	keeper.c \
+	channel.c \
+	buffer.c \
 	pthread_hack.c
 LOCAL_SHARED_LIBRARIES := lua-activity
 include $(BUILD_SHARED_LIBRARY)
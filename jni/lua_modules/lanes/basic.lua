@@ -300,6 +300,26 @@ local ok2= linda:receive( "up" )
 assert( ok2 == "ok2" )
 
 
+PRINT( "---=== Collected Lindas with parked values ===---")
+
+-- Functions are parked in the keeper state. Lindas collected in a GC step
+-- of a keeper call used to lock that keeper again, from the same thread.
+--
+local other= lanes_linda()
+for round=1,100 do
+    for i=1,20 do
+        lanes_linda():send( "k", function() return i end )
+    end
+    other:send( "k", function() return round end )
+    assert( other:receive( "k" )() == round )
+end
+collectgarbage()
+collectgarbage()
+for i,k in ipairs( lanes.keeper_stats() ) do
+    assert( k.parked == 0 )
+end
+
+
 PRINT( "---=== :join test ===---")
 
 -- NOTE: 'unpack()' cannot be used on the lane handle; it will always return nil
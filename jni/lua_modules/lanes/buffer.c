@@ -0,0 +1,535 @@
+/*
+ * BUFFER.C
+ *
+ * Typed arrays and immutable byte blobs shared between lanes
+ *
+ * Both are deep userdata: sending one to a lane, through a Linda or as
+ * a lane parameter, passes a reference to the same memory instead of
+ * copying it. Pool workers running 'map', 'reduce' and 'parallel_for'
+ * read and write buffers in place.
+ *
+ *   buf= lanes.buffer( "byte"|"int"|"float"|"double", n | table )
+ *
+ *   buf[i], buf[i]= v, #buf           elements indexed from 1
+ *   buf:type()
+ *   buf:fill( v [, i [, j]] )
+ *   buf:totable( [i [, j]] )
+ *   buf:pointer( [i] )                lightuserdata of element i, for GL
+ *
+ * A blob never changes once made, so any number of lanes can read it
+ * without locking. Its bytes are copied in when it is made (buffers stay
+ * writable); slices share them and keep the root blob alive.
+ *
+ *   blob= lanes.blob( str )           copies 'str' once
+ *   blob= lanes.blob( buf [, i [, j]] )   copies elements i..j once
+ *   blob= lanes.blob( blob [, i [, j]] )  slice, as blob:sub()
+ *
+ *   blob[i], #blob                    bytes indexed from 1
+ *   blob:sub( i [, j] )               slice, indices as in string.sub
+ *   blob:string( [i [, j]] )          copy to a Lua string
+ *   blob:byte( [i [, j]] )            as string.byte
+ *   blob:pointer( [i] )               lightuserdata of byte i, not to write to
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "threading.h"
+#include "tools.h"
+#include "buffer.h"
+
+static char const *const buffer_types[] = { "byte", "int", "float", "double", NULL };
+static size_t const buffer_elemsize[] = { sizeof(unsigned char), sizeof(int), sizeof(float), sizeof(double) };
+
+double buffer_get( struct s_Buffer const *b, int i)
+{
+	switch( b->type)
+	{
+		case BUFFER_BYTE: return ((unsigned char const *) b->data)[i];
+		case BUFFER_INT: return ((int const *) b->data)[i];
+		case BUFFER_FLOAT: return ((float const *) b->data)[i];
+		default: return ((double const *) b->data)[i];
+	}
+}
+
+void buffer_set( struct s_Buffer *b, int i, double v)
+{
+	switch( b->type)
+	{
+		case BUFFER_BYTE: ((unsigned char *) b->data)[i] = (unsigned char) v; break;
+		case BUFFER_INT: ((int *) b->data)[i] = (int) v; break;
+		case BUFFER_FLOAT: ((float *) b->data)[i] = (float) v; break;
+		default: ((double *) b->data)[i] = v; break;
+	}
+}
+
+static struct s_Buffer *check_buffer( lua_State *L, int i)
+{
+	struct s_Buffer *b = lua_toBuffer( L, i);
+	luaL_argcheck( L, b, i, "expected a buffer object!");
+	return b;
+}
+
+// 1-based index at 'i' as an offset, for element access
+static int check_element( lua_State *L, struct s_Buffer const *b, int i)
+{
+	lua_Integer k = luaL_checkinteger( L, i);
+	luaL_argcheck( L, k >= 1 && k <= b->n, i, "index out of range");
+	return (int) k - 1;
+}
+
+// Optional range [i, j] (1-based, inclusive) at 'first' as offsets [*lo, *hi)
+static void opt_range( lua_State *L, struct s_Buffer const *b, int first, int *lo, int *hi)
+{
+	lua_Integer i = luaL_optinteger( L, first, 1);
+	lua_Integer j = luaL_optinteger( L, first + 1, b->n);
+	luaL_argcheck( L, i >= 1 && i <= b->n + 1, first, "index out of range");
+	luaL_argcheck( L, j >= i - 1 && j <= b->n, first + 1, "index out of range");
+	*lo = (int) i - 1;
+	*hi = (int) j;
+}
+
+/*
+* buf:__index( i | method_str)
+*/
+LUAG_FUNC( buffer_index)
+{
+	struct s_Buffer *b = check_buffer( L, 1);
+	if( lua_type( L, 2) == LUA_TNUMBER)
+	{
+		lua_pushnumber( L, buffer_get( b, check_element( L, b, 2)));
+		return 1;
+	}
+	// methods are kept in the metatable
+	lua_getmetatable( L, 1);
+	lua_pushvalue( L, 2);
+	lua_rawget( L, -2);
+	return 1;
+}
+
+/*
+* buf:__newindex( i, v)
+*/
+LUAG_FUNC( buffer_newindex)
+{
+	struct s_Buffer *b = check_buffer( L, 1);
+	buffer_set( b, check_element( L, b, 2), luaL_checknumber( L, 3));
+	return 0;
+}
+
+LUAG_FUNC( buffer_len)
+{
+	struct s_Buffer *b = check_buffer( L, 1);
+	lua_pushinteger( L, b->n);
+	return 1;
+}
+
+LUAG_FUNC( buffer_type)
+{
+	struct s_Buffer *b = check_buffer( L, 1);
+	lua_pushstring( L, buffer_types[b->type]);
+	return 1;
+}
+
+LUAG_FUNC( buffer_fill)
+{
+	struct s_Buffer *b = check_buffer( L, 1);
+	lua_Number v = luaL_checknumber( L, 2);
+	int lo, hi;
+	opt_range( L, b, 3, &lo, &hi);
+	for( ; lo < hi; ++ lo)
+	{
+		buffer_set( b, lo, v);
+	}
+	return 0;
+}
+
+LUAG_FUNC( buffer_totable)
+{
+	struct s_Buffer *b = check_buffer( L, 1);
+	int lo, hi, k;
+	opt_range( L, b, 2, &lo, &hi);
+	lua_createtable( L, hi - lo, 0);
+	for( k = 1; lo < hi; ++ lo, ++ k)
+	{
+		lua_pushnumber( L, buffer_get( b, lo));
+		lua_rawseti( L, -2, k);
+	}
+	return 1;
+}
+
+LUAG_FUNC( buffer_pointer)
+{
+	struct s_Buffer *b = check_buffer( L, 1);
+	lua_Integer i = luaL_optinteger( L, 2, 1);
+	luaL_argcheck( L, i >= 1 && i <= b->n + 1, 2, "index out of range");
+	lua_pushlightuserdata( L, (char *) b->data + (size_t) (i - 1) * buffer_elemsize[b->type]);
+	return 1;
+}
+
+LUAG_FUNC( buffer_tostring)
+{
+	char text[48];
+	struct s_Buffer *b = check_buffer( L, 1);
+	sprintf( text, "buffer: %p (%s[%d])", b, buffer_types[b->type], b->n);
+	lua_pushstring( L, text);
+	return 1;
+}
+
+/*
+* Identity function of buffers (see 'linda_id()' in lanes.c)
+*
+*   lightuserdata= buffer_id( "new" ) with 'buffer_new()' parameters on the stack
+*/
+void buffer_id( lua_State *L, char const * const which)
+{
+	if( strcmp( which, "new") == 0)
+	{
+		struct s_Buffer *b;
+		int type = luaL_checkoption( L, 1, NULL, buffer_types);
+		int n = lua_istable( L, 2) ? (int) lua_objlen( L, 2) : (int) lua_tointeger( L, 2);
+		int i;
+
+		b = (struct s_Buffer *) malloc( sizeof(struct s_Buffer));
+		if( b)
+		{
+			b->data = calloc( n ? n : 1, buffer_elemsize[type]);
+			if( !b->data)
+			{
+				free( b);
+				b = NULL;
+			}
+		}
+		if( !b)
+		{
+			luaL_error( L, "not enough memory for a buffer of %d elements", n);
+		}
+		b->type = (enum e_BufferType) type;
+		b->n = n;
+		if( lua_istable( L, 2))
+		{
+			for( i = 0; i < n; ++ i)
+			{
+				lua_rawgeti( L, 2, i + 1);
+				buffer_set( b, i, lua_tonumber( L, -1));
+				lua_pop( L, 1);
+			}
+		}
+		lua_pushlightuserdata( L, b);
+	}
+	else if( strcmp( which, "delete") == 0)
+	{
+		struct s_Buffer *b = lua_touserdata( L, 1);
+		free( b->data);
+		free( b);
+	}
+	else if( strcmp( which, "metatable") == 0)
+	{
+		STACK_CHECK(L)
+		lua_newtable( L);
+
+		// protect metatable from external access
+		lua_pushboolean( L, 0);
+		lua_setfield( L, -2, "__metatable");
+
+		lua_pushcfunction( L, LG_buffer_index);
+		lua_setfield( L, -2, "__index");
+
+		lua_pushcfunction( L, LG_buffer_newindex);
+		lua_setfield( L, -2, "__newindex");
+
+		lua_pushcfunction( L, LG_buffer_len);
+		lua_setfield( L, -2, "__len");
+
+		lua_pushcfunction( L, LG_buffer_tostring);
+		lua_setfield( L, -2, "__tostring");
+
+		lua_pushcfunction( L, LG_buffer_type);
+		lua_setfield( L, -2, "type");
+
+		lua_pushcfunction( L, LG_buffer_fill);
+		lua_setfield( L, -2, "fill");
+
+		lua_pushcfunction( L, LG_buffer_totable);
+		lua_setfield( L, -2, "totable");
+
+		lua_pushcfunction( L, LG_buffer_pointer);
+		lua_setfield( L, -2, "pointer");
+		STACK_END(L,1)
+	}
+	else if( strcmp( which, "module") == 0)
+	{
+		// same as Lindas: lanes stays loaded as long as the main state
+		lua_pushnil( L);
+	}
+}
+
+/*
+* buf= buffer_new( "byte"|"int"|"float"|"double", n | table )
+*/
+int buffer_new( lua_State *L)
+{
+	luaL_checkoption( L, 1, NULL, buffer_types);
+	if( !lua_istable( L, 2))
+	{
+		// checked before any conversion to int, which would wrap
+		lua_Number n = luaL_checknumber( L, 2);
+		luaL_argcheck( L, n >= 0 && n <= INT_MAX && n == (lua_Number) (int) n, 2, "invalid buffer size");
+	}
+	lua_settop( L, 2);
+	return luaG_deep_userdata( L, buffer_id);
+}
+
+/*---=== Blobs ===---
+*/
+
+struct s_Blob
+{
+	// root blob holding the bytes of a slice, NULL for 'data'
+	DEEP_PRELUDE *owner;
+	luaG_IdFunction owner_id;
+	unsigned char const *p;
+	size_t len;
+	unsigned char data[1];
+};
+
+#define lua_toBlob( L, i) ((struct s_Blob *) luaG_todeep( L, blob_id, i))
+
+static struct s_Blob *check_blob( lua_State *L, int i)
+{
+	struct s_Blob *b = lua_toBlob( L, i);
+	luaL_argcheck( L, b, i, "expected a blob object!");
+	return b;
+}
+
+// Byte range [i, j] at 'first' with string.sub rules, as offsets [*lo, *hi)
+// (except that i may not start past the end)
+static void blob_range( lua_State *L, size_t len, int first, lua_Integer i_def, lua_Integer j_def, size_t *lo, size_t *hi)
+{
+	lua_Integer i = luaL_optinteger( L, first, i_def);
+	lua_Integer j = luaL_optinteger( L, first + 1, j_def);
+	if( i < 0) i += (lua_Integer) len + 1;
+	if( j < 0) j += (lua_Integer) len + 1;
+	if( i < 1) i = 1;
+	luaL_argcheck( L, i <= (lua_Integer) len + 1, first, "index out of range");
+	if( j > (lua_Integer) len) j = (lua_Integer) len;
+	*lo = (size_t) i - 1;
+	*hi = (j >= i) ? (size_t) j : *lo;
+}
+
+/*
+* blob:__index( i | method_str)
+*/
+LUAG_FUNC( blob_index)
+{
+	struct s_Blob *b = check_blob( L, 1);
+	if( lua_type( L, 2) == LUA_TNUMBER)
+	{
+		lua_Integer i = lua_tointeger( L, 2);
+		luaL_argcheck( L, i >= 1 && (size_t) i <= b->len, 2, "index out of range");
+		lua_pushinteger( L, b->p[i - 1]);
+		return 1;
+	}
+	lua_getmetatable( L, 1);
+	lua_pushvalue( L, 2);
+	lua_rawget( L, -2);
+	return 1;
+}
+
+LUAG_FUNC( blob_len)
+{
+	struct s_Blob *b = check_blob( L, 1);
+	lua_pushinteger( L, (lua_Integer) b->len);
+	return 1;
+}
+
+/*
+* slice= blob:sub( i [, j])
+*/
+LUAG_FUNC( blob_sub)
+{
+	check_blob( L, 1);
+	luaL_checkinteger( L, 2);
+	return blob_new( L);
+}
+
+LUAG_FUNC( blob_string)
+{
+	struct s_Blob *b = check_blob( L, 1);
+	size_t lo, hi;
+	blob_range( L, b->len, 2, 1, -1, &lo, &hi);
+	lua_pushlstring( L, (char const *) b->p + lo, hi - lo);
+	return 1;
+}
+
+LUAG_FUNC( blob_byte)
+{
+	struct s_Blob *b = check_blob( L, 1);
+	size_t lo, hi;
+	lua_Integer i = luaL_optinteger( L, 2, 1);
+	blob_range( L, b->len, 2, 1, i, &lo, &hi);
+	luaL_checkstack( L, (int) (hi - lo), "blob slice too long");
+	for( i = (lua_Integer) lo; (size_t) i < hi; ++ i)
+	{
+		lua_pushinteger( L, b->p[i]);
+	}
+	return (int) (hi - lo);
+}
+
+LUAG_FUNC( blob_pointer)
+{
+	struct s_Blob *b = check_blob( L, 1);
+	lua_Integer i = luaL_optinteger( L, 2, 1);
+	luaL_argcheck( L, i >= 1 && (size_t) i <= b->len + 1, 2, "index out of range");
+	lua_pushlightuserdata( L, (void *) (b->p + (i - 1)));
+	return 1;
+}
+
+LUAG_FUNC( blob_tostring)
+{
+	char text[48];
+	struct s_Blob *b = check_blob( L, 1);
+	sprintf( text, "blob: %p (%lu bytes)", b, (unsigned long) b->len);
+	lua_pushstring( L, text);
+	return 1;
+}
+
+/*
+* Identity function of blobs (see 'linda_id()' in lanes.c)
+*
+*   lightuserdata= blob_id( "new" ) with 'blob_new()' parameters on the stack
+*/
+void blob_id( lua_State *L, char const * const which)
+{
+	if( strcmp( which, "new") == 0)
+	{
+		struct s_Blob *b;
+		struct s_Buffer *buf = NULL;
+		if( lua_type( L, 1) == LUA_TSTRING || (buf = lua_toBuffer( L, 1)) != NULL)
+		{
+			size_t len;
+			char const *s;
+			if( buf)
+			{
+				int i, j;
+				opt_range( L, buf, 2, &i, &j);
+				s = (char const *) buf->data + (size_t) i * buffer_elemsize[buf->type];
+				len = (size_t) (j - i) * buffer_elemsize[buf->type];
+			}
+			else
+			{
+				s = lua_tolstring( L, 1, &len);
+			}
+			b = (struct s_Blob *) malloc( offsetof( struct s_Blob, data) + len);
+			if( !b)
+			{
+				luaL_error( L, "not enough memory for a blob of %lu bytes", (unsigned long) len);
+			}
+			memcpy( b->data, s, len);
+			b->owner = NULL;
+			b->owner_id = NULL;
+			b->p = b->data;
+			b->len = len;
+		}
+		else
+		{
+			// slice: the root blob holding the bytes gets one more reference
+			DEEP_PRELUDE *owner;
+			luaG_IdFunction owner_id = luaG_deep_prelude( L, 1, &owner);
+			struct s_Blob *parent = lua_toBlob( L, 1);
+			size_t lo, hi;
+			if( parent->owner)
+			{
+				// slices refer to the root blob, not to each other
+				owner = parent->owner;
+				owner_id = parent->owner_id;
+			}
+			blob_range( L, parent->len, 2, 1, -1, &lo, &hi);
+			b = (struct s_Blob *) malloc( sizeof( struct s_Blob));
+			if( !b)
+			{
+				luaL_error( L, "not enough memory");
+			}
+			luaG_deep_ref( owner);
+			b->owner = owner;
+			b->owner_id = owner_id;
+			b->p = parent->p + lo;
+			b->len = hi - lo;
+		}
+		lua_pushlightuserdata( L, b);
+	}
+	else if( strcmp( which, "delete") == 0)
+	{
+		struct s_Blob *b = lua_touserdata( L, 1);
+		if( b->owner)
+		{
+			luaG_deep_unref( L, b->owner_id, b->owner);
+		}
+		free( b);
+	}
+	else if( strcmp( which, "metatable") == 0)
+	{
+		STACK_CHECK(L)
+		lua_newtable( L);
+
+		// protect metatable from external access
+		lua_pushboolean( L, 0);
+		lua_setfield( L, -2, "__metatable");
+
+		lua_pushcfunction( L, LG_blob_index);
+		lua_setfield( L, -2, "__index");
+
+		lua_pushcfunction( L, LG_blob_len);
+		lua_setfield( L, -2, "__len");
+
+		lua_pushcfunction( L, LG_blob_tostring);
+		lua_setfield( L, -2, "__tostring");
+
+		lua_pushcfunction( L, LG_blob_sub);
+		lua_setfield( L, -2, "sub");
+
+		lua_pushcfunction( L, LG_blob_string);
+		lua_setfield( L, -2, "string");
+
+		lua_pushcfunction( L, LG_blob_byte);
+		lua_setfield( L, -2, "byte");
+
+		lua_pushcfunction( L, LG_blob_pointer);
+		lua_setfield( L, -2, "pointer");
+		STACK_END(L,1)
+	}
+	else if( strcmp( which, "module") == 0)
+	{
+		lua_pushnil( L);
+	}
+}
+
+/*
+* blob= blob_new( string | buffer | blob [, i [, j]] )
+*/
+int blob_new( lua_State *L)
+{
+	// errors past this point would leak the deep prelude
+	if( lua_type( L, 1) != LUA_TSTRING)
+	{
+		struct s_Buffer *buf = lua_toBuffer( L, 1);
+		if( buf)
+		{
+			int i, j;
+			opt_range( L, buf, 2, &i, &j);
+		}
+		else
+		{
+			size_t lo, hi;
+			blob_range( L, check_blob( L, 1)->len, 2, 1, -1, &lo, &hi);
+		}
+	}
+	lua_settop( L, 3);
+	return luaG_deep_userdata( L, blob_id);
+}
@@ -0,0 +1,38 @@
+#if !defined( __buffer_h__)
+#define __buffer_h__ 1
+
+// Element types, same names as in carray
+enum e_BufferType
+{
+	BUFFER_BYTE,
+	BUFFER_INT,
+	BUFFER_FLOAT,
+	BUFFER_DOUBLE
+};
+
+/*
+* Typed array shared by reference between lanes (deep userdata)
+*
+* Elements are read and written without locking; lanes working on the
+* same buffer must use different elements, or synchronize by themselves.
+*/
+struct s_Buffer
+{
+	enum e_BufferType type;
+	int n;
+	void *data;
+};
+
+#define lua_toBuffer( L, i) ((struct s_Buffer *) luaG_todeep( L, buffer_id, i))
+
+void buffer_id( lua_State *L, char const * const which);
+int buffer_new( lua_State *L);
+
+double buffer_get( struct s_Buffer const *b, int i);     // 0-based, unchecked
+void buffer_set( struct s_Buffer *b, int i, double v);
+
+// Immutable bytes shared between lanes, see buffer.c
+void blob_id( lua_State *L, char const * const which);
+int blob_new( lua_State *L);
+
+#endif // __buffer_h__
@@ -0,0 +1,1272 @@
+/*
+ * CHANNEL.C
+ *
+ * Linda contents, kept natively
+ *
+ * Each key of a Linda has a FIFO of values, encoded into flat memory
+ * blocks by the sending lane and decoded by the receiving one. The
+ * Linda lock is held only to link and unlink the blocks, so lanes
+ * talking over different Lindas never wait on each other, and a value
+ * is copied once each way instead of twice through a keeper state.
+ *
+ * Deep userdata (Lindas, buffers, blobs) are encoded as a reference, so
+ * they cross at the same cost whatever the size of what they hold.
+ *
+ * Values that cannot be flattened (functions, other userdata, tables with
+ * a metatable, or tables holding any of those) are parked in the keeper
+ * state of the Linda as before, under a light userdata key that is the
+ * address of their FIFO entry, so that ordering is kept.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "threading.h"
+#include "tools.h"
+#include "keeper.h"
+#include "channel.h"
+
+/*---=== Keys ===---
+*/
+
+struct s_Key
+{
+	int type;           // LUA_TBOOLEAN, LUA_TNUMBER, LUA_TSTRING or LUA_TLIGHTUSERDATA
+	unsigned int hash;
+	union
+	{
+		int b;
+		lua_Number n;
+		void *p;
+	} u;
+	char const *s;      // LUA_TSTRING contents
+	size_t len;
+};
+
+static unsigned int hash_bytes( unsigned int h, void const *p, size_t len)
+{
+	unsigned char const *b = (unsigned char const *) p;
+	for( ; len > 0; -- len)
+	{
+		h = h ^ ((h << 5) + (h >> 2) + b[len - 1]);
+	}
+	return h;
+}
+
+/*
+* Read the key at 'i', of a type checked by the caller. Touches neither
+* the stack nor the Lua allocator, so it can be used under the lock.
+*/
+static void key_get( lua_State *L, int i, struct s_Key *k)
+{
+	k->type = lua_type( L, i);
+	switch( k->type)
+	{
+		case LUA_TBOOLEAN:
+		k->u.b = lua_toboolean( L, i);
+		k->hash = (unsigned int) k->u.b;
+		break;
+
+		case LUA_TNUMBER:
+		k->u.n = lua_tonumber( L, i);
+		if( k->u.n == 0)
+		{
+			k->u.n = 0;     // -0 is the same key as 0
+		}
+		k->hash = hash_bytes( sizeof( lua_Number), &k->u.n, sizeof( lua_Number));
+		break;
+
+		case LUA_TSTRING:
+		k->s = lua_tolstring( L, i, &k->len);
+		k->hash = hash_bytes( (unsigned int) k->len, k->s, k->len);
+		break;
+
+		default:
+		k->u.p = lua_touserdata( L, i);
+		k->hash = (unsigned int) ((unsigned long) k->u.p >> 3);
+		break;
+	}
+}
+
+static bool_t key_equal( struct s_Key const *a, struct s_Key const *b)
+{
+	if( a->type != b->type || a->hash != b->hash)
+	{
+		return FALSE;
+	}
+	switch( a->type)
+	{
+		case LUA_TBOOLEAN: return a->u.b == b->u.b;
+		case LUA_TNUMBER: return a->u.n == b->u.n;
+		case LUA_TSTRING: return a->len == b->len && memcmp( a->s, b->s, a->len) == 0;
+		default: return a->u.p == b->u.p;
+	}
+}
+
+static void key_push( lua_State *L, struct s_Key const *k)
+{
+	switch( k->type)
+	{
+		case LUA_TBOOLEAN: lua_pushboolean( L, k->u.b); break;
+		case LUA_TNUMBER: lua_pushnumber( L, k->u.n); break;
+		case LUA_TSTRING: lua_pushlstring( L, k->s, k->len); break;
+		default: lua_pushlightuserdata( L, k->u.p); break;
+	}
+}
+
+/*---=== Values ===---
+*/
+
+/*
+* One value in a FIFO
+*/
+struct s_Item
+{
+	struct s_Item *next;
+	size_t size;        // of 'data', 0 for a value parked in the keeper state
+	bool_t refs;        // 'data' refers back to tables it already holds
+	bool_t deep;        // 'data' holds references to deep userdata
+	unsigned char data[1];
+};
+
+#define ITEM_SIZE( _size) (offsetof( struct s_Item, data) + (_size))
+
+enum e_Tag
+{
+	TAG_NIL,
+	TAG_FALSE,
+	TAG_TRUE,
+	TAG_NUMBER,         // lua_Number
+	TAG_STRING,         // size_t length, bytes
+	TAG_LIGHTUSERDATA,  // void *
+	TAG_TABLE,          // int narr, int nrec, key/value pairs, TAG_END
+	TAG_TABLEREF,       // int index of a table met before in the value
+	TAG_DEEP,           // luaG_IdFunction, DEEP_PRELUDE *
+	TAG_END
+};
+
+#define WRITER_BUFFER 256
+
+struct s_Writer
+{
+	unsigned char *b;
+	size_t n;
+	size_t size;
+	bool_t nomem;
+	int value_i;        // stack index of the value being encoded
+	int cache_i;        // stack index of the table -> index cache (nil until needed)
+	int tables;         // tables met so far
+	bool_t refs;
+	bool_t deep;
+	unsigned char buffer[WRITER_BUFFER];
+};
+
+static void write_bytes( struct s_Writer *w, void const *p, size_t n)
+{
+	if( w->nomem)
+	{
+		return;
+	}
+	if( w->n + n > w->size)
+	{
+		size_t size = w->size * 2;
+		unsigned char *b;
+		while( size < w->n + n)
+		{
+			size *= 2;
+		}
+		b = (w->b == w->buffer) ? malloc( size) : realloc( w->b, size);
+		if( !b)
+		{
+			w->nomem = TRUE;
+			return;
+		}
+		if( w->b == w->buffer)
+		{
+			memcpy( b, w->buffer, w->n);
+		}
+		w->b = b;
+		w->size = size;
+	}
+	memcpy( w->b + w->n, p, n);
+	w->n += n;
+}
+
+static void write_tag( struct s_Writer *w, unsigned char tag)
+{
+	if( w->n < w->size)
+	{
+		w->b[w->n ++] = tag;
+	}
+	else
+	{
+		write_bytes( w, &tag, 1);
+	}
+}
+
+static bool_t encode_value( lua_State *L, struct s_Writer *w, int i);
+
+/*
+* Tables go through a cache so that shared subtables and cycles are
+* kept, as luaG_inter_copy() does. Keys of other types than those a
+* Linda key can have are skipped, like there.
+*/
+static bool_t encode_table( lua_State *L, struct s_Writer *w, int i)
+{
+	size_t header;
+	int count[2] = { 0, 0 };    // narr, nrec
+
+	if( lua_getmetatable( L, i))
+	{
+		lua_pop( L, 1);
+		return FALSE;   // metatables are copied once per state, by the keeper
+	}
+	if( w->tables > 0)
+	{
+		if( lua_isnil( L, w->cache_i))
+		{
+			// second table in the value: start caching, with the value itself as 0
+			lua_newtable( L);
+			lua_replace( L, w->cache_i);
+			lua_pushvalue( L, w->value_i);
+			lua_pushinteger( L, 0);
+			lua_rawset( L, w->cache_i);
+		}
+		lua_pushvalue( L, i);
+		lua_rawget( L, w->cache_i);
+		if( !lua_isnil( L, -1))
+		{
+			int ref = (int) lua_tointeger( L, -1);
+			lua_pop( L, 1);
+			write_tag( w, TAG_TABLEREF);
+			write_bytes( w, &ref, sizeof( ref));
+			w->refs = TRUE;
+			return TRUE;
+		}
+		lua_pop( L, 1);
+		lua_pushvalue( L, i);
+		lua_pushinteger( L, w->tables);
+		lua_rawset( L, w->cache_i);
+	}
+	++ w->tables;
+
+	write_tag( w, TAG_TABLE);
+	header = w->n;
+	write_bytes( w, count, sizeof( count));
+
+	STACK_GROW( L, 3);
+	lua_pushnil( L);
+	while( lua_next( L, i))
+	{
+		int key_i = lua_gettop( L) - 1;
+		int t = lua_type( L, key_i);
+		if( t == LUA_TBOOLEAN || t == LUA_TNUMBER || t == LUA_TSTRING || t == LUA_TLIGHTUSERDATA)
+		{
+			lua_Number n;
+			encode_value( L, w, key_i);
+			if( !encode_value( L, w, key_i + 1))
+			{
+				lua_pop( L, 2);
+				return FALSE;
+			}
+			if( t == LUA_TNUMBER && (n = lua_tonumber( L, key_i)) >= 1 && n == (int) n)
+			{
+				++ count[0];
+			}
+			else
+			{
+				++ count[1];
+			}
+		}
+		lua_pop( L, 1);
+	}
+	write_tag( w, TAG_END);
+	if( !w->nomem)
+	{
+		memcpy( w->b + header, count, sizeof( count));
+	}
+	return TRUE;
+}
+
+/*
+* Returns FALSE for a value that has to be parked in the keeper state
+*/
+static bool_t encode_value( lua_State *L, struct s_Writer *w, int i)
+{
+	switch( lua_type( L, i))
+	{
+		case LUA_TNIL:
+		write_tag( w, TAG_NIL);
+		return TRUE;
+
+		case LUA_TBOOLEAN:
+		write_tag( w, lua_toboolean( L, i) ? TAG_TRUE : TAG_FALSE);
+		return TRUE;
+
+		case LUA_TNUMBER:
+		{
+			lua_Number n = lua_tonumber( L, i);
+			write_tag( w, TAG_NUMBER);
+			write_bytes( w, &n, sizeof( n));
+		}
+		return TRUE;
+
+		case LUA_TSTRING:
+		{
+			size_t len;
+			char const *s = lua_tolstring( L, i, &len);
+			write_tag( w, TAG_STRING);
+			write_bytes( w, &len, sizeof( len));
+			write_bytes( w, s, len);
+		}
+		return TRUE;
+
+		case LUA_TLIGHTUSERDATA:
+		{
+			void *p = lua_touserdata( L, i);
+			write_tag( w, TAG_LIGHTUSERDATA);
+			write_bytes( w, &p, sizeof( p));
+		}
+		return TRUE;
+
+		case LUA_TTABLE:
+		return encode_table( L, w, i);
+
+		case LUA_TUSERDATA:
+		{
+			// referenced once the item is complete, see 'deep_refs()'
+			DEEP_PRELUDE *p;
+			luaG_IdFunction idfunc = luaG_deep_prelude( L, i, &p);
+			if( !idfunc)
+			{
+				return FALSE;
+			}
+			write_tag( w, TAG_DEEP);
+			write_bytes( w, &idfunc, sizeof( idfunc));
+			write_bytes( w, &p, sizeof( p));
+			w->deep = TRUE;
+		}
+		return TRUE;
+
+		default:
+		return FALSE;   // functions, non-deep userdata and threads
+	}
+}
+
+struct s_Reader
+{
+	unsigned char const *p;
+	int refs_i;         // stack index of the decoded tables, or 0
+	int tables;
+};
+
+static void decode_value( lua_State *L, struct s_Reader *r)
+{
+	switch( *r->p ++)
+	{
+		case TAG_NIL:
+		lua_pushnil( L);
+		break;
+
+		case TAG_FALSE:
+		lua_pushboolean( L, 0);
+		break;
+
+		case TAG_TRUE:
+		lua_pushboolean( L, 1);
+		break;
+
+		case TAG_NUMBER:
+		{
+			lua_Number n;
+			memcpy( &n, r->p, sizeof( n));
+			r->p += sizeof( n);
+			lua_pushnumber( L, n);
+		}
+		break;
+
+		case TAG_STRING:
+		{
+			size_t len;
+			memcpy( &len, r->p, sizeof( len));
+			r->p += sizeof( len);
+			lua_pushlstring( L, (char const *) r->p, len);
+			r->p += len;
+		}
+		break;
+
+		case TAG_LIGHTUSERDATA:
+		{
+			void *p;
+			memcpy( &p, r->p, sizeof( p));
+			r->p += sizeof( p);
+			lua_pushlightuserdata( L, p);
+		}
+		break;
+
+		case TAG_TABLE:
+		{
+			int count[2];
+			memcpy( count, r->p, sizeof( count));
+			r->p += sizeof( count);
+			STACK_GROW( L, 3);
+			lua_createtable( L, count[0], count[1]);
+			if( r->refs_i)
+			{
+				lua_pushvalue( L, -1);
+				lua_rawseti( L, r->refs_i, ++ r->tables);
+			}
+			while( *r->p != TAG_END)
+			{
+				decode_value( L, r);   // key
+				decode_value( L, r);   // value
+				lua_rawset( L, -3);
+			}
+			++ r->p;
+		}
+		break;
+
+		case TAG_TABLEREF:
+		{
+			int ref;
+			memcpy( &ref, r->p, sizeof( ref));
+			r->p += sizeof( ref);
+			lua_rawgeti( L, r->refs_i, ref + 1);
+		}
+		break;
+
+		case TAG_DEEP:
+		{
+			// the new proxy (if any) takes a reference, the item drops its own
+			luaG_IdFunction idfunc;
+			DEEP_PRELUDE *p;
+			memcpy( &idfunc, r->p, sizeof( idfunc));
+			memcpy( &p, r->p + sizeof( idfunc), sizeof( p));
+			r->p += sizeof( idfunc) + sizeof( p);
+			luaG_push_proxy( L, idfunc, p);
+			luaG_deep_unref( L, idfunc, p);
+		}
+		break;
+	}
+}
+
+/*
+* Take ('L' NULL) or drop references to the deep userdata of an encoded
+* value, returning the end of the value
+*/
+static unsigned char const *deep_refs( lua_State *L, unsigned char const *p)
+{
+	switch( *p ++)
+	{
+		case TAG_NUMBER:
+		p += sizeof( lua_Number);
+		break;
+
+		case TAG_STRING:
+		{
+			size_t len;
+			memcpy( &len, p, sizeof( len));
+			p += sizeof( len) + len;
+		}
+		break;
+
+		case TAG_LIGHTUSERDATA:
+		p += sizeof( void *);
+		break;
+
+		case TAG_TABLE:
+		p += 2 * sizeof( int);
+		while( *p != TAG_END)
+		{
+			p = deep_refs( L, p);  // key
+			p = deep_refs( L, p);  // value
+		}
+		++ p;
+		break;
+
+		case TAG_TABLEREF:
+		p += sizeof( int);
+		break;
+
+		case TAG_DEEP:
+		{
+			luaG_IdFunction idfunc;
+			DEEP_PRELUDE *prelude;
+			memcpy( &idfunc, p, sizeof( idfunc));
+			memcpy( &prelude, p + sizeof( idfunc), sizeof( prelude));
+			p += sizeof( idfunc) + sizeof( prelude);
+			if( L)
+			{
+				luaG_deep_unref( L, idfunc, prelude);
+			}
+			else
+			{
+				luaG_deep_ref( prelude);
+			}
+		}
+		break;
+	}
+	return p;
+}
+
+static void decode_item( lua_State *L, struct s_Item *item)
+{
+	struct s_Reader r;
+	r.p = item->data;
+	r.refs_i = 0;
+	r.tables = 0;
+	if( item->refs)
+	{
+		lua_newtable( L);
+		r.refs_i = lua_gettop( L);
+	}
+	decode_value( L, &r);
+	if( r.refs_i)
+	{
+		lua_remove( L, r.refs_i);
+	}
+}
+
+/*
+* Keeper calls for parked values; 'item' is their key in the keeper state
+*/
+static int park( lua_State *L, void *linda, struct s_Item *item, int i)
+{
+	struct s_Keeper *K;
+	int pushed;
+	lua_pushlightuserdata( L, item);
+	lua_pushvalue( L, i);
+	K = keeper_acquire( linda);
+	pushed = keeper_call( K->L, "set", L, linda, lua_gettop( L) - 1);
+	if( pushed >= 0)
+	{
+		++ K->parked;
+	}
+	keeper_release( K);
+	lua_pop( L, 2);
+	return pushed;
+}
+
+// Push the value parked for 'item', dropping it from the keeper state
+static int unpark( lua_State *L, void *linda, struct s_Item *item)
+{
+	struct s_Keeper *K;
+	int pushed;
+	lua_pushlightuserdata( L, item);
+	K = keeper_acquire( linda);
+	pushed = keeper_call( K->L, "get", L, linda, lua_gettop( L));
+	lua_pushlightuserdata( L, item);
+	keeper_call( K->L, "set", L, linda, lua_gettop( L));
+	lua_pop( L, 1);
+	-- K->parked;
+	keeper_release( K);
+	if( pushed < 0)
+	{
+		lua_pop( L, 1);
+		return pushed;
+	}
+	ASSERT_L( pushed == 1);
+	lua_remove( L, -2);
+	return 0;
+}
+
+static void drop( lua_State *L, void *linda, struct s_Item *item)
+{
+	struct s_Keeper *K;
+	lua_pushlightuserdata( L, item);
+	K = keeper_acquire( linda);
+	keeper_call( K->L, "set", L, linda, lua_gettop( L));
+	-- K->parked;
+	keeper_release( K);
+	lua_pop( L, 1);
+}
+
+static struct s_Item *new_item( lua_State *L, void *linda, int i, int *status)
+{
+	struct s_Writer w;
+	struct s_Item *item;
+
+	w.b = w.buffer;
+	w.n = 0;
+	w.size = WRITER_BUFFER;
+	w.nomem = FALSE;
+	w.value_i = i;
+	w.cache_i = 0;
+	w.tables = 0;
+	w.refs = FALSE;
+	w.deep = FALSE;
+
+	if( lua_type( L, i) == LUA_TTABLE)
+	{
+		STACK_GROW( L, 1);
+		lua_pushnil( L);    // slot for the cache, created only for nested tables
+		w.cache_i = lua_gettop( L);
+	}
+	if( !encode_value( L, &w, i))
+	{
+		w.n = 0;    // park it
+	}
+	if( w.cache_i)
+	{
+		lua_settop( L, w.cache_i - 1);
+	}
+
+	item = w.nomem ? NULL : (struct s_Item *) malloc( ITEM_SIZE( w.n));
+	if( item)
+	{
+		item->next = NULL;
+		item->size = w.n;
+		item->refs = w.refs;
+		item->deep = w.deep && w.n > 0;
+		memcpy( item->data, w.b, w.n);
+		if( w.n == 0 && (*status = park( L, linda, item, i)) < 0)
+		{
+			free( item);
+			item = NULL;
+		}
+		else if( item->deep)
+		{
+			deep_refs( NULL, item->data);
+		}
+	}
+	else
+	{
+		*status = CHANNEL_ERRMEM;
+	}
+	if( w.b != w.buffer)
+	{
+		free( w.b);
+	}
+	return item;
+}
+
+/*
+* Encode the values from 'first' to 'last' into a list of FIFO entries
+*
+* Returns: 0, or CHANNEL_ERRMEM/KEEPER_ERR... with nothing in '*items'
+*/
+int channel_encode( lua_State *L, void *linda, int first, int last, struct s_Item **items)
+{
+	struct s_Item **tail = items;
+	int status = 0;
+	int i;
+	*items = NULL;
+	for( i = first; i <= last; ++ i)
+	{
+		*tail = new_item( L, linda, i, &status);
+		if( !*tail)
+		{
+			channel_release( L, linda, *items);
+			*items = NULL;
+			return status;
+		}
+		tail = &(*tail)->next;
+	}
+	return 0;
+}
+
+/*
+* Push the values of a list of entries, and free it
+*/
+int channel_decode( lua_State *L, void *linda, struct s_Item *items)
+{
+	int status = 0;
+	while( items)
+	{
+		struct s_Item *next = items->next;
+		STACK_GROW( L, 1);
+		if( items->size == 0)
+		{
+			if( status == 0)
+			{
+				status = unpark( L, linda, items);
+			}
+			else
+			{
+				drop( L, linda, items);
+			}
+		}
+		else if( status == 0)
+		{
+			decode_item( L, items);
+		}
+		else if( items->deep)
+		{
+			deep_refs( L, items->data);
+		}
+		free( items);
+		items = next;
+	}
+	return status;
+}
+
+/*
+* Free a list of entries that will not be received
+*/
+void channel_release( lua_State *L, void *linda, struct s_Item *items)
+{
+	while( items)
+	{
+		struct s_Item *next = items->next;
+		if( items->size == 0)
+		{
+			drop( L, linda, items);
+		}
+		else if( items->deep)
+		{
+			deep_refs( L, items->data);
+		}
+		free( items);
+		items = next;
+	}
+}
+
+/*---=== FIFOs ===---
+*/
+
+struct s_Channel
+{
+	struct s_Channel *next;     // in the same 'hash' slot
+	struct s_Item *first;
+	struct s_Item *last;
+	int count;                  // values in the FIFO
+	int limit;                  // max values in the FIFO, -1 for none
+	bool_t active;              // sent to or set, and not cleared since
+	struct s_Key key;
+	char str[1];                // string key contents
+};
+
+void channels_init( struct s_Channels *C)
+{
+	C->hash = NULL;
+	C->size = 0;
+	C->count = 0;
+	C->values = 0;
+	C->max_depth = 0;
+	C->bytes = 0;
+	C->parked = FALSE;
+}
+
+/*
+* Free all contents. Parked values are left for the keeper "clear" call,
+* queued by keeper_clear(): this runs in a GC step, which may come within
+* a keeper call with the keeper lock held.
+*/
+void channels_free( struct s_Channels *C, lua_State *L, void *linda)
+{
+	int i;
+	if( C->parked)
+	{
+		int parked = 0;
+		for( i = 0; i < C->size; ++ i)
+		{
+			struct s_Channel *ch;
+			struct s_Item *item;
+			for( ch = C->hash[i]; ch; ch = ch->next)
+			{
+				for( item = ch->first; item; item = item->next)
+				{
+					parked += (item->size == 0);
+				}
+			}
+		}
+		keeper_clear( linda, parked);
+	}
+	for( i = 0; i < C->size; ++ i)
+	{
+		struct s_Channel *ch = C->hash[i];
+		while( ch)
+		{
+			struct s_Channel *next = ch->next;
+			struct s_Item *item = ch->first;
+			while( item)
+			{
+				struct s_Item *next_item = item->next;
+				if( item->deep)
+				{
+					deep_refs( L, item->data);
+				}
+				free( item);
+				item = next_item;
+			}
+			free( ch);
+			ch = next;
+		}
+	}
+	free( C->hash);
+	channels_init( C);
+}
+
+static struct s_Channel *find( struct s_Channels *C, struct s_Key const *k)
+{
+	struct s_Channel *ch = C->size ? C->hash[k->hash & (C->size - 1)] : NULL;
+	while( ch && !key_equal( &ch->key, k))
+	{
+		ch = ch->next;
+	}
+	return ch;
+}
+
+static struct s_Channel *find_or_create( struct s_Channels *C, lua_State *L, int key_i)
+{
+	struct s_Key k;
+	struct s_Channel *ch;
+	key_get( L, key_i, &k);
+	ch = find( C, &k);
+	if( ch)
+	{
+		return ch;
+	}
+
+	if( C->count >= C->size)
+	{
+		int size = C->size ? 2 * C->size : 4;
+		struct s_Channel **hash = (struct s_Channel **) calloc( size, sizeof( struct s_Channel *));
+		int i;
+		if( !hash)
+		{
+			return NULL;
+		}
+		for( i = 0; i < C->size; ++ i)
+		{
+			while( C->hash[i])
+			{
+				struct s_Channel *c = C->hash[i];
+				C->hash[i] = c->next;
+				c->next = hash[c->key.hash & (size - 1)];
+				hash[c->key.hash & (size - 1)] = c;
+			}
+		}
+		free( C->hash);
+		C->hash = hash;
+		C->size = size;
+	}
+
+	ch = (struct s_Channel *) malloc( offsetof( struct s_Channel, str) + (k.type == LUA_TSTRING ? k.len : 0) + 1);
+	if( !ch)
+	{
+		return NULL;
+	}
+	ch->first = ch->last = NULL;
+	ch->count = 0;
+	ch->limit = -1;
+	ch->active = FALSE;
+	ch->key = k;
+	if( k.type == LUA_TSTRING)
+	{
+		memcpy( ch->str, k.s, k.len);
+		ch->key.s = ch->str;
+	}
+	ch->next = C->hash[k.hash & (C->size - 1)];
+	C->hash[k.hash & (C->size - 1)] = ch;
+	++ C->count;
+	return ch;
+}
+
+// Free a channel with no values and no limit, which is the same as none
+static void collect( struct s_Channels *C, struct s_Channel *ch)
+{
+	struct s_Channel **p;
+	if( ch->active || ch->limit >= 0)
+	{
+		return;
+	}
+	p = &C->hash[ch->key.hash & (C->size - 1)];
+	while( *p != ch)
+	{
+		p = &(*p)->next;
+	}
+	*p = ch->next;
+	-- C->count;
+	free( ch);
+}
+
+static struct s_Item *pop( struct s_Channels *C, struct s_Channel *ch, int n)
+{
+	struct s_Item *first = ch->first;
+	struct s_Item *last = first;
+	int i;
+	C->bytes -= ITEM_SIZE( first->size);
+	for( i = 1; i < n; ++ i)
+	{
+		last = last->next;
+		C->bytes -= ITEM_SIZE( last->size);
+	}
+	ch->first = last->next;
+	if( !ch->first)
+	{
+		ch->last = NULL;
+	}
+	last->next = NULL;
+	ch->count -= n;
+	C->values -= n;
+	return first;
+}
+
+/*
+* Queue all of 'items' if they fit within the key's limit
+*
+* Returns: 1 if queued, 0 if the limit was hit, CHANNEL_ERRMEM
+*/
+int channel_send( struct s_Channels *C, lua_State *L, int key_i, struct s_Item *items)
+{
+	struct s_Channel *ch = find_or_create( C, L, key_i);
+	struct s_Item *last = NULL;
+	struct s_Item *i;
+	size_t bytes = 0;
+	bool_t parked = FALSE;
+	int n = 0;
+	if( !ch)
+	{
+		return CHANNEL_ERRMEM;
+	}
+	ch->active = TRUE;
+	for( i = items; i; i = i->next)
+	{
+		bytes += ITEM_SIZE( i->size);
+		parked = parked || i->size == 0;
+		last = i;
+		++ n;
+	}
+	if( ch->limit >= 0 && ch->count + n > ch->limit)
+	{
+		return 0;
+	}
+	if( LINDA_MEMORY_LIMIT && C->bytes + bytes > LINDA_MEMORY_LIMIT)
+	{
+		return CHANNEL_ERRMEM;
+	}
+	if( ch->last)
+	{
+		ch->last->next = items;
+	}
+	else
+	{
+		ch->first = items;
+	}
+	ch->last = last;
+	ch->count += n;
+	C->values += n;
+	if( ch->count > C->max_depth)
+	{
+		C->max_depth = ch->count;
+	}
+	C->bytes += bytes;
+	C->parked = C->parked || parked;
+	return 1;
+}
+
+/*
+* Unqueue a value from the first key from 'key_i' to 'last_i' that has one
+*/
+struct s_Item *channel_receive( struct s_Channels *C, lua_State *L, int key_i, int last_i, int *found_i)
+{
+	int i;
+	for( i = key_i; i <= last_i; ++ i)
+	{
+		struct s_Key k;
+		struct s_Channel *ch;
+		key_get( L, i, &k);
+		ch = find( C, &k);
+		if( ch && ch->count > 0)
+		{
+			*found_i = i;
+			return pop( C, ch, 1);
+		}
+	}
+	return NULL;
+}
+
+/*
+* Unqueue 'count' values from a key, if it has that many
+*/
+struct s_Item *channel_receive_batched( struct s_Channels *C, lua_State *L, int key_i, int count)
+{
+	struct s_Key k;
+	struct s_Channel *ch;
+	if( count <= 0)
+	{
+		return NULL;
+	}
+	key_get( L, key_i, &k);
+	ch = find( C, &k);
+	return (ch && ch->count >= count) ? pop( C, ch, count) : NULL;
+}
+
+/*
+* Replace the FIFO of a key by 'item', or clear it if NULL
+*
+* The previous contents go to '*old', for the caller to release.
+*/
+int channel_set( struct s_Channels *C, lua_State *L, int key_i, struct s_Item *item, struct s_Item **old)
+{
+	struct s_Channel *ch;
+	*old = NULL;
+	if( item)
+	{
+		ch = find_or_create( C, L, key_i);
+		if( !ch)
+		{
+			return CHANNEL_ERRMEM;
+		}
+	}
+	else
+	{
+		struct s_Key k;
+		key_get( L, key_i, &k);
+		ch = find( C, &k);
+		if( !ch)
+		{
+			return 0;
+		}
+	}
+	if( item && LINDA_MEMORY_LIMIT)
+	{
+		size_t bytes = C->bytes + ITEM_SIZE( item->size);
+		struct s_Item *i;
+		for( i = ch->first; i; i = i->next)
+		{
+			bytes -= ITEM_SIZE( i->size);
+		}
+		if( bytes > LINDA_MEMORY_LIMIT)
+		{
+			return CHANNEL_ERRMEM;
+		}
+	}
+	if( ch->count > 0)
+	{
+		*old = pop( C, ch, ch->count);
+	}
+	if( item)
+	{
+		ch->first = ch->last = item;
+		ch->count = 1;
+		++ C->values;
+		if( C->max_depth < 1)
+		{
+			C->max_depth = 1;
+		}
+		C->parked = C->parked || item->size == 0;
+		ch->active = TRUE;
+		C->bytes += ITEM_SIZE( item->size);
+	}
+	else
+	{
+		ch->active = FALSE;
+		collect( C, ch);
+	}
+	return 0;
+}
+
+/*
+* Read the first value of a key, without unqueuing it
+*
+* The value is copied into '*copy', for decoding once the lock is released.
+* A parked value gets a second entry in the keeper state: the first one can
+* be received as soon as the lock is released.
+*/
+int channel_get( struct s_Channels *C, lua_State *L, int key_i, void *linda, struct s_Item **copy)
+{
+	struct s_Key k;
+	struct s_Channel *ch;
+	struct s_Item *item;
+	*copy = NULL;
+	key_get( L, key_i, &k);
+	ch = find( C, &k);
+	if( !ch || ch->count == 0)
+	{
+		return 0;
+	}
+	item = ch->first;
+	*copy = (struct s_Item *) malloc( ITEM_SIZE( item->size));
+	if( !*copy)
+	{
+		return CHANNEL_ERRMEM;
+	}
+	memcpy( *copy, item, ITEM_SIZE( item->size));
+	(*copy)->next = NULL;
+	if( item->size == 0)
+	{
+		struct s_Keeper *K = keeper_acquire( linda);
+		int status = keeper_dup( K->L, linda, item, *copy);
+		if( status == 0)
+		{
+			++ K->parked;
+		}
+		keeper_release( K);
+		if( status < 0)
+		{
+			free( *copy);
+			*copy = NULL;
+			return status;
+		}
+	}
+	else if( item->deep)
+	{
+		deep_refs( NULL, item->data);   // the copy holds its own
+	}
+	return 0;
+}
+
+/*
+* Set the max number of values queued in a key (-1 for no limit)
+*/
+int channel_limit( struct s_Channels *C, lua_State *L, int key_i, int limit)
+{
+	struct s_Channel *ch = find_or_create( C, L, key_i);
+	if( !ch)
+	{
+		return CHANNEL_ERRMEM;
+	}
+	ch->limit = limit;
+	collect( C, ch);
+	return 0;
+}
+
+/*
+* Snapshot of the FIFO lengths, taken under the lock and pushed after it
+*/
+struct s_Count
+{
+	struct s_Key key;
+	int count;          // -1 if the key is not active
+};
+
+struct s_Counts
+{
+	int n;
+	struct s_Count c[1];
+};
+
+/*
+* Count the values of the keys from 'key_i' to 'last_i', or of all keys
+* if there are none, into '*counts'
+*/
+int channel_count( struct s_Channels *C, lua_State *L, int key_i, int last_i, struct s_Counts **counts)
+{
+	int n = 0;
+	int i;
+	size_t strings = 0;
+	char *str;
+	struct s_Counts *cs;
+
+	if( last_i >= key_i)
+	{
+		n = last_i - key_i + 1;
+	}
+	else
+	{
+		for( i = 0; i < C->size; ++ i)
+		{
+			struct s_Channel *ch;
+			for( ch = C->hash[i]; ch; ch = ch->next)
+			{
+				if( ch->active)
+				{
+					++ n;
+					if( ch->key.type == LUA_TSTRING)
+					{
+						strings += ch->key.len;
+					}
+				}
+			}
+		}
+	}
+
+	cs = (struct s_Counts *) malloc( offsetof( struct s_Counts, c) + (n + 1) * sizeof( struct s_Count) + strings);
+	if( !cs)
+	{
+		return CHANNEL_ERRMEM;
+	}
+	cs->n = n;
+	str = (char *) &cs->c[n + 1];
+
+	if( last_i >= key_i)
+	{
+		for( i = 0; i < n; ++ i)
+		{
+			struct s_Channel *ch;
+			key_get( L, key_i + i, &cs->c[i].key);
+			ch = find( C, &cs->c[i].key);
+			cs->c[i].count = (ch && ch->active) ? ch->count : -1;
+		}
+	}
+	else
+	{
+		struct s_Count *c = cs->c;
+		for( i = 0; i < C->size; ++ i)
+		{
+			struct s_Channel *ch;
+			for( ch = C->hash[i]; ch; ch = ch->next)
+			{
+				if( ch->active)
+				{
+					c->key = ch->key;
+					c->count = ch->count;
+					if( ch->key.type == LUA_TSTRING)
+					{
+						memcpy( str, ch->key.s, ch->key.len);
+						c->key.s = str;
+						str += ch->key.len;
+					}
+					++ c;
+				}
+			}
+		}
+	}
+	*counts = cs;
+	return 0;
+}
+
+/*
+* Push what linda:count() returns, and free 'counts'
+*/
+int channel_push_counts( lua_State *L, int key_i, int last_i, struct s_Counts *counts)
+{
+	int i;
+	STACK_GROW( L, 3);
+	if( last_i == key_i)
+	{
+		// count(key): number of values, or nil
+		if( counts->c[0].count >= 0)
+		{
+			lua_pushinteger( L, counts->c[0].count);
+		}
+		else
+		{
+			lua_pushnil( L);
+		}
+	}
+	else if( last_i < key_i && counts->n == 0)
+	{
+		lua_pushnil( L);
+	}
+	else
+	{
+		// count() or count(key, ...): { [key] = number of values }
+		lua_createtable( L, 0, counts->n);
+		for( i = 0; i < counts->n; ++ i)
+		{
+			if( counts->c[i].count >= 0)
+			{
+				if( last_i >= key_i)
+				{
+					lua_pushvalue( L, key_i + i);
+				}
+				else
+				{
+					key_push( L, &counts->c[i].key);
+				}
+				lua_pushinteger( L, counts->c[i].count);
+				lua_rawset( L, -3);
+			}
+		}
+	}
+	free( counts);
+	return 1;
+}
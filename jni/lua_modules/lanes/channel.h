@@ -0,0 +1,57 @@
+#if !defined( __channel_h__)
+#define __channel_h__ 1
+
+/*
+* Hard memory limit of the values queued in one Linda (bytes, 0 for none).
+* Sending past it fails with a memory error, as a full keeper state did.
+*/
+#ifndef LINDA_MEMORY_LIMIT
+#define LINDA_MEMORY_LIMIT KEEPER_MEMORY_LIMIT
+#endif
+
+// channel_...() return values other than 0 (keeper_call() ones are passed on)
+#define CHANNEL_ERRMEM (-3)
+
+#define CHANNEL_ERROR( L, _status) \
+	((_status) == CHANNEL_ERRMEM ? luaL_error( L, "not enough memory in linda") : KEEPER_CALL_ERROR( L, _status))
+
+struct s_Item;
+struct s_Channel;
+struct s_Counts;
+
+/*
+* Contents of a Linda: a FIFO of encoded values per key
+*
+* Not locked by itself; the Linda mutex must be held around the calls
+* below that take a 's_Channels', and nothing in them raises Lua errors.
+*/
+struct s_Channels
+{
+	struct s_Channel **hash;
+	int size;       // of 'hash', a power of 2
+	int count;      // channels in 'hash'
+	int values;     // queued in all channels
+	int max_depth;  // most values queued in one channel so far
+	size_t bytes;   // held by queued values
+	bool_t parked;  // values were ever parked in the keeper state
+};
+
+void channels_init( struct s_Channels *C);
+void channels_free( struct s_Channels *C, lua_State *L, void *linda);
+
+// Encoding and decoding, done outside of the Linda lock
+int channel_encode( lua_State *L, void *linda, int first, int last, struct s_Item **items);
+int channel_decode( lua_State *L, void *linda, struct s_Item *items);
+void channel_release( lua_State *L, void *linda, struct s_Item *items);
+
+// Operations on the FIFO of the key at 'key_i' (in 'L')
+int channel_send( struct s_Channels *C, lua_State *L, int key_i, struct s_Item *items);
+struct s_Item *channel_receive( struct s_Channels *C, lua_State *L, int key_i, int last_i, int *found_i);
+struct s_Item *channel_receive_batched( struct s_Channels *C, lua_State *L, int key_i, int count);
+int channel_set( struct s_Channels *C, lua_State *L, int key_i, struct s_Item *item, struct s_Item **old);
+int channel_get( struct s_Channels *C, lua_State *L, int key_i, void *linda, struct s_Item **copy);
+int channel_limit( struct s_Channels *C, lua_State *L, int key_i, int limit);
+int channel_count( struct s_Channels *C, lua_State *L, int key_i, int last_i, struct s_Counts **counts);
+int channel_push_counts( lua_State *L, int key_i, int last_i, struct s_Counts *counts);
+
+#endif // __channel_h__
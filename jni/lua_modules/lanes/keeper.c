@@ -58,10 +58,43 @@
 *
 * Access to keeper states is locked (only one OS thread at a time) so the 
 * bigger the pool, the less chances of unnecessary waits. Lindas map to the
-* keepers randomly, by a hash.
+* first 'GNbShared' keepers randomly, by a hash, unless pinned to one.
 */
-static struct s_Keeper *GKeepers = NULL;
-static int GNbKeepers = 0;
+static struct s_Keeper GKeepers[KEEPERS_MAX];
+static int GNbKeepers = 0;              // states created, only grows
+static volatile int GNbShared = 0;      // changed with all keepers locked
+static MUTEX_T GResizeCS;               // serializes keeper_resize()
+
+/*
+* Lindas pinned to a keeper, looked up only when there are any. A Linda is
+* pinned at creation and unpinned at deletion, so its entry never changes
+* while it has values parked.
+*/
+struct s_Pin
+{
+	const void *ptr;
+	int k;
+};
+static struct s_Pin *GPins = NULL;
+static volatile int GNbPins = 0;
+static int GPinsSize = 0;
+static MUTEX_T GPinsCS;
+
+/*
+* Parked values of deleted Lindas, cleared by the next one to lock their
+* keeper (see keeper_clear()). A Linda is deleted in a GC step, which can
+* come while this thread holds any keeper lock, so it must not take one.
+*/
+struct s_Clear
+{
+	const void *ptr;
+	int k;
+	int parked;     // values to take off the keeper's count
+};
+static struct s_Clear *GClears = NULL;
+static volatile int GNbClears = 0;
+static int GClearsSize = 0;
+static MUTEX_T GClearsCS;
 
 /*
 * Lua code for the keeper states (baked in)
@@ -69,6 +102,137 @@ static int GNbKeepers = 0;
 static char const keeper_chunk[]= 
 #include "keeper.lch"
 
+/*
+* Calls into keeper states run protected, so that hitting the keeper
+* memory limit fails the call instead of panicking the keeper state.
+*
+* Copying values between the caller and the keeper state raises errors in
+* the caller (unsupported types, memory), and an error must never unwind
+* through a lua_pcall() of the other state. So the copies run under a
+* lua_pcall() in the caller, with the keeper memory limit lifted so that
+* the keeper state does not raise meanwhile, and only the keeper function
+* runs under a lua_pcall() in the keeper state. Going over the limit while
+* copying in fails the call as hitting it would have.
+*/
+struct s_KeeperCall
+{
+	lua_State *K;
+	char const *func_name;
+	void *linda;
+	int args;
+	int status;     // KEEPER_ERR... of the keeper side, or 0
+};
+
+// Calls the keeper function, its arguments being the top 'c->args' values of 'K'
+static int keeper_run( struct s_KeeperCall *c)
+{
+	lua_State *K = c->K;
+	int status;
+	luaL_AllocStats stats;
+
+	luaL_setalloclimit( K, KEEPER_MEMORY_LIMIT);
+	if( KEEPER_MEMORY_LIMIT && luaL_getallocstats( K, &stats) && stats.inuse > KEEPER_MEMORY_LIMIT)
+	{
+		// over it with what was copied in: unless that was garbage
+		lua_gc( K, LUA_GCCOLLECT, 0);
+		if( luaL_getallocstats( K, &stats) && stats.inuse > KEEPER_MEMORY_LIMIT)
+		{
+			return KEEPER_ERRMEM;
+		}
+	}
+	status = lua_pcall( K, 1 + c->args, LUA_MULTRET, 0);
+	if( status != 0)
+	{
+		return (status == LUA_ERRMEM) ? KEEPER_ERRMEM : KEEPER_ERRRUN;
+	}
+	return 0;
+}
+
+// Runs in the caller: [1]: 's_KeeperCall', [2..]: copies of the arguments
+static int keeper_call_protected( lua_State *L)
+{
+	struct s_KeeperCall *c = (struct s_KeeperCall *) lua_touserdata( L, 1);
+	lua_State *K = c->K;
+	int const Ktos = lua_gettop( K);
+	int retvals;
+
+	luaL_setalloclimit( K, 0);
+	if( !lua_checkstack( K, c->args + 3))
+	{
+		c->status = KEEPER_ERRMEM;
+		return 0;
+	}
+	lua_getglobal( K, c->func_name);
+	_ASSERT_L( K, lua_isfunction(K, -1));
+	lua_pushlightuserdata( K, c->linda);
+	if( (c->args > 0) && luaG_inter_copy( L, K, c->args) != 0) // L->K
+	{
+		c->status = KEEPER_ERRCOPY;
+		return 0;
+	}
+
+	c->status = keeper_run( c);
+	if( c->status != 0)
+	{
+		return 0;
+	}
+
+	retvals = lua_gettop( K) - Ktos;
+	luaL_setalloclimit( K, 0);
+	if( (retvals > 0) && luaG_inter_move( K, L, retvals) != 0) // K->L
+	{
+		c->status = KEEPER_ERRCOPY;
+		return 0;
+	}
+	return retvals;
+}
+
+/*
+* Create keeper state #_k (0-based)
+*/
+static char const *keeper_new( int _k)
+{
+	// Initialize Keeper states with bare minimum of libs (those required
+	// by 'keeper.lua')
+	//
+	lua_State *L= luaL_newstate();
+	if (!L)
+		return "out of memory";
+
+	// to see VM name in Decoda debugger
+	lua_pushliteral( L, "Keeper #");
+	lua_pushinteger( L, _k + 1);
+	lua_concat( L, 2);
+	lua_setglobal( L, "decoda_name");
+
+	luaG_openlibs( L, "io,table,package" );     // 'io' for debugging messages, package because we need to require modules exporting idfuncs
+	serialize_require( L);
+
+
+	// Read in the preloaded chunk (and run it)
+	//
+	if (luaL_loadbuffer( L, keeper_chunk, sizeof(keeper_chunk), "@keeper.lua"))
+		return "luaL_loadbuffer() failed";   // LUA_ERRMEM
+
+	if (lua_pcall( L, 0 /*args*/, 0 /*results*/, 0 /*errfunc*/ ))
+	{
+		// LUA_ERRRUN / LUA_ERRMEM / LUA_ERRERR
+		//
+		const char *err= lua_tostring(L,-1);
+		assert(err);
+		return err;
+	}
+
+	// Limit only after setup, which must not fail
+	luaL_setalloclimit( L, KEEPER_MEMORY_LIMIT);
+
+	MUTEX_INIT( &GKeepers[_k].lock_ );
+	GKeepers[_k].L= L;
+	memset( &GKeepers[_k].stats, 0, sizeof( struct s_LockStats));
+	GKeepers[_k].parked = 0;
+	return NULL;
+}
+
 /*
 * Initialize keeper states
 *
@@ -82,69 +246,293 @@ char const *init_keepers( int const _nbKeepers)
 {
 	int i;
 	assert( _nbKeepers >= 1);
-	GNbKeepers = _nbKeepers;
-	GKeepers = malloc( _nbKeepers * sizeof( struct s_Keeper));
+	if( _nbKeepers > KEEPERS_MAX)
+		return "too many keeper states";
+	MUTEX_INIT( &GResizeCS);
+	MUTEX_INIT( &GPinsCS);
+	MUTEX_INIT( &GClearsCS);
 	for( i = 0; i < _nbKeepers; ++ i)
 	{
+		char const *err = keeper_new( i);
+		if( err)
+			return err;
+		GNbKeepers = i + 1;
+	}
+	GNbShared = _nbKeepers;
+	return NULL;    // ok
+}
 
-		// Initialize Keeper states with bare minimum of libs (those required
-		// by 'keeper.lua')
-		//
-		lua_State *L= luaL_newstate();
-		if (!L)
-			return "out of memory";
+/*
+* Run the "clear" calls queued for 'K', with its lock held. The Lindas are
+* gone, but nothing new can use their address as a key in 'K' before
+* this: that takes the lock.
+*/
+static void keeper_drain( struct s_Keeper *K)
+{
+	int const k = (int) (K - GKeepers);
+	while( GNbClears)
+	{
+		struct s_Clear c;
+		int i;
+		// keeper_call() may queue more (GC in the keeper state): not under GClearsCS
+		MUTEX_LOCK( &GClearsCS);
+		for( i = 0; i < GNbClears && GClears[i].k != k; ++ i)
+			;
+		c.ptr = NULL;
+		if( i < GNbClears)
+		{
+			c = GClears[i];
+			GClears[i] = GClears[-- GNbClears];
+		}
+		MUTEX_UNLOCK( &GClearsCS);
+		if( !c.ptr)
+			break;
+		keeper_call( K->L, "clear", NULL, (void *) c.ptr, 0);
+		K->parked -= c.parked;
+	}
+}
 
-		// to see VM name in Decoda debugger
-		lua_pushliteral( L, "Keeper #");
-		lua_pushinteger( L, i + 1);
-		lua_concat( L, 2);
-		lua_setglobal( L, "decoda_name");
+/*
+* Have the values parked by 'ptr' cleared from its keeper state, which is
+* not locked here: this is for Linda deletion, from a GC step that may be
+* within a keeper call. Done before 'ptr' is unpinned and freed.
+*
+* If the queue cannot grow, the values stay in the keeper state until
+* exit.
+*/
+void keeper_clear( const void *ptr, int _parked)
+{
+	int k = keeper_index( ptr);
+	MUTEX_LOCK( &GClearsCS);
+	if( GNbClears == GClearsSize)
+	{
+		int size = GClearsSize ? 2 * GClearsSize : 8;
+		struct s_Clear *clears = (struct s_Clear *) realloc( GClears, size * sizeof( struct s_Clear));
+		if( clears)
+		{
+			GClears = clears;
+			GClearsSize = size;
+		}
+	}
+	if( GNbClears < GClearsSize)
+	{
+		GClears[GNbClears].ptr = ptr;
+		GClears[GNbClears].k = k;
+		GClears[GNbClears].parked = _parked;
+		++ GNbClears;
+	}
+	MUTEX_UNLOCK( &GClearsCS);
+}
 
-		luaG_openlibs( L, "io,table,package" );     // 'io' for debugging messages, package because we need to require modules exporting idfuncs
-		serialize_require( L);
+/*
+* Have unpinned Lindas hash to the first '_nbShared' keepers, creating
+* states up to '_nbKeepers' in all; the others are left for pinned Lindas.
+* States are never closed before exit, so '_nbKeepers' only grows the pool.
+*
+* Changing the hash would lose track of the values parked by unpinned
+* Lindas, so it is refused while there are any (in any keeper, to keep
+* it simple). So is a '_nbKeepers' that leaves out the keeper of a pinned
+* Linda.
+*
+* Returns an error message, or NULL for okay
+*/
+char const *keeper_resize( int _nbShared, int _nbKeepers)
+{
+	char const *err = NULL;
+	int i, parked = 0;
+	if( _nbKeepers < _nbShared)
+		_nbKeepers = _nbShared;
+	if( _nbShared < 1 || _nbKeepers > KEEPERS_MAX)
+		return "keeper count out of range";
 
+	MUTEX_LOCK( &GResizeCS);
+	MUTEX_LOCK( &GPinsCS);
+	for( i = 0; i < GNbPins && !err; ++ i)
+	{
+		if( GPins[i].k >= _nbKeepers)
+			err = "a Linda is pinned to a keeper state beyond the count";
+	}
+	MUTEX_UNLOCK( &GPinsCS);
+	for( i = GNbKeepers; i < _nbKeepers && !err; ++ i)
+	{
+		err = keeper_new( i);
+		if( !err)
+			GNbKeepers = i + 1;
+	}
+	if( !err && _nbShared != GNbShared)
+	{
+		for( i = 0; i < GNbKeepers; ++ i)
+		{
+			MUTEX_LOCK( &GKeepers[i].lock_);
+			keeper_drain( &GKeepers[i]);
+			parked += GKeepers[i].parked;
+		}
+		if( parked)
+			err = "values are parked in keeper states";
+		else
+			GNbShared = _nbShared;
+		for( i = 0; i < GNbKeepers; ++ i)
+			MUTEX_UNLOCK( &GKeepers[i].lock_);
+	}
+	MUTEX_UNLOCK( &GResizeCS);
+	return err;
+}
 
-		// Read in the preloaded chunk (and run it)
-		//
-		if (luaL_loadbuffer( L, keeper_chunk, sizeof(keeper_chunk), "@keeper.lua"))
-			return "luaL_loadbuffer() failed";   // LUA_ERRMEM
+int keeper_count( void)
+{
+	return GNbKeepers;
+}
 
-		if (lua_pcall( L, 0 /*args*/, 0 /*results*/, 0 /*errfunc*/ ))
+/*
+* Have 'ptr' use keeper #_k (0-based) whatever the hash; must be done
+* before it parks anything
+*
+* Returns an error message, or NULL for okay
+*/
+char const *keeper_pin( const void *ptr, int _k)
+{
+	char const *err = NULL;
+	if( _k < 0 || _k >= GNbKeepers)
+		return "no such keeper state";
+	MUTEX_LOCK( &GPinsCS);
+	if( GNbPins == GPinsSize)
+	{
+		int size = GPinsSize ? 2 * GPinsSize : 8;
+		struct s_Pin *pins = (struct s_Pin *) realloc( GPins, size * sizeof( struct s_Pin));
+		if( pins)
 		{
-			// LUA_ERRRUN / LUA_ERRMEM / LUA_ERRERR
-			//
-			const char *err= lua_tostring(L,-1);
-			assert(err);
-			return err;
+			GPins = pins;
+			GPinsSize = size;
 		}
+		else
+		{
+			err = "out of memory";
+		}
+	}
+	if( !err)
+	{
+		GPins[GNbPins].ptr = ptr;
+		GPins[GNbPins].k = _k;
+		++ GNbPins;
+	}
+	MUTEX_UNLOCK( &GPinsCS);
+	return err;
+}
 
-		MUTEX_INIT( &GKeepers[i].lock_ );
-		GKeepers[i].L= L;
-		//GKeepers[i].count = 0;
+void keeper_unpin( const void *ptr)
+{
+	int i;
+	MUTEX_LOCK( &GPinsCS);
+	for( i = 0; i < GNbPins; ++ i)
+	{
+		if( GPins[i].ptr == ptr)
+		{
+			GPins[i] = GPins[-- GNbPins];
+			break;
+		}
 	}
-	return NULL;    // ok
+	MUTEX_UNLOCK( &GPinsCS);
 }
 
-struct s_Keeper *keeper_acquire( const void *ptr)
+static int keeper_pinned( const void *ptr)
 {
-	/*
-	* Any hashing will do that maps pointers to 0..GNbKeepers-1 
-	* consistently.
-	*
-	* Pointers are often aligned by 8 or so - ignore the low order bits
-	*/
-	unsigned int i= ((unsigned long)(ptr) >> 3) % GNbKeepers;
-	struct s_Keeper *K= &GKeepers[i];
+	int i, k = -1;
+	MUTEX_LOCK( &GPinsCS);
+	for( i = 0; i < GNbPins; ++ i)
+	{
+		if( GPins[i].ptr == ptr)
+		{
+			k = GPins[i].k;
+			break;
+		}
+	}
+	MUTEX_UNLOCK( &GPinsCS);
+	return k;
+}
+
+/*
+* Any hashing will do that maps pointers to 0..GNbShared-1 consistently.
+*
+* Pointers are often aligned by 8 or so - ignore the low order bits
+*/
+static int keeper_hash( const void *ptr, int _nbShared)
+{
+	int k = GNbPins ? keeper_pinned( ptr) : -1;
+	return k >= 0 ? k : (int)(((unsigned long)(ptr) >> 3) % _nbShared);
+}
+
+// 0-based index of the keeper 'ptr' currently maps to
+int keeper_index( const void *ptr)
+{
+	return keeper_hash( ptr, GNbShared);
+}
+
+void lockstats_lock( MUTEX_T *mu, struct s_LockStats *S)
+{
+	bool_t sample;
+	if( MUTEX_TRYLOCK( mu))
+	{
+		sample = (++ S->locks % LOCKSTATS_SAMPLE) == 0;
+		S->locked_at = sample ? clock_secs() : 0.0;
+	}
+	else
+	{
+		double t = clock_secs(), now, wait;
+		MUTEX_LOCK( mu);
+		now = clock_secs();
+		wait = now - t;
+		sample = (++ S->locks % LOCKSTATS_SAMPLE) == 0;
+		S->locked_at = sample ? now : 0.0;
+		++ S->contended;
+		S->wait += wait;
+		if( wait > S->wait_max)
+			S->wait_max = wait;
+	}
+}
 
-	MUTEX_LOCK( &K->lock_);
-	//++ K->count;
-	return K;
+void lockstats_unlock( MUTEX_T *mu, struct s_LockStats *S)
+{
+	if( S->locked_at != 0.0)
+		S->hold += (clock_secs() - S->locked_at) * LOCKSTATS_SAMPLE;
+	MUTEX_UNLOCK( mu);
+}
+
+// Set the counters of 'S' into the table at the top of the stack
+void lockstats_set( lua_State *L, struct s_LockStats const *S)
+{
+	STACK_GROW( L, 1);
+	lua_pushnumber( L, (lua_Number) S->locks);
+	lua_setfield( L, -2, "locks");
+	lua_pushnumber( L, (lua_Number) S->contended);
+	lua_setfield( L, -2, "contended");
+	lua_pushnumber( L, S->wait);
+	lua_setfield( L, -2, "lock_wait");
+	lua_pushnumber( L, S->wait_max);
+	lua_setfield( L, -2, "lock_wait_max");
+	lua_pushnumber( L, S->hold);
+	lua_setfield( L, -2, "lock_hold");
+}
+
+struct s_Keeper *keeper_acquire( const void *ptr)
+{
+	for( ;;)
+	{
+		int n = GNbShared;
+		struct s_Keeper *K = &GKeepers[keeper_hash( ptr, n)];
+		lockstats_lock( &K->lock_, &K->stats);
+		// keeper_resize() changes the hash only with all keepers locked
+		if( n == GNbShared)
+		{
+			keeper_drain( K);
+			return K;
+		}
+		lockstats_unlock( &K->lock_, &K->stats);
+	}
 }
 
 void keeper_release( struct s_Keeper *K)
 {
-	//-- K->count;
-	MUTEX_UNLOCK( &K->lock_);
+	lockstats_unlock( &K->lock_, &K->stats);
 }
 
 void keeper_toggle_nil_sentinels( lua_State *L, int _val_i, int _nil_to_sentinel)
@@ -182,34 +570,144 @@ void keeper_toggle_nil_sentinels( lua_State *L, int _val_i, int _nil_to_sentinel
 * 'linda':          deep Linda pointer (used only as a unique table key, first parameter)
 * 'starting_index': first of the rest of parameters (none if 0)
 *
-* Returns: number of return values (pushed to 'L') or -1 in case of error
+* Returns: number of return values (pushed to 'L'), KEEPER_ERRCOPY if
+*          values could not be copied, KEEPER_ERRMEM if the keeper state
+*          ran out of memory, KEEPER_ERRRUN if the keeper function raised
+*          an error, KEEPER_ERRNOMEM if 'L' ran out of memory. Nothing is
+*          raised.
 */
 int keeper_call( lua_State *K, char const *func_name, lua_State *L, void *linda, uint_t starting_index)
 {
-	int const args = starting_index ? (lua_gettop(L) - starting_index +1) : 0;
 	int const Ktos = lua_gettop(K);
-	int retvals = -1;
+	int retvals;
+	struct s_KeeperCall c;
 
-	STACK_GROW( K, 2);
+	c.K = K;
+	c.func_name = func_name;
+	c.linda = linda;
+	c.args = starting_index ? (lua_gettop(L) - starting_index +1) : 0;
+	c.status = 0;
 
-	lua_getglobal( K, func_name);
-	ASSERT_L( lua_isfunction(K, -1));
+	if( L == NULL)
+	{
+		// no values to copy: call directly
+		lua_getglobal( K, func_name);
+		lua_pushlightuserdata( K, linda);
+		retvals = keeper_run( &c);
+	}
+	else
+	{
+		int const Ltos = lua_gettop( L);
+		int i, status;
+		if( !lua_checkstack( L, c.args + 2))
+		{
+			return KEEPER_ERRNOMEM;
+		}
+		lua_pushcfunction( L, keeper_call_protected);
+		lua_pushlightuserdata( L, &c);
+		for( i = 0; i < c.args; ++ i)
+		{
+			lua_pushvalue( L, starting_index + i);
+		}
+		status = lua_pcall( L, 1 + c.args, LUA_MULTRET, 0);
+		if( status != 0)
+		{
+			// the copies raised: 'L' has the message
+			lua_settop( L, Ltos);
+			retvals = (status == LUA_ERRMEM) ? KEEPER_ERRNOMEM : KEEPER_ERRCOPY;
+		}
+		else
+		{
+			retvals = (c.status != 0) ? c.status : lua_gettop( L) - Ltos;
+		}
+	}
+	// whatever happens, restore the limit and the stack to where it was at the origin
+	luaL_setalloclimit( K, KEEPER_MEMORY_LIMIT);
+	lua_settop( K, Ktos);
+	return retvals;
+}
 
-	lua_pushlightuserdata( K, linda);
+/*
+* Park the value parked under 'from' under 'to' too, within the keeper state
+* (no lane state involved, so it can be done under a Linda lock)
+*
+* Returns: 0, KEEPER_ERRMEM or KEEPER_ERRRUN
+*/
+int keeper_dup( lua_State *K, void *linda, void *from, void *to)
+{
+	int const Ktos = lua_gettop( K);
+	int status;
 
-	if( (args == 0) || luaG_inter_copy( L, K, args) == 0) // L->K
+	if( !lua_checkstack( K, 6))
+	{
+		return KEEPER_ERRMEM;
+	}
+	lua_getglobal( K, "set");
+	lua_pushlightuserdata( K, linda);
+	lua_pushlightuserdata( K, to);
+	lua_getglobal( K, "get");
+	lua_pushlightuserdata( K, linda);
+	lua_pushlightuserdata( K, from);
+	status = lua_pcall( K, 2, 1, 0);
+	if( status == 0)
+	{
+		status = lua_pcall( K, 3, 0, 0);
+	}
+	lua_settop( K, Ktos);
+	if( status != 0)
 	{
-		lua_call( K, 1 + args, LUA_MULTRET);
+		return (status == LUA_ERRMEM) ? KEEPER_ERRMEM : KEEPER_ERRRUN;
+	}
+	return 0;
+}
 
-		retvals = lua_gettop( K) - Ktos;
-		if( (retvals > 0) && luaG_inter_move( K, L, retvals) != 0) // K->L
+/*
+* Push an array of statistics tables, one per keeper state: allocator
+* statistics, lock contention, parked values, 'shared' (unpinned Lindas
+* hash to it) and 'pinned' (Lindas pinned to it)
+*/
+int keeper_push_stats( lua_State *L)
+{
+	int i, j;
+	int n = GNbKeepers;
+	lua_createtable( L, n, 0);
+	for( i = 0; i < n; ++ i)
+	{
+		struct s_Keeper *K = &GKeepers[i];
+		luaL_AllocStats stats;
+		struct s_LockStats lock_stats;
+		int ok, parked, pinned = 0;
+		// Copy under the lock, push (may raise an error) after it
+		MUTEX_LOCK( &K->lock_);
+		keeper_drain( K);
+		ok = luaL_getallocstats( K->L, &stats);
+		lock_stats = K->stats;
+		parked = K->parked;
+		MUTEX_UNLOCK( &K->lock_);
+		MUTEX_LOCK( &GPinsCS);
+		for( j = 0; j < GNbPins; ++ j)
+		{
+			pinned += (GPins[j].k == i);
+		}
+		MUTEX_UNLOCK( &GPinsCS);
+		if( ok)
 		{
-			retvals = -1;
+			luaL_pushallocstats( L, &stats);
 		}
+		else
+		{
+			lua_newtable( L);
+		}
+		lockstats_set( L, &lock_stats);
+		lua_pushinteger( L, parked);
+		lua_setfield( L, -2, "parked");
+		lua_pushboolean( L, i < GNbShared);
+		lua_setfield( L, -2, "shared");
+		lua_pushinteger( L, pinned);
+		lua_setfield( L, -2, "pinned");
+		lua_rawseti( L, -2, i + 1);
 	}
-	// whatever happens, restore the stack to where it was at the origin
-	lua_settop( K, Ktos);
-	return retvals;
+	return 1;
 }
 
 void close_keepers(void)
@@ -222,7 +720,15 @@ void close_keepers(void)
 		//assert( GKeepers[i].count == 0);
 		MUTEX_FREE( &GKeepers[i].lock_);
 	}
-	if( GKeepers) free( GKeepers);
-	GKeepers = NULL;
 	GNbKeepers = 0;
+	GNbShared = 0;
+	free( GPins);
+	GPins = NULL;
+	GNbPins = GPinsSize = 0;
+	MUTEX_FREE( &GPinsCS);
+	free( GClears);
+	GClears = NULL;
+	GNbClears = GClearsSize = 0;
+	MUTEX_FREE( &GClearsCS);
+	MUTEX_FREE( &GResizeCS);
 }
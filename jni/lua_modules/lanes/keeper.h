@@ -1,19 +1,87 @@
 #if !defined( __keeper_h__)
 #define __keeper_h__ 1
 
+/*
+* Contention counters of a lock, updated by whoever holds it (times in
+* seconds)
+*/
+struct s_LockStats
+{
+	unsigned long locks;        // acquisitions
+	unsigned long contended;    // ... that found the lock taken
+	double wait;                // spent waiting for the lock
+	double wait_max;            // longest single wait
+	double hold;                // spent holding the lock, estimated
+	double locked_at;           // clock_secs() if this hold is sampled, else 0
+};
+
+/*
+* Hold times are measured over one acquisition in LOCKSTATS_SAMPLE and
+* scaled up: reading the clock around every one would double the cost of
+* an uncontended lock. Waits are only timed when the lock is taken.
+*/
+#ifndef LOCKSTATS_SAMPLE
+#define LOCKSTATS_SAMPLE 16
+#endif
+
+void lockstats_lock( MUTEX_T *mu, struct s_LockStats *S);
+void lockstats_unlock( MUTEX_T *mu, struct s_LockStats *S);
+void lockstats_set( lua_State *L, struct s_LockStats const *S);
+
 struct s_Keeper
 {
 	MUTEX_T lock_;
 	lua_State *L;
-	//int count;
+	struct s_LockStats stats;
+	int parked;     // values parked in 'L', maintained by channel.c
 };
 
+/*
+* Keeper states that can exist at once (see keeper_resize()). They are
+* never moved nor closed before exit, so a Linda pinned to one can rely
+* on it.
+*/
+#ifndef KEEPERS_MAX
+#define KEEPERS_MAX 32
+#endif
+
+/*
+* Hard memory limit of each keeper state (bytes, 0 for none). A Linda
+* filling up its keeper makes the sending lane fail with a memory error.
+*/
+#ifndef KEEPER_MEMORY_LIMIT
+#define KEEPER_MEMORY_LIMIT (16*1024*1024)
+#endif
+
+// keeper_call() return values other than the number of results
+// (-3 is CHANNEL_ERRMEM)
+#define KEEPER_ERRCOPY (-1)
+#define KEEPER_ERRMEM (-2)     // in the keeper state
+#define KEEPER_ERRRUN (-4)     // the keeper function raised an error
+#define KEEPER_ERRNOMEM (-5)   // in the calling state
+
+#define KEEPER_ERROR_STRING( _pushed) \
+	((_pushed) == KEEPER_ERRMEM ? "not enough memory in keeper state" : \
+	 (_pushed) == KEEPER_ERRRUN ? "error in keeper state" : \
+	 (_pushed) == KEEPER_ERRNOMEM ? "not enough memory" : "tried to copy unsupported types")
+
+#define KEEPER_CALL_ERROR( L, _pushed) \
+	luaL_error( L, "%s", KEEPER_ERROR_STRING( _pushed))
+
 const char *init_keepers( int const _nbKeepers);
+char const *keeper_resize( int _nbShared, int _nbKeepers);
+int keeper_count( void);
+char const *keeper_pin( const void *ptr, int _k);
+void keeper_unpin( const void *ptr);
+void keeper_clear( const void *ptr, int _parked);
+int keeper_index( const void *ptr);
 struct s_Keeper *keeper_acquire( const void *ptr);
 void keeper_release( struct s_Keeper *K);
 void keeper_toggle_nil_sentinels( lua_State *L, int _val_i, int _nil_to_sentinel);
 int keeper_call( lua_State *K, char const *func_name, lua_State *L, void *linda, uint_t starting_index);
+int keeper_dup( lua_State *K, void *linda, void *from, void *to);
 void close_keepers(void);
+int keeper_push_stats( lua_State *L);
 
 
 #endif // __keeper_h__
\ No newline at end of file
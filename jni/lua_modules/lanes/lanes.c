@@ -83,6 +83,7 @@ THE SOFTWARE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <limits.h>
 
 #include "lua.h"
 #include "lauxlib.h"
@@ -90,6 +91,8 @@ THE SOFTWARE.
 #include "threading.h"
 #include "tools.h"
 #include "keeper.h"
+#include "channel.h"
+#include "buffer.h"
 
 #if !((defined PLATFORM_WIN32) || (defined PLATFORM_POCKETPC))
 # include <sys/time.h>
@@ -164,6 +167,22 @@ struct s_lane {
 	// M: sets to non-NULL if facing lane handle '__gc' cycle but the lane
 	//    is still running
 	// S: cleans up after itself if non-NULL at lane exit
+
+	struct s_pool *pool;
+	//
+	// M: pool running the lane, NULL for a lane with its own thread and state
+	//    ('thread' and 'L' are then not used)
+	// S: not used
+
+	struct s_lane *pool_next;
+	//
+	// Next lane in the pool queue, under the pool lock
+
+	struct s_Item *results;
+	//
+	// Pooled lane only, encoded as in a Linda:
+	// M: sets to the lane function and its parameters, reads results
+	// S: replaces with the results, or error message + stack trace
 };
 
 static bool_t cancel_test( lua_State *L );
@@ -200,6 +219,14 @@ struct s_Linda;
 
 static bool_t thread_cancel( struct s_lane *s, double secs, bool_t force );
 
+struct s_pool;
+static int pool_join( lua_State *L, struct s_lane *s, double secs );
+static bool_t pool_cancel( lua_State *L, struct s_lane *s, double secs );
+static void pool_lane_free( lua_State *L, struct s_lane *s );
+
+struct s_parallel;
+static void parallel_unref( struct s_parallel *J );
+
 
 /*
 * Push a table stored in registry onto Lua stack.
@@ -236,18 +263,81 @@ static bool_t push_registry_table( lua_State *L, void *key, bool_t create ) {
 */
 
 /*
-* Actual data is kept within a keeper state, which is hashed by the 's_Linda'
-* pointer (which is same to all userdatas pointing to it).
+* Contention counters of a Linda, under its lock (times in seconds)
+*/
+struct s_LindaStats {
+    struct s_LockStats lock;    // time blocked on the signals is not held
+    unsigned long sends;        // successful send() calls
+    unsigned long receives;     // successful receive() calls
+    unsigned long send_waits;   // times a sender blocked on a full key
+    unsigned long receive_waits;    // times a receiver blocked for data
+    double send_wait;           // spent blocked by senders
+    double receive_wait;        // spent blocked by receivers
+    int senders;                // blocked right now
+    int receivers;              // blocked right now
+};
+
+/*
+* Actual data is kept in 'channels', under the Linda's own lock. Values that
+* need a Lua state to be held are parked within a keeper state, which is
+* hashed by the 's_Linda' pointer (which is same to all userdatas pointing
+* to it), or picked at creation.
 */
 struct s_Linda {
     SIGNAL_T read_happened;
     SIGNAL_T write_happened;
+    MUTEX_T lock_;
+    struct s_Channels channels;
+    struct s_LindaStats stats;
+    int keeper;                 // pinned keeper state (0-based), -1 if hashed
 };
 
 static void linda_id( lua_State*, char const * const which);
 
 #define lua_toLinda(L,n) ((struct s_Linda *)luaG_todeep( L, linda_id, n ))
 
+#define linda_lock( linda) lockstats_lock( &(linda)->lock_, &(linda)->stats.lock)
+#define linda_unlock( linda) lockstats_unlock( &(linda)->lock_, &(linda)->stats.lock)
+
+/*
+* SIGNAL_WAIT() within the Linda lock, counting the wait as a blocked
+* sender or receiver instead of lock hold time
+*/
+static bool_t linda_wait( struct s_Linda *linda, SIGNAL_T *signal, time_d timeout, bool_t sender)
+{
+	struct s_LindaStats *S = &linda->stats;
+	double t = clock_secs();
+	bool_t ret;
+	if( S->lock.locked_at != 0.0)
+	{
+		S->lock.hold += (t - S->lock.locked_at) * LOCKSTATS_SAMPLE;
+	}
+	if( sender)
+	{
+		++ S->senders;
+		++ S->send_waits;
+	}
+	else
+	{
+		++ S->receivers;
+		++ S->receive_waits;
+	}
+	ret = SIGNAL_WAIT( signal, &linda->lock_, timeout);
+	t = clock_secs() - t;
+	S->lock.locked_at = 0.0;     // the rest of this hold is not sampled
+	if( sender)
+	{
+		-- S->senders;
+		S->send_wait += t;
+	}
+	else
+	{
+		-- S->receivers;
+		S->receive_wait += t;
+	}
+	return ret;
+}
+
 
 static void check_key_types( lua_State *L, int _start, int _end)
 {
@@ -255,7 +345,11 @@ static void check_key_types( lua_State *L, int _start, int _end)
 	for( i = _start; i <= _end; ++ i)
 	{
 		int t = lua_type( L, i);
-		if( t == LUA_TBOOLEAN || t == LUA_TNUMBER || t == LUA_TSTRING || t == LUA_TLIGHTUSERDATA)
+		if( t == LUA_TBOOLEAN || t == LUA_TSTRING || t == LUA_TLIGHTUSERDATA)
+		{
+			continue;
+		}
+		if( t == LUA_TNUMBER && lua_tonumber( L, i) == lua_tonumber( L, i)) // NaN can't be a key
 		{
 			continue;
 		}
@@ -274,9 +368,10 @@ static void check_key_types( lua_State *L, int _start, int _end)
 LUAG_FUNC( linda_send)
 {
 	struct s_Linda *linda = lua_toLinda( L, 1);
-	bool_t ret;
+	bool_t ret = FALSE;
 	bool_t cancel = FALSE;
-	int pushed;
+	int status;
+	struct s_Item *items;
 	time_d timeout= -1.0;
 	uint_t key_i = 2; // index of first key, if timeout not there
 
@@ -301,91 +396,87 @@ LUAG_FUNC( linda_send)
 		luaL_error( L, "no data to send");
 	}
 
-	// convert nils to some special non-nil sentinel in sent values
-	keeper_toggle_nil_sentinels( L, key_i + 1, 1);
+	// values are encoded before locking, the lock only covers queueing them
+	status = channel_encode( L, linda, key_i + 1, lua_gettop( L), &items);
+	if( status < 0)
+	{
+		CHANNEL_ERROR( L, status);
+	}
 
 	STACK_GROW(L, 1);
+	linda_lock( linda);
+	for( ;;)
 	{
-		struct s_Keeper *K = keeper_acquire( linda);
-		lua_State *KL = K->L;    // need to do this for 'STACK_CHECK'
-		STACK_CHECK( KL)
-		for( ;;)
+		status = channel_send( &linda->channels, L, key_i, items);
+		if( status < 0)
 		{
-			STACK_MID(KL, 0)
-			pushed = keeper_call( KL, "send", L, linda, key_i);
-			if( pushed < 0)
-			{
-				break;
-			}
-			ASSERT_L( pushed == 1);
-
-			ret = lua_toboolean( L, -1);
-			lua_pop( L, 1);
-
-			if( ret)
-			{
-				// Wake up ALL waiting threads
-				//
-				SIGNAL_ALL( &linda->write_happened);
-				break;
+			break;
+		}
+		if( status > 0)
+		{
+			ret = TRUE;
+			items = NULL;
+			++ linda->stats.sends;
+			// Wake up ALL waiting threads
+			//
+			SIGNAL_ALL( &linda->write_happened);
+			break;
+		}
+		if( timeout == 0.0)
+		{
+			break;  /* no wait; instant timeout */
+		}
+		/* limit faced; push until timeout */
 
-			}
-			if( timeout == 0.0)
-			{
-				break;  /* no wait; instant timeout */
-			}
-			/* limit faced; push until timeout */
+		cancel = cancel_test( L);   // testing here causes no delays
+		if (cancel)
+		{
+			break;
+		}
 
-			cancel = cancel_test( L);   // testing here causes no delays
-			if (cancel)
+		// change status of lane to "waiting"
+		{
+			struct s_lane *s;
+			enum e_status prev_status = ERROR_ST; // prevent 'might be used uninitialized' warnings
+			STACK_GROW(L, 1);
+
+			STACK_CHECK(L)
+			lua_pushlightuserdata( L, CANCEL_TEST_KEY);
+			lua_rawget( L, LUA_REGISTRYINDEX);
+			s = lua_touserdata( L, -1);     // lightuserdata (true 's_lane' pointer) / nil
+			lua_pop(L, 1);
+			STACK_END(L,0)
+			if( s)
 			{
-				break;
+				prev_status = s->status;
+				s->status = WAITING;
+				ASSERT_L( s->waiting_on == NULL);
+				s->waiting_on = &linda->read_happened;
 			}
-
-			// change status of lane to "waiting"
+			// could not send because no room: wait until some data was read before trying again, or until timeout is reached
+			if( !linda_wait( linda, &linda->read_happened, timeout, TRUE))
 			{
-				struct s_lane *s;
-				enum e_status prev_status = ERROR_ST; // prevent 'might be used uninitialized' warnings
-				STACK_GROW(L, 1);
-
-				STACK_CHECK(L)
-				lua_pushlightuserdata( L, CANCEL_TEST_KEY);
-				lua_rawget( L, LUA_REGISTRYINDEX);
-				s = lua_touserdata( L, -1);     // lightuserdata (true 's_lane' pointer) / nil
-				lua_pop(L, 1);
-				STACK_END(L,0)
-				if( s)
-				{
-					prev_status = s->status;
-					s->status = WAITING;
-					ASSERT_L( s->waiting_on == NULL);
-					s->waiting_on = &linda->read_happened;
-				}
-				// could not send because no room: wait until some data was read before trying again, or until timeout is reached
-				if( !SIGNAL_WAIT( &linda->read_happened, &K->lock_, timeout))
-				{
-					if( s)
-					{
-						s->waiting_on = NULL;
-						s->status = prev_status;
-					}
-					break;
-				}
 				if( s)
 				{
 					s->waiting_on = NULL;
 					s->status = prev_status;
 				}
+				break;
+			}
+			if( s)
+			{
+				s->waiting_on = NULL;
+				s->status = prev_status;
 			}
 		}
-		STACK_END( KL, 0)
-		keeper_release( K);
 	}
+	linda_unlock( linda);
 
-	// must trigger error after keeper state has been released
-	if( pushed < 0)
+	// values that were not queued, and errors, are dealt with out of the lock
+	channel_release( L, linda, items);
+	if( status < 0)
 	{
-		luaL_error( L, "tried to copy unsupported types");
+		CHANNEL_ERROR( L, status);
 	}
 
 	if( cancel)
@@ -412,9 +503,12 @@ LUAG_FUNC( linda_receive)
 {
 	struct s_Linda *linda = lua_toLinda( L, 1);
 	int pushed, expected_pushed;
+	int status;
+	int found_i = 0;
+	bool_t batched;
 	bool_t cancel = FALSE;
-	char *keeper_receive;
-	
+	struct s_Item *items = NULL;
+
 	time_d timeout = -1.0;
 	uint_t key_i = 2;
 
@@ -435,98 +529,108 @@ LUAG_FUNC( linda_receive)
 
 	// are we in batched mode?
 	lua_pushliteral( L, BATCH_SENTINEL);
-	if( lua_equal( L, key_i, -1))
+	batched = lua_equal( L, key_i, -1);
+	lua_pop( L, 1);
+	if( batched)
 	{
-		keeper_receive = "receive_batched";
 		expected_pushed = (int)luaL_checkinteger( L, key_i + 2);
 	}
 	else
 	{
-		keeper_receive = "receive";
 		expected_pushed = 2;
 	}
-	lua_pop( L, 1);
 
+	linda_lock( linda);
+	for( ;;)
 	{
-		struct s_Keeper *K = keeper_acquire( linda);
-		for( ;;)
+		if( batched)
 		{
-			pushed = keeper_call( K->L, keeper_receive, L, linda, key_i);
-			if( pushed < 0)
-			{
-				break;
-			}
-			if( pushed > 0)
-			{
-				ASSERT_L( pushed == expected_pushed);
-				// replace sentinels with real nils
-				keeper_toggle_nil_sentinels( L, lua_gettop( L) - pushed, 0);
-				// To be done from within the 'K' locking area
-				//
-				SIGNAL_ALL( &linda->read_happened);
-				break;
+			items = channel_receive_batched( &linda->channels, L, key_i + 1, expected_pushed);
+		}
+		else
+		{
+			items = channel_receive( &linda->channels, L, key_i, lua_gettop( L), &found_i);
+		}
+		if( items)
+		{
+			++ linda->stats.receives;
+			// To be done from within the Linda locking area
+			//
+			SIGNAL_ALL( &linda->read_happened);
+			break;
 
-			}
-			if( timeout == 0.0)
-			{
-				break;  /* instant timeout */
-			}
-			/* nothing received; wait until timeout */
+		}
+		if( timeout == 0.0)
+		{
+			break;  /* instant timeout */
+		}
+		/* nothing received; wait until timeout */
+
+		cancel = cancel_test( L);   // testing here causes no delays
+		if( cancel)
+		{
+			break;
+		}
 
-			cancel = cancel_test( L);   // testing here causes no delays
-			if( cancel)
+		// change status of lane to "waiting"
+		{
+			struct s_lane *s;
+			enum e_status prev_status = ERROR_ST; // prevent 'might be used uninitialized' warnings
+			STACK_GROW(L,1);
+
+			STACK_CHECK(L)
+			lua_pushlightuserdata( L, CANCEL_TEST_KEY);
+			lua_rawget( L, LUA_REGISTRYINDEX);
+			s= lua_touserdata( L, -1);     // lightuserdata (true 's_lane' pointer) / nil
+			lua_pop(L, 1);
+			STACK_END(L, 0)
+			if( s)
 			{
-				break;
+				prev_status = s->status;
+				s->status = WAITING;
+				ASSERT_L( s->waiting_on == NULL);
+				s->waiting_on = &linda->write_happened;
 			}
-
-			// change status of lane to "waiting"
+			// not enough data to read: wakeup when data was sent, or when timeout is reached
+			if( !linda_wait( linda, &linda->write_happened, timeout, FALSE))
 			{
-				struct s_lane *s;
-				enum e_status prev_status = ERROR_ST; // prevent 'might be used uninitialized' warnings
-				STACK_GROW(L,1);
-
-				STACK_CHECK(L)
-				lua_pushlightuserdata( L, CANCEL_TEST_KEY);
-				lua_rawget( L, LUA_REGISTRYINDEX);
-				s= lua_touserdata( L, -1);     // lightuserdata (true 's_lane' pointer) / nil
-				lua_pop(L, 1);
-				STACK_END(L, 0)
-				if( s)
-				{
-					prev_status = s->status;
-					s->status = WAITING;
-					ASSERT_L( s->waiting_on == NULL);
-					s->waiting_on = &linda->write_happened;
-				}
-				// not enough data to read: wakeup when data was sent, or when timeout is reached
-				if( !SIGNAL_WAIT( &linda->write_happened, &K->lock_, timeout))
-				{
-					if( s)
-					{
-						s->waiting_on = NULL;
-						s->status = prev_status;
-					}
-					break;
-				}
 				if( s)
 				{
 					s->waiting_on = NULL;
 					s->status = prev_status;
 				}
+				break;
+			}
+			if( s)
+			{
+				s->waiting_on = NULL;
+				s->status = prev_status;
 			}
 		}
-		keeper_release( K);
-	}
-
-	// must trigger error after keeper state has been released
-	if( pushed < 0)
-	{
-		luaL_error( L, "tried to copy unsupported types");
 	}
+	linda_unlock( linda);
 
 	if( cancel)
 		cancel_error( L);
 
+	if( !items)
+	{
+		return 0;
+	}
+
+	// values are decoded out of the lock
+	pushed = lua_gettop( L);
+	status = channel_decode( L, linda, items);
+	if( status < 0)
+	{
+		CHANNEL_ERROR( L, status);
+	}
+	if( !batched)
+	{
+		lua_pushvalue( L, found_i);
+	}
+	pushed = lua_gettop( L) - pushed;
+	ASSERT_L( pushed == expected_pushed);
 	return pushed;
 }
 
@@ -542,36 +646,42 @@ LUAG_FUNC( linda_receive)
 LUAG_FUNC( linda_set)
 {
 	struct s_Linda *linda = lua_toLinda( L, 1);
-	bool_t has_value = !lua_isnil( L, 3);
+	bool_t has_value = !lua_isnoneornil( L, 3);
+	struct s_Item *item = NULL;
+	struct s_Item *old;
+	int status;
 	luaL_argcheck( L, linda, 1, "expected a linda object!");
 
 	// make sure the key is of a valid type
 	check_key_types( L, 2, 2);
 
+	// no nil is queued, we really clear the linda contents for the given key with a set()
+	if( has_value)
 	{
-		int pushed;
-		struct s_Keeper *K = keeper_acquire( linda);
-		// no nil->sentinel toggling, we really clear the linda contents for the given key with a set()
-		pushed = keeper_call( K->L, "set", L, linda, 2);
-		if( pushed >= 0) // no error?
-		{
-			ASSERT_L( pushed == 0);
-
-			/* Set the signal from within 'K' locking.
-			*/
-			if( has_value)
-			{
-				SIGNAL_ALL( &linda->write_happened);
-			}
-		}
-		keeper_release( K);
-		// must trigger error after keeper state has been released
-		if( pushed < 0)
+		status = channel_encode( L, linda, 3, 3, &item);
+		if( status < 0)
 		{
-			luaL_error( L, "tried to copy unsupported types");
+			CHANNEL_ERROR( L, status);
 		}
 	}
 
+	linda_lock( linda);
+	status = channel_set( &linda->channels, L, 2, item, &old);
+	if( status == 0 && has_value)
+	{
+		/* Set the signal from within the Linda locking.
+		*/
+		SIGNAL_ALL( &linda->write_happened);
+	}
+	linda_unlock( linda);
+
+	channel_release( L, linda, old);
+	if( status < 0)
+	{
+		channel_release( L, linda, item);
+		CHANNEL_ERROR( L, status);
+	}
+
 	return 0;
 }
 
@@ -584,22 +694,21 @@ LUAG_FUNC( linda_set)
 LUAG_FUNC( linda_count)
 {
 	struct s_Linda *linda= lua_toLinda( L, 1);
-	int pushed;
+	struct s_Counts *counts;
+	int status;
 
 	luaL_argcheck( L, linda, 1, "expected a linda object!");
 	// make sure the keys are of a valid type
 	check_key_types( L, 2, lua_gettop( L));
 
+	linda_lock( linda);
+	status = channel_count( &linda->channels, L, 2, lua_gettop( L), &counts);
+	linda_unlock( linda);
+	if( status < 0)
 	{
-		struct s_Keeper *K = keeper_acquire( linda);
-		pushed = keeper_call( K->L, "count", L, linda, 2);
-		keeper_release( K);
-		if( pushed < 0)
-		{
-			luaL_error( L, "tried to count an invalid key");
-		}
+		CHANNEL_ERROR( L, status);
 	}
-	return pushed;
+	return channel_push_counts( L, 2, lua_gettop( L), counts);
 }
 
 
@@ -612,27 +721,35 @@ LUAG_FUNC( linda_count)
 LUAG_FUNC( linda_get)
 {
 	struct s_Linda *linda= lua_toLinda( L, 1);
+	struct s_Item *copy;
 	int pushed;
 
 	luaL_argcheck( L, linda, 1, "expected a linda object!");
 	// make sure the key is of a valid type
 	check_key_types( L, 2, 2);
 
+	STACK_GROW( L, 2);
+	linda_lock( linda);
+	pushed = channel_get( &linda->channels, L, 2, linda, &copy);
+	linda_unlock( linda);
+	if( copy)
 	{
-		struct s_Keeper *K = keeper_acquire( linda);
-		pushed = keeper_call( K->L, "get", L, linda, 2);
-		ASSERT_L( pushed==0 || pushed==1 );
-		if( pushed > 0)
-		{
-			keeper_toggle_nil_sentinels( L, lua_gettop( L) - pushed, 0);
-		}
-		keeper_release(K);
-		// must trigger error after keeper state has been released
-		if( pushed < 0)
+		pushed = channel_decode( L, linda, copy);
+		if( pushed == 0)
 		{
-			luaL_error( L, "tried to copy unsupported types");
+			pushed = 1;
 		}
 	}
+	else if( pushed == 0)
+	{
+		lua_pushnil( L);
+		pushed = 1;
+	}
+	// must trigger error after the Linda has been released
+	if( pushed < 0)
+	{
+		CHANNEL_ERROR( L, pushed);
+	}
 
 	return pushed;
 }
@@ -646,27 +763,94 @@ LUAG_FUNC( linda_get)
 LUAG_FUNC( linda_limit)
 {
 	struct s_Linda *linda= lua_toLinda( L, 1 );
+	int limit;
+	int status;
 
 	luaL_argcheck( L, linda, 1, "expected a linda object!");
 	// make sure the key is of a valid type
 	check_key_types( L, 2, 2);
+	limit = lua_isnoneornil( L, 3) ? -1 : luaL_checkint( L, 3);
 
+	linda_lock( linda);
+	status = channel_limit( &linda->channels, L, 2, limit);
+	linda_unlock( linda);
+	if( status < 0)
 	{
-		struct s_Keeper *K = keeper_acquire( linda);
-		int pushed = keeper_call( K->L, "limit", L, linda, 2);
-		ASSERT_L( pushed <= 0); // either error or no return values
-		keeper_release( K);
-		// must trigger error after keeper state has been released
-		if( pushed < 0)
-		{
-			luaL_error( L, "tried to copy unsupported types");
-		}
+		CHANNEL_ERROR( L, status);
 	}
 
 	return 0;
 }
 
 
+/*
+* tbl= linda_stats( linda_ud [, reset_bool] )
+*
+* Contention counters of the Linda: its lock ('locks', 'contended',
+* 'lock_wait', 'lock_wait_max', 'lock_hold' estimated from a sample of
+* the acquisitions, see keeper.h), blocked senders and
+* receivers ('send_waits', 'send_wait', 'senders' blocked now, and the
+* same for receivers), calls that went through ('sends', 'receives'),
+* queue depths ('queued' values, their 'bytes', 'max_depth' of any key)
+* and the 'keeper' state its parked values go to. Times are in seconds.
+*
+* 'reset' zeroes the counters afterwards, 'max_depth' included.
+*/
+LUAG_FUNC( linda_stats)
+{
+	struct s_Linda *linda = lua_toLinda( L, 1);
+	struct s_LindaStats stats;
+	int queued, max_depth;
+	size_t bytes;
+	luaL_argcheck( L, linda, 1, "expected a linda object!");
+
+	// Copy under the lock (not counted), push after it
+	MUTEX_LOCK( &linda->lock_);
+	stats = linda->stats;
+	queued = linda->channels.values;
+	max_depth = linda->channels.max_depth;
+	bytes = linda->channels.bytes;
+	if( lua_toboolean( L, 2))
+	{
+		memset( &linda->stats.lock, 0, sizeof( struct s_LockStats));
+		linda->stats.sends = linda->stats.receives = 0;
+		linda->stats.send_waits = linda->stats.receive_waits = 0;
+		linda->stats.send_wait = linda->stats.receive_wait = 0.0;
+		linda->channels.max_depth = 0;
+	}
+	MUTEX_UNLOCK( &linda->lock_);
+
+	STACK_GROW( L, 2);
+	lua_createtable( L, 0, 17);
+	lockstats_set( L, &stats.lock);
+	lua_pushnumber( L, (lua_Number) stats.sends);
+	lua_setfield( L, -2, "sends");
+	lua_pushnumber( L, (lua_Number) stats.receives);
+	lua_setfield( L, -2, "receives");
+	lua_pushnumber( L, (lua_Number) stats.send_waits);
+	lua_setfield( L, -2, "send_waits");
+	lua_pushnumber( L, (lua_Number) stats.receive_waits);
+	lua_setfield( L, -2, "receive_waits");
+	lua_pushnumber( L, stats.send_wait);
+	lua_setfield( L, -2, "send_wait");
+	lua_pushnumber( L, stats.receive_wait);
+	lua_setfield( L, -2, "receive_wait");
+	lua_pushinteger( L, stats.senders);
+	lua_setfield( L, -2, "senders");
+	lua_pushinteger( L, stats.receivers);
+	lua_setfield( L, -2, "receivers");
+	lua_pushinteger( L, queued);
+	lua_setfield( L, -2, "queued");
+	lua_pushnumber( L, (lua_Number) bytes);
+	lua_setfield( L, -2, "bytes");
+	lua_pushinteger( L, max_depth);
+	lua_setfield( L, -2, "max_depth");
+	lua_pushinteger( L, keeper_index( linda) + 1);
+	lua_setfield( L, -2, "keeper");
+	return 1;
+}
+
+
 /*
 * lightuserdata= linda_deep( linda_ud )
 *
@@ -775,26 +959,29 @@ static void linda_id( lua_State *L, char const * const which)
 
         SIGNAL_INIT( &s->read_happened );
         SIGNAL_INIT( &s->write_happened );
+        MUTEX_INIT( &s->lock_ );
+        channels_init( &s->channels );
+        memset( &s->stats, 0, sizeof( struct s_LindaStats));
+        s->keeper = -1;
 
         lua_pushlightuserdata( L, s );
     }
     else if (strcmp( which, "delete" )==0)
     {
-        struct s_Keeper *K;
         struct s_Linda *s= lua_touserdata(L,1);
         ASSERT_L(s);
 
-        /* Clean associated structures in the keeper state.
-        */
-        K= keeper_acquire(s);
-        {
-            keeper_call( K->L, "clear", L, s, 0 );
-        }
-        keeper_release(K);
-
         /* There aren't any lanes waiting on these lindas, since all proxies
         * have been gc'ed. Right?
+        * Their parked values are queued for clearing from the keeper state
+        * the Linda maps to, so unpin only after.
         */
+        channels_free( &s->channels, L, s );
+        if( s->keeper >= 0)
+        {
+            keeper_unpin( s);
+        }
+        MUTEX_FREE( &s->lock_ );
         SIGNAL_FREE( &s->read_happened );
         SIGNAL_FREE( &s->write_happened );
         free(s);
@@ -841,6 +1028,9 @@ static void linda_id( lua_State *L, char const * const which)
         lua_pushcfunction( L, LG_linda_deep );
         lua_setfield( L, -2, "deep" );
 
+        lua_pushcfunction( L, LG_linda_stats );
+        lua_setfield( L, -2, "stats" );
+
         lua_pushliteral( L, BATCH_SENTINEL);
         lua_setfield(L, -2, "batched");
 
@@ -858,13 +1048,33 @@ static void linda_id( lua_State *L, char const * const which)
 }
 
 /*
- * ud = lanes.linda()
+ * ud = lanes.linda( [keeper_uint] )
  *
- * returns a linda object
+ * returns a linda object, its parked values going to keeper state
+ * #keeper_uint instead of the one picked by hashing
  */
 LUAG_FUNC( linda)
 {
-	return luaG_deep_userdata( L, linda_id);
+	lua_Number n = luaL_optnumber( L, 1, 0);
+	int k;
+	struct s_Linda *s;
+	char const *err;
+	// checked before the conversion, which would truncate 2.5 to keeper #2
+	luaL_argcheck( L, n >= 0 && n <= keeper_count() && n == (lua_Number) (int) n, 1, "no such keeper state");
+	k = (int) n;
+	lua_settop( L, 0);
+	luaG_deep_userdata( L, linda_id);
+	if( k > 0)
+	{
+		s = lua_toLinda( L, 1);
+		err = keeper_pin( s, k - 1);
+		if( err)
+		{
+			luaL_error( L, "%s", err);
+		}
+		s->keeper = k - 1;
+	}
+	return 1;
 }
 
 
@@ -1360,6 +1570,8 @@ LUAG_FUNC( set_debug_threadname)
 #if defined PLATFORM_WIN32  && !defined __GNUC__
 	// to see thead name in Visual Studio C debugger
 	SetThreadName(-1, threadName);
+#else
+	(void)threadName;
 #endif
 
 	// to see VM name in Decoda debugger Virtual Machine window
@@ -1369,18 +1581,10 @@ LUAG_FUNC( set_debug_threadname)
 }
 
 //---
-#if (defined PLATFORM_WIN32) || (defined PLATFORM_POCKETPC)
-  static THREAD_RETURN_T __stdcall lane_main( void *vs )
-#else
-  static THREAD_RETURN_T lane_main( void *vs )
-#endif
+// Functions available inside the global namespace of lanes
+//
+static void lane_register_globals( lua_State *L )
 {
-    struct s_lane *s= (struct s_lane *)vs;
-    int rc, rc2;
-    lua_State *L= s->L;
-
-   s->status= RUNNING;  // PENDING -> RUNNING
-
     // Tie "set_finalizer()" to the state
     //
     lua_pushcfunction( L, LG_set_finalizer );
@@ -1395,6 +1599,17 @@ LUAG_FUNC( set_debug_threadname)
     //
     lua_pushcfunction( L, LG_cancel_test);
     lua_setglobal( L, "cancel_test" );
+}
+
+//---
+// Run the lane function at [1] with parameters [2..top], then the finalizers
+//
+// Returns: 0 with the results on the stack, or a LUA_ERRxxx code with the
+//          error message at [1] and the stack trace (table) at [2]
+//
+static int lane_call( lua_State *L )
+{
+    int rc, rc2;
 
 #ifdef ERROR_FULL_STACK
     STACK_GROW( L, 1 );
@@ -1411,7 +1626,8 @@ LUAG_FUNC( set_debug_threadname)
         // LUA_ERRMEM: memory allocation error
         // LUA_ERRERR: error while running the error handler (if any)
 
-    assert( rc!=LUA_ERRERR );   // since we've authored it
+    // LUA_ERRERR only if the handler itself ran out of memory (lane over
+    // its memory limit); we've authored it otherwise
 
     lua_remove(L,1);    // remove error handler
 
@@ -1423,9 +1639,11 @@ LUAG_FUNC( set_debug_threadname)
         lua_pushlightuserdata( L, STACK_TRACE_KEY );
         lua_gettable(L, LUA_REGISTRYINDEX);
 
-        // For cancellation, a stack trace isn't placed
+        // For cancellation, a stack trace isn't placed. Neither for memory
+        // errors, which Lua 5.1 raises without calling the error handler.
         //
-        assert( lua_istable(L,2) || (lua_touserdata(L,1)==CANCEL_ERROR) );
+        assert( lua_istable(L,2) || (lua_touserdata(L,1)==CANCEL_ERROR) ||
+                rc==LUA_ERRMEM || rc==LUA_ERRERR );
         
         // Just leaving the stack trace table on the stack is enough to get
         // it through to the master.
@@ -1462,6 +1680,26 @@ LUAG_FUNC( set_debug_threadname)
         //
         lua_newtable(L);
     }
+    return rc;
+}
+
+//---
+#if (defined PLATFORM_WIN32) || (defined PLATFORM_POCKETPC)
+  static THREAD_RETURN_T __stdcall lane_main( void *vs )
+#else
+  static THREAD_RETURN_T lane_main( void *vs )
+#endif
+{
+    struct s_lane *s= (struct s_lane *)vs;
+    int rc;
+    lua_State *L= s->L;
+
+   s->status= RUNNING;  // PENDING -> RUNNING
+
+    lane_register_globals( L );
+
+    rc= lane_call( L );
+
     s->waiting_on = NULL; // just in case
     if (s->selfdestruct_next != NULL) {
         // We're a free-running thread and no-one's there to clean us up.
@@ -1503,40 +1741,14 @@ LUAG_FUNC( set_debug_threadname)
 
 
 //---
-// lane_ud= thread_new( function, [libs_str], 
-//                          [cancelstep_uint=0], 
-//                          [prio_int=0],
-//                          [globals_tbl],
-//                          [packagepath],
-//                          [... args ...] )
+// L2= lane_state_new( L, libs, globals_i, packagepath_i, packagecpath_i )
 //
-// Upvalues: metatable to use for 'lane_ud'
+// Creates and prepares a state for running lanes. Indices of the optional
+// parameters in 'L' are 0 if they are not given.
 //
-LUAG_FUNC( thread_new )
+static lua_State *lane_state_new( lua_State *L, char const *libs, uint_t glob, uint_t ppath, uint_t pcpath )
 {
-	lua_State *L2;
-	struct s_lane *s;
-	struct s_lane **ud;
-
-	const char *libs= lua_tostring( L, 2 );
-	uint_t cs= luaG_optunsigned( L, 3,0);
-	int prio= (int)luaL_optinteger( L, 4,0);
-	uint_t glob= luaG_isany(L,5) ? 5:0;
-	uint_t ppath = luaG_isany(L,6) ? 6:0;
-	uint_t pcpath = luaG_isany(L,7) ? 7:0;
-
-#define FIXED_ARGS (7)
-	uint_t args= lua_gettop(L) - FIXED_ARGS;
-
-	if (prio < THREAD_PRIO_MIN || prio > THREAD_PRIO_MAX)
-	{
-		luaL_error( L, "Priority out of range: %d..+%d (%d)", 
-			THREAD_PRIO_MIN, THREAD_PRIO_MAX, prio );
-	}
-
-	/* --- Create and prepare the sub state --- */
-
-	L2 = luaL_newstate();   // uses standard 'realloc()'-based allocator,
+	lua_State *L2 = luaL_newstate();   // uses the per-state pool allocator,
 	// sets the panic callback
 
 	if (!L2) luaL_error( L, "'luaL_newstate()' failed; out of memory" );
@@ -1613,17 +1825,60 @@ LUAG_FUNC( thread_new )
 	}
 	STACK_END(L2,0)
 
-	// Lane main function
-	//
-	STACK_CHECK(L)
-	if( lua_type( L, 1) == LUA_TFUNCTION)
-	{
-		lua_pushvalue( L, 1);
-		if( luaG_inter_move( L, L2, 1) != 0)    // L->L2
-			luaL_error( L, "tried to copy unsupported types");
-		STACK_MID(L,0)
-	}
-	else if( lua_type(L, 1) == LUA_TSTRING)
+	return L2;
+}
+
+
+//---
+// lane_ud= thread_new( function, [libs_str], 
+//                          [cancelstep_uint=0], 
+//                          [prio_int=0],
+//                          [globals_tbl],
+//                          [packagepath],
+//                          [packagecpath],
+//                          [memlimit_uint=0],
+//                          [... args ...] )
+//
+// Upvalues: metatable to use for 'lane_ud'
+//
+LUAG_FUNC( thread_new )
+{
+	lua_State *L2;
+	struct s_lane *s;
+	struct s_lane **ud;
+
+	const char *libs= lua_tostring( L, 2 );
+	uint_t cs= luaG_optunsigned( L, 3,0);
+	int prio= (int)luaL_optinteger( L, 4,0);
+	uint_t glob= luaG_isany(L,5) ? 5:0;
+	uint_t ppath = luaG_isany(L,6) ? 6:0;
+	uint_t pcpath = luaG_isany(L,7) ? 7:0;
+	uint_t memlimit= luaG_optunsigned( L, 8,0);
+
+#define FIXED_ARGS (8)
+	uint_t args= lua_gettop(L) - FIXED_ARGS;
+
+	if (prio < THREAD_PRIO_MIN || prio > THREAD_PRIO_MAX)
+	{
+		luaL_error( L, "Priority out of range: %d..+%d (%d)", 
+			THREAD_PRIO_MIN, THREAD_PRIO_MAX, prio );
+	}
+
+	/* --- Create and prepare the sub state --- */
+
+	L2 = lane_state_new( L, libs, glob, ppath, pcpath );
+
+	// Lane main function
+	//
+	STACK_CHECK(L)
+	if( lua_type( L, 1) == LUA_TFUNCTION)
+	{
+		lua_pushvalue( L, 1);
+		if( luaG_inter_move( L, L2, 1) != 0)    // L->L2
+			luaL_error( L, "tried to copy unsupported types");
+		STACK_MID(L,0)
+	}
+	else if( lua_type(L, 1) == LUA_TSTRING)
 	{
 		// compile the string
 		if( luaL_loadstring( L2, lua_tostring( L, 1)) != 0)
@@ -1665,6 +1920,9 @@ LUAG_FUNC( thread_new )
 #endif
 	s->mstatus= NORMAL;
 	s->selfdestruct_next= NULL;
+	s->pool= NULL;
+	s->pool_next= NULL;
+	s->results= NULL;
 
 	// Set metatable for the userdata
 	//
@@ -1689,6 +1947,14 @@ LUAG_FUNC( thread_new )
 		lua_sethook( L2, cancel_hook, LUA_MASKCOUNT, cs );
 	}
 
+	// Hard memory limit applies to the lane's own code only; setting up
+	// L2 above runs unprotected and must not fail
+	//
+	if (memlimit)
+	{
+		luaL_setalloclimit( L2, memlimit );
+	}
+
 	THREAD_CREATE( &s->thread, lane_main, s, prio );
 	STACK_END(L,1)
 
@@ -1720,6 +1986,12 @@ LUAG_FUNC( thread_gc )
 {
 	struct s_lane *s= lua_toLane(L,1);
 
+	if (s->pool)
+	{
+		pool_lane_free( L, s);
+		return 0;
+	}
+
 	// We can read 's->status' without locks, but not wait for it
 	//
 	if (s->status < DONE)
@@ -1829,7 +2101,9 @@ LUAG_FUNC( thread_cancel)
 
 	force= lua_toboolean(L,force_i);     // FALSE if nothing there
 
-	done = thread_cancel( s, secs, force);
+	// A pooled lane is never killed, that would take the worker with it
+	//
+	done = s->pool ? pool_cancel( L, s, secs) : thread_cancel( s, secs, force);
 
 	lua_pushboolean( L, done);
 	return 1;
@@ -1887,6 +2161,11 @@ LUAG_FUNC( thread_join )
 	int ret;
 	bool_t done;
 
+	if (s->pool)
+	{
+		return pool_join( L, s, wait_secs);
+	}
+
 	done = (s->thread == 0) ||
 #if (defined PLATFORM_WIN32) || (defined PLATFORM_POCKETPC) || (defined PTHREAD_TIMEDJOIN)
 		THREAD_WAIT( &s->thread, wait_secs );
@@ -2084,159 +2363,1397 @@ LUAG_FUNC( thread_index)
 	return 0;
 }
 
-/*---=== Timer support ===---
+/*
+* Metatable of the lane handles, one per state
+*
+* contains keys: { __gc, __index, cached_error, cached_tostring, cancel, join }
+*/
+#define LANE_METATABLE_KEY ((void*)LG_thread_gc)    // used as registry key
+
+static void push_lane_metatable( lua_State *L)
+{
+	STACK_GROW( L, 2);
+	if( push_registry_table( L, LANE_METATABLE_KEY, FALSE))
+	{
+		return;
+	}
+	push_registry_table( L, LANE_METATABLE_KEY, TRUE);
+	lua_pushcfunction( L, LG_thread_gc);
+	lua_setfield( L, -2, "__gc");
+	lua_pushcfunction( L, LG_thread_index);
+	lua_setfield( L, -2, "__index");
+	lua_getfield( L, LUA_GLOBALSINDEX, "error");
+	ASSERT_L( lua_isfunction( L, -1));
+	lua_setfield( L, -2, "cached_error");
+	lua_getfield( L, LUA_GLOBALSINDEX, "tostring");
+	ASSERT_L( lua_isfunction( L, -1));
+	lua_setfield( L, -2, "cached_tostring");
+	lua_pushcfunction( L, LG_thread_join);
+	lua_setfield( L, -2, "join");
+	lua_pushcfunction( L, LG_thread_cancel);
+	lua_setfield( L, -2, "cancel");
+	lua_pushboolean( L, 0);
+	lua_setfield( L, -2, "__metatable");
+}
+
+/*---=== Lane pools ===---
 */
 
 /*
-* secs= now_secs()
+* A pool runs lanes on a fixed set of worker threads, each with its own Lua
+* state that is prepared once (libraries, globals, package paths) and then
+* reused for one lane after the other. Queuing a lane costs about as much as
+* sending its function and parameters through a Linda, instead of creating,
+* preparing and closing a state and a thread.
 *
-* Returns the current time, as seconds (millisecond resolution).
+* Pooled lanes use the usual 'struct s_lane' and lane handles, with 's->pool'
+* set. Their function and parameters, and later the results, are encoded in
+* 's->results' like Linda contents; values that need to be parked go to the
+* keeper state under the 's_lane' pointer. Globals set by a lane remain in
+* the worker state for the lanes that follow.
+*
+* The pool is deep userdata, so lanes can queue more lanes on it. It lives on
+* as long as there are proxies, workers or pooled lanes referring to it.
 */
-LUAG_FUNC( now_secs )
+struct s_worker {
+	THREAD_T thread;
+	lua_State *L;
+	struct s_pool *pool;
+	struct s_lane *lane;    // running, under the pool lock
+};
+
+struct s_pool {
+	MUTEX_T lock_;
+	SIGNAL_T work_;         // lanes queued, or closing
+	SIGNAL_T done_;         // a pooled lane finished
+	struct s_lane *first;   // queue of pending lanes
+	struct s_lane **last;
+	int refs;               // proxies (1 for all of them), running workers, lanes
+	bool_t closing;         // no proxies left: cancel pending lanes and leave
+	int size;
+	struct s_worker workers[1];     // 'size' of them
+};
+
+/*
+* Workers of dropped pools that have not left yet, waited for when closing
+* the state that first required Lanes (the library goes away with it)
+*/
+static MUTEX_T pool_cs;
+static SIGNAL_T pool_left;
+static int pool_leaving;
+
+static void pool_id( lua_State*, char const * const which);
+LUAG_FUNC( parallel_helper);
+
+#define lua_toPool(L,n) ((struct s_pool *)luaG_todeep( L, pool_id, n ))
+
+/*
+* Number of processors, for the default pool size
+*/
+static int pool_default_size( void)
 {
-    lua_pushnumber( L, now_secs() );
-    return 1;
+	int n = 1;
+#if (defined PLATFORM_WIN32) || (defined PLATFORM_POCKETPC)
+	SYSTEM_INFO si;
+	GetSystemInfo( &si);
+	n = (int) si.dwNumberOfProcessors;
+#elif defined _SC_NPROCESSORS_ONLN
+	n = (int) sysconf( _SC_NPROCESSORS_ONLN);
+#endif
+	return (n > 0) ? n : 1;
 }
 
 /*
-* wakeup_at_secs= wakeup_conv( date_tbl )
+* Drop a reference to the pool, freeing it with the last one
+*
+* Called with the pool lock held; releases it.
 */
-LUAG_FUNC( wakeup_conv )
+static void pool_unref_UNLOCK( struct s_pool *P)
 {
-    int year, month, day, hour, min, sec, isdst;
-    struct tm tm= {0};
-        //
-        // .year (four digits)
-        // .month (1..12)
-        // .day (1..31)
-        // .hour (0..23)
-        // .min (0..59)
-        // .sec (0..61)
-        // .yday (day of the year)
-        // .isdst (daylight saving on/off)
-
-  STACK_CHECK(L)    
-    lua_getfield( L, 1, "year" ); year= (int)lua_tointeger(L,-1); lua_pop(L,1);
-    lua_getfield( L, 1, "month" ); month= (int)lua_tointeger(L,-1); lua_pop(L,1);
-    lua_getfield( L, 1, "day" ); day= (int)lua_tointeger(L,-1); lua_pop(L,1);
-    lua_getfield( L, 1, "hour" ); hour= (int)lua_tointeger(L,-1); lua_pop(L,1);
-    lua_getfield( L, 1, "min" ); min= (int)lua_tointeger(L,-1); lua_pop(L,1);
-    lua_getfield( L, 1, "sec" ); sec= (int)lua_tointeger(L,-1); lua_pop(L,1);
+	bool_t last = (-- P->refs == 0);
+	MUTEX_UNLOCK( &P->lock_);
+	if( last)
+	{
+		SIGNAL_FREE( &P->done_);
+		SIGNAL_FREE( &P->work_);
+		MUTEX_FREE( &P->lock_);
+		free( P);
+	}
+}
 
-    // If Lua table has '.isdst' we trust that. If it does not, we'll let
-    // 'mktime' decide on whether the time is within DST or not (value -1).
-    //
-    lua_getfield( L, 1, "isdst" );
-    isdst= lua_isboolean(L,-1) ? lua_toboolean(L,-1) : -1;
-    lua_pop(L,1);
-  STACK_END(L,0)
+/*
+* New pooled lane, for the function and parameters from 'first' to 'last'
+*
+* Returns: the lane, or NULL with CHANNEL_ERRMEM/KEEPER_ERR... in '*status'
+*/
+static struct s_lane *pool_lane_new( lua_State *L, struct s_pool *P, int first, int last, int *status)
+{
+	struct s_lane *s = malloc( sizeof(struct s_lane));
+	if( !s)
+	{
+		*status = CHANNEL_ERRMEM;
+		return NULL;
+	}
 
-    tm.tm_year= year-1900;
-    tm.tm_mon= month-1;     // 0..11
-    tm.tm_mday= day;        // 1..31
-    tm.tm_hour= hour;       // 0..23
-    tm.tm_min= min;         // 0..59
-    tm.tm_sec= sec;         // 0..60
-    tm.tm_isdst= isdst;     // 0/1/negative
+	s->L = NULL;
+	s->status = PENDING;
+	s->waiting_on = NULL;
+	s->cancel_request = FALSE;
+	s->mstatus = NORMAL;
+	s->selfdestruct_next = NULL;
+	s->pool = P;
+	s->pool_next = NULL;
 
-    lua_pushnumber( L, (double) mktime( &tm ) );   // ms=0
-    return 1;
+	// lane function and parameters, encoded before taking the pool lock
+	//
+	*status = channel_encode( L, s, first, last, &s->results);
+	if( *status < 0)
+	{
+		free( s);
+		return NULL;
+	}
+	return s;
 }
 
-/*---=== Module linkage ===---
-*/
+static void pool_queue( struct s_pool *P, struct s_lane *s)
+{
+	MUTEX_LOCK( &P->lock_);
+	++ P->refs;
+	*P->last = s;
+	P->last = &s->pool_next;
+	SIGNAL_ONE( &P->work_);
+	MUTEX_UNLOCK( &P->lock_);
+}
 
-static const struct luaL_reg lanes_functions [] = {
-    {"linda", LG_linda},
-    {"now_secs", LG_now_secs},
-    {"wakeup_conv", LG_wakeup_conv},
-    {"_single", LG__single},
-    {NULL, NULL}
-};
+// Take a pending lane out of the queue, under the pool lock
+static void pool_unlink( struct s_pool *P, struct s_lane *s)
+{
+	struct s_lane **prev = &P->first;
+	while( *prev != s)
+	{
+		prev = &(*prev)->pool_next;
+	}
+	*prev = s->pool_next;
+	if( P->last == &s->pool_next)
+	{
+		P->last = prev;
+	}
+	s->pool_next = NULL;
+}
 
 /*
-* One-time initializations
+* Run a pooled lane in the worker state 'L' (empty stack)
+*
+* Returns: the final status; 's->results' holds the results, or the error
+*          message and stack trace
 */
-static void init_once_LOCKED( lua_State *L, volatile DEEP_PRELUDE ** timer_deep_ref, int const nbKeepers)
+static enum e_status pool_run( lua_State *L, struct s_lane *s)
 {
-    const char *err;
+	enum e_status st;
+	int rc, status;
 
-#if (defined PLATFORM_WIN32) || (defined PLATFORM_POCKETPC)
-        now_secs();     // initialize 'now_secs()' internal offset
-#endif
+	STACK_GROW( L, 2);
 
-#if (defined PLATFORM_OSX) && (defined _UTILBINDTHREADTOCPU)
-        chudInitialize();
-#endif
-    
-        // Locks for 'tools.c' inc/dec counters
-        //
-        MUTEX_INIT( &deep_lock );
-        MUTEX_INIT( &mtid_lock );
-    
-        // Serialize calls to 'require' from now on, also in the primary state
-        //
-        MUTEX_RECURSIVE_INIT( &require_cs );
+	// 's' for 'cancel_test()' and the Linda waits, as in 'thread_new()'
+	//
+	lua_pushlightuserdata( L, CANCEL_TEST_KEY);
+	lua_pushlightuserdata( L, s);
+	lua_rawset( L, LUA_REGISTRYINDEX);
 
-        serialize_require( L );
+	// [1]: lane function (or code string, or parallel loop)
+	// [2..top]: parameters
+	//
+	status = channel_decode( L, s, s->results);
+	s->results = NULL;
+	if( status == 0 && lua_type( L, 1) == LUA_TLIGHTUSERDATA)
+	{
+		// helper of a parallel loop
+		lua_pushcfunction( L, LG_parallel_helper);
+		lua_insert( L, 1);
+	}
+	else if( status == 0 && lua_type( L, 1) == LUA_TSTRING)
+	{
+		if( luaL_loadstring( L, lua_tostring( L, 1)) != 0)
+		{
+			lua_replace( L, 1);
+			lua_settop( L, 1);
+			lua_newtable( L);
+			status = LUA_ERRSYNTAX;
+		}
+		else
+		{
+			lua_replace( L, 1);
+		}
+	}
+	if( status == 0)
+	{
+		rc = lane_call( L);
+	}
+	else
+	{
+		if( status < 0)
+		{
+			lua_settop( L, 0);
+			lua_pushstring( L, (status == CHANNEL_ERRMEM) ? "not enough memory" : KEEPER_ERROR_STRING( status));
+			lua_newtable( L);
+		}
+		rc = LUA_ERRRUN;
+	}
 
-        // Selfdestruct chain handling
-        //
-        MUTEX_INIT( &selfdestruct_cs );
-        atexit( selfdestruct_atexit );
+	st = (rc == 0) ? DONE
+		: (lua_touserdata( L, 1) == CANCEL_ERROR) ? CANCELLED
+		: ERROR_ST;
 
-        //---
-        // Linux needs SCHED_RR to change thread priorities, and that is only
-        // allowed for sudo'ers. SCHED_OTHER (default) has no priorities.
-        // SCHED_OTHER threads are always lower priority than SCHED_RR.
-        //
-        // ^-- those apply to 2.6 kernel.  IF **wishful thinking** these 
-        //     constraints will change in the future, non-sudo priorities can 
-        //     be enabled also for Linux.
-        //
-#ifdef PLATFORM_LINUX
-        sudo= geteuid()==0;     // we are root?
+	if( st != CANCELLED && lua_gettop( L) > 0)
+	{
+		status = channel_encode( L, s, 1, lua_gettop( L), &s->results);
+		if( status < 0)
+		{
+			lua_settop( L, 0);
+			lua_pushstring( L, (status == CHANNEL_ERRMEM) ? "not enough memory" : KEEPER_ERROR_STRING( status));
+			lua_newtable( L);
+			channel_encode( L, s, 1, 2, &s->results);
+			st = ERROR_ST;
+		}
+	}
+	lua_settop( L, 0);
 
-        // If lower priorities (-2..-1) are wanted, we need to lift the main
-        // thread to SCHED_RR and 50 (medium) level. Otherwise, we're always below 
-        // the launched threads (even -2).
-	    //
-  #ifdef LINUX_SCHED_RR
-        if (sudo) {
-            struct sched_param sp= {0}; sp.sched_priority= _PRIO_0;
-            PT_CALL( pthread_setschedparam( pthread_self(), SCHED_RR, &sp) );
-        }
-  #endif
+	// Nothing of this lane is left for the next one in the registry
+	//
+	lua_pushlightuserdata( L, CANCEL_TEST_KEY);
+	lua_pushnil( L);
+	lua_rawset( L, LUA_REGISTRYINDEX);
+	lua_pushlightuserdata( L, FINALIZER_REG_KEY);
+	lua_pushnil( L);
+	lua_rawset( L, LUA_REGISTRYINDEX);
+#ifdef ERROR_FULL_STACK
+	lua_pushlightuserdata( L, STACK_TRACE_KEY);
+	lua_pushnil( L);
+	lua_rawset( L, LUA_REGISTRYINDEX);
 #endif
-    err= init_keepers( nbKeepers);
-    if (err)
-    {
-            luaL_error( L, "Unable to initialize: %s", err );
-    }
-    
-    // Initialize 'timer_deep'; a common Linda object shared by all states
-    //
-    ASSERT_L( timer_deep_ref && (!(*timer_deep_ref)) );
 
-    STACK_CHECK(L)
-    {
-        // proxy_ud= deep_userdata( idfunc )
-        //
-        luaG_deep_userdata( L, linda_id);
+	s->waiting_on = NULL; // just in case
+	return st;
+}
 
-        ASSERT_L( lua_isuserdata(L,-1) );
-        
-        // Proxy userdata contents is only a 'DEEP_PRELUDE*' pointer
-        //
-        *timer_deep_ref= * (DEEP_PRELUDE**) lua_touserdata( L, -1 );
-        ASSERT_L( (*timer_deep_ref) && (*timer_deep_ref)->refcount==1 && (*timer_deep_ref)->deep );
+//---
+#if (defined PLATFORM_WIN32) || (defined PLATFORM_POCKETPC)
+  static THREAD_RETURN_T __stdcall pool_worker( void *vw )
+#else
+  static THREAD_RETURN_T pool_worker( void *vw )
+#endif
+{
+	struct s_worker *w = (struct s_worker *) vw;
+	struct s_pool *P = w->pool;
+	lua_State *L = w->L;
 
-        // The host Lua state must always have a reference to this Linda object in order for our 'timer_deep_ref' to be valid.
-        // So store a reference that we will never actually use.
-        lua_pushlightuserdata(L, (void *)init_once_LOCKED);
+	MUTEX_LOCK( &P->lock_);
+	for( ;;)
+	{
+		struct s_lane *s;
+		enum e_status st;
+		bool_t orphan;
+
+		while( P->first == NULL && !P->closing)
+		{
+			SIGNAL_WAIT( &P->work_, &P->lock_, -1.0);
+		}
+		s = P->first;
+		if( s == NULL)
+		{
+			break;  // closing, and nothing left to cancel
+		}
+		P->first = s->pool_next;
+		if( P->first == NULL)
+		{
+			P->last = &P->first;
+		}
+		s->pool_next = NULL;
+		st = P->closing ? CANCELLED : RUNNING;
+		s->status = st;     // PENDING -> RUNNING
+		w->lane = (st == RUNNING) ? s : NULL;
+		MUTEX_UNLOCK( &P->lock_);
+
+		if( st == RUNNING)
+		{
+			st = pool_run( L, s);
+		}
+		else
+		{
+			// A parallel loop helper holds a reference on its loop
+			// ('parallel_lud' first), which it drops when it runs
+			channel_decode( L, s, s->results);
+			s->results = NULL;
+			if( lua_type( L, 1) == LUA_TLIGHTUSERDATA)
+			{
+				parallel_unref( (struct s_parallel *) lua_touserdata( L, 1));
+			}
+			lua_settop( L, 0);
+		}
+
+		MUTEX_LOCK( &P->lock_);
+		w->lane = NULL;
+		s->status = st;
+		SIGNAL_ALL( &P->done_);     // wake up joiners
+		orphan = (s->selfdestruct_next != NULL);
+		if( orphan)
+		{
+			-- P->refs;     // not the last one: we hold our own
+			MUTEX_UNLOCK( &P->lock_);
+			channel_release( L, s, s->results);
+			free( s);
+			MUTEX_LOCK( &P->lock_);
+		}
+	}
+	pool_unref_UNLOCK( P);
+
+	lua_close( L);
+
+	MUTEX_LOCK( &pool_cs);
+	-- pool_leaving;
+	SIGNAL_ALL( &pool_left);
+	MUTEX_UNLOCK( &pool_cs);
+	return 0;   // ignored
+}
+
+/*
+* '__gc' of a sentinel in the state that first required Lanes, collected
+* after the pools of that state when it is closed
+*
+* The running lanes of those pools were cancelled with a hook (see
+* 'pool_id()'), so only a lane stuck in a C call can delay this. Returning
+* before the workers are out would unload the code they run: wait for them,
+* however long it takes.
+*/
+LUAG_FUNC( pool_atclose)
+{
+	MUTEX_LOCK( &pool_cs);
+	while( pool_leaving > 0)
+	{
+		SIGNAL_WAIT( &pool_left, &pool_cs, -1.0);
+	}
+	MUTEX_UNLOCK( &pool_cs);
+	return 0;
+}
+
+/*
+* Wait for a pooled lane to finish
+*
+* 'secs': <0 to wait forever, 0.0 to just check, >0 time to wait
+*
+* Returns: TRUE if the lane is DONE/ERROR_ST/CANCELLED
+*/
+static bool_t pool_wait( struct s_lane *s, double secs)
+{
+	struct s_pool *P = s->pool;
+	time_d timeout = SIGNAL_TIMEOUT_PREPARE( secs);
+	bool_t done;
+
+	MUTEX_LOCK( &P->lock_);
+	while( s->status < DONE && secs != 0.0)
+	{
+		if( !SIGNAL_WAIT( &P->done_, &P->lock_, timeout))
+		{
+			break;  // timeout
+		}
+	}
+	done = (s->status >= DONE);
+	MUTEX_UNLOCK( &P->lock_);
+	return done;
+}
+
+/*
+* 'thread_join()' of a pooled lane; returns its results once (see there)
+*/
+static int pool_join( lua_State *L, struct s_lane *s, double secs)
+{
+	struct s_Item *results;
+	int top = lua_gettop( L);
+	int status;
+
+	if( !pool_wait( s, secs))
+	{
+		return 0;   // timeout
+	}
+	results = s->results;
+	s->results = NULL;
+	if( results == NULL)
+	{
+		return 0;   // no results, or already joined
+	}
+
+	STACK_GROW( L, 1);
+	if( s->status == ERROR_ST)
+	{
+		lua_pushnil( L);    // error message at [-2], stack trace at [-1] follow
+	}
+	status = channel_decode( L, s, results);
+	if( status < 0)
+	{
+		CHANNEL_ERROR( L, status);
+	}
+	return lua_gettop( L) - top;
+}
+
+/*
+* Cancel a pooled lane: pending ones are taken out of the queue, running ones
+* are signalled like 'thread_cancel()' does
+*/
+static bool_t pool_cancel( lua_State *L, struct s_lane *s, double secs)
+{
+	struct s_pool *P = s->pool;
+	struct s_Item *items = NULL;
+
+	MUTEX_LOCK( &P->lock_);
+	if( s->status == PENDING)
+	{
+		pool_unlink( P, s);
+		items = s->results;
+		s->results = NULL;
+		s->status = CANCELLED;
+		SIGNAL_ALL( &P->done_);
+	}
+	else if( s->status < DONE)
+	{
+		s->cancel_request = TRUE;    // it's now signalled to stop
+	}
+	MUTEX_UNLOCK( &P->lock_);
+
+	channel_release( L, s, items);
+	return pool_wait( s, secs);
+}
+
+/*
+* '__gc' of a pooled lane handle: a lane still in the queue or running is left
+* for the worker to free
+*/
+static void pool_lane_free( lua_State *L, struct s_lane *s)
+{
+	struct s_pool *P = s->pool;
+
+	MUTEX_LOCK( &P->lock_);
+	if( s->status < DONE)
+	{
+		s->selfdestruct_next = s;   // not on the selfdestruct chain, just a mark for the worker
+		MUTEX_UNLOCK( &P->lock_);
+		return;
+	}
+	pool_unref_UNLOCK( P);
+
+	channel_release( L, s, s->results);
+	free( s);
+}
+
+/*
+* lane_ud= pool:submit( function|code_str, ... )
+*
+* Queues a lane running 'function( ...)' on a worker of the pool, and returns
+* its handle (same as a lane from 'lanes.gen()').
+*/
+LUAG_FUNC( pool_submit)
+{
+	struct s_pool *P = lua_toPool( L, 1);
+	struct s_lane *s;
+	struct s_lane **ud;
+	int status;
+
+	luaL_argcheck( L, P, 1, "expected a pool object!");
+	luaL_argcheck( L, lua_type( L, 2) == LUA_TFUNCTION || lua_type( L, 2) == LUA_TSTRING, 2, "expected a function or a string");
+
+	STACK_GROW( L, 2);
+	STACK_CHECK(L)
+	ud = lua_newuserdata( L, sizeof(struct s_lane*));
+	ASSERT_L(ud);
+
+	s = pool_lane_new( L, P, 2, lua_gettop( L) - 1, &status);
+	if( !s)
+	{
+		CHANNEL_ERROR( L, status);
+	}
+	*ud = s;
+	push_lane_metatable( L);
+	lua_setmetatable( L, -2);
+	lua_newtable( L);
+	lua_setfenv( L, -2);
+	STACK_END(L,1)
+
+	pool_queue( P, s);
+	return 1;
+}
+
+/*
+* int= pool:size()
+*/
+LUAG_FUNC( pool_size)
+{
+	struct s_pool *P = lua_toPool( L, 1);
+	luaL_argcheck( L, P, 1, "expected a pool object!");
+	lua_pushinteger( L, P->size);
+	return 1;
+}
+
+/*
+* string = pool:__tostring( pool_ud)
+*/
+LUAG_FUNC( pool_tostring)
+{
+	char text[32];
+	struct s_pool *P = lua_toPool( L, 1);
+	luaL_argcheck( L, P, 1, "expected a pool object!");
+	sprintf( text, "pool: %p", P);
+	lua_pushstring( L, text);
+	return 1;
+}
+
+/*---=== Parallel loops ===---
+*/
+
+/*
+* 'parallel_for', 'map' and 'reduce' split a range into chunks, shared by the
+* calling lane and one helper lane queued per worker of the pool. Each of
+* them has a deque of chunks: it takes chunks from the front of its own,
+* and once that is empty steals the back half of another one. Helpers that
+* start late find nothing left, so a busy pool only means that the caller
+* does more of the work itself; those still queued at the end are dropped.
+*
+* The data goes through buffers (deep userdata, see buffer.c), read and
+* written in place by all the participants.
+*/
+enum e_parallel { PARALLEL_FOR, PARALLEL_MAP, PARALLEL_REDUCE };
+
+struct s_deque {
+	MUTEX_T lock_;
+	int lo, hi;     // chunks [lo, hi)
+};
+
+struct s_parallel {
+	MUTEX_T lock_;
+	SIGNAL_T done_;         // all chunks completed
+	int refs;               // caller and helpers, under 'lock_'
+	int completed;          // chunks run or skipped, under 'lock_'
+	char *error;            // first error message, under 'lock_'
+	volatile bool_t failed; // remaining chunks are skipped
+	enum e_parallel kind;
+	int n;                  // elements
+	int chunk;              // elements per chunk
+	int chunks;
+	struct s_Buffer *in, *out;
+	double *partials;       // 'reduce': result of each chunk
+	int nb_deques;
+	struct s_deque deques[1];   // 'nb_deques' of them, [0] for the caller
+};
+
+static void parallel_unref( struct s_parallel *J)
+{
+	bool_t last;
+	MUTEX_LOCK( &J->lock_);
+	last = (-- J->refs == 0);
+	MUTEX_UNLOCK( &J->lock_);
+	if( last)
+	{
+		int k;
+		for( k = 0; k < J->nb_deques; ++ k)
+		{
+			MUTEX_FREE( &J->deques[k].lock_);
+		}
+		SIGNAL_FREE( &J->done_);
+		MUTEX_FREE( &J->lock_);
+		free( J->error);
+		free( J->partials);
+		free( J);
+	}
+}
+
+/*
+* Next chunk for participant 'k', -1 when there is none left anywhere
+*/
+static int parallel_claim( struct s_parallel *J, int k)
+{
+	struct s_deque *d = &J->deques[k];
+	int c = -1;
+	int v;
+
+	MUTEX_LOCK( &d->lock_);
+	if( d->lo < d->hi)
+	{
+		c = d->lo ++;
+	}
+	MUTEX_UNLOCK( &d->lock_);
+
+	for( v = 1; c < 0 && v < J->nb_deques; ++ v)
+	{
+		struct s_deque *victim = &J->deques[(k + v) % J->nb_deques];
+		int lo = 0, hi = 0;
+		MUTEX_LOCK( &victim->lock_);
+		if( victim->lo < victim->hi)
+		{
+			hi = victim->hi;
+			lo = hi - (hi - victim->lo + 1) / 2;    // back half, at least one
+			victim->hi = lo;
+		}
+		MUTEX_UNLOCK( &victim->lock_);
+		if( lo < hi)
+		{
+			c = lo;
+			MUTEX_LOCK( &d->lock_);
+			d->lo = lo + 1;
+			d->hi = hi;
+			MUTEX_UNLOCK( &d->lock_);
+		}
+	}
+	return c;
+}
+
+// Non-number result of a 'map' or 'reduce' function: replaced by an error message
+static int parallel_check_number( lua_State *L)
+{
+	if( lua_type( L, -1) == LUA_TNUMBER)
+	{
+		return 0;
+	}
+	lua_pushfstring( L, "function returned %s instead of a number", luaG_typename( L, -1));
+	lua_remove( L, -2);
+	return LUA_ERRRUN;
+}
+
+/*
+* Run chunk 'c' in 'L', the function being at 'f_i' and its extra parameters
+* ('parallel_for' only) up to 'last_i'
+*
+* Returns: 0, or a LUA_ERRxxx code with the error message on the stack
+*/
+static int parallel_chunk( lua_State *L, struct s_parallel *J, int c, int f_i, int last_i)
+{
+	int lo = c * J->chunk;
+	int hi = (lo + J->chunk < J->n) ? lo + J->chunk : J->n;
+	int rc = 0;
+	int i;
+
+	STACK_GROW( L, 3 + last_i - f_i);
+	switch( J->kind)
+	{
+		case PARALLEL_FOR:
+		lua_pushvalue( L, f_i);
+		lua_pushinteger( L, lo + 1);
+		lua_pushinteger( L, hi);
+		for( i = f_i + 1; i <= last_i; ++ i)
+		{
+			lua_pushvalue( L, i);
+		}
+		rc = lua_pcall( L, 2 + last_i - f_i, 0, 0);
+		break;
+
+		case PARALLEL_MAP:
+		for( i = lo; i < hi && rc == 0; ++ i)
+		{
+			lua_pushvalue( L, f_i);
+			lua_pushnumber( L, buffer_get( J->in, i));
+			lua_pushinteger( L, i + 1);
+			rc = lua_pcall( L, 2, 1, 0);
+			if( rc == 0 && (rc = parallel_check_number( L)) == 0)
+			{
+				buffer_set( J->out, i, lua_tonumber( L, -1));
+				lua_pop( L, 1);
+			}
+		}
+		break;
+
+		case PARALLEL_REDUCE:
+		{
+			double acc = buffer_get( J->in, lo);
+			for( i = lo + 1; i < hi && rc == 0; ++ i)
+			{
+				lua_pushvalue( L, f_i);
+				lua_pushnumber( L, acc);
+				lua_pushnumber( L, buffer_get( J->in, i));
+				rc = lua_pcall( L, 2, 1, 0);
+				if( rc == 0 && (rc = parallel_check_number( L)) == 0)
+				{
+					acc = lua_tonumber( L, -1);
+					lua_pop( L, 1);
+				}
+			}
+			J->partials[c] = acc;
+		}
+		break;
+	}
+	return rc;
+}
+
+/*
+* Take chunks and run them until there are none left, for participant 'k'
+*/
+static void parallel_run( lua_State *L, struct s_parallel *J, int k, int f_i, int last_i)
+{
+	int c;
+	while( (c = parallel_claim( J, k)) >= 0)
+	{
+		int rc = J->failed ? 0 : parallel_chunk( L, J, c, f_i, last_i);
+		MUTEX_LOCK( &J->lock_);
+		if( rc != 0 && !J->failed)
+		{
+			char const *msg = lua_tostring( L, -1);
+			if( msg == NULL)
+			{
+				msg = (lua_touserdata( L, -1) == CANCEL_ERROR) ? "cancelled" : "(error object is not a string)";
+			}
+			J->error = malloc( strlen( msg) + 1);
+			if( J->error)
+			{
+				strcpy( J->error, msg);
+			}
+			J->failed = TRUE;
+		}
+		if( ++ J->completed == J->chunks)
+		{
+			SIGNAL_ALL( &J->done_);
+		}
+		MUTEX_UNLOCK( &J->lock_);
+		if( rc != 0)
+		{
+			lua_pop( L, 1);
+		}
+	}
+}
+
+//---
+// = parallel_helper( parallel_lud, deque_int, function, ... )
+//
+// Lane function of the helpers, run by 'pool_run()'
+//
+LUAG_FUNC( parallel_helper)
+{
+	struct s_parallel *J = (struct s_parallel *) lua_touserdata( L, 1);
+	parallel_run( L, J, (int) lua_tointeger( L, 2), 3, lua_gettop( L));
+	parallel_unref( J);
+	return 0;
+}
+
+/*
+* Take the helper lanes back once all chunks are completed: drop those still
+* queued, leave the others to free themselves
+*/
+static void parallel_release_helpers( lua_State *L, struct s_pool *P, struct s_parallel *J, struct s_lane **helpers, int n)
+{
+	int k;
+	for( k = 0; k < n; ++ k)
+	{
+		struct s_lane *s = helpers[k];
+		bool_t dropped = FALSE;
+		MUTEX_LOCK( &P->lock_);
+		if( s->status == PENDING)
+		{
+			pool_unlink( P, s);
+			dropped = TRUE;
+		}
+		else if( s->status < DONE)
+		{
+			s->selfdestruct_next = s;   // not on the selfdestruct chain, just a mark for the worker
+			MUTEX_UNLOCK( &P->lock_);
+			continue;
+		}
+		pool_unref_UNLOCK( P);      // the caller still holds a proxy
+		channel_release( L, s, s->results);
+		free( s);
+		if( dropped)
+		{
+			parallel_unref( J);     // the reference it would have dropped
+		}
+	}
+}
+
+/*
+* Common part of 'parallel_for', 'map' and 'reduce', see there
+*/
+static int parallel_do( lua_State *L, struct s_pool *P, enum e_parallel kind, int n, int chunk, int f_i, int last_i, struct s_Buffer *in, struct s_Buffer *out)
+{
+	struct s_parallel *J;
+	struct s_lane **helpers;
+	int nb_helpers, chunks, k, status = 0;
+
+	if( n == 0)
+	{
+		return 0;
+	}
+	if( chunk <= 0)
+	{
+		// a few chunks per participant, to even out their speeds
+		int parts = 4 * (P->size + 1);
+		chunk = (n + parts - 1) / parts;
+	}
+	chunks = (n + chunk - 1) / chunk;
+	nb_helpers = (chunks - 1 < P->size) ? chunks - 1 : P->size;
+
+	J = (struct s_parallel *) malloc( sizeof(struct s_parallel) + nb_helpers * sizeof(struct s_deque));
+	helpers = (struct s_lane **) malloc( (nb_helpers + 1) * sizeof(struct s_lane *));
+	if( J)
+	{
+		J->partials = (kind == PARALLEL_REDUCE) ? (double *) malloc( chunks * sizeof(double)) : NULL;
+	}
+	if( !J || !helpers || (kind == PARALLEL_REDUCE && !J->partials))
+	{
+		if( J)
+		{
+			free( J->partials);
+		}
+		free( J);
+		free( helpers);
+		return luaL_error( L, "not enough memory");
+	}
+
+	MUTEX_INIT( &J->lock_);
+	SIGNAL_INIT( &J->done_);
+	J->refs = 1 + nb_helpers;
+	J->completed = 0;
+	J->error = NULL;
+	J->failed = FALSE;
+	J->kind = kind;
+	J->n = n;
+	J->chunk = chunk;
+	J->chunks = chunks;
+	J->in = in;
+	J->out = out;
+	J->nb_deques = 1 + nb_helpers;
+	for( k = 0; k < J->nb_deques; ++ k)
+	{
+		MUTEX_INIT( &J->deques[k].lock_);
+		J->deques[k].lo = (int) ((double) chunks * k / J->nb_deques);
+		J->deques[k].hi = (int) ((double) chunks * (k + 1) / J->nb_deques);
+	}
+
+	// Helpers get the function and parameters by value
+	//
+	STACK_GROW( L, 2 + last_i - f_i + 1);
+	for( k = 0; k < nb_helpers; ++ k)
+	{
+		int i, top = lua_gettop( L);
+		lua_pushlightuserdata( L, J);
+		lua_pushinteger( L, k + 1);
+		for( i = f_i; i <= last_i; ++ i)
+		{
+			lua_pushvalue( L, i);
+		}
+		helpers[k] = pool_lane_new( L, P, top + 1, lua_gettop( L), &status);
+		lua_settop( L, top);
+		if( !helpers[k])
+		{
+			break;
+		}
+	}
+	if( k < nb_helpers)
+	{
+		// could not copy the function: nothing was queued yet
+		int queued = k;
+		for( k = 0; k < queued; ++ k)
+		{
+			channel_release( L, helpers[k], helpers[k]->results);
+			free( helpers[k]);
+		}
+		J->refs = 1;
+		parallel_unref( J);
+		free( helpers);
+		return CHANNEL_ERROR( L, status);
+	}
+	for( k = 0; k < nb_helpers; ++ k)
+	{
+		pool_queue( P, helpers[k]);
+	}
+
+	// The caller takes part, and waits for the chunks the others are running
+	//
+	parallel_run( L, J, 0, f_i, last_i);
+	MUTEX_LOCK( &J->lock_);
+	while( J->completed < J->chunks)
+	{
+		SIGNAL_WAIT( &J->done_, &J->lock_, -1.0);
+	}
+	MUTEX_UNLOCK( &J->lock_);
+
+	parallel_release_helpers( L, P, J, helpers, nb_helpers);
+	free( helpers);
+
+	if( J->failed)
+	{
+		lua_pushstring( L, J->error ? J->error : "not enough memory");
+		parallel_unref( J);
+		return lua_error( L);
+	}
+
+	if( kind == PARALLEL_REDUCE)
+	{
+		// chunk results are combined in order
+		int rc = 0;
+		lua_pushnumber( L, J->partials[0]);
+		for( k = 1; k < chunks && rc == 0; ++ k)
+		{
+			lua_pushvalue( L, f_i);
+			lua_insert( L, -2);
+			lua_pushnumber( L, J->partials[k]);
+			rc = lua_pcall( L, 2, 1, 0);
+			if( rc == 0)
+			{
+				rc = parallel_check_number( L);
+			}
+		}
+		parallel_unref( J);
+		if( rc != 0)
+		{
+			return lua_error( L);
+		}
+		return 1;
+	}
+	parallel_unref( J);
+	return 0;
+}
+
+// Non negative int at 'i', checked before conversion so that it cannot wrap
+static int check_count( lua_State *L, int i, char const *msg)
+{
+	lua_Number n = luaL_checknumber( L, i);
+	luaL_argcheck( L, n >= 0 && n <= INT_MAX && n == (lua_Number) (int) n, i, msg);
+	return (int) n;
+}
+
+// Optional chunk size at 'i'
+static int opt_chunk( lua_State *L, int i)
+{
+	return lua_isnoneornil( L, i) ? 0 : check_count( L, i, "invalid chunk size");
+}
+
+/*
+* pool:parallel_for( n, [chunk_uint,] function, ... )
+*
+* Calls 'function( i, j, ...)' for chunks [i, j] covering 1..n, on the
+* calling lane and the workers, and returns when they are all done. After
+* an error in a chunk, the chunks not started yet are skipped, and the error
+* is raised (as a string).
+*/
+LUAG_FUNC( pool_parallel_for)
+{
+	struct s_pool *P = lua_toPool( L, 1);
+	int f_i = (lua_type( L, 3) == LUA_TNUMBER) ? 4 : 3;
+	int n;
+	luaL_argcheck( L, P, 1, "expected a pool object!");
+	n = check_count( L, 2, "invalid count");
+	luaL_checktype( L, f_i, LUA_TFUNCTION);
+	return parallel_do( L, P, PARALLEL_FOR, n, (f_i == 4) ? opt_chunk( L, 3) : 0, f_i, lua_gettop( L), NULL, NULL);
+}
+
+/*
+* pool:map( function, in_buf, out_buf [, chunk_uint] )
+*
+* out_buf[i]= function( in_buf[i], i) for i= 1..#in_buf (see 'parallel_for')
+*/
+LUAG_FUNC( pool_map)
+{
+	struct s_pool *P = lua_toPool( L, 1);
+	struct s_Buffer *in = lua_toBuffer( L, 3);
+	struct s_Buffer *out = lua_toBuffer( L, 4);
+	luaL_argcheck( L, P, 1, "expected a pool object!");
+	luaL_checktype( L, 2, LUA_TFUNCTION);
+	luaL_argcheck( L, in, 3, "expected a buffer object!");
+	luaL_argcheck( L, out, 4, "expected a buffer object!");
+	luaL_argcheck( L, out->n >= in->n, 4, "output buffer too small");
+	return parallel_do( L, P, PARALLEL_MAP, in->n, opt_chunk( L, 5), 2, 2, in, out);
+}
+
+/*
+* value= pool:reduce( function, buf [, chunk_uint] )
+*
+* Folds the elements of 'buf' with 'function( a, b)', which must be
+* associative: each chunk is folded on its own, then the chunk results in
+* order. Returns nil for an empty buffer, there being no identity element
+* to start from.
+*/
+LUAG_FUNC( pool_reduce)
+{
+	struct s_pool *P = lua_toPool( L, 1);
+	struct s_Buffer *in = lua_toBuffer( L, 3);
+	luaL_argcheck( L, P, 1, "expected a pool object!");
+	luaL_checktype( L, 2, LUA_TFUNCTION);
+	luaL_argcheck( L, in, 3, "expected a buffer object!");
+	if( in->n == 0)
+	{
+		lua_pushnil( L);
+		return 1;
+	}
+	return parallel_do( L, P, PARALLEL_REDUCE, in->n, opt_chunk( L, 4), 2, 2, in, NULL);
+}
+
+/*
+* Identity function of pools (see 'linda_id()')
+*
+*   lightuserdata= pool_id( "new" ) with the 'pool_new()' parameters on the stack
+*/
+static void pool_id( lua_State *L, char const * const which)
+{
+	if( strcmp( which, "new") == 0)
+	{
+		struct s_pool *P;
+		int i;
+
+		const char *libs = lua_tostring( L, 1);
+		uint_t cs = luaG_optunsigned( L, 2, 0);
+		int prio = (int) luaL_optinteger( L, 3, 0);
+		uint_t glob = luaG_isany( L, 4) ? 4 : 0;
+		uint_t ppath = luaG_isany( L, 5) ? 5 : 0;
+		uint_t pcpath = luaG_isany( L, 6) ? 6 : 0;
+		uint_t memlimit = luaG_optunsigned( L, 7, 0);
+		int size = luaG_isany( L, 8) ? (int) luaL_checkinteger( L, 8) : pool_default_size();
+
+		if( size < 1)
+		{
+			luaL_error( L, "Pool size must be > 0 (%d)", size);
+		}
+		if( prio < THREAD_PRIO_MIN || prio > THREAD_PRIO_MAX)
+		{
+			luaL_error( L, "Priority out of range: %d..+%d (%d)", 
+				THREAD_PRIO_MIN, THREAD_PRIO_MAX, prio );
+		}
+
+		P = (struct s_pool *) malloc( sizeof(struct s_pool) + (size - 1) * sizeof(struct s_worker));
+		ASSERT_L(P);
+
+		// All worker states are prepared before any thread is started, so
+		// that the pool can still be dropped if that raises an error
+		//
+		for( i = 0; i < size; ++ i)
+		{
+			lua_State *L2 = lane_state_new( L, libs, glob, ppath, pcpath);
+			lane_register_globals( L2);
+			if( cs)
+			{
+				lua_sethook( L2, cancel_hook, LUA_MASKCOUNT, cs);
+			}
+			if( memlimit)
+			{
+				luaL_setalloclimit( L2, memlimit);
+			}
+			P->workers[i].L = L2;
+			P->workers[i].pool = P;
+			P->workers[i].lane = NULL;
+		}
+
+		MUTEX_INIT( &P->lock_);
+		SIGNAL_INIT( &P->work_);
+		SIGNAL_INIT( &P->done_);
+		P->first = NULL;
+		P->last = &P->first;
+		P->refs = 1 + size;
+		P->closing = FALSE;
+		P->size = size;
+
+		for( i = 0; i < size; ++ i)
+		{
+			THREAD_CREATE( &P->workers[i].thread, pool_worker, &P->workers[i], prio);
+		}
+
+		lua_pushlightuserdata( L, P);
+	}
+	else if( strcmp( which, "delete") == 0)
+	{
+		struct s_pool *P = lua_touserdata( L, 1);
+		int i;
+		ASSERT_L(P);
+
+		MUTEX_LOCK( &pool_cs);
+		pool_leaving += P->size;
+		MUTEX_UNLOCK( &pool_cs);
+
+		/* No proxies left, so nothing can be queued anymore. The workers
+		* cancel what is still pending, and the running lanes are cancelled
+		* too, then the workers leave; the last one out frees the pool.
+		* Not waiting for them here, this may well be the GC of one of the
+		* worker states, or of a keeper state.
+		*
+		* A lane that never calls 'cancel_test()' is stopped by the cancel
+		* hook, set even if the pool was made without one: 'pool_atclose()'
+		* waits for the workers. The hook may be set from another thread, and
+		* the worker state is not closed while 'lane' is set.
+		*/
+		MUTEX_LOCK( &P->lock_);
+		P->closing = TRUE;
+		for( i = 0; i < P->size; ++ i)
+		{
+			struct s_lane *s = P->workers[i].lane;
+			if( s)
+			{
+				s->cancel_request = TRUE;
+				lua_sethook( P->workers[i].L, cancel_hook, LUA_MASKCOUNT, 1);
+				// wake it up if it waits on a linda (see 'selfdestruct_atexit()')
+				if( s->status == WAITING && s->waiting_on != NULL)
+				{
+					SIGNAL_T *waiting_on = s->waiting_on;
+					s->waiting_on = NULL;
+					SIGNAL_ALL( waiting_on);
+				}
+			}
+		}
+		SIGNAL_ALL( &P->work_);
+		pool_unref_UNLOCK( P);
+	}
+	else if( strcmp( which, "metatable") == 0)
+	{
+		STACK_CHECK(L)
+		lua_newtable( L);
+		// metatable is its own index
+		lua_pushvalue( L, -1);
+		lua_setfield( L, -2, "__index");
+
+		// protect metatable from external access
+		lua_pushboolean( L, 0);
+		lua_setfield( L, -2, "__metatable");
+
+		lua_pushcfunction( L, LG_pool_tostring);
+		lua_setfield( L, -2, "__tostring");
+
+		lua_pushcfunction( L, LG_pool_submit);
+		lua_setfield( L, -2, "submit");
+
+		lua_pushcfunction( L, LG_pool_size);
+		lua_setfield( L, -2, "size");
+
+		lua_pushcfunction( L, LG_pool_parallel_for);
+		lua_setfield( L, -2, "parallel_for");
+
+		lua_pushcfunction( L, LG_pool_map);
+		lua_setfield( L, -2, "map");
+
+		lua_pushcfunction( L, LG_pool_reduce);
+		lua_setfield( L, -2, "reduce");
+		STACK_END(L,1)
+	}
+	else if( strcmp( which, "module") == 0)
+	{
+		// same as Lindas: lanes stays loaded as long as the main state
+		lua_pushnil( L);
+	}
+}
+
+//---
+// pool_ud= pool_new( [libs_str], 
+//                    [cancelstep_uint=0], 
+//                    [prio_int=0],
+//                    [globals_tbl],
+//                    [packagepath],
+//                    [packagecpath],
+//                    [memlimit_uint=0],
+//                    [size_uint=processors] )
+//
+// Options as in 'thread_new()', applied to each worker state once
+//
+LUAG_FUNC( pool_new)
+{
+	lua_settop( L, 8);
+	return luaG_deep_userdata( L, pool_id);
+}
+
+/*---=== Timer support ===---
+*/
+
+/*
+* secs= now_secs()
+*
+* Returns the current time, as seconds (millisecond resolution).
+*/
+LUAG_FUNC( now_secs )
+{
+    lua_pushnumber( L, now_secs() );
+    return 1;
+}
+
+/*
+* wakeup_at_secs= wakeup_conv( date_tbl )
+*/
+LUAG_FUNC( wakeup_conv )
+{
+    int year, month, day, hour, min, sec, isdst;
+    struct tm tm= {0};
+        //
+        // .year (four digits)
+        // .month (1..12)
+        // .day (1..31)
+        // .hour (0..23)
+        // .min (0..59)
+        // .sec (0..61)
+        // .yday (day of the year)
+        // .isdst (daylight saving on/off)
+
+  STACK_CHECK(L)    
+    lua_getfield( L, 1, "year" ); year= (int)lua_tointeger(L,-1); lua_pop(L,1);
+    lua_getfield( L, 1, "month" ); month= (int)lua_tointeger(L,-1); lua_pop(L,1);
+    lua_getfield( L, 1, "day" ); day= (int)lua_tointeger(L,-1); lua_pop(L,1);
+    lua_getfield( L, 1, "hour" ); hour= (int)lua_tointeger(L,-1); lua_pop(L,1);
+    lua_getfield( L, 1, "min" ); min= (int)lua_tointeger(L,-1); lua_pop(L,1);
+    lua_getfield( L, 1, "sec" ); sec= (int)lua_tointeger(L,-1); lua_pop(L,1);
+
+    // If Lua table has '.isdst' we trust that. If it does not, we'll let
+    // 'mktime' decide on whether the time is within DST or not (value -1).
+    //
+    lua_getfield( L, 1, "isdst" );
+    isdst= lua_isboolean(L,-1) ? lua_toboolean(L,-1) : -1;
+    lua_pop(L,1);
+  STACK_END(L,0)
+
+    tm.tm_year= year-1900;
+    tm.tm_mon= month-1;     // 0..11
+    tm.tm_mday= day;        // 1..31
+    tm.tm_hour= hour;       // 0..23
+    tm.tm_min= min;         // 0..59
+    tm.tm_sec= sec;         // 0..60
+    tm.tm_isdst= isdst;     // 0/1/negative
+
+    lua_pushnumber( L, (double) mktime( &tm ) );   // ms=0
+    return 1;
+}
+
+/*
+* { stats_tbl, ... }= keeper_stats()
+*
+* Allocator statistics (bytes in use, peak, limit, ...) of each keeper state
+*/
+LUAG_FUNC( keeper_stats )
+{
+    return keeper_push_stats( L );
+}
+
+/*
+* = set_keepers( shared_uint [, total_uint] )
+*
+* Have Lindas hash to the first 'shared' keeper states, creating states up
+* to 'total' in all (never fewer than there are). The others only serve
+* Lindas pinned to them with lanes.linda( keeper ). Fails while any values
+* are parked in keeper states and 'shared' changes, or if a live Linda is
+* pinned to a state beyond 'total'.
+*/
+LUAG_FUNC( set_keepers )
+{
+    lua_Number n= luaL_checknumber( L, 1 );
+    lua_Number m= luaL_optnumber( L, 2, n );
+    char const *err;
+    luaL_argcheck( L, n >= 1 && n <= KEEPERS_MAX && n == (lua_Number) (int) n, 1, "keeper count out of range" );
+    luaL_argcheck( L, m >= 1 && m <= KEEPERS_MAX && m == (lua_Number) (int) m, 2, "keeper count out of range" );
+    err= keeper_resize( (int) n, (int) m );
+    if (err)
+    {
+        luaL_error( L, "set_keepers: %s", err );
+    }
+    return 0;
+}
+
+/*---=== Module linkage ===---
+*/
+
+static const struct luaL_reg lanes_functions [] = {
+    {"linda", LG_linda},
+    {"now_secs", LG_now_secs},
+    {"wakeup_conv", LG_wakeup_conv},
+    {"_single", LG__single},
+    {"keeper_stats", LG_keeper_stats},
+    {"set_keepers", LG_set_keepers},
+    {"pool_new", LG_pool_new},
+    {"buffer", buffer_new},
+    {"blob", blob_new},
+    {NULL, NULL}
+};
+
+/*
+* One-time initializations
+*/
+static void init_once_LOCKED( lua_State *L, volatile DEEP_PRELUDE ** timer_deep_ref, int const nbKeepers)
+{
+    const char *err;
+
+#if (defined PLATFORM_WIN32) || (defined PLATFORM_POCKETPC)
+        now_secs();     // initialize 'now_secs()' internal offset
+#endif
+
+#if (defined PLATFORM_OSX) && (defined _UTILBINDTHREADTOCPU)
+        chudInitialize();
+#endif
+    
+        // Locks for 'tools.c' inc/dec counters
+        //
+        MUTEX_INIT( &deep_lock );
+        MUTEX_INIT( &mtid_lock );
+    
+        // Serialize calls to 'require' from now on, also in the primary state
+        //
+        MUTEX_RECURSIVE_INIT( &require_cs );
+
+        serialize_require( L );
+
+        // Selfdestruct chain handling
+        //
+        MUTEX_INIT( &selfdestruct_cs );
+        atexit( selfdestruct_atexit );
+
+        // Pool workers leaving
+        //
+        MUTEX_INIT( &pool_cs );
+        SIGNAL_INIT( &pool_left );
+
+        //---
+        // Linux needs SCHED_RR to change thread priorities, and that is only
+        // allowed for sudo'ers. SCHED_OTHER (default) has no priorities.
+        // SCHED_OTHER threads are always lower priority than SCHED_RR.
+        //
+        // ^-- those apply to 2.6 kernel.  IF **wishful thinking** these 
+        //     constraints will change in the future, non-sudo priorities can 
+        //     be enabled also for Linux.
+        //
+#ifdef PLATFORM_LINUX
+        sudo= geteuid()==0;     // we are root?
+
+        // If lower priorities (-2..-1) are wanted, we need to lift the main
+        // thread to SCHED_RR and 50 (medium) level. Otherwise, we're always below 
+        // the launched threads (even -2).
+	    //
+  #ifdef LINUX_SCHED_RR
+        if (sudo) {
+            struct sched_param sp= {0}; sp.sched_priority= _PRIO_0;
+            PT_CALL( pthread_setschedparam( pthread_self(), SCHED_RR, &sp) );
+        }
+  #endif
+#endif
+    err= init_keepers( nbKeepers);
+    if (err)
+    {
+            luaL_error( L, "Unable to initialize: %s", err );
+    }
+    
+    // Initialize 'timer_deep'; a common Linda object shared by all states
+    //
+    ASSERT_L( timer_deep_ref && (!(*timer_deep_ref)) );
+
+    STACK_CHECK(L)
+    {
+        // proxy_ud= deep_userdata( idfunc )
+        //
+        luaG_deep_userdata( L, linda_id);
+
+        ASSERT_L( lua_isuserdata(L,-1) );
+        
+        // Proxy userdata contents is only a 'DEEP_PRELUDE*' pointer
+        //
+        *timer_deep_ref= * (DEEP_PRELUDE**) lua_touserdata( L, -1 );
+        ASSERT_L( (*timer_deep_ref) && (*timer_deep_ref)->refcount==1 && (*timer_deep_ref)->deep );
+
+        // The host Lua state must always have a reference to this Linda object in order for our 'timer_deep_ref' to be valid.
+        // So store a reference that we will never actually use.
+        lua_pushlightuserdata(L, (void *)init_once_LOCKED);
         lua_insert(L, -2); // Swap key with the Linda object
         lua_rawset(L, LUA_REGISTRYINDEX);
 
+        // Pools are created after this, so at the close of this state they are
+        // collected before the sentinel (and the library after it)
+        lua_pushlightuserdata(L, (void *)LG_pool_atclose);
+        lua_newuserdata(L, 1);
+        lua_newtable(L);
+        lua_pushcfunction(L, LG_pool_atclose);
+        lua_setfield(L, -2, "__gc");
+        lua_setmetatable(L, -2);
+        lua_rawset(L, LUA_REGISTRYINDEX);
     }
     STACK_END(L,0)
 }
@@ -2296,25 +3813,8 @@ luaopen_lanes( lua_State *L )
     luaL_register(L, NULL, lanes_functions);
 
     // metatable for threads
-    // contains keys: { __gc, __index, cached_error, cached_tostring, cancel, join }
     //
-    lua_newtable( L);
-    lua_pushcfunction( L, LG_thread_gc);
-    lua_setfield( L, -2, "__gc");
-    lua_pushcfunction( L, LG_thread_index);
-    lua_setfield( L, -2, "__index");
-    lua_getfield( L, LUA_GLOBALSINDEX, "error");
-    ASSERT_L( lua_isfunction( L, -1));
-    lua_setfield( L, -2, "cached_error");
-    lua_getfield( L, LUA_GLOBALSINDEX, "tostring");
-    ASSERT_L( lua_isfunction( L, -1));
-    lua_setfield( L, -2, "cached_tostring");
-    lua_pushcfunction( L, LG_thread_join);
-    lua_setfield( L, -2, "join");
-    lua_pushcfunction( L, LG_thread_cancel);
-    lua_setfield( L, -2, "cancel");
-    lua_pushboolean( L, 0);
-    lua_setfield( L, -2, "__metatable");
+    push_lane_metatable( L);
 
     lua_pushcclosure( L, LG_thread_new, 1 );    // metatable as closure param
     lua_setfield(L, -2, "thread_new");
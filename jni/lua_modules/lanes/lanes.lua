@@ -55,6 +55,18 @@ local wakeup_conv= assert( mm.wakeup_conv )
 
 local max_prio= assert( mm.max_prio )
 
+keeper_stats= assert( mm.keeper_stats )
+
+-----
+-- lanes.set_keepers( shared_uint [, total_uint] )
+--
+-- Lindas hash to the first 'shared_uint' keeper states; states up to
+-- 'total_uint' are created for Lindas pinned with lanes.linda( k ).
+-- Fails while values are parked in keeper states, or if 'total_uint' (by
+-- default 'shared_uint') leaves out the keeper of a live pinned Linda.
+--
+set_keepers= assert( mm.set_keepers )
+
 -- This check is for sublanes requiring Lanes
 --
 -- TBD: We could also have the C level expose 'string.gmatch' for us. But this is simpler.
@@ -161,18 +173,19 @@ local valid_libs= {
     ["*"]= true
 }
 
-function gen( ... )
+--
+-- Parses the string/table modifiers of 'gen' and 'pool'
+--
+-- 'extra': options valid besides the common ones (their values are passed on as is)
+--
+-- Returns: libs_str|nil, { prio, cs, g_tbl, packagepath, packagecpath, memlimit, [extra] }
+--
+local function lane_options( extra, n, ... )
     local opt= {}
     local libs= nil
-    local lev= 2  -- level for errors
-
-    local n= select('#',...)
-    
-    if n==0 then
-        error( "No parameters!" )
-    end
+    local lev= 3  -- level for errors (caller of 'gen'/'pool')
 
-    for i=1,n-1 do
+    for i=1,n do
         local v= select(i,...)
         if type(v)=="string" then
             libs= libs and libs..","..v or v
@@ -187,12 +200,6 @@ function gen( ... )
         end
     end
 
-    local func= select(n,...)
-    local functype = type(func)
-    if functype ~= "function" and functype ~= "string" then
-        error( "Last parameter not function or string: "..tostring(func))
-    end
-
     -- Check 'libs' already here, so the error goes in the right place
     -- (otherwise will be noticed only once the generator is called)
     --
@@ -204,39 +211,138 @@ function gen( ... )
         end
     end
     
-    local prio, cs, g_tbl, packagepath, packagecpath
+    local o= {}
 
     for k,v in pairs(opt) do
-            if k=="priority" then prio= v
-        elseif k=="cancelstep" then cs= (v==true) and 100 or
+            if k=="priority" then o.prio= v
+        elseif k=="cancelstep" then o.cs= (v==true) and 100 or
                                         (v==false) and 0 or 
                                         type(v)=="number" and v or
                                         error( "Bad cancelstep: "..tostring(v), lev )
-        elseif k=="globals" then g_tbl= v
-        elseif k=="packagepath" then packagepath= v
-        elseif k=="packagecpath" then packagecpath= v
+        elseif k=="globals" then o.g_tbl= v
+        elseif k=="packagepath" then o.packagepath= v
+        elseif k=="packagecpath" then o.packagecpath= v
+        elseif k=="memlimit" then o.memlimit= type(v)=="number" and v>=0 and v or
+                                        error( "Bad memlimit: "..tostring(v), lev )
+        elseif extra[k] then o[k]= v
         --..
         elseif k==1 then error( "unkeyed option: ".. tostring(v), lev )
         else error( "Bad option: ".. tostring(k), lev )
         end
     end
+    return libs, o
+end
+
+function gen( ... )
+    local n= select('#',...)
+    
+    if n==0 then
+        error( "No parameters!" )
+    end
+
+    local func= select(n,...)
+    local functype = type(func)
+    if functype ~= "function" and functype ~= "string" then
+        error( "Last parameter not function or string: "..tostring(func))
+    end
+
+    local libs, o= lane_options( {}, n-1, ... )
+    local prio, cs, g_tbl, packagepath, packagecpath, memlimit= o.prio, o.cs, o.g_tbl, o.packagepath, o.packagecpath, o.memlimit
 
     -- Lane generator
     --
     return function(...)
-              return thread_new( func, libs, cs, prio, g_tbl, packagepath, packagecpath, ...)     -- args
+              return thread_new( func, libs, cs, prio, g_tbl, packagepath, packagecpath, memlimit, ...)     -- args
            end
 end
 
+-----
+-- lanes.pool( [libs_str|opt_tbl [, ...]] ) -> pool_ud
+--
+-- A fixed set of worker threads, each with a Lua state prepared once with
+-- 'libs' and 'opt' (as for 'lanes.gen'), reused for one lane after the other.
+-- Lanes are queued on the pool instead of getting their own thread and
+-- state, which is much cheaper for short tasks. Globals set by a lane remain
+-- for the following lanes of the same worker.
+--
+-- 'opt': .size:  number of workers (default: number of processors)
+--
+-- pool_ud:submit( lane_func, [...] ) -> h
+--
+--      Queues 'lane_func(...)', 'h' being a lane handle as returned by a
+--      generator. Canceling a lane that is still queued removes it from the
+--      queue; 'force_kill' does not apply to pooled lanes.
+--
+-- pool_ud:size() -> int
+--
+-- pool_ud:parallel_for( n, [chunk,] func, [...] )
+--
+--      Calls 'func( i, j, ...)' for chunks [i..j] covering 1..n, on the
+--      calling lane and the workers, and returns once they are all done.
+--      Each of them takes chunks from its own share and steals from the
+--      others when it runs out. Give buffers as '...' to work on shared data.
+--
+-- pool_ud:map( func, in_buf, out_buf [, chunk] )
+--
+--      out_buf[i]= func( in_buf[i], i ) for all elements of in_buf
+--
+-- pool_ud:reduce( func, buf [, chunk] ) -> number|nil
+--
+--      Folds buf with 'func( a, b )', which must be associative; nil if
+--      buf is empty
+--
+--      After an error in a chunk, the remaining chunks are skipped and the
+--      error is raised (as a string) by the three of them.
+--
+-- The pool is deep userdata, so lanes can queue lanes on it too. Once
+-- nothing refers to it anymore, its lanes are cancelled (queued ones right
+-- away, running ones as by 'h:cancel()' with a cancel step of 1) and the
+-- workers leave. Closing the state that first required Lanes waits for
+-- them, so a lane blocked in a C call holds it up.
+--
+local pool_new = assert(mm.pool_new)
+
+function pool( ... )
+    local libs, o= lane_options( { size= true }, select('#',...), ... )
+    if o.size~=nil and (type(o.size)~="number" or o.size<1) then
+        error( "Bad size: "..tostring(o.size), 2 )
+    end
+    return pool_new( libs, o.cs, o.prio, o.g_tbl, o.packagepath, o.packagecpath, o.memlimit, o.size )
+end
+
 ---=== Lindas ===---
 
 -- We let the C code attach methods to userdata directly
 
 -----
--- lanes.linda() -> linda_ud
+-- lanes.linda( [keeper_uint] ) -> linda_ud
+--
+-- Values a Linda cannot hold natively are parked in a keeper state, picked
+-- by hashing unless 'keeper_uint' pins the Linda to that one (see
+-- set_keepers). linda:stats( [reset_bool] ) returns its lock contention,
+-- blocked senders/receivers and queue depths.
 --
 linda = mm.linda
 
+-----
+-- lanes.buffer( "byte"|"int"|"float"|"double", n | tbl ) -> buffer_ud
+--
+-- Typed array of 'n' zeroes (a whole number up to INT_MAX), or of the
+-- numbers of 'tbl', shared by reference with the lanes it is sent to:
+-- buf[i], buf[i]= v, #buf, buf:type(), buf:fill( v [, i [, j]] ),
+-- buf:totable( [i [, j]] ), buf:pointer( [i] )
+--
+buffer = mm.buffer
+
+-----
+-- lanes.blob( str | buffer_ud [, i [, j]] | blob_ud [, i [, j]] ) -> blob_ud
+--
+-- Immutable bytes, shared by reference like buffers. Made from a string
+-- or buffer elements i..j (copied once), or as a slice of another blob: blob[i], #blob, blob:sub( i [, j] ),
+-- blob:string( [i [, j]] ), blob:byte( [i [, j]] ), blob:pointer( [i] )
+--
+blob = mm.blob
+
 
 ---=== Timers ===---
 local want_timers = true
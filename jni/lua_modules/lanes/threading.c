@@ -156,6 +156,29 @@ time_d now_secs(void) {
 #endif
 }
 
+/*
+* Seconds from an arbitrary origin, at the best resolution available, for
+* timing short intervals ('now_secs()' goes by milliseconds)
+*/
+double clock_secs(void) {
+#if (defined PLATFORM_WIN32) || (defined PLATFORM_POCKETPC)
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER c;
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency( &freq );
+    QueryPerformanceCounter( &c );
+    return (double) c.QuadPart / (double) freq.QuadPart;
+#elif (defined CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ((double)ts.tv_sec) + ts.tv_nsec / 1e9;
+#else
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    return ((double)tv.tv_sec) + tv.tv_usec / 1e6;
+#endif
+}
+
 
 /*
 */
@@ -241,6 +264,12 @@ static void prepare_timeout( struct timespec *ts, time_d abs_secs ) {
     DWORD rc= WaitForSingleObject(*ref,INFINITE);
     if (rc!=0) FAIL( "WaitForSingleObject", rc==WAIT_FAILED ? GetLastError() : rc );
   }
+  bool_t MUTEX_TRYLOCK( MUTEX_T *ref ) {
+    DWORD rc= WaitForSingleObject(*ref,0);
+    if (rc==WAIT_TIMEOUT) return FALSE;
+    if (rc!=0) FAIL( "WaitForSingleObject", rc==WAIT_FAILED ? GetLastError() : rc );
+    return TRUE;
+  }
   void MUTEX_UNLOCK( MUTEX_T *ref ) {
     if (!ReleaseMutex(*ref))
         FAIL( "ReleaseMutex", GetLastError() );
@@ -724,5 +753,3 @@ static void prepare_timeout( struct timespec *ts, time_d abs_secs ) {
     pthread_cancel( *ref );
   }
 #endif
-
-static const lua_Alloc alloc_f= 0;
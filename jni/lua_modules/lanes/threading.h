@@ -67,6 +67,7 @@ enum e_status { PENDING, RUNNING, WAITING, DONE, ERROR_ST, CANCELLED };
   #define MUTEX_RECURSIVE_INIT(ref)  MUTEX_INIT(ref)  /* always recursive in Win32 */
   void MUTEX_FREE( MUTEX_T *ref );
   void MUTEX_LOCK( MUTEX_T *ref );
+  bool_t MUTEX_TRYLOCK( MUTEX_T *ref );
   void MUTEX_UNLOCK( MUTEX_T *ref );
 
   typedef unsigned THREAD_RETURN_T;
@@ -95,6 +96,7 @@ enum e_status { PENDING, RUNNING, WAITING, DONE, ERROR_ST, CANCELLED };
       }
   #define MUTEX_FREE(ref)    pthread_mutex_destroy(ref)
   #define MUTEX_LOCK(ref)    pthread_mutex_lock(ref)
+  #define MUTEX_TRYLOCK(ref) (pthread_mutex_trylock(ref) == 0)
   #define MUTEX_UNLOCK(ref)  pthread_mutex_unlock(ref)
 
   typedef void * THREAD_RETURN_T;
@@ -128,6 +130,7 @@ void SIGNAL_ALL( SIGNAL_T *ref );
 */
 typedef double time_d;
 time_d now_secs(void);
+double clock_secs(void);
 
 time_d SIGNAL_TIMEOUT_PREPARE( double rel_secs );
 
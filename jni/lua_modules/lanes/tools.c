@@ -592,6 +592,65 @@ void *luaG_todeep( lua_State *L, luaG_IdFunction idfunc, int index )
 }
 
 
+/*
+* Deep userdata held outside of any Lua state (encoded Linda values)
+*
+* 'luaG_deep_prelude()' gives the id function and prelude of the deep
+* userdata at 'index', or NULL if it is not one. Each 'luaG_deep_ref()'
+* must be matched by a 'luaG_deep_unref()', which cleans up as the last
+* proxy would. 'luaG_push_proxy()' makes a proxy for it again.
+*/
+luaG_IdFunction luaG_deep_prelude( lua_State *L, int index, DEEP_PRELUDE **prelude )
+{
+    luaG_IdFunction idfunc= get_idfunc( L, index );
+    if (idfunc)
+        *prelude= *(DEEP_PRELUDE**)lua_touserdata( L, index );
+    return idfunc;
+}
+
+void luaG_deep_ref( DEEP_PRELUDE *prelude )
+{
+    MUTEX_LOCK( &deep_lock );
+    ++(prelude->refcount);
+    MUTEX_UNLOCK( &deep_lock );
+}
+
+struct s_DeepDelete
+{
+    luaG_IdFunction idfunc;
+    DEEP_PRELUDE *prelude;
+};
+
+// 'idfunc( "delete", deep_ptr )' needs a clean stack, as in 'deep_userdata_gc()'
+static int deep_delete( lua_State *L )
+{
+    struct s_DeepDelete *d= (struct s_DeepDelete*)lua_touserdata( L, 1 );
+    lua_settop( L, 0 );
+    lua_pushlightuserdata( L, d->prelude->deep );
+    d->idfunc( L, "delete" );
+    return 0;
+}
+
+void luaG_deep_unref( lua_State *L, luaG_IdFunction idfunc, DEEP_PRELUDE *prelude )
+{
+    int v;
+
+    MUTEX_LOCK( &deep_lock );
+    v= --(prelude->refcount);
+    MUTEX_UNLOCK( &deep_lock );
+
+    if (v==0)
+    {
+        struct s_DeepDelete d;
+        d.idfunc= idfunc;
+        d.prelude= prelude;
+        if (lua_cpcall( L, deep_delete, &d ) != 0)
+            lua_pop( L, 1 );    // error message
+        DEEP_FREE( (void*)prelude );
+    }
+}
+
+
 /*
 * Copy deep userdata between two separate Lua states.
 *
@@ -742,6 +801,124 @@ static int buf_writer( lua_State *L, const void* b, size_t n, void* B ) {
 }
 
 
+/*
+* Functions are copied as bytecode. Both ends cache it, so that sending the
+* same function again (lane body, callback) does not dump nor parse it:
+*
+*   source:      weak keyed table, function -> dumped bytecode
+*   destination: bytecode -> function loaded from it, whose prototype is
+*                shared by the copies (see 'lua_clonefunction()')
+*
+* The destination cache is emptied once it holds FUNC_PROTO_CACHE_MAX
+* functions, so long lived states (keepers, pool workers) stay bounded.
+*/
+#define FUNC_DUMP_CACHE_KEY ((void*)buf_writer)
+#define FUNC_PROTO_CACHE_KEY ((void*)push_func_proto)
+
+#ifndef FUNC_PROTO_CACHE_MAX
+#define FUNC_PROTO_CACHE_MAX 64
+#endif
+
+/*
+* Replace the Lua function at [-1] with its bytecode
+*/
+static void dump_func( lua_State *L ) {
+    STACK_GROW(L,3);
+
+  STACK_CHECK(L)
+    push_registry_subtable_mode( L, FUNC_DUMP_CACHE_KEY, "k" );
+    lua_pushvalue( L, -2 );
+    lua_rawget( L, -2 );
+        //
+        // [-3]: function
+        // [-2]: dump cache
+        // [-1]: nil/dumped string
+
+    if (lua_isnil(L,-1)) {
+        luaL_Buffer b;
+        int tmp;
+
+        // 'lua_dump()' needs the function at top of stack
+        //
+        lua_pushvalue( L, -3 );
+        luaL_buffinit(L,&b);
+        tmp= lua_dump(L, buf_writer, &b);
+        ASSERT_L(tmp==0);
+            //
+            // "value returned is the error code returned by the last call 
+            // to the writer" (and we only return 0)
+
+        luaL_pushresult(&b);    // pushes dumped string on 'L'
+        lua_replace( L, -3 );   // over the nil
+        lua_pop( L, 1 );
+
+        lua_pushvalue( L, -3 );
+        lua_pushvalue( L, -2 );
+        lua_rawset( L, -4 );    // cache[function]= dumped string
+    }
+    lua_replace( L, -3 );
+    lua_pop( L, 1 );
+  STACK_END(L,0)
+}
+
+/*
+* Push a function of bytecode 's' (size 'sz') to 'L2', with nil upvalues.
+* 'L' gets the error if the bytecode does not load.
+*/
+static void push_func_proto( lua_State *L2, lua_State *L, const char *s, size_t sz, const char *name ) {
+    STACK_GROW(L2,4);
+
+  STACK_CHECK(L2)
+    push_registry_subtable( L2, FUNC_PROTO_CACHE_KEY );
+    lua_pushlstring( L2, s, sz );
+    lua_pushvalue( L2, -1 );
+    lua_rawget( L2, -3 );
+        //
+        // [-3]: proto cache
+        // [-2]: dumped string
+        // [-1]: nil/function
+
+    if (lua_isnil(L2,-1)) {
+        int n;
+
+        lua_pop( L2, 1 );
+        if (luaL_loadbuffer(L2, s, sz, name) != 0) {
+            // chunk is precompiled so only LUA_ERRMEM can happen
+            // "Otherwise, it pushes an error message"
+            //
+            STACK_GROW( L,1 );
+            luaL_error( L, "%s", lua_tostring(L2,-1) );
+        }
+
+        lua_pushlightuserdata( L2, FUNC_PROTO_CACHE_KEY );
+        lua_rawget( L2, -4 );
+        n= (int) lua_tointeger( L2, -1 );
+        lua_pop( L2, 1 );
+        if (n >= FUNC_PROTO_CACHE_MAX) {
+            lua_newtable( L2 );
+            lua_pushlightuserdata( L2, FUNC_PROTO_CACHE_KEY );
+            lua_pushvalue( L2, -2 );
+            lua_rawset( L2, LUA_REGISTRYINDEX );
+            lua_replace( L2, -4 );
+            n= 0;
+        }
+        lua_pushvalue( L2, -2 );
+        lua_pushvalue( L2, -2 );
+        lua_rawset( L2, -5 );   // cache[dumped string]= function
+        lua_pushlightuserdata( L2, FUNC_PROTO_CACHE_KEY );
+        lua_pushinteger( L2, n+1 );
+        lua_rawset( L2, -5 );
+    }
+
+    // the cached function keeps nil upvalues; hand out a new closure
+    //
+    lua_clonefunction( L2, -1 );
+    lua_replace( L2, -4 );
+    lua_pop( L2, 2 );
+  STACK_END(L2,1)
+}
+
+
 /* 
  * Check if we've already copied the same table from 'L', and
  * reuse the old copy. This allows table upvalues shared by multiple
@@ -909,10 +1086,8 @@ static void inter_copy_func( lua_State *L2, uint_t L2_cache_i, lua_State *L, uin
 
   STACK_CHECK(L)
     if (!cfunc) {   // Lua function
-        luaL_Buffer b;
         const char *s;
         size_t sz;
-        int tmp;
         const char *name= NULL;
 
 #if 0
@@ -927,36 +1102,18 @@ static void inter_copy_func( lua_State *L2, uint_t L2_cache_i, lua_State *L, uin
         fprintf( stderr, "NAME: %s\n", name );  // just gives NULL
         }
 #endif 
-        // 'lua_dump()' needs the function at top of stack
-        //
-        if (i!=-1) lua_pushvalue( L, i );
-
-        luaL_buffinit(L,&b);
-        tmp= lua_dump(L, buf_writer, &b);
-        ASSERT_L(tmp==0);
-            //
-            // "value returned is the error code returned by the last call 
-            // to the writer" (and we only return 0)
-
-        luaL_pushresult(&b);    // pushes dumped string on 'L'
+        lua_pushvalue( L, i );
+        dump_func( L );         // pushes dumped string on 'L'
         s= lua_tolstring(L,-1,&sz);
         ASSERT_L( s && sz );
 
-        if (i!=-1) lua_remove( L, -2 );
-
         // Note: Line numbers seem to be taken precisely from the 
         //       original function. 'name' is not used since the chunk
         //       is precompiled (it seems...). 
         //
         // TBD: Can we get the function's original name through, as well?
         //
-        if (luaL_loadbuffer(L2, s, sz, name) != 0) {
-            // chunk is precompiled so only LUA_ERRMEM can happen
-            // "Otherwise, it pushes an error message"
-            //
-            STACK_GROW( L,1 );
-            luaL_error( L, "%s", lua_tostring(L2,-1) );
-        }
+        push_func_proto( L2, L, s, sz, name );
         lua_pop(L,1);   // remove the dumped string
   STACK_MID(L,0)
     }
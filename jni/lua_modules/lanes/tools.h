@@ -63,6 +63,9 @@ typedef struct {
 } DEEP_PRELUDE;
 
 void luaG_push_proxy( lua_State *L, luaG_IdFunction idfunc, DEEP_PRELUDE *deep_userdata );
+luaG_IdFunction luaG_deep_prelude( lua_State *L, int index, DEEP_PRELUDE **prelude );
+void luaG_deep_ref( DEEP_PRELUDE *prelude );
+void luaG_deep_unref( lua_State *L, luaG_IdFunction idfunc, DEEP_PRELUDE *prelude );
 
 int luaG_inter_copy( lua_State *L, lua_State *L2, uint_t n);
 int luaG_inter_move( lua_State *L, lua_State *L2, uint_t n);
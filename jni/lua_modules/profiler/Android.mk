@@ -0,0 +1,9 @@
+LOCAL_PATH := $(call my-dir)
+
+# profiler module sampling Lua stacks from the debug hook
+include $(CLEAR_VARS)
+LOCAL_MODULE := profiler
+LOCAL_SRC_FILES := luaprofiler.cpp
+LOCAL_LDLIBS := -llog
+LOCAL_SHARED_LIBRARIES := lua-activity
+include $(BUILD_SHARED_LIBRARY)
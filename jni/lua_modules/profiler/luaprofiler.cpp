@@ -0,0 +1,682 @@
+/*
+  Lua module with a sampling profiler built on the debug hook
+
+  start() installs a count hook on the calling state. In count mode a
+  sample is taken every count VM instructions; in timer mode a SIGPROF
+  interval timer only bumps a tick and the count hook samples when it
+  sees a new tick, so the signal handler never touches a Lua state.
+  Any previous hook (e.g. the Lanes cancel hook) is chained.
+
+  Samples from every state that loaded the module (main state and
+  Lanes) are aggregated natively under one lock into collapsed stacks,
+  self time per function and per line, plus a bounded ring of recent
+  samples for the Chrome trace export. Nothing is allocated in the
+  sampled state, so the profiler does not skew its GC or memory limit.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <android/log.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+  #include "lua.h"
+  #include "lauxlib.h"
+#ifdef __cplusplus
+}
+#endif
+
+#include "profiletable.h"
+#include "luaprofiler.h"
+
+#ifndef LOG_TAG
+#define LOG_TAG "lua"
+#endif
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO,LOG_TAG,__VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN,LOG_TAG,__VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR,LOG_TAG,__VA_ARGS__)
+
+#define MT_NAME "PROFILER_MT"
+
+#define PROFILER_DEFAULT_COUNT 1000
+#define PROFILER_MAX_DEPTH 64
+#define PROFILER_STACK_LEN 4096
+#define PROFILER_FRAME_LEN 256
+#define PROFILER_MAX_STACKS 8192
+#define PROFILER_MAX_KEYS 4096
+#define PROFILER_MAX_THREADS 256
+#define PROFILER_MAX_SAMPLES 65536
+
+typedef struct {
+  long long ts;  // usec since first sample
+  int tid;
+  int stack;
+} ProfileSample;
+
+// Per Lua state, kept as userdata in the registry
+typedef struct {
+  lua_Hook prevHook;
+  int prevMask;
+  int prevCount;
+  int count;
+  int interval;  // usec, 0 = count mode
+  int lastTick;
+  int tid;
+  int running;
+} ProfileState;
+
+class Profiler {
+public:
+  ProfileTable stacks;
+  ProfileTable functions;
+  ProfileTable lines;
+  ProfileTable threads;  // state name -> tid
+
+  ProfileSample *sample;  // ring of the last PROFILER_MAX_SAMPLES
+  long nSample;
+  long long t0;
+
+  int nTimer;  // states in timer mode
+  int nState;  // states started, for default names
+  struct sigaction oldAction;
+  pthread_mutex_t lock;
+
+  Profiler(): stacks(PROFILER_MAX_STACKS), functions(PROFILER_MAX_KEYS),
+	      lines(PROFILER_MAX_KEYS), threads(PROFILER_MAX_THREADS),
+	      sample(NULL), nSample(0), t0(-1), nTimer(0), nState(0) {
+    pthread_mutex_init(&lock, NULL);
+  }
+
+  virtual ~Profiler() {
+    free(sample);
+    pthread_mutex_destroy(&lock);
+  }
+
+  // Only call with lock held
+  void reset() {
+    stacks.clear();
+    functions.clear();
+    lines.clear();
+    nSample = 0;
+    t0 = -1;
+  }
+};
+
+static Profiler gProfiler;
+static volatile sig_atomic_t gTick;
+static char profiler_key;
+
+static long long profiler_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+/*
+ * SIGPROF timer
+ */
+
+static void profiler_signal(int sig) {
+  (void)sig;
+  gTick++;
+}
+
+static bool profiler_timer_start(int interval) {
+  bool ok = true;
+  pthread_mutex_lock(&gProfiler.lock);
+  if (gProfiler.nTimer == 0) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = profiler_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    struct itimerval it;
+    it.it_interval.tv_sec = interval/1000000;
+    it.it_interval.tv_usec = interval%1000000;
+    it.it_value = it.it_interval;
+    if (sigaction(SIGPROF, &sa, &gProfiler.oldAction) != 0) {
+      ok = false;
+    }
+    else if (setitimer(ITIMER_PROF, &it, NULL) != 0) {
+      sigaction(SIGPROF, &gProfiler.oldAction, NULL);
+      ok = false;
+    }
+  }
+  // A running timer keeps the interval it was started with
+  if (ok) gProfiler.nTimer++;
+  pthread_mutex_unlock(&gProfiler.lock);
+  return ok;
+}
+
+static void profiler_timer_stop() {
+  pthread_mutex_lock(&gProfiler.lock);
+  if ((gProfiler.nTimer > 0) && (--gProfiler.nTimer == 0)) {
+    struct itimerval it;
+    memset(&it, 0, sizeof(it));
+    setitimer(ITIMER_PROF, &it, NULL);
+    sigaction(SIGPROF, &gProfiler.oldAction, NULL);
+  }
+  pthread_mutex_unlock(&gProfiler.lock);
+}
+
+/*
+ * Sampling
+ */
+
+static ProfileState* profiler_getstate(lua_State *L) {
+  lua_pushlightuserdata(L, &profiler_key);
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  ProfileState *ps = (ProfileState *)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  return ps;
+}
+
+// Frame separators and JSON specials are replaced so keys need no escaping
+static int profiler_frame(lua_Debug *ar, char *buf, int size) {
+  const char *name = ar->name ? ar->name : "?";
+  int n;
+  if (*ar->what == 'C') {
+    n = snprintf(buf, size, "%s [C]", name);
+  }
+  else if (*ar->what == 'm') {
+    n = snprintf(buf, size, "main@%s", ar->short_src);
+  }
+  else {
+    n = snprintf(buf, size, "%s@%s:%d", name, ar->short_src, ar->linedefined);
+  }
+  if (n >= size) n = size - 1;
+  for (int i = 0; i < n; i++) {
+    if ((buf[i] == ';') || (buf[i] == '"') || (buf[i] == '\\') ||
+	((unsigned char)buf[i] < ' ')) {
+      buf[i] = '_';
+    }
+  }
+  return n;
+}
+
+static void profiler_sample(lua_State *L, ProfileState *ps) {
+  lua_Debug ar;
+  char stack[PROFILER_STACK_LEN];
+  char top[PROFILER_FRAME_LEN];
+  char line[PROFILER_FRAME_LEN];
+  int depth = 0;
+
+  // Count hooks only fire in Lua functions, so level 0 always has a line
+  while ((depth < PROFILER_MAX_DEPTH) && lua_getstack(L, depth, &ar)) depth++;
+  if (depth == 0) return;
+
+  // Collapsed stacks list the outermost frame first
+  int len = 0;
+  if (lua_getstack(L, PROFILER_MAX_DEPTH, &ar)) {
+    len = snprintf(stack, sizeof(stack), "...");
+  }
+  for (int level = depth - 1; level >= 0; level--) {
+    lua_getstack(L, level, &ar);
+    lua_getinfo(L, "Sln", &ar);
+    int room = (int)sizeof(stack) - len - 1;
+    if (room < 2) break;
+    if (len > 0) stack[len++] = ';';
+    len += profiler_frame(&ar, stack + len, room);
+    if (level == 0) {
+      profiler_frame(&ar, top, sizeof(top));
+      snprintf(line, sizeof(line), "%s:%d", ar.short_src, ar.currentline);
+    }
+  }
+  stack[len] = '\0';
+
+  long long now = profiler_now();
+  pthread_mutex_lock(&gProfiler.lock);
+  if (gProfiler.t0 < 0) gProfiler.t0 = now;
+  int id = gProfiler.stacks.add(stack, len, 1);
+  gProfiler.functions.add(top, strlen(top), 1);
+  gProfiler.lines.add(line, strlen(line), 1);
+  if (gProfiler.sample == NULL) {
+    gProfiler.sample = (ProfileSample *)malloc(PROFILER_MAX_SAMPLES *
+					       sizeof(ProfileSample));
+  }
+  if (gProfiler.sample && (id >= 0)) {
+    ProfileSample *s = gProfiler.sample +
+      (gProfiler.nSample % PROFILER_MAX_SAMPLES);
+    s->ts = now - gProfiler.t0;
+    s->tid = ps->tid;
+    s->stack = id;
+    gProfiler.nSample++;
+  }
+  pthread_mutex_unlock(&gProfiler.lock);
+}
+
+static void profiler_hook(lua_State *L, lua_Debug *ar) {
+  ProfileState *ps = profiler_getstate(L);
+  if (ps == NULL) return;
+
+  if (ps->running && (ar->event == LUA_HOOKCOUNT)) {
+    if (ps->interval == 0) {
+      profiler_sample(L, ps);
+    }
+    else {
+      int tick = gTick;
+      if (tick != ps->lastTick) {
+	ps->lastTick = tick;
+	profiler_sample(L, ps);
+      }
+    }
+  }
+
+  // Previous hook runs last as it may raise (Lanes cancellation)
+  if (ps->prevHook) {
+    int event = (ar->event == LUA_HOOKTAILRET) ? LUA_HOOKRET : ar->event;
+    if (ps->prevMask & (1 << event)) ps->prevHook(L, ar);
+  }
+}
+
+/*
+ * Output
+ */
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t size;
+  bool ok;
+} ProfileBuffer;
+
+static void profiler_printf(ProfileBuffer *b, const char *fmt, ...) {
+  if (!b->ok) return;
+  for (;;) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(b->data + b->len, b->size - b->len, fmt, args);
+    va_end(args);
+    if (n < 0) {
+      b->ok = false;
+      return;
+    }
+    if (b->len + n < b->size) {
+      b->len += n;
+      return;
+    }
+    size_t size = (b->size + n + 1)*2;
+    char *p = (char *)realloc(b->data, size);
+    if (p == NULL) {
+      b->ok = false;
+      return;
+    }
+    b->data = p;
+    b->size = size;
+  }
+}
+
+static int profiler_compare(const void *a, const void *b) {
+  long ca = (*(ProfileEntry * const *)a)->count;
+  long cb = (*(ProfileEntry * const *)b)->count;
+  return (ca < cb) ? 1 : ((ca > cb) ? -1 : 0);
+}
+
+// Entries by descending count; caller frees, NULL if out of memory
+static ProfileEntry** profiler_sorted(ProfileTable *t) {
+  ProfileEntry **e = (ProfileEntry **)malloc((t->nEntry + 1) *
+					     sizeof(ProfileEntry *));
+  if (e == NULL) return NULL;
+  memcpy(e, t->entry, t->nEntry*sizeof(ProfileEntry *));
+  qsort(e, t->nEntry, sizeof(ProfileEntry *), profiler_compare);
+  return e;
+}
+
+static void profiler_collapsed(ProfileBuffer *b) {
+  ProfileTable *t = &gProfiler.stacks;
+  for (int i = 0; i < t->nEntry; i++) {
+    profiler_printf(b, "%s %ld\n", t->entry[i]->key, t->entry[i]->count);
+  }
+}
+
+static void profiler_histogram(ProfileBuffer *b, ProfileTable *t) {
+  ProfileEntry **e = profiler_sorted(t);
+  if (e == NULL) {
+    b->ok = false;
+    return;
+  }
+  for (int i = 0; i < t->nEntry; i++) {
+    profiler_printf(b, "%8ld %5.1f%% %s\n", e[i]->count,
+		    100.0*e[i]->count/t->total, e[i]->key);
+  }
+  free(e);
+}
+
+// Number of leading frames two collapsed stacks have in common
+static int profiler_common(const char *a, const char *b) {
+  int n = 0;
+  for (;;) {
+    if ((*a == '\0') || (*a == ';')) {
+      if ((*b == '\0') || (*b == ';')) n++;
+      if ((*a == '\0') || (*b != ';')) return n;
+    }
+    else if (*a != *b) {
+      return n;
+    }
+    a++;
+    b++;
+  }
+}
+
+static const char* profiler_skip(const char *s, int n) {
+  while (n > 0) {
+    s = strchr(s, ';');
+    if (s == NULL) return NULL;
+    s++;
+    n--;
+  }
+  return s;
+}
+
+static void profiler_event(ProfileBuffer *b, const char *frame, char ph,
+			   long long ts, int tid) {
+  int len = (int)strcspn(frame, ";");
+  profiler_printf(b, ",\n{\"name\":\"%.*s\",\"ph\":\"%c\","
+		  "\"ts\":%lld,\"pid\":1,\"tid\":%d}", len, frame, ph, ts, tid);
+}
+
+static int profiler_depth(const char *s) {
+  int n = 1;
+  while ((s = strchr(s, ';')) != NULL) {
+    s++;
+    n++;
+  }
+  return n;
+}
+
+// Closes frames of prev down to depth keep, innermost first
+static void profiler_close(ProfileBuffer *b, const char *prev, int keep,
+			   long long ts, int tid) {
+  for (int d = profiler_depth(prev) - 1; d >= keep; d--) {
+    profiler_event(b, profiler_skip(prev, d), 'E', ts, tid);
+  }
+}
+
+// Trace Event Format: consecutive samples of a state become B/E pairs
+static void profiler_chrome(ProfileBuffer *b) {
+  ProfileTable *t = &gProfiler.threads;
+  int *last = (int *)malloc((t->nEntry + 1)*sizeof(int));
+  long long *lastTs = (long long *)malloc((t->nEntry + 1)*sizeof(long long));
+  if ((last == NULL) || (lastTs == NULL)) {
+    free(last);
+    free(lastTs);
+    b->ok = false;
+    return;
+  }
+
+  profiler_printf(b, "{\"traceEvents\":[\n"
+		  "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+		  "\"args\":{\"name\":\"lua\"}}");
+  for (int i = 0; i < t->nEntry; i++) {
+    profiler_printf(b, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+		    "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+		    i, t->entry[i]->key);
+    last[i] = -1;
+    lastTs[i] = 0;
+  }
+
+  long n = gProfiler.nSample;
+  long first = (n > PROFILER_MAX_SAMPLES) ? n - PROFILER_MAX_SAMPLES : 0;
+  for (long i = first; (i < n) && gProfiler.sample; i++) {
+    ProfileSample *s = gProfiler.sample + (i % PROFILER_MAX_SAMPLES);
+    if ((s->tid < 0) || (s->tid >= t->nEntry)) continue;
+    const char *cur = gProfiler.stacks.get(s->stack)->key;
+    int keep = 0;
+    if (last[s->tid] >= 0) {
+      const char *prev = gProfiler.stacks.get(last[s->tid])->key;
+      keep = profiler_common(prev, cur);
+      profiler_close(b, prev, keep, s->ts, s->tid);
+    }
+    for (const char *f = profiler_skip(cur, keep); f; f = profiler_skip(f, 1)) {
+      profiler_event(b, f, 'B', s->ts, s->tid);
+    }
+    last[s->tid] = s->stack;
+    lastTs[s->tid] = s->ts;
+  }
+
+  for (int i = 0; i < t->nEntry; i++) {
+    if (last[i] >= 0) {
+      profiler_close(b, gProfiler.stacks.get(last[i])->key, 0,
+		     lastTs[i] + 1, i);
+    }
+  }
+  profiler_printf(b, "\n],\"displayTimeUnit\":\"ms\"}\n");
+  free(last);
+  free(lastTs);
+}
+
+/*
+ * Lua functions
+ */
+
+static int lua_profiler_state_gc(lua_State *L) {
+  ProfileState *ps = (ProfileState *)lua_touserdata(L, 1);
+  if (ps->running && ps->interval) profiler_timer_stop();
+  ps->running = 0;
+  return 0;
+}
+
+// start([count, interval, name]) - interval in ms, 0 samples every count
+static int lua_profiler_start(lua_State *L) {
+  int count = luaL_optint(L, 1, PROFILER_DEFAULT_COUNT);
+  lua_Number interval = luaL_optnumber(L, 2, 0);
+  const char *name = luaL_optstring(L, 3, NULL);
+  luaL_argcheck(L, count > 0, 1, "count must be positive");
+  luaL_argcheck(L, interval >= 0, 2, "interval must not be negative");
+
+  ProfileState *ps = profiler_getstate(L);
+  if (ps == NULL) {
+    ps = (ProfileState *)lua_newuserdata(L, sizeof(ProfileState));
+    memset(ps, 0, sizeof(ProfileState));
+    ps->tid = -1;
+    luaL_getmetatable(L, MT_NAME);
+    lua_setmetatable(L, -2);
+    lua_pushlightuserdata(L, &profiler_key);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+    lua_pop(L, 1);
+  }
+  if (ps->running) {
+    lua_pushboolean(L, 0);
+    lua_pushliteral(L, "profiler already running");
+    return 2;
+  }
+
+  pthread_mutex_lock(&gProfiler.lock);
+  char buf[32];
+  if (name == NULL) {
+    if (ps->tid >= 0) {
+      name = gProfiler.threads.get(ps->tid)->key;
+    }
+    else {
+      snprintf(buf, sizeof(buf), "lua %d", ++gProfiler.nState);
+      name = buf;
+    }
+  }
+  ps->tid = gProfiler.threads.add(name, strlen(name), 0);
+  pthread_mutex_unlock(&gProfiler.lock);
+
+  ps->count = count;
+  ps->interval = (int)(interval*1000);
+  if ((interval > 0) && (ps->interval == 0)) ps->interval = 1;
+  if (ps->interval && !profiler_timer_start(ps->interval)) {
+    lua_pushboolean(L, 0);
+    lua_pushliteral(L, "cannot start profiling timer");
+    return 2;
+  }
+
+  if (lua_gethook(L) != profiler_hook) {
+    ps->prevHook = lua_gethook(L);
+    ps->prevMask = lua_gethookmask(L);
+    ps->prevCount = lua_gethookcount(L);
+  }
+  ps->lastTick = gTick;
+  ps->running = 1;
+  lua_sethook(L, profiler_hook, ps->prevMask | LUA_MASKCOUNT, count);
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+static int lua_profiler_stop(lua_State *L) {
+  ProfileState *ps = profiler_getstate(L);
+  if ((ps == NULL) || !ps->running) return 0;
+  if (ps->interval) profiler_timer_stop();
+  ps->running = 0;
+  if (lua_gethook(L) == profiler_hook) {
+    lua_sethook(L, ps->prevHook, ps->prevMask, ps->prevCount);
+  }
+  ps->prevHook = NULL;
+  ps->prevMask = ps->prevCount = 0;
+  return 0;
+}
+
+static int lua_profiler_reset(lua_State *L) {
+  (void)L;
+  pthread_mutex_lock(&gProfiler.lock);
+  gProfiler.reset();
+  pthread_mutex_unlock(&gProfiler.lock);
+  return 0;
+}
+
+// dump(format [, filename]) - format is collapsed, chrome, functions or lines
+static int lua_profiler_dump(lua_State *L) {
+  static const char *const formats[] = {
+    "collapsed", "chrome", "functions", "lines", NULL
+  };
+  int format = luaL_checkoption(L, 1, "collapsed", formats);
+  const char *filename = luaL_optstring(L, 2, NULL);
+
+  ProfileBuffer b = {NULL, 0, 0, true};
+  // Output is built outside the Lua heap so no error is raised with lock held
+  pthread_mutex_lock(&gProfiler.lock);
+  switch (format) {
+  case 0: profiler_collapsed(&b); break;
+  case 1: profiler_chrome(&b); break;
+  case 2: profiler_histogram(&b, &gProfiler.functions); break;
+  case 3: profiler_histogram(&b, &gProfiler.lines); break;
+  }
+  pthread_mutex_unlock(&gProfiler.lock);
+
+  if (!b.ok) {
+    free(b.data);
+    return luaL_error(L, "not enough memory for profile");
+  }
+  if (filename == NULL) {
+    lua_pushlstring(L, b.data ? b.data : "", b.len);
+    free(b.data);
+    return 1;
+  }
+
+  FILE *f = fopen(filename, "wb");
+  bool ok = (f != NULL) && (fwrite(b.data, 1, b.len, f) == b.len);
+  if (f && (fclose(f) != 0)) ok = false;
+  free(b.data);
+  if (!ok) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "cannot write %s", filename);
+    return 2;
+  }
+  LOGI("profile written to %s", filename);
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+// histogram([kind, n]) -> {{name, count}, ...} by descending count
+static int lua_profiler_histogram(lua_State *L) {
+  static const char *const kinds[] = {"functions", "lines", "stacks", NULL};
+  int kind = luaL_checkoption(L, 1, "functions", kinds);
+  int n = luaL_optint(L, 2, 20);
+  ProfileTable *t = (kind == 0) ? &gProfiler.functions :
+    ((kind == 1) ? &gProfiler.lines : &gProfiler.stacks);
+
+  // Copy the top entries out so the table is built without the lock held
+  pthread_mutex_lock(&gProfiler.lock);
+  ProfileEntry **e = profiler_sorted(t);
+  if (e && (n > t->nEntry)) n = t->nEntry;
+  ProfileBuffer b = {NULL, 0, 0, true};
+  long *count = e ? (long *)malloc((n + 1)*sizeof(long)) : NULL;
+  for (int i = 0; count && (i < n); i++) {
+    count[i] = e[i]->count;
+    profiler_printf(&b, "%s%c", e[i]->key, '\0');
+  }
+  pthread_mutex_unlock(&gProfiler.lock);
+  free(e);
+  if ((count == NULL) || !b.ok) {
+    free(count);
+    free(b.data);
+    return luaL_error(L, "not enough memory for profile");
+  }
+
+  lua_createtable(L, n, 0);
+  const char *key = b.data;
+  for (int i = 0; i < n; i++) {
+    lua_createtable(L, 2, 0);
+    lua_pushstring(L, key);
+    lua_rawseti(L, -2, 1);
+    lua_pushinteger(L, count[i]);
+    lua_rawseti(L, -2, 2);
+    lua_rawseti(L, -2, i+1);
+    key += strlen(key) + 1;
+  }
+  free(count);
+  free(b.data);
+  return 1;
+}
+
+static int lua_profiler_stats(lua_State *L) {
+  pthread_mutex_lock(&gProfiler.lock);
+  long samples = gProfiler.stacks.total;
+  long kept = (gProfiler.nSample > PROFILER_MAX_SAMPLES) ?
+    PROFILER_MAX_SAMPLES : gProfiler.nSample;
+  int stacks = gProfiler.stacks.nEntry;
+  int states = gProfiler.threads.nEntry;
+  int timers = gProfiler.nTimer;
+  pthread_mutex_unlock(&gProfiler.lock);
+
+  ProfileState *ps = profiler_getstate(L);
+  lua_createtable(L, 0, 6);
+  lua_pushinteger(L, samples);
+  lua_setfield(L, -2, "samples");
+  lua_pushinteger(L, kept);
+  lua_setfield(L, -2, "traced");
+  lua_pushinteger(L, stacks);
+  lua_setfield(L, -2, "stacks");
+  lua_pushinteger(L, states);
+  lua_setfield(L, -2, "states");
+  lua_pushinteger(L, timers);
+  lua_setfield(L, -2, "timers");
+  lua_pushboolean(L, ps && ps->running);
+  lua_setfield(L, -2, "running");
+  return 1;
+}
+
+static const struct luaL_reg profiler_functions[] = {
+  {"start", lua_profiler_start},
+  {"stop", lua_profiler_stop},
+  {"reset", lua_profiler_reset},
+  {"dump", lua_profiler_dump},
+  {"histogram", lua_profiler_histogram},
+  {"stats", lua_profiler_stats},
+  {NULL, NULL}
+};
+
+#ifdef __cplusplus
+extern "C"
+#endif
+int luaopen_profiler (lua_State *L) {
+  luaL_newmetatable(L, MT_NAME);
+  lua_pushcfunction(L, lua_profiler_state_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+
+  luaL_register(L, "profiler", profiler_functions);
+  return 1;
+}
@@ -0,0 +1,113 @@
+#ifndef profiletable_h
+#define profiletable_h
+
+/*
+  Sample counters keyed by string (collapsed stack, function or line)
+
+  Entries are chained in a fixed bucket array and also indexed by id
+  in insertion order, so a recorded sample only needs to keep the id
+  of its stack. The number of entries is capped so a profiler left
+  running in a field build has bounded memory; keys seen after the
+  cap is reached are counted under PROFILETABLE_OVERFLOW instead.
+  Callers serialize access.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PROFILETABLE_BUCKETS 1024
+#define PROFILETABLE_OVERFLOW "[other]"
+
+typedef struct ProfileEntry {
+  struct ProfileEntry *next;
+  unsigned int hash;
+  int id;
+  long count;
+  char key[1];  // allocated to fit
+} ProfileEntry;
+
+class ProfileTable {
+public:
+  ProfileEntry *bucket[PROFILETABLE_BUCKETS];
+  ProfileEntry **entry;  // by id
+  int nEntry;
+  int maxEntry;
+  int limit;
+  long total;
+
+  ProfileTable(int l): entry(NULL), nEntry(0), maxEntry(0),
+		       limit(l), total(0) {
+    memset(bucket, 0, sizeof(bucket));
+  }
+
+  virtual ~ProfileTable() {
+    clear();
+  }
+
+  void clear() {
+    for (int i = 0; i < nEntry; i++) free(entry[i]);
+    free(entry);
+    entry = NULL;
+    nEntry = maxEntry = 0;
+    total = 0;
+    memset(bucket, 0, sizeof(bucket));
+  }
+
+  static unsigned int hashKey(const char *key, size_t len) {
+    // FNV-1a
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+      h = (h ^ (unsigned char)key[i]) * 16777619u;
+    }
+    return h;
+  }
+
+  // Add n samples to key; returns id of the counting entry, -1 on failure
+  int add(const char *key, size_t len, long n) {
+    unsigned int h = hashKey(key, len);
+    ProfileEntry *e;
+    for (e = bucket[h % PROFILETABLE_BUCKETS]; e; e = e->next) {
+      if ((e->hash == h) && (strncmp(e->key, key, len) == 0) &&
+	  (e->key[len] == '\0')) {
+	break;
+      }
+    }
+    if (e == NULL) {
+      if (nEntry >= limit) {
+	if (strcmp(key, PROFILETABLE_OVERFLOW) == 0) return -1;
+	limit++;  // room for the overflow entry itself
+	int id = add(PROFILETABLE_OVERFLOW, strlen(PROFILETABLE_OVERFLOW), n);
+	limit--;
+	return id;
+      }
+      if (nEntry == maxEntry) {
+	int size = maxEntry ? maxEntry*2 : 64;
+	ProfileEntry **p = (ProfileEntry **)realloc(entry,
+						    size*sizeof(ProfileEntry *));
+	if (p == NULL) return -1;
+	entry = p;
+	maxEntry = size;
+      }
+      e = (ProfileEntry *)malloc(sizeof(ProfileEntry) + len);
+      if (e == NULL) return -1;
+      memcpy(e->key, key, len);
+      e->key[len] = '\0';
+      e->hash = h;
+      e->id = nEntry;
+      e->count = 0;
+      e->next = bucket[h % PROFILETABLE_BUCKETS];
+      bucket[h % PROFILETABLE_BUCKETS] = e;
+      entry[nEntry++] = e;
+    }
+    e->count += n;
+    total += n;
+    return e->id;
+  }
+
+  ProfileEntry* get(int id) {
+    if ((id < 0) || (id >= nEntry)) return NULL;
+    return entry[id];
+  }
+};
+
+#endif
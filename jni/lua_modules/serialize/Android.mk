@@ -0,0 +1,9 @@
+LOCAL_PATH := $(call my-dir)
+
+# serialize module with a MessagePack encoder/decoder for Lua values
+include $(CLEAR_VARS)
+LOCAL_MODULE := serialize
+LOCAL_SRC_FILES := luaserialize.cpp
+LOCAL_LDLIBS := -llog
+LOCAL_SHARED_LIBRARIES := lua-activity
+include $(BUILD_SHARED_LIBRARY)
@@ -0,0 +1,504 @@
+/*
+  Lua module to serialize Lua values in MessagePack format
+
+  nil, booleans, numbers, strings and tables are supported. Numbers
+  with an integral value are written as msgpack integers, others as
+  float64. Tables with keys 1..n are written as arrays, others as
+  maps. A table met again (shared or cyclic) is written as an ext
+  record of type SERIALIZE_EXT_REF holding the index of its first
+  occurrence in encoding order, so the decoder rebuilds the same
+  graph; data without repeated tables is plain msgpack. References
+  are numbered per encoded value, so tables shared between the
+  arguments of one encode() are written once per argument and each
+  value decodes on its own.
+
+  Encoding goes to a string or straight into a caller's buffer
+  (lightuserdata and size, e.g. carray.pointer), and decoding reads
+  from a string or a pointer and length without copying the input
+  into a Lua string first. Decode takes a position and returns the
+  next one, so several values can be streamed through one buffer.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <android/log.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+  #include "lua.h"
+  #include "lauxlib.h"
+#ifdef __cplusplus
+}
+#endif
+
+#include "luaserialize.h"
+
+#define MT_NAME "serialize_buffer_mt"
+#define SERIALIZE_EXT_REF 1
+#define SERIALIZE_MAX_DEPTH 200
+#define SERIALIZE_INIT_SIZE 256
+#define ARRAY_CHUNK 32
+
+#ifndef LOG_TAG
+#define LOG_TAG "lua"
+#endif
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO,LOG_TAG,__VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN,LOG_TAG,__VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR,LOG_TAG,__VA_ARGS__)
+
+// Output buffer, either growing (owned, freed by __gc so that errors
+// raised while encoding do not leak) or fixed (caller's memory)
+typedef struct SerialBuffer {
+  unsigned char *data;
+  size_t size, max;
+  int fixed;
+  int overflow;  // fixed buffer too small; size is the size needed
+} SerialBuffer;
+
+typedef struct Encoder {
+  lua_State *L;
+  SerialBuffer *b;
+  int seen;   // stack index of table -> reference index
+  int nseen;
+} Encoder;
+
+typedef struct Decoder {
+  lua_State *L;
+  const unsigned char *p, *end;
+  int refs;   // stack index of reference index -> table
+  int nrefs;
+} Decoder;
+
+/* Output */
+
+static unsigned char* serial_reserve(Encoder *e, size_t n) {
+  SerialBuffer *b = e->b;
+  if (b->size + n > b->max) {
+    if (b->fixed) {
+      // Keep counting so the caller learns the size needed
+      b->overflow = 1;
+      b->size += n;
+      return NULL;
+    }
+    size_t max = b->max ? b->max : SERIALIZE_INIT_SIZE;
+    while (max < b->size + n) max *= 2;
+    unsigned char *p = (unsigned char *)realloc(b->data, max);
+    if (p == NULL) luaL_error(e->L, "not enough memory");
+    b->data = p;
+    b->max = max;
+  }
+  unsigned char *p = b->data + b->size;
+  b->size += n;
+  return p;
+}
+
+static void serial_byte(Encoder *e, unsigned char c) {
+  unsigned char *p = serial_reserve(e, 1);
+  if (p) *p = c;
+}
+
+// Type byte followed by a big-endian value of n bytes
+static void serial_typed(Encoder *e, unsigned char type, uint64_t v, int n) {
+  unsigned char *p = serial_reserve(e, 1 + n);
+  if (p == NULL) return;
+  *p++ = type;
+  for (int k = n - 1; k >= 0; k--) {
+    *p++ = (unsigned char)(v >> (8*k));
+  }
+}
+
+static void serial_bytes(Encoder *e, const char *s, size_t len) {
+  unsigned char *p = serial_reserve(e, len);
+  if (p) memcpy(p, s, len);
+}
+
+/* Encoder */
+
+static void encode_value(Encoder *e, int idx, int depth);
+
+static void encode_number(Encoder *e, lua_Number n) {
+  double d = (double)n;
+  if ((d == floor(d)) && (d >= -9223372036854775808.0) &&
+      (d < 18446744073709551616.0)) {
+    if (d >= 0) {
+      uint64_t u = (uint64_t)d;
+      if (u < 128) serial_byte(e, (unsigned char)u);
+      else if (u <= 0xff) serial_typed(e, 0xcc, u, 1);
+      else if (u <= 0xffff) serial_typed(e, 0xcd, u, 2);
+      else if (u <= 0xffffffffu) serial_typed(e, 0xce, u, 4);
+      else serial_typed(e, 0xcf, u, 8);
+    }
+    else {
+      int64_t i = (int64_t)d;
+      if (i >= -32) serial_byte(e, (unsigned char)(i & 0xff));
+      else if (i >= -128) serial_typed(e, 0xd0, (uint64_t)i, 1);
+      else if (i >= -32768) serial_typed(e, 0xd1, (uint64_t)i, 2);
+      else if (i >= -2147483647 - 1) serial_typed(e, 0xd2, (uint64_t)i, 4);
+      else serial_typed(e, 0xd3, (uint64_t)i, 8);
+    }
+    return;
+  }
+  uint64_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  serial_typed(e, 0xcb, bits, 8);
+}
+
+static void encode_string(Encoder *e, const char *s, size_t len) {
+  if (len < 32) serial_byte(e, 0xa0 | (unsigned char)len);
+  else if (len <= 0xff) serial_typed(e, 0xd9, len, 1);
+  else if (len <= 0xffff) serial_typed(e, 0xda, len, 2);
+  else serial_typed(e, 0xdb, len, 4);
+  serial_bytes(e, s, len);
+}
+
+static void encode_header(Encoder *e, size_t n, unsigned char fix,
+			  unsigned char t16, unsigned char t32) {
+  if (n < 16) serial_byte(e, fix | (unsigned char)n);
+  else if (n <= 0xffff) serial_typed(e, t16, n, 2);
+  else serial_typed(e, t32, n, 4);
+}
+
+static void encode_table(Encoder *e, int idx, int depth) {
+  lua_State *L = e->L;
+  if (depth > SERIALIZE_MAX_DEPTH) luaL_error(L, "table nesting too deep");
+  luaL_checkstack(L, 4, "table nesting too deep");
+
+  // Repeated table: reference to its first occurrence
+  lua_pushvalue(L, idx);
+  lua_rawget(L, e->seen);
+  if (!lua_isnil(L, -1)) {
+    // fixext 4: ext type then 32-bit reference
+    uint32_t ref = (uint32_t)lua_tointeger(L, -1);
+    serial_typed(e, 0xd6, ((uint64_t)SERIALIZE_EXT_REF << 32) | ref, 5);
+    lua_pop(L, 1);
+    return;
+  }
+  lua_pop(L, 1);
+  lua_pushvalue(L, idx);
+  lua_pushinteger(L, e->nseen++);
+  lua_rawset(L, e->seen);
+
+  // Array if keys are exactly 1..n
+  size_t n = lua_objlen(L, idx);
+  size_t count = 0;
+  int isArray = 1;
+  lua_pushnil(L);
+  while (lua_next(L, idx)) {
+    lua_pop(L, 1);
+    count++;
+    if (isArray) {
+      lua_Number k = lua_tonumber(L, -1);
+      isArray = (lua_type(L, -1) == LUA_TNUMBER) &&
+	(k == floor(k)) && (k >= 1) && (k <= n);
+    }
+  }
+  if (isArray && (count == n)) {
+    encode_header(e, n, 0x90, 0xdc, 0xdd);
+    for (size_t i = 1; i <= n; i++) {
+      lua_rawgeti(L, idx, (int)i);
+      encode_value(e, lua_gettop(L), depth + 1);
+      lua_pop(L, 1);
+    }
+    return;
+  }
+  encode_header(e, count, 0x80, 0xde, 0xdf);
+  lua_pushnil(L);
+  while (lua_next(L, idx)) {
+    int top = lua_gettop(L);
+    encode_value(e, top - 1, depth + 1);
+    encode_value(e, top, depth + 1);
+    lua_pop(L, 1);
+  }
+}
+
+static void encode_value(Encoder *e, int idx, int depth) {
+  lua_State *L = e->L;
+  switch (lua_type(L, idx)) {
+  case LUA_TNIL:
+    serial_byte(e, 0xc0);
+    break;
+  case LUA_TBOOLEAN:
+    serial_byte(e, lua_toboolean(L, idx) ? 0xc3 : 0xc2);
+    break;
+  case LUA_TNUMBER:
+    encode_number(e, lua_tonumber(L, idx));
+    break;
+  case LUA_TSTRING: {
+    size_t len;
+    const char *s = lua_tolstring(L, idx, &len);
+    encode_string(e, s, len);
+    break;
+  }
+  case LUA_TTABLE:
+    encode_table(e, idx, depth);
+    break;
+  default:
+    luaL_error(L, "cannot serialize a %s", luaL_typename(L, idx));
+  }
+}
+
+// Encode arguments first..top into b, each with its own reference
+// table on the stack since decode() numbers references per value
+static void encode_args(lua_State *L, SerialBuffer *b, int first) {
+  int top = lua_gettop(L);
+  Encoder e;
+  e.L = L;
+  e.b = b;
+  for (int i = first; i <= top; i++) {
+    lua_newtable(L);
+    e.seen = lua_gettop(L);
+    e.nseen = 0;
+    encode_value(&e, i, 0);
+    lua_pop(L, 1);
+  }
+}
+
+static int lua_serialbuffer_gc(lua_State *L) {
+  SerialBuffer *b = (SerialBuffer *)luaL_checkudata(L, 1, MT_NAME);
+  if (!b->fixed) free(b->data);
+  b->data = NULL;
+  return 0;
+}
+
+// serialize.encode(...) -> string
+static int lua_serialize_encode(lua_State *L) {
+  SerialBuffer *b = (SerialBuffer *)lua_newuserdata(L, sizeof(SerialBuffer));
+  memset(b, 0, sizeof(SerialBuffer));
+  luaL_getmetatable(L, MT_NAME);
+  lua_setmetatable(L, -2);
+  lua_insert(L, 1);
+  encode_args(L, b, 2);
+  lua_pushlstring(L, (const char *)b->data, b->size);
+  lua_serialbuffer_gc(L);  // free now rather than at next collection
+  return 1;
+}
+
+// serialize.encodeto(pointer, size, ...) -> bytes written, or nil and
+// the size needed if the buffer is too small
+static int lua_serialize_encodeto(lua_State *L) {
+  luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+  SerialBuffer b;
+  memset(&b, 0, sizeof(SerialBuffer));
+  b.data = (unsigned char *)lua_touserdata(L, 1);
+  b.max = (size_t)luaL_checknumber(L, 2);
+  b.fixed = 1;
+  encode_args(L, &b, 3);
+  if (b.overflow) {
+    lua_pushnil(L);
+    lua_pushinteger(L, b.size);
+    return 2;
+  }
+  lua_pushinteger(L, b.size);
+  return 1;
+}
+
+/* Decoder */
+
+static void decode_value(Decoder *d, int depth);
+
+static const unsigned char* decode_need(Decoder *d, size_t n) {
+  if ((size_t)(d->end - d->p) < n) luaL_error(d->L, "truncated data");
+  const unsigned char *p = d->p;
+  d->p += n;
+  return p;
+}
+
+static uint64_t decode_uint(Decoder *d, int n) {
+  const unsigned char *p = decode_need(d, n);
+  uint64_t v = 0;
+  for (int k = 0; k < n; k++) v = (v << 8) | p[k];
+  return v;
+}
+
+static int64_t decode_int(Decoder *d, int n) {
+  uint64_t v = decode_uint(d, n);
+  if (n < 8) {
+    uint64_t sign = (uint64_t)1 << (8*n - 1);
+    v = (v ^ sign) - sign;  // sign extend
+  }
+  return (int64_t)v;
+}
+
+static void decode_string(Decoder *d, size_t len) {
+  const unsigned char *p = decode_need(d, len);
+  lua_pushlstring(d->L, (const char *)p, len);
+}
+
+// Register the table on top of the stack as the next reference
+static void decode_register(Decoder *d) {
+  lua_pushvalue(d->L, -1);
+  lua_rawseti(d->L, d->refs, ++d->nrefs);
+}
+
+static void decode_array(Decoder *d, size_t n, int depth) {
+  lua_State *L = d->L;
+  // Each element takes at least one byte
+  if (n > (size_t)(d->end - d->p)) luaL_error(L, "truncated data");
+  luaL_checkstack(L, ARRAY_CHUNK + 2, "table nesting too deep");
+  lua_createtable(L, (int)n, 0);
+  decode_register(d);
+  int t = lua_gettop(L);
+  for (size_t base = 0; base < n; base += ARRAY_CHUNK) {
+    int m = (n - base < ARRAY_CHUNK) ? (int)(n - base) : ARRAY_CHUNK;
+    for (int k = 0; k < m; k++) decode_value(d, depth + 1);
+    lua_rawsetlist(L, t, (int)base + 1, m);
+  }
+}
+
+static void decode_map(Decoder *d, size_t n, int depth) {
+  lua_State *L = d->L;
+  if (n > (size_t)(d->end - d->p)/2) luaL_error(L, "truncated data");
+  luaL_checkstack(L, 4, "table nesting too deep");
+  lua_createtable(L, 0, (int)n);
+  decode_register(d);
+  for (size_t i = 0; i < n; i++) {
+    decode_value(d, depth + 1);
+    if (lua_isnil(L, -1) ||
+	((lua_type(L, -1) == LUA_TNUMBER) &&
+	 (lua_tonumber(L, -1) != lua_tonumber(L, -1)))) {
+      luaL_error(L, "invalid table key");
+    }
+    decode_value(d, depth + 1);
+    lua_rawset(L, -3);
+  }
+}
+
+static void decode_ext(Decoder *d, size_t len) {
+  int type = (signed char)decode_need(d, 1)[0];
+  if ((type != SERIALIZE_EXT_REF) || (len != 4)) {
+    luaL_error(d->L, "unsupported ext type %d", type);
+  }
+  uint32_t ref = (uint32_t)decode_uint(d, 4);
+  if (ref >= (uint32_t)d->nrefs) luaL_error(d->L, "invalid table reference");
+  lua_rawgeti(d->L, d->refs, ref + 1);
+}
+
+static void decode_value(Decoder *d, int depth) {
+  lua_State *L = d->L;
+  if (depth > SERIALIZE_MAX_DEPTH) luaL_error(L, "table nesting too deep");
+  unsigned char c = decode_need(d, 1)[0];
+  if (c <= 0x7f) {
+    lua_pushinteger(L, c);
+    return;
+  }
+  if (c >= 0xe0) {
+    lua_pushinteger(L, (signed char)c);
+    return;
+  }
+  if ((c & 0xe0) == 0xa0) {
+    decode_string(d, c & 0x1f);
+    return;
+  }
+  if ((c & 0xf0) == 0x90) {
+    decode_array(d, c & 0x0f, depth);
+    return;
+  }
+  if ((c & 0xf0) == 0x80) {
+    decode_map(d, c & 0x0f, depth);
+    return;
+  }
+  switch (c) {
+  case 0xc0: lua_pushnil(L); break;
+  case 0xc2: lua_pushboolean(L, 0); break;
+  case 0xc3: lua_pushboolean(L, 1); break;
+  case 0xc4: case 0xd9: decode_string(d, decode_uint(d, 1)); break;
+  case 0xc5: case 0xda: decode_string(d, decode_uint(d, 2)); break;
+  case 0xc6: case 0xdb: decode_string(d, decode_uint(d, 4)); break;
+  case 0xc7: decode_ext(d, decode_uint(d, 1)); break;
+  case 0xc8: decode_ext(d, decode_uint(d, 2)); break;
+  case 0xc9: decode_ext(d, decode_uint(d, 4)); break;
+  case 0xca: {
+    uint32_t bits = (uint32_t)decode_uint(d, 4);
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    lua_pushnumber(L, f);
+    break;
+  }
+  case 0xcb: {
+    uint64_t bits = decode_uint(d, 8);
+    double v;
+    memcpy(&v, &bits, sizeof(v));
+    lua_pushnumber(L, v);
+    break;
+  }
+  case 0xcc: lua_pushnumber(L, (lua_Number)decode_uint(d, 1)); break;
+  case 0xcd: lua_pushnumber(L, (lua_Number)decode_uint(d, 2)); break;
+  case 0xce: lua_pushnumber(L, (lua_Number)decode_uint(d, 4)); break;
+  case 0xcf: lua_pushnumber(L, (lua_Number)decode_uint(d, 8)); break;
+  case 0xd0: lua_pushnumber(L, (lua_Number)decode_int(d, 1)); break;
+  case 0xd1: lua_pushnumber(L, (lua_Number)decode_int(d, 2)); break;
+  case 0xd2: lua_pushnumber(L, (lua_Number)decode_int(d, 4)); break;
+  case 0xd3: lua_pushnumber(L, (lua_Number)decode_int(d, 8)); break;
+  case 0xd4: decode_ext(d, 1); break;
+  case 0xd5: decode_ext(d, 2); break;
+  case 0xd6: decode_ext(d, 4); break;
+  case 0xd7: decode_ext(d, 8); break;
+  case 0xd8: decode_ext(d, 16); break;
+  case 0xdc: decode_array(d, decode_uint(d, 2), depth); break;
+  case 0xdd: decode_array(d, decode_uint(d, 4), depth); break;
+  case 0xde: decode_map(d, decode_uint(d, 2), depth); break;
+  case 0xdf: decode_map(d, decode_uint(d, 4), depth); break;
+  default:
+    luaL_error(L, "invalid type byte 0x%x", c);
+  }
+}
+
+// serialize.decode(s [, pos]) or serialize.decode(pointer, size [, pos])
+// -> value, next position
+static int lua_serialize_decode(lua_State *L) {
+  const unsigned char *data;
+  size_t len;
+  int posArg;
+  if (lua_islightuserdata(L, 1)) {
+    data = (const unsigned char *)lua_touserdata(L, 1);
+    len = (size_t)luaL_checknumber(L, 2);
+    posArg = 3;
+  }
+  else {
+    data = (const unsigned char *)luaL_checklstring(L, 1, &len);
+    posArg = 2;
+  }
+  size_t pos = (size_t)luaL_optinteger(L, posArg, 1);
+  luaL_argcheck(L, (pos >= 1) && (pos <= len + 1), posArg,
+		"position out of range");
+  if (pos == len + 1) {
+    // End of stream: no value
+    lua_pushnil(L);
+    lua_pushinteger(L, pos);
+    return 2;
+  }
+  Decoder d;
+  d.L = L;
+  d.p = data + pos - 1;
+  d.end = data + len;
+  lua_newtable(L);
+  d.refs = lua_gettop(L);
+  d.nrefs = 0;
+  decode_value(&d, 0);
+  lua_pushinteger(L, d.p - data + 1);
+  return 2;
+}
+
+static const struct luaL_reg serialize_functions[] = {
+  {"encode", lua_serialize_encode},
+  {"encodeto", lua_serialize_encodeto},
+  {"decode", lua_serialize_decode},
+  {NULL, NULL}
+};
+
+#ifdef __cplusplus
+extern "C"
+#endif
+int luaopen_serialize (lua_State *L) {
+  luaL_newmetatable(L, MT_NAME);
+  lua_pushcfunction(L, lua_serialbuffer_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+
+  luaL_register(L, "serialize", serialize_functions);
+  return 1;
+}
@@ -13,6 +13,17 @@
 
 #include "jnicontext.h"
 
+// Log allocator statistics of Lua state
+static void lua_logallocstats(lua_State *L, const char *when) {
+  luaL_AllocStats s;
+  if (!luaL_getallocstats(L, &s)) return;
+  LOGI("%s: Lua memory %u bytes (peak %u, limit %u, pools %u), "
+       "%lu allocs, %lu reallocs, %lu frees, %lu large, %lu refused",
+       when, (unsigned)s.inuse, (unsigned)s.peak, (unsigned)s.limit,
+       (unsigned)s.reserved, s.nalloc, s.nrealloc, s.nfree, s.nlarge,
+       s.nfailed);
+}
+
 // Lua callback function of name
 static int lua_callback_errchk(lua_State *L, const char *name, int nargs) {
   lua_getfield(L, LUA_GLOBALSINDEX, name);
@@ -22,9 +33,11 @@ static int lua_callback_errchk(lua_State *L, const char *name, int nargs) {
   }
   // Move lua function before pushed arguments
   lua_insert(L, -(nargs+1));
-  if (lua_pcall(L, nargs, LUA_MULTRET, 0)) {
+  int status = lua_pcall(L, nargs, LUA_MULTRET, 0);
+  if (status) {
     LOGE("pcall %s", lua_tostring(L, -1));
     lua_pop(L, 1);
+    if (status == LUA_ERRMEM) lua_logallocstats(L, name);
     return 0;
   }
   return lua_gettop(L);
@@ -105,6 +118,7 @@ static void onDestroy(ANativeActivity* activity) {
 
   struct engine* engine = (struct engine *)activity->instance;
   lua_callback_errchk(engine->L, "onDestroy", 0);
+  lua_logallocstats(engine->L, "onDestroy");
   lua_close(engine->L);
   free(engine);
 }
@@ -153,6 +167,12 @@ static void onConfigurationChanged(ANativeActivity* activity) {
 static void onLowMemory(ANativeActivity* activity) {
   LOGI("onLowMemory: %p", activity);
 
+  struct engine* engine = (struct engine *)activity->instance;
+  // Collect, then give pool pages left unused back to the system
+  lua_gc(engine->L, LUA_GCCOLLECT, 0);
+  size_t trimmed = luaL_trimpool(engine->L);
+  LOGI("onLowMemory: trimmed %u bytes of pool pages", (unsigned)trimmed);
+  lua_logallocstats(engine->L, "onLowMemory");
 }
 
 static void onWindowFocusChanged(ANativeActivity* activity, int focused) {
@@ -274,6 +294,7 @@ LOGI("cpath: %s", dirname);
   // New lua state
   lua_State *L = luaL_newstate();
   engine->L = L;
+  luaL_setalloclimit(L, LUA_MEMORY_LIMIT);
   luaL_openlibs(L);
 
   // Register post() C closure function
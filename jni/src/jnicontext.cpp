@@ -5,6 +5,9 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
 #include <jni.h>
 #include <android/log.h>
 #include <android/asset_manager.h>
@@ -25,6 +28,92 @@ static jobject gApplication;
 static jobject gApplicationContext;
 static AAssetManager* gAssetManager;
 
+// Per thread JNIEnv, cached under a pthread key. Threads attached by
+// jniGetEnv() are detached by the key destructor when they exit, so
+// worker threads (Lanes, camera callbacks) do not leak attachments.
+typedef struct {
+  JNIEnv *env;
+  int attached;  // attached by us, detach on thread exit
+} jniThreadEnv;
+
+static pthread_key_t gEnvKey;
+static pthread_once_t gEnvKeyOnce = PTHREAD_ONCE_INIT;
+
+// Cache of global class refs and method/field IDs, keyed by
+// class + name + signature. Lookups through the JNI reflection calls
+// are slow, so modules resolve what they need once at luaopen_() and
+// repeated lookups (e.g. calls by method name) become a hash probe.
+// IDs stay valid as long as their class is loaded, which the cached
+// global class refs guarantee.
+#define JNI_CACHE_BUCKETS 64
+
+enum {
+  JNI_CACHE_CLASS,
+  JNI_CACHE_METHOD,
+  JNI_CACHE_STATIC_METHOD,
+  JNI_CACHE_FIELD,
+  JNI_CACHE_STATIC_FIELD
+};
+
+typedef struct jniCacheEntry {
+  struct jniCacheEntry *next;
+  int kind;
+  jclass cls;         // NULL for class entries
+  char *name;
+  char *signature;    // NULL for class entries
+  void *id;           // global jclass, jmethodID or jfieldID
+} jniCacheEntry;
+
+static jniCacheEntry *gCache[JNI_CACHE_BUCKETS];
+static pthread_mutex_t gCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int jniCacheHash(int kind, jclass cls,
+				 const char *name, const char *signature) {
+  unsigned int h = kind*31 + (unsigned int)(size_t)cls;
+  for (const char *c = name; *c; c++) h = h*33 + *c;
+  if (signature) {
+    for (const char *c = signature; *c; c++) h = h*33 + *c;
+  }
+  return h % JNI_CACHE_BUCKETS;
+}
+
+static void* jniCacheFind(int kind, jclass cls,
+			  const char *name, const char *signature) {
+  unsigned int h = jniCacheHash(kind, cls, name, signature);
+  void *id = NULL;
+  pthread_mutex_lock(&gCacheLock);
+  for (jniCacheEntry *e = gCache[h]; e; e = e->next) {
+    if ((e->kind == kind) && (e->cls == cls) &&
+	(strcmp(e->name, name) == 0) &&
+	((signature == NULL) || (strcmp(e->signature, signature) == 0))) {
+      id = e->id;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&gCacheLock);
+  return id;
+}
+
+// Resolved outside the lock, so two threads may race to insert the
+// same key; both entries hold the same ID and the first one wins.
+static void jniCacheInsert(int kind, jclass cls,
+			   const char *name, const char *signature,
+			   void *id) {
+  jniCacheEntry *e = (jniCacheEntry *)malloc(sizeof(jniCacheEntry));
+  if (e == NULL) return;
+  e->kind = kind;
+  e->cls = cls;
+  e->name = strdup(name);
+  e->signature = signature ? strdup(signature) : NULL;
+  e->id = id;
+
+  unsigned int h = jniCacheHash(kind, cls, name, signature);
+  pthread_mutex_lock(&gCacheLock);
+  e->next = gCache[h];
+  gCache[h] = e;
+  pthread_mutex_unlock(&gCacheLock);
+}
+
 // Called to save JavaVM if library is loaded from Java:
 extern "C"
 int JNI_OnLoad(JavaVM* vm, void* reserved) {
@@ -45,30 +134,84 @@ JavaVM* jniGetJavaVM() {
   return gJavaVM;
 }
 
+static void jniThreadExit(void *data) {
+  jniThreadEnv *t = (jniThreadEnv *)data;
+  if (t->attached && gJavaVM) {
+    gJavaVM->DetachCurrentThread();
+  }
+  free(t);
+}
+
+static void jniCreateEnvKey() {
+  pthread_key_create(&gEnvKey, jniThreadExit);
+}
+
 // Utility function to get JNIEnv
 extern "C"
 JNIEnv* jniGetEnv() {
+  pthread_once(&gEnvKeyOnce, jniCreateEnvKey);
+  jniThreadEnv *t = (jniThreadEnv *)pthread_getspecific(gEnvKey);
+  if (t) return t->env;
+
   JNIEnv *env;
   if (gJavaVM == 0) {
     LOGE("Invalid global Java VM");
     return 0;
   }
 
+  int attached = 0;
   int status;
   status = gJavaVM->GetEnv((void **) &env, JNI_VERSION_1_4);
   if (status < 0) {
-    LOGW("Failed to get JNI environment, trying to attach thread");
     // Try to attach native thread to JVM:
     status = gJavaVM->AttachCurrentThread(&env, 0);
     if (status < 0) {
       LOGE("Failed to attach current thread to JVM");
       return 0;
     }
+    attached = 1;
+    LOGI("Attached thread %p to JVM", (void *)pthread_self());
   }
 
+  t = (jniThreadEnv *)malloc(sizeof(jniThreadEnv));
+  if (t) {
+    t->env = env;
+    t->attached = attached;
+    pthread_setspecific(gEnvKey, t);
+  }
   return env;
 }
 
+// Detach now instead of at thread exit (e.g. thread going idle)
+extern "C"
+void jniDetachThread() {
+  pthread_once(&gEnvKeyOnce, jniCreateEnvKey);
+  jniThreadEnv *t = (jniThreadEnv *)pthread_getspecific(gEnvKey);
+  if (t == NULL) return;
+  pthread_setspecific(gEnvKey, NULL);
+  jniThreadExit(t);
+}
+
+extern "C"
+int jniPushLocalFrame(int capacity) {
+  JNIEnv *env = jniGetEnv();
+  if (env == 0) return -1;
+  if (env->PushLocalFrame(capacity) < 0) {
+    // OutOfMemoryError
+    env->ExceptionClear();
+    LOGE("Could not push JNI local frame");
+    return -1;
+  }
+  return 0;
+}
+
+extern "C"
+jobject jniPopLocalFrame(jobject result) {
+  JNIEnv *env = jniGetEnv();
+  if (env == 0) return 0;
+  return env->PopLocalFrame(result);
+}
+
 extern "C"
 int jniSetContext(jobject context) {
   JNIEnv *env = jniGetEnv();
@@ -81,10 +224,10 @@ int jniSetContext(jobject context) {
   LOGI("Saving Android activity object %p", gActivity);
 
   // Application object
-  jmethodID methodGetApplication = 
-    env->GetMethodID(env->GetObjectClass(gActivity),
-		     "getApplication",
-		     "()Landroid/app/Application;");
+  jmethodID methodGetApplication =
+    jniGetMethodID(jniGetClass("android/app/Activity"),
+		   "getApplication",
+		   "()Landroid/app/Application;");
   if (methodGetApplication == 0) {
     LOGE("Failed to get getApplication method");
     return -1;
@@ -94,15 +237,15 @@ int jniSetContext(jobject context) {
   LOGI("Saving Android application object %p", gApplication);
 
   // Application context
-  jclass contextClass = env->FindClass("android/content/Context");
+  jclass contextClass = jniGetClass("android/content/Context");
   if (contextClass == 0) {
     LOGE("Could not get context object class");
     return -1;
   }
   jmethodID getApplicationContextMethod =
-    env->GetMethodID(contextClass,
-		     "getApplicationContext",
-		     "()Landroid/content/Context;");
+    jniGetMethodID(contextClass,
+		   "getApplicationContext",
+		   "()Landroid/content/Context;");
   if (getApplicationContextMethod == 0) {
     LOGE("Could not get getApplicationContext method");
     return -1;
@@ -149,9 +292,9 @@ int jniSetAssetManager(AAssetManager *a) {
     JNIEnv *env = jniGetEnv();
     jobject context = jniGetApplicationContext();
     jmethodID methodGetAssets =
-      env->GetMethodID(env->GetObjectClass(context),
-		       "getAssets",
-		       "()Landroid/content/res/AssetManager;");
+      jniGetMethodID(jniGetClass("android/content/Context"),
+		     "getAssets",
+		     "()Landroid/content/res/AssetManager;");
     if (methodGetAssets == 0) {
       LOGE("Could not get getAssets method");
       return 0;
@@ -181,52 +324,246 @@ AAssetManager *jniGetAssetManager() {
 
 extern "C"
 jclass jniFindClass(const char *name) {
+  static jobject classLoaderObject;
+  static jmethodID loadClassMethod;
   JNIEnv *env = jniGetEnv();
 
   // Default class loader will not work on custom Java files
   // getClassLoader method on native activity object
-  jclass activityClass =
-    env->FindClass("android/app/NativeActivity");
-  jmethodID getClassLoaderMethod =
-    env->GetMethodID(activityClass,
-		      "getClassLoader",
-		      "()Ljava/lang/ClassLoader;");
-  LOGI("getClassLoaderMethod %p", getClassLoaderMethod);
-
-  // Use Native Activity clazz
-  jobject classLoaderObject =
-    env->CallObjectMethod(gActivity, getClassLoaderMethod);
-  LOGI("classLoaderObject %p", classLoaderObject);
-
-  jclass javaClassLoader = env->FindClass("java/lang/ClassLoader");
-  jmethodID loadClassMethod =
-    env->GetMethodID(javaClassLoader,
-		     "loadClass", "(Ljava/lang/String;)Ljava/lang/Class;");
-  LOGI("loadClassMethod %p", loadClassMethod);
+  if (classLoaderObject == 0) {
+    jclass activityClass =
+      env->FindClass("android/app/NativeActivity");
+    jmethodID getClassLoaderMethod =
+      env->GetMethodID(activityClass,
+		       "getClassLoader",
+		       "()Ljava/lang/ClassLoader;");
+    LOGI("getClassLoaderMethod %p", getClassLoaderMethod);
+
+    // Use Native Activity clazz
+    jobject loaderLocal =
+      env->CallObjectMethod(gActivity, getClassLoaderMethod);
+    LOGI("classLoaderObject %p", loaderLocal);
+    if (loaderLocal == 0) return 0;
+
+    jclass javaClassLoader = env->FindClass("java/lang/ClassLoader");
+    loadClassMethod =
+      env->GetMethodID(javaClassLoader,
+		       "loadClass", "(Ljava/lang/String;)Ljava/lang/Class;");
+    LOGI("loadClassMethod %p", loadClassMethod);
+
+    classLoaderObject = env->NewGlobalRef(loaderLocal);
+    env->DeleteLocalRef(loaderLocal);
+    env->DeleteLocalRef(activityClass);
+    env->DeleteLocalRef(javaClassLoader);
+  }
+
+  // ClassLoader.loadClass() wants dots, not slashes
+  char dotted[256];
+  strncpy(dotted, name, sizeof(dotted) - 1);
+  dotted[sizeof(dotted) - 1] = 0;
+  for (char *c = dotted; *c; c++) {
+    if (*c == '/') *c = '.';
+  }
 
+  jstring nameString = env->NewStringUTF(dotted);
   jclass classFind =
     (jclass)env->CallObjectMethod(classLoaderObject,
 				  loadClassMethod,
-				  env->NewStringUTF(name));
+				  nameString);
+  env->DeleteLocalRef(nameString);
+  if (env->ExceptionCheck()) {
+    env->ExceptionClear();
+    classFind = 0;
+  }
   LOGI("classFind %p", classFind);
 
   return classFind;
 }
 
+// Global ref to class, looked up with FindClass() and then with the
+// activity class loader (for classes packaged with the app, e.g. shim/)
+extern "C"
+jclass jniGetClass(const char *name) {
+  jclass cls = (jclass)jniCacheFind(JNI_CACHE_CLASS, NULL, name, NULL);
+  if (cls) return cls;
+
+  JNIEnv *env = jniGetEnv();
+  if (env == 0) return 0;
+
+  jclass local = env->FindClass(name);
+  if (local == 0) {
+    env->ExceptionClear();
+    local = jniFindClass(name);
+  }
+  if (local == 0) {
+    LOGE("Could not find class %s", name);
+    return 0;
+  }
+  cls = (jclass)env->NewGlobalRef(local);
+  env->DeleteLocalRef(local);
+
+  jniCacheInsert(JNI_CACHE_CLASS, NULL, name, NULL, cls);
+  return cls;
+}
+
+static void* jniGetMemberID(int kind, jclass cls,
+			    const char *name, const char *signature) {
+  if (cls == 0) return 0;
+  void *id = jniCacheFind(kind, cls, name, signature);
+  if (id) return id;
+
+  JNIEnv *env = jniGetEnv();
+  if (env == 0) return 0;
+
+  switch (kind) {
+  case JNI_CACHE_METHOD:
+    id = (void *)env->GetMethodID(cls, name, signature);
+    break;
+  case JNI_CACHE_STATIC_METHOD:
+    id = (void *)env->GetStaticMethodID(cls, name, signature);
+    break;
+  case JNI_CACHE_FIELD:
+    id = (void *)env->GetFieldID(cls, name, signature);
+    break;
+  case JNI_CACHE_STATIC_FIELD:
+    id = (void *)env->GetStaticFieldID(cls, name, signature);
+    break;
+  }
+  if (id == 0) {
+    // NoSuchMethodError/NoSuchFieldError: let caller handle missing IDs
+    env->ExceptionClear();
+    LOGW("Could not get %s %s", name, signature);
+    return 0;
+  }
+
+  jniCacheInsert(kind, cls, name, signature, id);
+  return id;
+}
+
+// cls must be a global ref (e.g. from jniGetClass) so the key is stable
+extern "C"
+jmethodID jniGetMethodID(jclass cls, const char *name, const char *sig) {
+  return (jmethodID)jniGetMemberID(JNI_CACHE_METHOD, cls, name, sig);
+}
+
+extern "C"
+jmethodID jniGetStaticMethodID(jclass cls, const char *name, const char *sig) {
+  return (jmethodID)jniGetMemberID(JNI_CACHE_STATIC_METHOD, cls, name, sig);
+}
+
+extern "C"
+jfieldID jniGetFieldID(jclass cls, const char *name, const char *sig) {
+  return (jfieldID)jniGetMemberID(JNI_CACHE_FIELD, cls, name, sig);
+}
+
+extern "C"
+jfieldID jniGetStaticFieldID(jclass cls, const char *name, const char *sig) {
+  return (jfieldID)jniGetMemberID(JNI_CACHE_STATIC_FIELD, cls, name, sig);
+}
+
+// Resolve a table of methods at module load; returns number not found
+extern "C"
+int jniResolveMethods(jclass cls, jniMethod *methods) {
+  int nMissing = 0;
+  for (jniMethod *m = methods; m->name; m++) {
+    m->id = m->isStatic ?
+      jniGetStaticMethodID(cls, m->name, m->signature) :
+      jniGetMethodID(cls, m->name, m->signature);
+    if (m->id == 0) nMissing++;
+  }
+  return nMissing;
+}
+
+// Typed call helpers: log and clear Java exceptions so they do not
+// abort the next JNI call, returning 0 in that case
+static int jniCheckException(JNIEnv *env, jmethodID m) {
+  if (!env->ExceptionCheck()) return 0;
+  env->ExceptionDescribe();
+  env->ExceptionClear();
+  LOGE("Java exception in method %p", m);
+  return 1;
+}
+
+extern "C"
+int jniCallVoidMethod(jobject obj, jmethodID m, ...) {
+  JNIEnv *env = jniGetEnv();
+  if ((env == 0) || (obj == 0) || (m == 0)) return -1;
+  va_list args;
+  va_start(args, m);
+  env->CallVoidMethodV(obj, m, args);
+  va_end(args);
+  return jniCheckException(env, m) ? -1 : 0;
+}
+
+extern "C"
+jint jniCallIntMethod(jobject obj, jmethodID m, ...) {
+  JNIEnv *env = jniGetEnv();
+  if ((env == 0) || (obj == 0) || (m == 0)) return 0;
+  va_list args;
+  va_start(args, m);
+  jint ret = env->CallIntMethodV(obj, m, args);
+  va_end(args);
+  return jniCheckException(env, m) ? 0 : ret;
+}
+
+extern "C"
+jboolean jniCallBooleanMethod(jobject obj, jmethodID m, ...) {
+  JNIEnv *env = jniGetEnv();
+  if ((env == 0) || (obj == 0) || (m == 0)) return JNI_FALSE;
+  va_list args;
+  va_start(args, m);
+  jboolean ret = env->CallBooleanMethodV(obj, m, args);
+  va_end(args);
+  return jniCheckException(env, m) ? JNI_FALSE : ret;
+}
+
+extern "C"
+jobject jniCallObjectMethod(jobject obj, jmethodID m, ...) {
+  JNIEnv *env = jniGetEnv();
+  if ((env == 0) || (obj == 0) || (m == 0)) return 0;
+  va_list args;
+  va_start(args, m);
+  jobject ret = env->CallObjectMethodV(obj, m, args);
+  va_end(args);
+  return jniCheckException(env, m) ? 0 : ret;
+}
+
+extern "C"
+jint jniCallStaticIntMethod(jclass cls, jmethodID m, ...) {
+  JNIEnv *env = jniGetEnv();
+  if ((env == 0) || (cls == 0) || (m == 0)) return 0;
+  va_list args;
+  va_start(args, m);
+  jint ret = env->CallStaticIntMethodV(cls, m, args);
+  va_end(args);
+  return jniCheckException(env, m) ? 0 : ret;
+}
+
+extern "C"
+jobject jniCallStaticObjectMethod(jclass cls, jmethodID m, ...) {
+  JNIEnv *env = jniGetEnv();
+  if ((env == 0) || (cls == 0) || (m == 0)) return 0;
+  va_list args;
+  va_start(args, m);
+  jobject ret = env->CallStaticObjectMethodV(cls, m, args);
+  va_end(args);
+  return jniCheckException(env, m) ? 0 : ret;
+}
+
 // Hack since activity->internalDataPath is broken in Android 2.3
 extern "C"
 const char* jniGetFilesDir(ANativeActivity *activity) {
   JNIEnv *env = jniGetEnv();
-  jclass activityClass = env->FindClass("android/app/NativeActivity");
-  jmethodID getFilesDirMethod = env->GetMethodID(activityClass,
-						 "getFilesDir",
-						 "()Ljava/io/File;");
+  jmethodID getFilesDirMethod =
+    jniGetMethodID(jniGetClass("android/content/Context"),
+		   "getFilesDir",
+		   "()Ljava/io/File;");
   jobject filesDirObj = env->CallObjectMethod(activity->clazz,
 					      getFilesDirMethod);
-  jclass fileClass = env->FindClass("java/io/File");
-  jmethodID getPathMethod = env->GetMethodID(fileClass,
-					     "getPath",
-					     "()Ljava/lang/String;");
+  jmethodID getPathMethod =
+    jniGetMethodID(jniGetClass("java/io/File"),
+		   "getPath",
+		   "()Ljava/lang/String;");
   jstring pathObj = (jstring) env->CallObjectMethod(filesDirObj,
 						    getPathMethod);
   const char* filesDir = env->GetStringUTFChars(pathObj, NULL);
@@ -0,0 +1,62 @@
+-- Allocator churn: small tables, closures and strings with a bounded
+-- live set, as a game loop produces them
+--
+-- builds: lua lua-nopool
+--
+-- Prints seconds per phase and the allocator statistics at the end;
+-- "reserved" is what the pools hold, before and after
+-- collectgarbage("trim").
+
+local clock = os.clock
+
+local function phase(name, f)
+  collectgarbage()
+  local t0 = clock()
+  f()
+  print(string.format("%-10s %7.3f s", name, clock() - t0))
+end
+
+phase("tables", function()
+  local keep = {}
+  for i = 1, 300000 do
+    keep[i % 5000] = { x = i, y = i * 2, { i } }
+  end
+end)
+
+phase("closures", function()
+  local keep = {}
+  for i = 1, 300000 do
+    keep[i % 5000] = function() return i end
+  end
+end)
+
+phase("strings", function()
+  local keep = {}
+  for i = 1, 300000 do
+    keep[i % 5000] = tostring(i) .. "x"
+  end
+end)
+
+phase("mixed", function()
+  local keep = {}
+  for i = 1, 300000 do
+    keep[i % 5000] = { i, tostring(i), { x = i }, function() return i end }
+    if i % 7 == 0 then keep[(i * 3) % 5000] = string.rep("a", i % 600) end
+    local g = {}
+    for k = 1, i % 40 do g[k] = k end
+  end
+end)
+
+phase("grow", function()
+  for n = 1, 30 do
+    local t = {}
+    for i = 1, 20000 do t[i] = i end
+  end
+end)
+
+local s = collectgarbage("stats")
+if s.reserved then
+  print(string.format("peak %d KB, reserved %d KB, %d large of %d allocs",
+                      s.peak / 1024, s.reserved / 1024, s.nlarge, s.nalloc))
+  print(string.format("trim released %d KB", collectgarbage("trim")))
+end
@@ -0,0 +1,65 @@
+-- String building through luaL_Buffer: table.concat, string.rep,
+-- gsub, string.format and the LuaSocket mime filters
+--
+-- builds: lua lua-buf1k
+-- modules: socket/mime_core
+--
+-- Prints the best of 5 runs per phase in milliseconds. Run with -b to
+-- compare against a revision before a buffer change; lua-buf1k has
+-- the buffer size of the device.
+
+local clock = os.clock
+local fmt = string.format
+
+local function phase(name, f)
+  local best = math.huge
+  for i = 1, 5 do
+    collectgarbage()
+    local t0 = clock()
+    f()
+    t0 = clock() - t0
+    if t0 < best then best = t0 end
+  end
+  print(fmt("%-14s %8.2f ms", name, best * 1e3))
+end
+
+local chunk = string.rep("x", 2048)
+local big = {}
+for i = 1, 256 do big[i] = chunk end
+phase("concat 2k", function() return table.concat(big) end)
+
+local small = {}
+for i = 1, 50000 do small[i] = i % 10 == 0 and i or "ab" end
+phase("concat small", function() return table.concat(small, ",") end)
+
+phase("json records", function()
+  local out = {}
+  for i = 1, 20000 do
+    out[i] = fmt('{"id":%d,"x":%.3f,"name":"%s"}', i, i / 7, "obj" .. i)
+  end
+  return "[" .. table.concat(out, ",") .. "]"
+end)
+
+local text = string.rep("The quick brown fox jumps over the lazy dog. ", 12000)
+phase("gsub 512k", function() return (text:gsub("o", "0")) end)
+phase("rep 512k", function() return string.rep("abcd", 131072) end)
+phase("format %s", function()
+  for i = 1, 20 do local s = fmt("<%s>", text) end
+end)
+
+local ok, mime = pcall(require, "mime")
+if ok then
+  local ltn12 = require "ltn12"
+  local data = text:sub(1, 512 * 1024)
+  phase("b64+wrap 512k", function()
+    local out = {}
+    ltn12.pump.all(ltn12.source.string(data),
+                   ltn12.sink.chain(ltn12.filter.chain(mime.encode("base64"),
+                                                       mime.wrap("base64")),
+                                    ltn12.sink.table(out)))
+    return table.concat(out)
+  end)
+  phase("qp 512k", function() return (mime.qp(data)) end)
+else
+  print("mime not available: " .. tostring(mime))
+end
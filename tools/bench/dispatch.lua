@@ -0,0 +1,115 @@
+-- Interpreter dispatch: opcode-heavy loops that do little else, with
+-- the computed-goto build against the switch build
+--
+-- builds: lua lua-switch
+--
+-- Prints the best of 3 runs per phase in seconds and a result that
+-- must be the same in both builds. The "breakout" phase runs the game
+-- logic of assets/Breakout, without drawing.
+
+local clock = os.clock
+
+local function phase(name, f)
+  local best, r = math.huge
+  for i = 1, 3 do
+    collectgarbage()
+    local t0 = clock()
+    r = f()
+    t0 = clock() - t0
+    if t0 < best then best = t0 end
+  end
+  print(string.format("%-10s %7.3f s  %s", name, best, tostring(r)))
+end
+
+local function fib(n)
+  if n < 2 then return n end
+  return fib(n - 1) + fib(n - 2)
+end
+
+phase("calls", function() return fib(30) end)
+
+phase("arith", function()
+  local a, b = 0, 1
+  for i = 1, 3000000 do
+    a = (a + i * 3 - b) % 1000003
+    b = b + 1
+  end
+  return a
+end)
+
+phase("tables", function()
+  local s = 0
+  for r = 1, 10 do
+    local t = {}
+    for i = 1, 100000 do t[i] = i * 2 end
+    for i = 1, #t do s = s + t[i] end
+    local h = {}
+    for i = 1, 20000 do h["k" .. (i % 500)] = i end
+  end
+  return s
+end)
+
+phase("strings", function()
+  local n = 0
+  for r = 1, 20 do
+    local parts = {}
+    for i = 1, 5000 do
+      local s = string.format("%d:%s", i, string.rep("ab", i % 8))
+      parts[#parts + 1] = s:upper():sub(2, -2)
+      n = n + #s + (s:find("b:", 1, true) or 0) + s:byte(1)
+    end
+    local all = table.concat(parts, ",")
+    n = n + select(2, all:gsub("AB", "x")) + #all:match("[%d:]+")
+    local t = ""
+    for i = 1, 500 do t = t .. string.char(65 + i % 26) end
+    n = n + #t
+  end
+  return n
+end)
+
+phase("closures", function()
+  local acc = 0
+  for r = 1, 1000000 do
+    local f = function(x) return x + r end
+    acc = acc + f(1)
+  end
+  local co = coroutine.wrap(function()
+    for i = 1, 100000 do coroutine.yield(i) end
+  end)
+  for i = 1, 100000 do acc = acc + co() end
+  return acc
+end)
+
+phase("metatables", function()
+  local mt = { __index = function(t, k) return k * 2 end,
+               __add = function(a, b) return 1 end }
+  local o = setmetatable({}, mt)
+  local acc = 0
+  for i = 1, 1000000 do acc = acc + o[i] + (o + o) end
+  return acc
+end)
+
+phase("hooks", function()
+  local n = 0
+  debug.sethook(function() n = n + 1 end, "", 100)
+  local s = 0
+  for i = 1, 5000000 do s = s + i end
+  debug.sethook()
+  return n
+end)
+
+-- Breakout draws through gles1; the game logic only needs its colors
+local root = arg[0]:match("^(.*)/tools/bench/[^/]*$") or "."
+package.path = root .. "/assets/Breakout/?.lua;" .. package.path
+Painter = { nColor = 6 }
+package.loaded.Painter = Painter
+require("Game")
+
+phase("breakout", function()
+  local game = Game.new()
+  for i = 1, 5000 do
+    game:setX(Wall.WIDTH/2 + (i % 200) - 100)
+    game:tick()
+  end
+  return string.format("%.3f %.3f", game.ball.x, game.ball.y)
+end)
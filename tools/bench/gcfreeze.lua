@@ -0,0 +1,59 @@
+-- Collector cost against the size of a static world, with the world
+-- left live or frozen with collectgarbage("freeze")
+--
+-- builds: lua
+--
+-- For each world size, churns garbage as a game loop does for a fixed
+-- number of collection cycles and prints, from collectgarbage("stats"):
+-- bytes traversed by the last mark phase, the last atomic phase and
+-- the longest pause (ms), and the time spent in pauses per cycle (ms).
+-- Frozen, the mark work should stay flat as the world grows.
+
+local fmt = string.format
+local CYCLES = 20
+
+-- Bricks with a few fields and a shared metatable, in rows
+local function world(n)
+  local mt = { __index = { hit = function(self) self.hp = self.hp - 1 end } }
+  local w = {}
+  for r = 1, n / 100 do
+    local row = {}
+    for c = 1, 100 do
+      row[c] = setmetatable({ x = c, y = r, hp = 3, name = "b" .. c }, mt)
+    end
+    w[r] = row
+  end
+  return w
+end
+
+local function run(n, freeze)
+  collectgarbage()
+  local w = world(n)
+  if freeze then collectgarbage("freeze", w) end
+  collectgarbage()
+  local s0 = collectgarbage("stats")
+  local keep = {}
+  local i, s, maxpause = 0, s0, 0
+  -- maxpause covers the whole run: take the longest pause seen here
+  while s.cycles - s0.cycles < CYCLES do
+    i = i + 1
+    keep[i % 2000] = { i, tostring(i), { x = i } }
+    local pauses = s.pauses
+    s = collectgarbage("stats")
+    if s.pauses ~= pauses and s.lastpause > maxpause then
+      maxpause = s.lastpause
+    end
+  end
+  print(fmt("%8d %-6s %10d %8.3f %8.3f %8.3f", n,
+            freeze and "frozen" or "live", s.marked, s.atomic, maxpause,
+            (s.pausetime - s0.pausetime) / CYCLES))
+  if freeze then collectgarbage("thaw") end
+  return w
+end
+
+print(fmt("%8s %-6s %10s %8s %8s %8s", "objects", "", "marked", "atomic",
+          "maxpause", "ms/cycle"))
+for _, n in ipairs({ 0, 20000, 100000, 400000 }) do
+  run(n, false)
+  run(n, true)
+end
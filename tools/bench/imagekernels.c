@@ -0,0 +1,150 @@
+/*
+  Host benchmark of the 8-bit image kernels (imagekernels.c)
+
+  sources: jni/lua_modules/image/imagekernels.c
+  builds: simd scalar=-U__SSE2__
+
+  Runs each kernel on the Y plane of NV21 frames, serially and on 4
+  threads, and prints the best time per frame with a checksum of the
+  output that must be the same in every build (all paths produce
+  identical results).
+
+  By default the frames are a synthetic 1280x720 pair. To use raw
+  NV21 dumps from a device (one or more frames back to back, e.g.
+  written from a camera data callback), set
+
+    NV21_DUMP=frames.nv21 NV21_SIZE=640x480 tools/bench/run.sh imagekernels
+
+  The first two frames of the dump are compared by absdiff; with a
+  single frame it is compared with itself shifted down one row.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "imagekernels.h"
+
+#define WIDTH 1280
+#define HEIGHT 720
+#define FRAMES 100
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t checksum(const uint8_t *p, size_t n) {
+  uint32_t h = 2166136261u;
+  size_t i;
+  for (i = 0; i < n; i++) h = (h ^ p[i]) * 16777619u;
+  return h;
+}
+
+// Reads up to two NV21 frames of width x height into a and b, returns
+// the number read
+static int load_dump(const char *path, int width, int height,
+		     uint8_t *a, uint8_t *b) {
+  size_t frame = (size_t)width*height*3/2;
+  int n = 0;
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) return 0;
+  if (fread(a, 1, frame, f) == frame) n++;
+  if (n && fread(b, 1, frame, f) == frame) n++;
+  fclose(f);
+  return n;
+}
+
+static void report(const char *name, int nthreads, double best,
+		   const uint8_t *out, size_t n) {
+  printf("%-14s %d thread%s  %7.3f ms/frame  %08x\n", name, nthreads,
+	 nthreads > 1 ? "s" : " ", best*1e3, checksum(out, n));
+}
+
+int main(void) {
+  const char *dump = getenv("NV21_DUMP");
+  const char *size = getenv("NV21_SIZE");
+  int width = WIDTH, height = HEIGHT;
+  uint8_t *a, *b, *dst;
+  uint32_t hist[256];
+  long changed = 0;
+  int i, t;
+
+  if (dump && (size == NULL ||
+	       sscanf(size, "%dx%d", &width, &height) != 2 ||
+	       width < 8 || height < 8)) {
+    fprintf(stderr, "NV21_SIZE must be WIDTHxHEIGHT with NV21_DUMP\n");
+    return 1;
+  }
+  a = (uint8_t *)malloc((size_t)width*height*3/2);
+  b = (uint8_t *)malloc((size_t)width*height*3/2);
+  dst = (uint8_t *)malloc((size_t)width*height);
+  if (a == NULL || b == NULL || dst == NULL) return 1;
+
+  if (dump) {
+    int n = load_dump(dump, width, height, a, b);
+    if (n == 0) {
+      fprintf(stderr, "%s: no %dx%d NV21 frame\n", dump, width, height);
+      return 1;
+    }
+    if (n == 1) {
+      memcpy(b + width, a, (size_t)width*(height - 1));
+      memcpy(b, a, width);
+    }
+    printf("%s: %d frame%s of %dx%d\n", dump, n, n > 1 ? "s" : "",
+	   width, height);
+  } else {
+    srand(1);
+    for (i = 0; i < width*height; i++) {
+      a[i] = (uint8_t)rand();
+      b[i] = (i % 7) ? a[i] : (uint8_t)rand();
+    }
+  }
+
+#define TIME(name, nthreads, call, out, n) do {	\
+    double best = 1e9;					\
+    for (i = 0; i < FRAMES; i++) {			\
+      double t0 = now();				\
+      call;						\
+      t0 = now() - t0;					\
+      if (t0 < best) best = t0;				\
+    }							\
+    report(name, nthreads, best, out, n);		\
+  } while (0)
+
+  TIME("copy", 1, image_copy(a, width, height, width, dst, width),
+       dst, (size_t)width*height);
+  TIME("rotate90", 1,
+       image_rotate90(a, width, height, width, 1, dst, height),
+       dst, (size_t)width*height);
+  for (t = 1; t <= 4; t += 3) {
+    TIME("box /2", t,
+	 image_downscale_box(a, width, height, width, 2,
+			     dst, width/2, t),
+	 dst, (size_t)(width/2)*(height/2));
+    TIME("box /4", t,
+	 image_downscale_box(a, width, height, width, 4,
+			     dst, width/4, t),
+	 dst, (size_t)(width/4)*(height/4));
+    TIME("bilinear 1/3", t,
+	 image_resize_bilinear(a, width, height, width,
+			       dst, width/3, height/3, width/3, t),
+	 dst, (size_t)(width/3)*(height/3));
+    TIME("histogram", t,
+	 image_histogram(a, width, height, width, hist, t),
+	 (const uint8_t *)hist, sizeof(hist));
+    TIME("absdiff", t,
+	 changed = image_absdiff(a, width, b, width, width, height, 16,
+				 dst, width, t),
+	 dst, (size_t)width*height);
+  }
+  printf("absdiff: %ld of %d pixels over 16\n", changed, width*height);
+
+  free(a);
+  free(b);
+  free(dst);
+  return 0;
+}
@@ -0,0 +1,49 @@
+-- Linda throughput: lanes sending to one Linda, received by the main
+-- state, with values encoded natively and values parked in the keeper
+-- state (functions)
+--
+-- builds: lua
+-- modules: lanes
+--
+-- Prints the best of 3 runs per case in messages per second of wall
+-- time, for 1 to 8 sending lanes. Keys are limited so that queued
+-- values stay within the keeper memory limit.
+
+require "lanes"
+local now = require("lua51-lanes").now_secs
+local fmt = string.format
+
+local MESSAGES = 20000      -- per sending lane
+
+local function payload_number(i) return i end
+local function payload_table(i) return { i, "x", { y = i } } end
+local function payload_function(i) return function() return i end end
+
+local sender = lanes.gen("*", function(l, n, payload)
+  for i = 1, n do l:send("k", payload(i)) end
+  return true
+end)
+
+local function phase(name, payload)
+  for _, lanes_n in ipairs({ 1, 2, 4, 8 }) do
+    local best = math.huge
+    for r = 1, 3 do
+      local l = lanes.linda()
+      l:limit("k", 1000)
+      collectgarbage()
+      local t0 = now()
+      local hs = {}
+      for i = 1, lanes_n do hs[i] = sender(l, MESSAGES, payload) end
+      for i = 1, lanes_n * MESSAGES do l:receive("k") end
+      for i = 1, lanes_n do assert(hs[i][1]) end
+      t0 = now() - t0
+      if t0 < best then best = t0 end
+    end
+    print(fmt("%-9s %d lane%s %10.0f msg/s", name, lanes_n,
+              lanes_n > 1 and "s" or " ", lanes_n * MESSAGES / best))
+  end
+end
+
+phase("number", payload_number)
+phase("table", payload_table)
+phase("function", payload_function)
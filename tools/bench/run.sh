@@ -0,0 +1,209 @@
+#!/bin/sh
+#
+# Run the host benchmarks of the native code
+#
+# usage: tools/bench/run.sh [-b rev] [name ...]
+#
+# A benchmark is tools/bench/<name>.lua, run by host builds of
+# jni/lua-5.1.4, or tools/bench/<name>.c, a harness compiled with the
+# sources it measures. Without names all of them run. Builds go to
+# obj/host/bench and are redone when their sources change.
+#
+# Each benchmark lists the builds it is run with on a "builds:" line
+# in its header. For Lua benchmarks these are core builds:
+#   lua         the default configuration
+#   lua-nopool  realloc for every block (LUAI_POOLMAX=0)
+#   lua-switch  switch opcode dispatch (LUA_NO_JUMPTABLE)
+#   lua-buf1k   LUAL_BUFFERSIZE of 1024, BUFSIZ on Android
+# A "modules:" line names directories of jni/lua_modules to build as
+# host shared libraries (the first module of their Android.mk, or
+# dir/module for another one), next to the Lua files of the
+# directory, for require. Modules are compiled with -Wall; the core,
+# stock Lua apart from our changes, with the compiler's default
+# warnings.
+# For C harnesses they are name=flags pairs (flags without spaces),
+# and a "sources:" line names the files compiled with the harness.
+#
+# -b rev also builds git revision rev (e.g. HEAD~1) into
+# obj/host/bench/base and runs every benchmark with it first, to
+# compare before and after a change. Benchmarks of features the
+# revision lacks fail there and are reported as such. Where its
+# luaconf.h does not yet let a build's macro be overridden, that
+# build gets the revision's default.
+#
+# Host numbers do not carry over to devices, but the ratios between
+# builds mostly do.
+#
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/../.." && pwd)
+BENCH=$ROOT/tools/bench
+OUT=$ROOT/obj/host/bench
+CC=${CC:-cc}
+CXX=${CXX:-c++}
+CFLAGS=${CFLAGS:--O2}
+
+BASE=
+if [ "$1" = "-b" ]; then
+  BASE=$2
+  shift 2
+fi
+
+NAMES=$*
+if [ -z "$NAMES" ]; then
+  NAMES=$(cd "$BENCH" && ls *.lua *.c 2>/dev/null | sed 's/\.[a-z]*$//' | sort -u)
+fi
+
+# Host stand-ins for what the NDK provides
+mkdir -p "$OUT/include/android"
+cat > "$OUT/include/android/log.h" <<'EOF'
+#include <stdio.h>
+enum { ANDROID_LOG_INFO = 4, ANDROID_LOG_WARN = 5, ANDROID_LOG_ERROR = 6 };
+#define __android_log_print(p, t, ...) printf(__VA_ARGS__)
+#define __android_log_write(p, t, s) fputs(s, stdout)
+EOF
+cat > "$OUT/include/host.h" <<'EOF'
+#include <string.h>
+#include <sched.h>
+typedef unsigned int uint_t;
+#define pthread_yield sched_yield
+#define strlcat host_strlcat
+static inline size_t host_strlcat(char *d, const char *s, size_t n) {
+  size_t l = strlen(d);
+  if (l + 1 < n) strncat(d, s, n - l - 1);
+  return l + strlen(s);
+}
+EOF
+HOSTFLAGS="-I$OUT/include -include $OUT/include/host.h"
+
+# stale <target> <dir>: target is missing or older than a source in dir
+stale() {
+  [ ! -e "$1" ] || [ -n "$(find "$2" -newer "$1" -name '*.[ch]*' | head -1)" ]
+}
+
+# build_core <tree> <outdir> <name> <flags>
+build_core() {
+  src=$1/jni/lua-5.1.4/src
+  if stale "$2/$3" "$1/jni/lua-5.1.4"; then
+    echo "Building $3 ($2)"
+    (cd "$src" && $CC $CFLAGS -o "$2/$3" $HOSTFLAGS $4 \
+      -DLUA_USE_POSIX -DLUA_USE_DLOPEN -I. -I../include \
+      $(ls *.c | grep -v '^luac\.c$\|^print\.c$\|^luauser\.c$') \
+      -lm -ldl -lpthread -Wl,-E)
+  fi
+}
+
+# build <tree> <outdir>
+build() {
+  mkdir -p "$2"
+  build_core "$1" "$2" lua ""
+  build_core "$1" "$2" lua-nopool "-DLUAI_POOLMAX=0"
+  build_core "$1" "$2" lua-switch "-DLUA_NO_JUMPTABLE"
+  build_core "$1" "$2" lua-buf1k "-DLUAL_BUFFERSIZE=1024"
+}
+
+# header <file> <key>: value of "key:" in the header of a benchmark
+header() {
+  sed -n "s/^[-*/ ]*$2: *//p" "$1" | head -1
+}
+
+# mkvar <Android.mk> <var> [module]: value of var in the first module,
+# or in the named one, continuation lines joined
+mkvar() {
+  sed -e ':a' -e '/\\$/N; s/\\\n//; ta' "$1" | awk -v v="$2" -v m="$3" '
+    $1 == "LOCAL_MODULE" { mod = $3 }
+    $1 == v && (m == "" || mod == m) { sub(/^[^=]*= */, ""); print; exit }'
+}
+
+# build_module <tree> <outdir> <dir>[/<module>]
+build_module() {
+  mod=$1/jni/lua_modules/${3%%/*}
+  [ -f "$mod/Android.mk" ] || return 1
+  name=
+  [ "${3#*/}" != "$3" ] && name=${3#*/}
+  name=$(mkvar "$mod/Android.mk" LOCAL_MODULE $name)
+  [ -n "$name" ] || return 1
+  if stale "$2/$name.so" "$mod"; then
+    echo "Building $name.so ($2)"
+    inc="-I$1/jni/lua-5.1.4/src -I$1/jni/lua-5.1.4/include -I$1/jni/include"
+    objs=
+    for f in $(mkvar "$mod/Android.mk" LOCAL_SRC_FILES $name); do
+      o=$2/$name-${f%.*}.o
+      case $f in
+        *.c) $CC $CFLAGS -Wall -fPIC -fcommon $HOSTFLAGS $inc -c "$mod/$f" -o "$o" ;;
+        *) $CXX $CFLAGS -Wall -fPIC $HOSTFLAGS $inc -c "$mod/$f" -o "$o" ;;
+      esac || return 1
+      objs="$objs $o"
+    done
+    $CXX -shared -o "$2/$name.so" $objs -lpthread || return 1
+    for f in "$mod"/*.lua; do
+      [ -f "$f" ] && cp "$f" "$2/"
+    done
+  fi
+  return 0
+}
+
+# run_lua <tree> <outdir> <name>
+run_lua() {
+  for m in $(header "$BENCH/$3.lua" modules); do
+    if ! build_module "$1" "$2" "$m"; then
+      echo "--- $3: module $m failed to build"
+      return 0
+    fi
+  done
+  for b in $(header "$BENCH/$3.lua" builds); do
+    echo "--- $3 ($b${BASE:+, $(basename "$2")})"
+    (cd "$2" && LUA_PATH="$2/?.lua;;" LUA_CPATH="$2/?.so;;" \
+      "./${b:-lua}" "$BENCH/$3.lua") || echo "failed"
+  done
+}
+
+# run_c <tree> <outdir> <name>
+run_c() {
+  srcs=
+  incs=
+  for f in $(header "$BENCH/$3.c" sources); do
+    srcs="$srcs $1/$f"
+    incs="$incs -I$(dirname "$1/$f")"
+  done
+  for b in $(header "$BENCH/$3.c" builds); do
+    name=${b%%=*}
+    flags=
+    [ "$name" != "$b" ] && flags=${b#*=}
+    exe=$2/$3-$name
+    echo "--- $3 ($name${BASE:+, $(basename "$2")})"
+    if $CC $CFLAGS $flags $incs -o "$exe" "$BENCH/$3.c" $srcs -lpthread -lm; then
+      "$exe"
+    else
+      echo "failed"
+    fi
+  done
+}
+
+TREES="$ROOT:$OUT/cur"
+if [ -n "$BASE" ]; then
+  rm -rf "$OUT/base-src"
+  mkdir -p "$OUT/base-src"
+  (cd "$ROOT" && git archive "$BASE" jni) | tar -x -C "$OUT/base-src"
+  # a fresh tree: rebuild whatever it has
+  rm -rf "$OUT/base"
+  TREES="$OUT/base-src:$OUT/base $TREES"
+fi
+
+for t in $TREES; do
+  build "${t%%:*}" "${t#*:}"
+done
+
+for n in $NAMES; do
+  for t in $TREES; do
+    if [ -f "$BENCH/$n.lua" ]; then
+      run_lua "${t%%:*}" "${t#*:}" "$n"
+    elif [ -f "$BENCH/$n.c" ]; then
+      run_c "${t%%:*}" "${t#*:}" "$n"
+    else
+      echo "$n: no such benchmark" >&2
+      exit 1
+    fi
+  done
+done
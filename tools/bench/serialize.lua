@@ -0,0 +1,79 @@
+-- MessagePack serialization against the string building it replaces
+-- (string.format and table.concat into a Lua literal, read back with
+-- loadstring)
+--
+-- builds: lua
+-- modules: serialize
+--
+-- Prints seconds for encoding and decoding a batch of sensor samples
+-- and a nested scene table both ways, with the encoded sizes.
+
+local serialize = require "serialize"
+local clock = os.clock
+local fmt, concat = string.format, table.concat
+
+local function literal(v, out)
+  local t = type(v)
+  if t == "number" then
+    out[#out + 1] = fmt("%.17g", v)
+  elseif t == "string" then
+    out[#out + 1] = fmt("%q", v)
+  elseif t == "boolean" then
+    out[#out + 1] = tostring(v)
+  else
+    out[#out + 1] = "{"
+    for k, x in pairs(v) do
+      out[#out + 1] = "["
+      literal(k, out)
+      out[#out + 1] = "]="
+      literal(x, out)
+      out[#out + 1] = ","
+    end
+    out[#out + 1] = "}"
+  end
+end
+
+local function toliteral(v)
+  local out = {}
+  literal(v, out)
+  return concat(out)
+end
+
+local function fromliteral(s)
+  return assert(loadstring("return " .. s))()
+end
+
+local samples = {}
+for i = 1, 200 do
+  samples[i] = { t = i * 0.016, x = math.sin(i), y = math.cos(i), z = i % 9 }
+end
+
+local scene = { name = "level1", objects = {} }
+for i = 1, 100 do
+  scene.objects[i] = {
+    id = i, kind = (i % 3 == 0) and "brick" or "ball",
+    pos = { i * 1.5, i * 2.5 }, visible = i % 2 == 0,
+    tags = { "a", "b", "c" },
+  }
+end
+
+local function run(name, value, n)
+  local s, m
+  collectgarbage()
+  local t0 = clock()
+  for i = 1, n do s = toliteral(value) end
+  local t1 = clock()
+  for i = 1, n do fromliteral(s) end
+  local t2 = clock()
+  for i = 1, n do m = serialize.encode(value) end
+  local t3 = clock()
+  for i = 1, n do serialize.decode(m) end
+  local t4 = clock()
+  print(fmt("%-8s format+concat %6.3f s  loadstring %6.3f s  %6d bytes",
+            name, t1 - t0, t2 - t1, #s))
+  print(fmt("%-8s encode        %6.3f s  decode     %6.3f s  %6d bytes",
+            "", t3 - t2, t4 - t3, #m))
+end
+
+run("samples", samples, 500)
+run("scene", scene, 500)
@@ -0,0 +1,86 @@
+-- String interning: hashing of long strings with shared prefixes and
+-- suffixes, lookups of existing strings, and string table growth
+--
+-- builds: lua
+--
+-- Run with -b to compare against a revision before a hashing or
+-- resizing change. "grow" also prints the slowest batch of 1000 new
+-- strings, where a string table resize that rehashes every chain at
+-- once shows up.
+
+local clock = os.clock
+local N = 200000
+
+local function phase(name, f)
+  collectgarbage()
+  local t0 = clock()
+  local extra = f()
+  print(string.format("%-8s %7.3f s%s", name, clock() - t0,
+                      extra and "  " .. extra or ""))
+end
+
+phase("paths", function()
+  local keep = {}
+  for i = 1, N do
+    keep[i % 5000] = "/data/data/com.example.luaactivity/files/lua/modules/"
+      .. (i % 5000) .. "/init.lua"
+  end
+end)
+
+phase("messages", function()
+  local pad = string.rep("-", 40)
+  for i = 1, N do
+    local s = string.format(
+      '{"type":"touch","x":%d,"y":%d,"pointer":0,"pad":"%s"}',
+      i % 1080, i % 1920, pad)
+  end
+end)
+
+phase("collide", function()
+  -- long strings that differ only in the middle
+  local head, tail = string.rep("a", 50), string.rep("b", 45)
+  local keep = {}
+  for i = 1, 40000 do
+    keep[i] = head .. string.format("%05d", i) .. tail
+  end
+end)
+
+phase("lines", function()
+  local buf = {}
+  for i = 1, 2000 do
+    buf[i] = "HTTP/1.1 200 OK header-" .. i .. ": value " ..
+      string.rep("x", i % 64)
+  end
+  local data = table.concat(buf, "\n")
+  for r = 1, N / 2000 do
+    for line in data:gmatch("[^\n]+") do local _ = line end
+  end
+end)
+
+local live = {}
+
+phase("grow", function()
+  local worst = 0
+  for b = 0, 2 * N - 1, 1000 do
+    local t0 = clock()
+    for i = b + 1, b + 1000 do live[i] = "key" .. i end
+    t0 = clock() - t0
+    if t0 > worst then worst = t0 end
+  end
+  return string.format("slowest batch %.3f ms", worst * 1e3)
+end)
+
+phase("lookup", function()
+  math.randomseed(1)
+  local n = 0
+  for i = 1, 3 * N do
+    local k = "key" .. math.random(2 * N)
+    n = n + #k
+  end
+end)
+
+phase("shrink", function()
+  live = nil
+  collectgarbage()
+  collectgarbage()
+end)
@@ -0,0 +1,117 @@
+/*
+  Host benchmark of the YUV 4:2:0 to RGB converter (yuvconvert.c)
+
+  sources: jni/lua_modules/android_camera/yuvconvert.c
+  builds: simd scalar=-DYUV_NO_SIMD
+
+  Converts a synthetic 1280x720 frame from each source layout to each
+  output layout, serially and on 4 threads, and prints the best time
+  per frame, with a checksum of the output that must be the same in
+  every build (all paths produce identical pixels).
+
+  The first line is the scalar loop yuv420torgba() had in the camera
+  modules before yuvconvert.c, which nv21 -> rgba8888 replaces and
+  must match pixel for pixel.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "yuvconvert.h"
+
+#define WIDTH 1280
+#define HEIGHT 720
+#define FRAMES 200
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// lua_camera_yuv420torgba() before yuvconvert.c, minus the Lua glue
+static void legacy_yuv420torgba(const uint8_t *yuv, int *rgba,
+				int width, int height) {
+  int i, j, yp;
+  for (j = 0, yp = 0; j < height; j++) {
+    int uvp = width*height + (j >> 1) * width, u = 0, v = 0;
+    for (i = 0; i < width; i++, yp++) {
+      int y = (0xff & ((int) yuv[yp])) - 16;
+      if (y < 0) y = 0;
+      if ((i & 1) == 0) {
+	v = (0xff & yuv[uvp++]) - 128;
+	u = (0xff & yuv[uvp++]) - 128;
+      }
+
+      int y1192 = 1192*y;
+      int r = (y1192 + 1634*v);
+      int g = (y1192 - 833*v - 400*u);
+      int b = (y1192 + 2066*u);
+
+      if (r < 0) r = 0;
+      else if (r > 262143) r = 262143;
+      if (g < 0) g = 0;
+      else if (g > 262143) g = 262143;
+      if (b < 0) b = 0;
+      else if (b > 262143) b = 262143;
+
+      rgba[yp] = 0xff000000 | ((b << 6) & 0xff0000) | ((g >> 2) & 0xff00) | ((r >> 10) & 0xff);
+    }
+  }
+}
+
+static uint32_t checksum(const uint8_t *p, size_t n) {
+  uint32_t h = 2166136261u;
+  size_t i;
+  for (i = 0; i < n; i++) h = (h ^ p[i]) * 16777619u;
+  return h;
+}
+
+int main(void) {
+  static const char *srcName[] = { "nv21", "nv12", "i420" };
+  static const char *dstName[] = { "rgba8888", "rgb565" };
+  int size = yuv_size(HEIGHT, WIDTH, YUV_NV21);  // the largest layout
+  uint8_t *src = (uint8_t *)malloc(size);
+  uint8_t *dst = (uint8_t *)malloc(4*WIDTH*HEIGHT);
+  int i, s, d, t;
+  if (src == NULL || dst == NULL) return 1;
+
+  srand(1);
+  for (i = 0; i < size; i++)
+    src[i] = (uint8_t)rand();
+
+  {
+    double best = 1e9;
+    for (i = 0; i < FRAMES; i++) {
+      double t0 = now();
+      legacy_yuv420torgba(src, (int *)dst, WIDTH, HEIGHT);
+      t0 = now() - t0;
+      if (t0 < best) best = t0;
+    }
+    printf("legacy   -> rgba8888 1 thread   %7.3f ms/frame  %08x\n",
+	   best*1e3, checksum(dst, (size_t)4*WIDTH*HEIGHT));
+  }
+
+  for (s = YUV_NV21; s <= YUV_I420; s++) {
+    for (d = RGB_RGBA8888; d <= RGB_RGB565; d++) {
+      int dstStride = rgb_pixel_size(d)*WIDTH;
+      for (t = 1; t <= 4; t += 3) {
+	double best = 1e9;
+	for (i = 0; i < FRAMES; i++) {
+	  double t0 = now();
+	  yuv_convert(src, WIDTH, HEIGHT, WIDTH, s, dst, dstStride, d, t);
+	  t0 = now() - t0;
+	  if (t0 < best) best = t0;
+	}
+	printf("%s -> %-8s %d thread%s  %7.3f ms/frame  %08x\n",
+	       srcName[s], dstName[d], t, t > 1 ? "s" : " ", best*1e3,
+	       checksum(dst, (size_t)dstStride*HEIGHT));
+      }
+    }
+  }
+  free(src);
+  free(dst);
+  return 0;
+}
@@ -0,0 +1,74 @@
+#!/bin/sh
+#
+# Compile the Lua assets to bytecode for the device
+#
+# usage: tools/luac-assets.sh [-g] [assets-dir [output-dir]]
+#
+# Builds a host luac from jni/lua-5.1.4/src and mirrors assets-dir
+# (default assets) into output-dir (default obj/assets), compiling
+# every .lua file to stripped bytecode under the same name, so
+# asset.path, require and dofile work unchanged. Other files are
+# copied. Package output-dir in place of assets (e.g. asset.dir in
+# ant.properties). -g keeps debug information (line numbers in
+# error messages).
+#
+# All target ABIs are 32-bit little-endian, so chunks are written
+# with 4-byte string lengths whatever the host size_t, and every
+# chunk header is checked against the target before it is kept.
+# The loader in android_asset checks the header again on device.
+#
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+LUASRC=$ROOT/jni/lua-5.1.4/src
+CC=${CC:-cc}
+
+STRIP=-s
+if [ "$1" = "-g" ]; then
+  STRIP=
+  shift
+fi
+SRCDIR=${1:-assets}
+OUTDIR=${2:-obj/assets}
+
+# Header of a chunk for the target (see luaU_header in lundump.c):
+# signature, version 5.1, format 0, little-endian, int 4, size_t 4,
+# Instruction 4, lua_Number 8 (double), not integral
+TARGET_HEADER="1b4c75615100010404040800"
+
+# Host luac, rebuilt when the core sources change
+LUAC_DIR=$ROOT/obj/host/luac
+LUAC=$LUAC_DIR/luac
+if [ ! -x "$LUAC" ] || [ -n "$(find "$LUASRC" -newer "$LUAC" -name '*.[ch]')" ]; then
+  echo "Building host luac"
+  mkdir -p "$LUAC_DIR"
+  (cd "$LUASRC" && $CC -O2 -o "$LUAC" \
+    -I. -I../include '-DLUAC_DUMP_SIZE_T=unsigned int' \
+    luac.c print.c lapi.c lauxlib.c lcode.c ldebug.c ldo.c ldump.c \
+    lfunc.c lgc.c llex.c lmem.c lobject.c lopcodes.c lparser.c \
+    lstate.c lstring.c ltable.c ltm.c lundump.c lvm.c lzio.c -lm)
+fi
+
+mkdir -p "$OUTDIR"
+OUTDIR=$(cd "$OUTDIR" && pwd)
+(cd "$SRCDIR" && find . -type f) | while read -r f; do
+  out=$OUTDIR/$f
+  mkdir -p "$(dirname "$out")"
+  case "$f" in
+  *.lua)
+    # Compiled from inside SRCDIR so the chunk name is the asset name
+    (cd "$SRCDIR" && "$LUAC" $STRIP -o "$out" "${f#./}")
+    header=$(head -c 12 "$out" | od -An -tx1 | tr -d ' \n')
+    if [ "$header" != "$TARGET_HEADER" ]; then
+      echo "$f: bytecode header $header does not match target" >&2
+      rm -f "$out"
+      exit 1
+    fi
+    ;;
+  *)
+    cp "$SRCDIR/$f" "$out"
+    ;;
+  esac
+done
+echo "Compiled $SRCDIR to $OUTDIR"